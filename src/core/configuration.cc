@@ -48,10 +48,12 @@ filesystem::path options::default_socket_file_name = "zeek-agent.$$.sock";
 static struct option long_driver_options[] = {
     // clang-format off
     {"autodoc", no_argument, nullptr, 'D'},
+    {"bench", optional_argument, nullptr, 'B'},
     {"config", required_argument, nullptr, 'c'},
     {"execute", required_argument, nullptr, 'e'},
     {"help", no_argument, nullptr, 'h'},
     {"interactive", no_argument, nullptr, 'i'},
+    {"load-test", optional_argument, nullptr, 'l'},
     {"log-level", required_argument, nullptr, 'L'},
     {"remote", no_argument, nullptr, 'r'},
     {"socket", no_argument, nullptr, 's'},
@@ -77,6 +79,7 @@ static void usage(const filesystem::path& name) {
     std::cerr << "\nUsage: " << name.filename().string() << frmt(
         " [options]\n"
         "\n"
+        "  -B | --bench[=<FILTER>]          Run microbenchmarks, output JSON results, and exit\n"
         "  -D | --autodoc                   Output JSON documentating table schemas and exit.\n"
         "  -L | --log-level <LEVEL>         Set logging level (" LOG_LEVEL_HELP ") [default: warning]\n"
         "  -M | --use-mock-data             Let tables return only fake mock data for testing\n"
@@ -86,6 +89,7 @@ static void usage(const filesystem::path& name) {
         "  -e | --execute <STMT>            SQL statement to execute immediately, then quit\n"
         "  -h | --help                      Show usage information\n"
         "  -i | --interactive               Spawn interactive console\n"
+        "  -l | --load-test[=<PARAMS>]      Run load test against local fake Zeek, output JSON results, and exit\n"
         "  -r | --remote                    Connect interactive console to already running agent\n"
         "  -s | --socket <FILE>             Specify socket to use for console communication [default: {}]\n"
         "  -v | --version                   Print version information\n"
@@ -112,8 +116,8 @@ Result<Nothing> Options::parseArgv(const std::vector<std::string>& argv) {
 #endif
 
     while ( true ) {
-        int c = getopt_long(static_cast<int>(argv_.size()), argv_.data(), "DL:MNTc:e:hirs:vz:", long_driver_options,
-                            nullptr);
+        int c = getopt_long(static_cast<int>(argv_.size()), argv_.data(), "B::DL:MNTc:e:hil::rs:vz:",
+                            long_driver_options, nullptr);
         if ( c < 0 )
             return Nothing();
 
@@ -127,6 +131,12 @@ Result<Nothing> Options::parseArgv(const std::vector<std::string>& argv) {
                 break;
             }
 
+            case 'B': {
+                mode = options::Mode::Benchmark;
+                benchmark_filter = (optarg ? optarg : "");
+                break;
+            }
+
             case 'D': {
                 options::default_log_type = options::LogType::Stderr;
                 log_type = options::LogType::Stderr;
@@ -134,6 +144,12 @@ Result<Nothing> Options::parseArgv(const std::vector<std::string>& argv) {
                 break;
             }
 
+            case 'l': {
+                mode = options::Mode::LoadTest;
+                load_test = (optarg ? optarg : "");
+                break;
+            }
+
             case 'M': use_mock_data = true; break;
             case 'N': terminate_on_disconnect = true; break;
             case 'T': mode = options::Mode::Test; break;
@@ -168,6 +184,8 @@ void Options::debugDump() const {
     ZEEK_AGENT_DEBUG("configuration", "[option] socket: {}", (socket ? socket->string() : "<not set>"));
     ZEEK_AGENT_DEBUG("configuration", "[option] use-mock-data: {}", use_mock_data);
     ZEEK_AGENT_DEBUG("configuration", "[option] terminate-on-disconnect: {}", terminate_on_disconnect);
+    ZEEK_AGENT_DEBUG("configuration", "[option] worker-threads: {}", worker_threads);
+    ZEEK_AGENT_DEBUG("configuration", "[option] glob-limit: {}", glob_limit);
     ZEEK_AGENT_DEBUG("configuration", "[option] zeek.groups: {}", join(zeek_groups, ", "));
     ZEEK_AGENT_DEBUG("configuration", "[option] zeek.hello_interval: {}", to_string(zeek_hello_interval));
     ZEEK_AGENT_DEBUG("configuration", "[option] zeek.reconnect_interval: {}", to_string(zeek_reconnect_interval));
@@ -409,6 +427,12 @@ Result<Nothing> Configuration::Implementation::read(const std::optional<toml::ta
         if ( tomlValue(tbl, "log.path", &log_path) )
             options->log_path = log_path;
 
+        if ( tomlValue(tbl, "worker-threads", &options->worker_threads) && options->worker_threads < 0 )
+            return result::Error("worker-threads must not be negative");
+
+        if ( tomlValue(tbl, "glob-limit", &options->glob_limit) && options->glob_limit < 0 )
+            return result::Error("glob-limit must not be negative");
+
         tomlArray(tbl, "zeek.destination", &options->zeek_destinations);
         tomlArray(tbl, "zeek.groups", &options->zeek_groups);
 
@@ -481,6 +505,46 @@ TEST_SUITE("Configuration") {
         }
     }
 
+    TEST_CASE("set 'worker-threads'") {
+        Configuration cfg;
+        CHECK_EQ(cfg.options().worker_threads, 0);
+
+        SUBCASE("config") {
+            std::stringstream s;
+            s << "worker-threads = 3\n";
+            auto rc = cfg.read(s, "<test>");
+            CHECK(rc);
+            CHECK_EQ(cfg.options().worker_threads, 3);
+        }
+
+        SUBCASE("negative") {
+            std::stringstream s;
+            s << "worker-threads = -1\n";
+            auto rc = cfg.read(s, "<test>");
+            CHECK_EQ(rc, result::Error("worker-threads must not be negative"));
+        }
+    }
+
+    TEST_CASE("set 'glob-limit'") {
+        Configuration cfg;
+        CHECK_EQ(cfg.options().glob_limit, static_cast<int64_t>(DefaultGlobLimit));
+
+        SUBCASE("config") {
+            std::stringstream s;
+            s << "glob-limit = 0\n";
+            auto rc = cfg.read(s, "<test>");
+            CHECK(rc);
+            CHECK_EQ(cfg.options().glob_limit, 0);
+        }
+
+        SUBCASE("negative") {
+            std::stringstream s;
+            s << "glob-limit = -1\n";
+            auto rc = cfg.read(s, "<test>");
+            CHECK_EQ(rc, result::Error("glob-limit must not be negative"));
+        }
+    }
+
     TEST_CASE("set 'interactive'") {
         Configuration cfg;
 
@@ -25,6 +25,8 @@ enum class Mode {
     Standard,      /**< normal operation */
     RemoteConsole, /**< connect to remote agent */
     Test,          /**< run unit tests and exit */
+    Benchmark,     /**< run microbenchmarks and exit */
+    LoadTest,      /**< run end-to-end load test against fake Zeek instances and exit */
     AutoDoc        /**< print out JSON describing table schemas and exit */
 };
 
@@ -33,6 +35,8 @@ inline std::string to_string(options::Mode mode) {
         case options::Mode::RemoteConsole: return "remote console";
         case options::Mode::Standard: return "standard";
         case options::Mode::Test: return "test";
+        case options::Mode::Benchmark: return "benchmark";
+        case options::Mode::LoadTest: return "load test";
         case options::Mode::AutoDoc: return "autodoc";
     }
 
@@ -126,6 +130,12 @@ struct Options {
     /** Console statement/command to execute at startup, and then terminate */
     std::string execute;
 
+    /** In benchmark mode, run only benchmarks with names containing this string. */
+    std::string benchmark_filter;
+
+    /** In load test mode, comma-separated `key=value` parameters for the test. */
+    std::string load_test;
+
     /** True to spawn the interactive console locally. */
     bool interactive = false;
 
@@ -154,6 +164,18 @@ struct Options {
     /** Terminate when a Zeek connections goes down (instead of retrying). */
     bool terminate_on_disconnect = false;
 
+    /**
+     * Number of threads in the worker pool that tables use for parallelizing
+     * data collection. Zero means one per CPU.
+     */
+    int64_t worker_threads = 0;
+
+    /**
+     * Maximum number of paths that a table's glob pattern may expand into.
+     * Further matches get ignored, with a warning. Zero means no limit.
+     */
+    int64_t glob_limit = DefaultGlobLimit;
+
     /** Zeek instances to connect to */
     std::vector<std::string> zeek_destinations;
 
@@ -5,13 +5,17 @@
 #include "core/table.h"
 #include "logger.h"
 #include "sqlite.h"
+#include "util/benchmark.h"
 #include "util/helpers.h"
 #include "util/testing.h"
+#include "util/thread-pool.h"
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <list>
 #include <map>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <unordered_map>
@@ -26,7 +30,7 @@ struct ScheduledQuery {
     timer::ID id;                                              // query's unique ID
     Query query;                                               // query itself
     std::unique_ptr<sqlite::PreparedStatement> prepared_query; // pre-compiled query statement
-    std::optional<sqlite::Result> previous_result;             // previous result set for subscription queries
+    std::optional<sqlite::Result> previous_result;             // previous result of subscriptions, w/ rows if diffing
     std::optional<Time> previous_execution;                    // time when query was most recently run
 };
 
@@ -66,6 +70,8 @@ struct Pimpl<Database>::Implementation {
     const Configuration* _configuration = nullptr; // configuration object, as passed into constructor
     Scheduler* _scheduler = nullptr;               // scheduler as passed into constructor
     std::unique_ptr<SQLite> _sqlite;               // SQLite backend for performing queries
+    std::unique_ptr<ThreadPool> _worker_pool;      // worker pool shared by tables, created on first use
+    std::once_flag _worker_pool_once;              // guards creation of `_worker_pool`
 
     std::map<std::string, Table*> _tables; // registered tables indexed by name
     std::list<Table*> _pending_tables;     // registered tables that we were initially temporarily unavailable
@@ -81,6 +87,7 @@ std::map<std::string, std::unique_ptr<Table>> Database::Implementation::_registe
 void Database::Implementation::done() {
     _queries.clear();
     _sqlite.reset(); // ensure this gets released before the tables go away
+    _worker_pool.reset();
 }
 
 Result<std::optional<query::ID>> Database::Implementation::query(Query query) {
@@ -191,6 +198,9 @@ void Database::Implementation::poll() {
 void Database::Implementation::addTable(Table* t) {
     EventTable::Init init_result;
 
+    // Tables may access options and the worker pool from `init()` onwards.
+    t->setDatabase(_db);
+
     if ( t->usesMockData() )
         init_result = EventTable::Init::Available;
     else
@@ -199,9 +209,8 @@ void Database::Implementation::addTable(Table* t) {
     switch ( init_result ) {
         case EventTable::Init::Available: {
             ZEEK_AGENT_DEBUG("database", "adding table {} to database", t->name());
-            t->setDatabase(_db);
 
-            auto schema = t->schema();
+            const auto& schema = t->schema();
 
             if ( _tables.find(schema.name) != _tables.end() )
                 throw InternalError(frmt("table {} registered more than once", schema.name));
@@ -228,41 +237,70 @@ void Database::Implementation::addTable(Table* t) {
     }
 }
 
-static auto diffRows(std::vector<std::vector<Value>> old, std::vector<std::vector<Value>> new_) {
-    std::sort(old.begin(), old.end(), ValueVectorCompare);
-    std::sort(new_.begin(), new_.end(), ValueVectorCompare);
+// Three-way version of `ValueVectorCompare`.
+static int compareRows(const std::vector<Value>& a, const std::vector<Value>& b) {
+    if ( a.size() != b.size() )
+        return a.size() < b.size() ? -1 : 1;
 
-    std::vector<std::vector<Value>> deletes;
-    std::set_difference(old.begin(), old.end(), new_.begin(), new_.end(), std::back_inserter(deletes),
-                        ValueVectorCompare);
+    for ( size_t i = 0; i < a.size(); i++ ) {
+        if ( auto c = value::compare(a[i], b[i]) )
+            return c;
+    }
 
-    std::vector<std::vector<Value>> adds;
-    std::set_difference(new_.begin(), new_.end(), old.begin(), old.end(), std::back_inserter(adds), ValueVectorCompare);
+    return 0;
+}
+
+// Computes the rows removed and added between two results in a single pass.
+// Both need to be sorted by `ValueVectorCompare`, as `SQLite::runStatement()`
+// returns them. Removed rows get moved out of the old result, which the
+// caller is about to discard; added rows need to be copied as the new result
+// will be retained for the next round.
+static auto diffRows(std::vector<std::vector<Value>>* old, const std::vector<std::vector<Value>>& new_) {
+    assert(std::is_sorted(old->begin(), old->end(), ValueVectorCompare));
+    assert(std::is_sorted(new_.begin(), new_.end(), ValueVectorCompare));
 
     std::vector<query::result::Row> diff;
+    std::vector<query::result::Row> adds;
+
+    auto o = old->begin();
+    auto n = new_.begin();
 
-    diff.reserve(deletes.size());
-    for ( auto&& i : deletes )
-        diff.push_back({.type = query::result::ChangeType::Delete, .values = std::move(i)});
+    while ( o != old->end() || n != new_.end() ) {
+        auto c = (o == old->end() ? 1 : (n == new_.end() ? -1 : compareRows(*o, *n)));
 
-    for ( auto&& i : adds )
-        diff.push_back({.type = query::result::ChangeType::Add, .values = std::move(i)});
+        if ( c < 0 )
+            diff.push_back({.type = query::result::ChangeType::Delete, .values = std::move(*o++)});
+        else if ( c > 0 )
+            adds.push_back({.type = query::result::ChangeType::Add, .values = *n++});
+        else {
+            ++o;
+            ++n;
+        }
+    }
 
+    diff.insert(diff.end(), std::make_move_iterator(adds.begin()), std::make_move_iterator(adds.end()));
     return diff;
 }
 
-static auto newRows(std::vector<std::vector<Value>> old, std::vector<std::vector<Value>> new_) {
-    std::sort(old.begin(), old.end(), ValueVectorCompare);
-    std::sort(new_.begin(), new_.end(), ValueVectorCompare);
-
-    std::vector<std::vector<Value>> adds;
-    std::set_difference(new_.begin(), new_.end(), old.begin(), old.end(), std::back_inserter(adds), ValueVectorCompare);
+// Computes the rows added between two results. Both need to be sorted by
+// `ValueVectorCompare`, as `SQLite::runStatement()` returns them.
+static auto newRows(const std::vector<std::vector<Value>>& old, const std::vector<std::vector<Value>>& new_) {
+    assert(std::is_sorted(old.begin(), old.end(), ValueVectorCompare));
+    assert(std::is_sorted(new_.begin(), new_.end(), ValueVectorCompare));
 
     std::vector<query::result::Row> diff;
 
-    diff.reserve(adds.size());
-    for ( auto&& i : adds )
-        diff.push_back({.type = query::result::ChangeType::Add, .values = std::move(i)});
+    auto o = old.begin();
+    for ( const auto& row : new_ ) {
+        int c = -1;
+        while ( o != old.end() && (c = compareRows(*o, row)) < 0 )
+            ++o;
+
+        if ( o == old.end() || c > 0 )
+            diff.push_back({.type = query::result::ChangeType::Add, .values = row});
+        else
+            ++o;
+    }
 
     return diff;
 }
@@ -288,10 +326,25 @@ Interval Database::Implementation::timerCallback(timer::ID id) {
     if ( sql_result ) {
         std::vector<query::result::Row> rows;
 
+        // Only differences and events need the rows for comparison next
+        // time. Otherwise, we hand them over to the callback without
+        // copying, just retaining the (then empty) result for its columns.
+        bool keep_rows = (stype && *stype != query::SubscriptionType::Snapshots);
+
         if ( ! stype || *stype == query::SubscriptionType::Snapshots ||
              (stype == query::SubscriptionType::SnapshotPlusDifferences && ! (*i)->previous_result) ) {
-            for ( const auto& sql_row : sql_result->rows )
-                rows.push_back({.type = {}, .values = sql_row});
+            rows.reserve(sql_result->rows.size());
+
+            if ( keep_rows ) {
+                for ( const auto& sql_row : sql_result->rows )
+                    rows.push_back({.type = {}, .values = sql_row});
+            }
+            else {
+                for ( auto& sql_row : sql_result->rows )
+                    rows.push_back({.type = {}, .values = std::move(sql_row)});
+
+                sql_result->rows.clear();
+            }
         }
 
         else if ( stype == query::SubscriptionType::Events ) {
@@ -302,7 +355,7 @@ Interval Database::Implementation::timerCallback(timer::ID id) {
         else if ( stype == query::SubscriptionType::Differences ||
                   stype == query::SubscriptionType::SnapshotPlusDifferences ) {
             if ( (*i)->previous_result )
-                rows = diffRows((*i)->previous_result->rows, sql_result->rows);
+                rows = diffRows(&(*i)->previous_result->rows, sql_result->rows);
         }
 
         else
@@ -393,6 +446,17 @@ Time Database::currentTime() const {
     return pimpl()->_scheduler->currentTime();
 }
 
+ThreadPool& Database::workerPool() {
+    auto p = pimpl();
+    std::call_once(p->_worker_pool_once, [&]() {
+        auto threads = static_cast<size_t>(p->_configuration->options().worker_threads);
+        p->_worker_pool = std::make_unique<ThreadPool>(threads);
+        ZEEK_AGENT_DEBUG("database", "started worker pool with {} threads", p->_worker_pool->size());
+    });
+
+    return *p->_worker_pool;
+}
+
 size_t Database::numberQueries() const { return pimpl()->_queries.size(); }
 
 Table* Database::table(const std::string& name) { return pimpl()->table(name); }
@@ -468,7 +532,7 @@ std::string Database::documentRegisteredTables() {
     nlohmann::json tables;
 
     for ( const auto& t : registeredTables() ) {
-        auto schema = t.second->schema();
+        const auto& schema = t.second->schema();
         nlohmann::ordered_json columns; // preserve column order
 
         for ( const auto& c : schema.columns ) {
@@ -512,7 +576,7 @@ TEST_SUITE("Database") {
     class TestTable : public Table {
     public:
         TestTable(std::string name_postfix = "") : name_postfix(std::move(name_postfix)) {}
-        Schema schema() const override {
+        Schema buildSchema() const override {
             return {.name = "test_table" + name_postfix,
                     .description = "test-description",
                     .columns = {
@@ -568,11 +632,33 @@ TEST_SUITE("Database") {
             CHECK_EQ((*db.tables().begin())->schema().description, "test-description");
         }
 
+        SUBCASE("database access from init()") {
+            class InitAccess : public TestTable {
+            public:
+                Init init() override {
+                    // These throw if the database isn't set yet.
+                    (void)options();
+                    workerPool().run(2, [this](size_t) { ++shards; });
+                    return TestTable::init();
+                }
+
+                std::atomic<int> shards = 0;
+            };
+
+            InitAccess t;
+            Configuration cfg;
+            Scheduler tmgr;
+            Database db(&cfg, &tmgr);
+            db.addTable(&t);
+            REQUIRE(db.table("test_table"));
+            CHECK_EQ(t.shards, 2);
+        }
+
         SUBCASE("permanently disabled table") {
             class Disabled : public TestTable {
             public:
-                Schema schema() const override {
-                    auto schema = TestTable::schema();
+                Schema buildSchema() const override {
+                    auto schema = TestTable::buildSchema();
                     schema.name = "disabled";
                     return schema;
                 }
@@ -591,8 +677,8 @@ TEST_SUITE("Database") {
         SUBCASE("temporarily disabled table") {
             class Disabled : public TestTable {
             public:
-                Schema schema() const override {
-                    auto schema = TestTable::schema();
+                Schema buildSchema() const override {
+                    auto schema = TestTable::buildSchema();
                     schema.name = "disabled";
                     return schema;
                 }
@@ -1087,7 +1173,7 @@ TEST_SUITE("Database") {
     TEST_CASE("permanent table error") {
         class ErrorTable : public SnapshotTable {
         public:
-            Schema schema() const override {
+            Schema buildSchema() const override {
                 return {.name = "error_table", .columns = {{.name = "i", .type = value::Type::Integer}}};
             }
 
@@ -1182,3 +1268,48 @@ TEST_SUITE("Database") {
         CHECK_EQ(zeek_agent["columns"].size(), 13);
     }
 }
+
+// Returns two sorted, synthetic results for benchmarking the diffing, with
+// about a tenth of the rows differing between them.
+static auto benchmarkResults(size_t n) {
+    std::vector<std::vector<Value>> old;
+    std::vector<std::vector<Value>> new_;
+
+    for ( size_t i = 0; i < n; i++ ) {
+        std::vector<Value> row = {static_cast<int64_t>(i), frmt("/proc/{}/cmdline", i), static_cast<bool>(i & 1)};
+
+        if ( i % 20 != 0 )
+            old.push_back(row);
+
+        if ( i % 20 != 10 )
+            new_.push_back(std::move(row));
+    }
+
+    std::sort(old.begin(), old.end(), ValueVectorCompare);
+    std::sort(new_.begin(), new_.end(), ValueVectorCompare);
+    return std::make_pair(std::move(old), std::move(new_));
+}
+
+ZEEK_AGENT_BENCHMARK("database/diffRows") {
+    auto [old, new_] = benchmarkResults(10000);
+    state.setItemsPerIteration(static_cast<int64_t>(old.size() + new_.size()));
+
+    while ( state.keepRunning() ) {
+        state.pause();
+        auto copy = old;
+        state.resume();
+
+        auto diff = diffRows(&copy, new_);
+        benchmark::doNotOptimize(diff);
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("database/newRows") {
+    auto [old, new_] = benchmarkResults(10000);
+    state.setItemsPerIteration(static_cast<int64_t>(old.size() + new_.size()));
+
+    while ( state.keepRunning() ) {
+        auto diff = newRows(old, new_);
+        benchmark::doNotOptimize(diff);
+    }
+}
@@ -122,6 +122,7 @@ struct Query {
 class Table;
 class SQLite;
 class Scheduler;
+class ThreadPool;
 
 /**
  * Database of tables available for querying. This ties together the indivudual
@@ -150,6 +151,14 @@ public:
     /** Returns the current time, per our scheduler. */
     Time currentTime() const;
 
+    /**
+     * Returns the worker pool that tables share for parallelizing data
+     * collection. The pool is created on first access, sized according to
+     * the configuration's `worker_threads` option. This method is
+     * thread-safe.
+     */
+    ThreadPool& workerPool();
+
     /** Returns the number of concurrently scheduled queries. */
     size_t numberQueries() const;
 
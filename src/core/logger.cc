@@ -10,6 +10,7 @@
 #include <string>
 #include <utility>
 
+#include <spdlog/async.h>
 #include <spdlog/common.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
@@ -30,8 +31,15 @@
 using namespace zeek::agent;
 
 namespace {
+// Maximum number of messages waiting for the background thread to write them.
+constexpr size_t LogQueueSize = 8192;
+
+// Background thread writing out messages. Declared before the logger so that
+// it goes away last, after draining the queue.
+std::shared_ptr<spdlog::details::thread_pool> log_thread = {};
+
 std::shared_ptr<spdlog::logger> global_logger = {};
-}
+} // namespace
 
 Result<Nothing> zeek::agent::setGlobalLogger(options::LogType type, options::LogLevel level,
                                              const std::optional<filesystem::path>& path) {
@@ -70,7 +78,12 @@ Result<Nothing> zeek::agent::setGlobalLogger(options::LogType type, options::Log
             break;
     }
 
-    global_logger = std::make_shared<spdlog::logger>("Zeek Agent", std::move(sink));
+    if ( ! log_thread )
+        log_thread = std::make_shared<spdlog::details::thread_pool>(LogQueueSize, 1);
+
+    // Drop the oldest messages if the queue fills up, instead of blocking.
+    global_logger = std::make_shared<spdlog::async_logger>("Zeek Agent", std::move(sink), log_thread,
+                                                           spdlog::async_overflow_policy::overrun_oldest);
     global_logger->set_level(level);
 
     return Nothing();
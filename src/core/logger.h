@@ -11,18 +11,52 @@ namespace zeek::agent {
 Result<Nothing> setGlobalLogger(options::LogType type, options::LogLevel level,
                                 const std::optional<filesystem::path>& path = {});
 
-/** Returns the global logger instance. Use of the logger is thread-safe. */
+/**
+ * Returns the global logger instance. Use of the logger is thread-safe. The
+ * logger hands messages to a background thread for writing them out, so that
+ * logging doesn't block the caller; if that thread falls behind, the oldest
+ * pending messages get dropped.
+ */
 extern spdlog::logger* logger();
 
+/**
+ * Lowest level of debug output that gets compiled in. The debug macros for
+ * levels below it don't evaluate their arguments at all, not even at runtime.
+ * This defaults to keeping trace output only in debug builds; define it
+ * through the compiler's command line to change that (e.g., use
+ * `-DZEEK_AGENT_LOG_COMPILE_LEVEL=SPDLOG_LEVEL_INFO` to remove debug output
+ * from release builds as well).
+ */
+#ifndef ZEEK_AGENT_LOG_COMPILE_LEVEL
+#ifndef NDEBUG
+#define ZEEK_AGENT_LOG_COMPILE_LEVEL SPDLOG_LEVEL_TRACE
+#else
+#define ZEEK_AGENT_LOG_COMPILE_LEVEL SPDLOG_LEVEL_DEBUG
+#endif
+#endif
+
+// Checks the level before evaluating any of the arguments, so that disabled
+// output doesn't cost more than that check.
 #define __ZEEK_AGENT_LOG(level, component, ...) /* NOLINT */                                                           \
-    logger()->log(level, frmt("[{}] ", component) + frmt(__VA_ARGS__))
+    do {                                                                                                               \
+        if ( auto* __logger = logger(); __logger->should_log(level) )                                                  \
+            __logger->log(level, frmt("[{}] ", component) + frmt(__VA_ARGS__));                                        \
+    } while ( false )
 
-#ifndef NDEBUG
+#if ZEEK_AGENT_LOG_COMPILE_LEVEL <= SPDLOG_LEVEL_DEBUG
 #define ZEEK_AGENT_DEBUG(component, ...) __ZEEK_AGENT_LOG(spdlog::level::debug, component, __VA_ARGS__)
+#else
+#define ZEEK_AGENT_DEBUG(component, ...)                                                                               \
+    do {                                                                                                               \
+    } while ( false )
+#endif
+
+#if ZEEK_AGENT_LOG_COMPILE_LEVEL <= SPDLOG_LEVEL_TRACE
 #define ZEEK_AGENT_TRACE(component, ...) __ZEEK_AGENT_LOG(spdlog::level::trace, component, __VA_ARGS__)
 #else
-#define ZEEK_AGENT_DEBUG(component, ...) __ZEEK_AGENT_LOG(spdlog::level::debug, component, __VA_ARGS__)
-#define ZEEK_AGENT_TRACE(component, ...)
+#define ZEEK_AGENT_TRACE(component, ...)                                                                               \
+    do {                                                                                                               \
+    } while ( false )
 #endif
 
 } // namespace zeek::agent
@@ -3,6 +3,7 @@
 #include "core/sqlite.h"
 
 #include "logger.h"
+#include "util/benchmark.h"
 #include "util/fmt.h"
 #include "util/helpers.h"
 #include "util/testing.h"
@@ -12,6 +13,9 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <set>
+#include <string>
+#include <string_view>
 #include <utility>
 
 #define SQLITE_ENABLE_COLUMN_METADATA
@@ -46,12 +50,13 @@ struct VTab {
 
 // Captures the current position in a result set.
 struct Cursor {
-    struct ::sqlite3_vtab_cursor cursor {}; // SQLite data structure for current cursor; must be first field
-    struct Cookie cookie {};                // Cookie for access by SQLite callbacks
-    struct VTab* vtab;                      // Links to virtual table cursor applies to
-    Schema schema;                          // copy of the virtual tables schema (duplicated here for faster access)
-    std::vector<std::vector<Value>> rows;   // set of rows cursor iterates over
-    size_t current = 0;                     // current cursor position in `rows`
+    struct ::sqlite3_vtab_cursor cursor {};          // SQLite data structure for current cursor; must be first field
+    struct Cookie cookie {};                         // Cookie for access by SQLite callbacks
+    struct VTab* vtab;                               // Links to virtual table cursor applies to
+    const Schema* schema = nullptr;                  // the virtual table's schema, owned by the table
+    std::vector<std::vector<Value>> rows;            // set of rows cursor iterates over
+    size_t current = 0;                              // current cursor position in `rows`
+    std::vector<std::string> encoded;                // encodings of current row's values for SQLite, by column
 };
 
 template<>
@@ -80,7 +85,10 @@ struct Pimpl<SQLite>::Implementation {
     ::sqlite3* _sqlite_db = nullptr; // SQLite database handle
     std::list<Cookie> _cookies;      // list containing one cookie per registered table
     std::set<Table*> _stmt_tables;   // set of tables statement refers to; set during statement compilation
+    std::map<Table*, std::vector<table::Constraint>> _stmt_constraints; // constraints per table; set during statement compilation
+    bool _preparing = false; // true while compiling a statement
     std::optional<Time> _stmt_t;     // earliest time of interest during statement execution
+    table::StatementState* _stmt_state = nullptr; // state storage of statement currently executing, if any
     std::map<std::string, Table*> _tables_by_name; // map of registered tables indexed by their names
 
     mutable std::mutex _stmt_mutex; // lock acquired during statement execution to prevent concurrent processing
@@ -124,10 +132,16 @@ static Result<Value> sqliteConvertValue(const std::string& name, ::sqlite3_value
 
             switch ( *type ) {
                 case value::Type::Blob: return Value(blob);
-                case value::Type::Port: return from_json_string(blob, value::Type::Port);
-                case value::Type::Record: return from_json_string(blob, value::Type::Record);
-                case value::Type::Set: return from_json_string(blob, value::Type::Set);
-                case value::Type::Vector: return from_json_string(blob, value::Type::Vector);
+                case value::Type::Port:
+                case value::Type::Record:
+                case value::Type::Set:
+                case value::Type::Vector: {
+                    auto x = from_binary_string(blob, *type);
+                    if ( ! x )
+                        return x.error();
+
+                    return std::move(x->first);
+                }
                 default: throw InternalError("unexpected type for blob in sqliteConvertValue");
             }
 
@@ -135,9 +149,16 @@ static Result<Value> sqliteConvertValue(const std::string& name, ::sqlite3_value
         }
 
         case SQLITE_TEXT: {
-            // Can be Text or Address, but both are returned as strings.
             auto data = reinterpret_cast<const char*>(::sqlite3_value_text(v));
             auto size = ::sqlite3_value_bytes(v);
+
+            if ( type && *type == value::Type::Address ) {
+                if ( auto a = Address::fromString(std::string_view(data, size)) )
+                    return Value(*a);
+
+                return result::Error(frmt("invalid address in column {}", name));
+            }
+
             return Value(std::string(data, size));
         }
 
@@ -145,6 +166,20 @@ static Result<Value> sqliteConvertValue(const std::string& name, ::sqlite3_value
     }
 }
 
+// Converts a SQLite constraint operator into our corresponding table
+// operator, if we support it.
+static std::optional<table::Operator> sqliteConvertOperator(unsigned char op) {
+    switch ( op ) {
+        case SQLITE_INDEX_CONSTRAINT_EQ: return table::Operator::Equal;
+        case SQLITE_INDEX_CONSTRAINT_NE: return table::Operator::NotEqual;
+        case SQLITE_INDEX_CONSTRAINT_LT: return table::Operator::Less;
+        case SQLITE_INDEX_CONSTRAINT_LE: return table::Operator::LessEqual;
+        case SQLITE_INDEX_CONSTRAINT_GT: return table::Operator::Greater;
+        case SQLITE_INDEX_CONSTRAINT_GE: return table::Operator::GreaterEqual;
+        default: return {};
+    }
+}
+
 // Converts a SQLite type into a corresponding table value type. This assumes
 // we don't have further schema knowledge about the column, so will use a
 // default type where ambigious.
@@ -159,6 +194,75 @@ static Result<value::Type> sqliteConvertType(const std::string& name, int type)
     }
 }
 
+// Returns true if `sqliteResult()` needs a buffer for encoding values of a type.
+static bool sqliteNeedsEncoding(value::Type type) {
+    switch ( type ) {
+        case value::Type::Address:
+        case value::Type::Port:
+        case value::Type::Record:
+        case value::Type::Set:
+        case value::Type::Vector: return true;
+        default: return false;
+    }
+}
+
+// Sets a table value as the result of a SQLite callback. `destructor` is
+// passed on to SQLite for strings and blobs. Values that SQLite doesn't
+// support natively get encoded into `buffer`, unless it's non-empty already,
+// in which case it must hold the encoding of the same value from an earlier
+// call; addresses get rendered into text. With SQLITE_STATIC, both `value`
+// and `buffer` must remain unchanged until SQLite is done with the result.
+static void sqliteResult(::sqlite3_context* context, const Value& value, value::Type type,
+                         ::sqlite3_destructor_type destructor, std::string* buffer) {
+    if ( std::holds_alternative<std::monostate>(value) ) {
+        ::sqlite3_result_null(context);
+        return;
+    }
+
+    switch ( type ) {
+        case value::Type::Integer:
+        case value::Type::Count: ::sqlite3_result_int64(context, std::get<int64_t>(value)); break;
+        case value::Type::Bool: ::sqlite3_result_int64(context, (std::get<bool>(value) ? 1 : 0)); break;
+        case value::Type::Time:
+            ::sqlite3_result_int64(context, std::chrono::duration_cast<std::chrono::microseconds>(
+                                                std::get<Time>(value).time_since_epoch())
+                                                .count());
+            break;
+        case value::Type::Interval: ::sqlite3_result_int64(context, std::get<Interval>(value).count()); break;
+        case value::Type::Double: ::sqlite3_result_double(context, std::get<double>(value)); break;
+        case value::Type::Null: ::sqlite3_result_null(context); break;
+        case value::Type::Blob: {
+            const auto& v = *value::text(value);
+            ::sqlite3_result_blob(context, v.data(), static_cast<int>(v.size()), destructor);
+            break;
+        }
+        case value::Type::Enum:
+        case value::Type::Text: {
+            const auto& v = *value::text(value);
+            ::sqlite3_result_text(context, v.data(), static_cast<int>(v.size()), destructor);
+            break;
+        }
+        case value::Type::Address: {
+            // Passed as text so that SQL comparisons keep working.
+            if ( buffer->empty() )
+                *buffer = to_string(std::get<Address>(value));
+
+            ::sqlite3_result_text(context, buffer->data(), static_cast<int>(buffer->size()), destructor);
+            break;
+        }
+        case value::Type::Port:
+        case value::Type::Record:
+        case value::Type::Set:
+        case value::Type::Vector: {
+            if ( buffer->empty() )
+                to_binary_string(value, type, buffer);
+
+            ::sqlite3_result_blob(context, buffer->data(), static_cast<int>(buffer->size()), destructor);
+            break;
+        }
+    }
+}
+
 // SQLite callback that leverages the "authorizer" APIto track which tables a
 // statement accesses.
 static int sqliteAuthorizer(void* user, int action, const char* arg3, const char* arg4, const char* arg5,
@@ -245,16 +349,12 @@ static int onxBestIndexCallback(::sqlite3_vtab* pvtab, ::sqlite3_index_info* inf
 
     ZEEK_AGENT_TRACE("sqlite", "[{}] [callback] best-index", cookie->table->name());
 
-    // Extract table parameters.
-    std::vector<std::string> need_parameters;
-    for ( const auto& c : cookie->table->schema().columns ) {
-        if ( c.is_parameter )
-            need_parameters.emplace_back(c.name);
-    }
+    const auto& schema = cookie->table->schema();
 
-    std::vector<std::string> have_parameters;
+    std::vector<size_t> have_parameters; // column indices
     std::vector<Parameter> parameters;
     parameters.reserve(info->nConstraint);
+    std::vector<table::Constraint> constraints;
 
     for ( auto i = 0; i < info->nConstraint; i++ ) {
         const auto& c = info->aConstraint[i];
@@ -263,7 +363,19 @@ static int onxBestIndexCallback(::sqlite3_vtab* pvtab, ::sqlite3_index_info* inf
             // -1 for ROWID
             continue;
 
-        auto column = cookie->table->schema().columns[c.iColumn];
+        const auto& column = schema.columns[c.iColumn];
+
+        // Record the constraint if it compares against a constant, so that
+        // the table can see it.
+        ::sqlite3_value* rhs = nullptr;
+        if ( auto op = sqliteConvertOperator(c.op); op && ::sqlite3_vtab_rhs_value(info, i, &rhs) == SQLITE_OK && rhs ) {
+            if ( auto value = sqliteConvertValue(column.name, rhs, {}) ) {
+                ZEEK_AGENT_TRACE("sqlite", "[{}] [callback] -  constraint on column: {}", cookie->table->name(),
+                                 column.name);
+                constraints.push_back(table::Constraint{.column = column.name, .op = *op, .value = *value});
+            }
+        }
+
         if ( ! column.is_parameter ) {
             // Let SQLite handle this constraint.
             info->aConstraintUsage[i].argvIndex = 0;
@@ -280,36 +392,49 @@ static int onxBestIndexCallback(::sqlite3_vtab* pvtab, ::sqlite3_index_info* inf
         info->aConstraintUsage[i].argvIndex = param.argv_index; // pass argument value for this parameter to filter()
         info->aConstraintUsage[i].omit = true;                  // the table is in charge of filtering, not SQLite
 
-        have_parameters.emplace_back(param.column);
+        have_parameters.emplace_back(static_cast<size_t>(c.iColumn));
         parameters.push_back(std::move(param));
     }
 
     // The following is bit long-winded because we use vector (instead of sets)
     // to maintain the order of paramters in the resulting error message.
     std::vector<std::string> missing_parameters;
-    for ( const auto& p : need_parameters ) {
+    for ( auto p : schema.parameter_indices ) {
         if ( std::find(have_parameters.begin(), have_parameters.end(), p) != have_parameters.end() )
             continue;
 
         // See if we have a default.
-        bool have_default = false;
-        for ( const auto& c : cookie->table->schema().columns ) {
-            if ( c.name == p && c.is_parameter && c.default_ ) {
-                ZEEK_AGENT_TRACE("sqlite", "[{}] [callback] -  table parameter default: {}", cookie->table->name(),
-                                 c.name);
-                Parameter param{.column = c.name, .argv_index = -1, .value = c.default_};
-                parameters.push_back(std::move(param));
-                have_default = true;
-            }
+        const auto& c = schema.columns[p];
+        if ( c.default_ ) {
+            ZEEK_AGENT_TRACE("sqlite", "[{}] [callback] -  table parameter default: {}", cookie->table->name(), c.name);
+            Parameter param{.column = c.name, .argv_index = -1, .value = c.default_};
+            parameters.push_back(std::move(param));
         }
-
-        if ( ! have_default )
-            missing_parameters.emplace_back(p);
+        else
+            missing_parameters.emplace_back(c.name);
     }
 
     if ( ! missing_parameters.empty() )
         return sqliteError(vtab, frmt("mandatory table parameter '{}' is missing", join(missing_parameters, ", ")));
 
+    if ( cookie->sqlite->_preparing ) {
+        // SQLite may call us multiple times while planning a statement, each
+        // time with a different subset of the WHERE clause (e.g., for
+        // separate branches of an OR, or for multiple instances of the same
+        // table). We hence retain only constraints that all calls see.
+        auto [existing, inserted] =
+            cookie->sqlite->_stmt_constraints.emplace(cookie->table, std::move(constraints));
+
+        if ( ! inserted ) {
+            auto& c = existing->second;
+            c.erase(std::remove_if(c.begin(), c.end(),
+                                   [&](const auto& x) {
+                                       return std::find(constraints.begin(), constraints.end(), x) == constraints.end();
+                                   }),
+                    c.end());
+        }
+    }
+
     vtab->parameters = std::move(parameters);
     return SQLITE_OK;
 }
@@ -324,7 +449,7 @@ static int onTableOpen(::sqlite3_vtab* pvtab, ::sqlite3_vtab_cursor** ppcursor)
     auto cursor = new Cursor;
     cursor->cookie = *cookie;
     cursor->vtab = vtab;
-    cursor->schema = cookie->table->schema();
+    cursor->schema = &cookie->table->schema();
     *ppcursor = &cursor->cursor;
 
     return SQLITE_OK;
@@ -374,7 +499,11 @@ static int onTableFilter(::sqlite3_vtab_cursor* pcursor, int idxnum, const char*
     }
 
     auto t = cookie->sqlite->_stmt_t;
+    ScopeGuard reset_state([cookie]() { cookie->table->sqliteSetStatementState(nullptr); });
+    cookie->table->sqliteSetStatementState(cookie->sqlite->_stmt_state);
+
     try {
+        cursor->encoded.assign(cursor->schema->columns.size(), std::string());
         cursor->rows = cookie->table->rows((t ? *t : 0_time), args);
     } catch ( const table::PermanentContentError& e ) {
         return sqliteError(cursor->vtab, frmt("table error: {}", e.what()));
@@ -382,10 +511,17 @@ static int onTableFilter(::sqlite3_vtab_cursor* pcursor, int idxnum, const char*
 
     cursor->current = 0;
 
-    // Double check that the returned rows match our schema.
-    for ( const auto& row : cursor->rows ) {
-        auto query_columns = cursor->schema.columns;
+    // Double check that the returned rows match our schema. Tables building
+    // their rows through a `RowBuilder` have that checked at compile time, so
+    // we skip them in release builds.
+#ifdef NDEBUG
+    if ( cursor->schema->typed_rows )
+        return SQLITE_OK;
+#endif
 
+    const auto& query_columns = cursor->schema->columns;
+
+    for ( const auto& row : cursor->rows ) {
         if ( row.size() != query_columns.size() )
             return sqliteError(cursor->vtab, frmt("wrong row size returned by table {}", cookie->table->name()));
 
@@ -403,10 +539,10 @@ static int onTableFilter(::sqlite3_vtab_cursor* pcursor, int idxnum, const char*
                     case value::Type::Bool: return std::holds_alternative<bool>(value);
                     case value::Type::Null: return std::holds_alternative<std::monostate>(value);
                     case value::Type::Double: return std::holds_alternative<double>(value);
-                    case value::Type::Address:
+                    case value::Type::Address: return std::holds_alternative<Address>(value);
                     case value::Type::Enum:
                     case value::Type::Text:
-                    case value::Type::Blob: return std::holds_alternative<std::string>(value);
+                    case value::Type::Blob: return value::text(value) != nullptr;
                     case value::Type::Port: return std::holds_alternative<Port>(value);
                     case value::Type::Record: return std::holds_alternative<Record>(value);
                     case value::Type::Set: return std::holds_alternative<Set>(value);
@@ -435,6 +571,11 @@ static int onNext(::sqlite3_vtab_cursor* pcursor) {
 
     ++cursor->current;
 
+    // Encodings are only valid for the row they were made for. Clearing keeps
+    // the strings' capacity for reuse.
+    for ( auto& e : cursor->encoded )
+        e.clear();
+
     return SQLITE_OK;
 }
 
@@ -456,51 +597,19 @@ static int onColumn(::sqlite3_vtab_cursor* pcursor, ::sqlite3_context* context,
     assert(cursor->current < cursor->rows.size());
     assert(i >= 0 && i < static_cast<int>(cursor->rows[cursor->current].size()));
 
-    const auto& column = cursor->schema.columns[i];
+    const auto& column = cursor->schema->columns[i];
     const auto& value = cursor->rows[cursor->current][i];
 
     ZEEK_AGENT_TRACE("sqlite", "[{}] [callback] get-column {} ({})", cookie->table->name(), column.name, i);
 
-    if ( std::holds_alternative<std::monostate>(value) ) {
-        ::sqlite3_result_null(context);
-        return SQLITE_OK;
-    }
-
-    switch ( column.type ) {
-        case value::Type::Integer:
-        case value::Type::Count: ::sqlite3_result_int64(context, std::get<int64_t>(value)); break;
-        case value::Type::Bool: ::sqlite3_result_int64(context, (std::get<bool>(value) ? 1 : 0)); break;
-        case value::Type::Time:
-            ::sqlite3_result_int64(context, std::chrono::duration_cast<std::chrono::microseconds>(
-                                                std::get<Time>(value).time_since_epoch())
-                                                .count());
-            break;
-        case value::Type::Interval: ::sqlite3_result_int64(context, std::get<Interval>(value).count()); break;
-        case value::Type::Double: ::sqlite3_result_double(context, std::get<double>(value)); break;
-        case value::Type::Null: ::sqlite3_result_null(context); break;
-        case value::Type::Blob: {
-            const auto& v = std::get<std::string>(value);
-            ::sqlite3_result_blob(context, v.data(), static_cast<int>(v.size()), SQLITE_STATIC);
-            break;
-        }
-        case value::Type::Address:
-        case value::Type::Enum:
-        case value::Type::Text: {
-            const auto& v = std::get<std::string>(value);
-            ::sqlite3_result_text(context, v.data(), static_cast<int>(v.size()), SQLITE_STATIC);
-            break;
-        }
-        case value::Type::Port:
-        case value::Type::Record:
-        case value::Type::Set:
-        case value::Type::Vector: {
-            auto v = to_json_string(value, column.type);
-            ::sqlite3_result_blob(context, v.data(), static_cast<int>(v.size()),
-                                  SQLITE_TRANSIENT); // NOLINT(performance-no-int-to-ptr)
-            break;
-        }
-    }
+    // Values get passed without copying, as the cursor keeps them around
+    // until the next scan. The encodings we make for SQLite stay around until
+    // the cursor advances to the next row.
+    std::string* buffer = nullptr;
+    if ( sqliteNeedsEncoding(column.type) )
+        buffer = &cursor->encoded[i];
 
+    sqliteResult(context, value, column.type, SQLITE_STATIC, buffer);
     return SQLITE_OK;
 }
 
@@ -516,6 +625,223 @@ static int onRowid(::sqlite3_vtab_cursor* pcursor, ::sqlite3_int64* prowid) {
     return SQLITE_OK;
 }
 
+// Decodes the argument of one of our SQL functions that operates on values
+// SQLite doesn't support natively. Sets the function's result to NULL if the
+// argument is NULL, or to an error if it doesn't hold a value of one of the
+// expected types; returns unset in both cases.
+static std::optional<std::pair<Value, value::Type>> sqliteFunctionArgument(::sqlite3_context* context,
+                                                                           const char* function, ::sqlite3_value* v,
+                                                                           const std::set<value::Type>& types) {
+    if ( ::sqlite3_value_type(v) == SQLITE_NULL ) {
+        ::sqlite3_result_null(context);
+        return {};
+    }
+
+    if ( ::sqlite3_value_type(v) == SQLITE_BLOB ) {
+        auto data = std::string_view(reinterpret_cast<const char*>(::sqlite3_value_blob(v)), ::sqlite3_value_bytes(v));
+        if ( auto x = from_binary_string(data); x && types.count(x->second) )
+            return std::move(*x);
+    }
+
+    auto expected = join(transform(types, [](auto t) { return to_string(t); }), " or ");
+    auto msg = frmt("{}() expects a value of type {}", function, expected);
+    ::sqlite3_result_error(context, msg.c_str(), -1);
+    return {};
+}
+
+// SQL function `port_num(port)`: returns the number of a port.
+static void sqlitePortNum(::sqlite3_context* context, int argc, ::sqlite3_value** argv) {
+    assert(argc == 1);
+
+    auto x = sqliteFunctionArgument(context, "port_num", argv[0], {value::Type::Port});
+    if ( ! x )
+        return;
+
+    if ( std::holds_alternative<std::monostate>(x->first) )
+        ::sqlite3_result_null(context);
+    else
+        ::sqlite3_result_int64(context, std::get<Port>(x->first).port);
+}
+
+// SQL function `record_get(record, index)`: returns a record's field by its
+// 0-based index, or NULL if the index is out of range.
+static void sqliteRecordGet(::sqlite3_context* context, int argc, ::sqlite3_value** argv) {
+    assert(argc == 2);
+
+    auto x = sqliteFunctionArgument(context, "record_get", argv[0], {value::Type::Record});
+    if ( ! x )
+        return;
+
+    if ( std::holds_alternative<std::monostate>(x->first) || ::sqlite3_value_type(argv[1]) == SQLITE_NULL ) {
+        ::sqlite3_result_null(context);
+        return;
+    }
+
+    if ( ::sqlite3_value_type(argv[1]) != SQLITE_INTEGER ) {
+        ::sqlite3_result_error(context, "record_get() expects an integer index", -1);
+        return;
+    }
+
+    auto idx = ::sqlite3_value_int64(argv[1]);
+
+    const auto& record = std::get<Record>(x->first);
+    if ( idx < 0 || static_cast<uint64_t>(idx) >= record.size() ) {
+        ::sqlite3_result_null(context);
+        return;
+    }
+
+    std::string buffer;
+    const auto& [value, type] = record[idx];
+    sqliteResult(context, value, type, SQLITE_TRANSIENT, &buffer); // NOLINT(performance-no-int-to-ptr)
+}
+
+// SQL function `set_contains(set, value)`: returns 1 if a set (or vector)
+// contains a value, and 0 if not.
+static void sqliteSetContains(::sqlite3_context* context, int argc, ::sqlite3_value** argv) {
+    assert(argc == 2);
+
+    auto x = sqliteFunctionArgument(context, "set_contains", argv[0], {value::Type::Set, value::Type::Vector});
+    if ( ! x )
+        return;
+
+    if ( std::holds_alternative<std::monostate>(x->first) || ::sqlite3_value_type(argv[1]) == SQLITE_NULL ) {
+        ::sqlite3_result_null(context);
+        return;
+    }
+
+    auto elem_type = (x->second == value::Type::Set ? std::get<Set>(x->first).type : std::get<Vector>(x->first).type);
+
+    // Convert the argument into the type of the elements; if it doesn't
+    // match that, it can't be contained.
+    auto needle = [&]() -> std::optional<Value> {
+        auto v = argv[1];
+
+        switch ( elem_type ) {
+            case value::Type::Bool:
+            case value::Type::Count:
+            case value::Type::Integer:
+            case value::Type::Interval:
+            case value::Type::Time:
+                if ( ::sqlite3_value_type(v) != SQLITE_INTEGER )
+                    return {};
+
+                return *sqliteConvertValue("set_contains", v, elem_type);
+
+            case value::Type::Double:
+                if ( ::sqlite3_value_type(v) != SQLITE_FLOAT && ::sqlite3_value_type(v) != SQLITE_INTEGER )
+                    return {};
+
+                return Value(::sqlite3_value_double(v));
+
+            case value::Type::Enum:
+            case value::Type::Text:
+                if ( ::sqlite3_value_type(v) != SQLITE_TEXT )
+                    return {};
+
+                return *sqliteConvertValue("set_contains", v, elem_type);
+
+            case value::Type::Address:
+                if ( ::sqlite3_value_type(v) != SQLITE_TEXT )
+                    return {};
+
+                if ( auto y = sqliteConvertValue("set_contains", v, elem_type) )
+                    return *y;
+
+                return {};
+
+            case value::Type::Blob:
+            case value::Type::Port:
+            case value::Type::Record:
+            case value::Type::Set:
+            case value::Type::Vector: {
+                if ( ::sqlite3_value_type(v) != SQLITE_BLOB )
+                    return {};
+
+                if ( auto y = sqliteConvertValue("set_contains", v, elem_type) )
+                    return *y;
+
+                return {};
+            }
+
+            case value::Type::Null: return {};
+        }
+
+        cannot_be_reached(); // thanks GCC
+    }();
+
+    bool found = false;
+
+    if ( needle ) {
+        if ( x->second == value::Type::Set )
+            found = (std::get<Set>(x->first).count(*needle) > 0);
+        else {
+            const auto& vector = std::get<Vector>(x->first);
+            found = (std::find(vector.begin(), vector.end(), *needle) != vector.end());
+        }
+    }
+
+    ::sqlite3_result_int(context, found ? 1 : 0);
+}
+
+// Parses the address argument of one of our SQL functions. Returns unset if
+// the argument is NULL or not a valid address.
+static std::optional<Address> sqliteAddressArgument(::sqlite3_value* v) {
+    if ( ::sqlite3_value_type(v) != SQLITE_TEXT )
+        return {};
+
+    auto data = reinterpret_cast<const char*>(::sqlite3_value_text(v));
+    return Address::fromString(std::string_view(data, ::sqlite3_value_bytes(v)));
+}
+
+// SQL function `cidr_match(addr, subnet)`: returns 1 if an address falls into
+// a subnet given in CIDR notation, and 0 if not. The subnet is normally a
+// constant, so we parse it only once per statement, caching it with SQLite.
+static void sqliteCidrMatch(::sqlite3_context* context, int argc, ::sqlite3_value** argv) {
+    assert(argc == 2);
+
+    auto subnet = reinterpret_cast<const address::Subnet*>(::sqlite3_get_auxdata(context, 1));
+    std::unique_ptr<address::Subnet> parsed;
+
+    if ( ! subnet ) {
+        if ( ::sqlite3_value_type(argv[1]) == SQLITE_NULL ) {
+            ::sqlite3_result_null(context);
+            return;
+        }
+
+        auto data = reinterpret_cast<const char*>(::sqlite3_value_text(argv[1]));
+        auto s = (data ? address::Subnet::fromString(std::string_view(data, ::sqlite3_value_bytes(argv[1]))) :
+                         std::nullopt);
+        if ( ! s ) {
+            ::sqlite3_result_error(context, "cidr_match() expects a subnet in CIDR notation", -1);
+            return;
+        }
+
+        parsed = std::make_unique<address::Subnet>(*s);
+        subnet = parsed.get();
+    }
+
+    if ( auto a = sqliteAddressArgument(argv[0]) )
+        ::sqlite3_result_int(context, subnet->contains(*a) ? 1 : 0);
+    else
+        ::sqlite3_result_null(context);
+
+    // Note that SQLite may delete the data right away, so this must come last.
+    if ( parsed )
+        ::sqlite3_set_auxdata(context, 1, parsed.release(),
+                              [](void* p) { delete reinterpret_cast<address::Subnet*>(p); });
+}
+
+// SQL function `is_private(addr)`: returns 1 if an address falls into
+// private, loopback, or link-local space, and 0 if not.
+static void sqliteIsPrivate(::sqlite3_context* context, int argc, ::sqlite3_value** argv) {
+    assert(argc == 1);
+
+    if ( auto a = sqliteAddressArgument(argv[0]) )
+        ::sqlite3_result_int(context, address::isPrivate(*a) ? 1 : 0);
+    else
+        ::sqlite3_result_null(context);
+}
+
 namespace {
 
 // Define a SQLite module defining our virtual tables, with all its
@@ -535,12 +861,17 @@ const ::sqlite3_module OurSqliteModule = {3, // Version
 
 
 sqlite::PreparedStatement::PreparedStatement(::sqlite3_stmt* stmt, std::set<Table*> tables,
-                                             std::vector<std::optional<sqlite::Column>> columns)
+                                             std::vector<std::optional<sqlite::Column>> columns,
+                                             std::map<Table*, std::vector<table::Constraint>> constraints)
     : _statement(stmt), _tables(std::move(tables)), _columns(std::move(columns)) {
     assert(stmt);
 
-    for ( const auto& t : _tables )
-        t->sqliteTrackStatement();
+    for ( const auto& t : _tables ) {
+        if ( auto c = constraints.find(t); c != constraints.end() )
+            t->sqliteTrackStatement(this, std::move(c->second));
+        else
+            t->sqliteTrackStatement(this);
+    }
 }
 
 ::sqlite::PreparedStatement::~PreparedStatement() {
@@ -548,7 +879,7 @@ sqlite::PreparedStatement::PreparedStatement(::sqlite3_stmt* stmt, std::set<Tabl
     ::sqlite3_finalize(_statement);
 
     for ( const auto& t : _tables )
-        t->sqliteUntrackStatement();
+        t->sqliteUntrackStatement(this);
 };
 
 void SQLite::Implementation::open() {
@@ -557,6 +888,20 @@ void SQLite::Implementation::open() {
 
     if ( ::sqlite3_set_authorizer(_sqlite_db, sqliteAuthorizer, this) != SQLITE_OK )
         throw FatalError("failed to set authorizer for the SQLite database");
+
+    struct Function {
+        const char* name;
+        int argc;
+        void (*callback)(::sqlite3_context*, int, ::sqlite3_value**);
+    };
+
+    for ( const auto& f : {Function{"port_num", 1, sqlitePortNum}, Function{"record_get", 2, sqliteRecordGet},
+                           Function{"set_contains", 2, sqliteSetContains}, Function{"cidr_match", 2, sqliteCidrMatch},
+                           Function{"is_private", 1, sqliteIsPrivate}} ) {
+        if ( ::sqlite3_create_function_v2(_sqlite_db, f.name, f.argc, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                          f.callback, nullptr, nullptr, nullptr) != SQLITE_OK )
+            throw FatalError(frmt("failed to register SQL function {}()", f.name));
+    }
 }
 
 void SQLite::Implementation::close() { ::sqlite3_close(_sqlite_db); }
@@ -595,7 +940,11 @@ Result<Nothing> SQLite::Implementation::addTable(Table* table) {
 Result<std::unique_ptr<sqlite::PreparedStatement>> SQLite::Implementation::prepareStatement(std::string stmt) {
     ::sqlite3_stmt* prepared_stmt = nullptr;
     _stmt_tables.clear();
+    _stmt_constraints.clear();
+
+    _preparing = true;
     auto rc = ::sqlite3_prepare_v2(_sqlite_db, stmt.data(), static_cast<int>(stmt.size()), &prepared_stmt, nullptr);
+    _preparing = false;
     if ( rc != SQLITE_OK )
         return result::Error(frmt("failed to compile SQL statement: {} ({})", stmt, ::sqlite3_errmsg(_sqlite_db)));
 
@@ -626,7 +975,8 @@ Result<std::unique_ptr<sqlite::PreparedStatement>> SQLite::Implementation::prepa
             ZEEK_AGENT_DEBUG("sqlite", "  <column schema n/a>");
 #endif
 
-    return std::make_unique<sqlite::PreparedStatement>(prepared_stmt, std::move(_stmt_tables), std::move(columns));
+    return std::make_unique<sqlite::PreparedStatement>(prepared_stmt, std::move(_stmt_tables), std::move(columns),
+                                                       std::move(_stmt_constraints));
 }
 
 Result<sqlite::Result> SQLite::Implementation::runStatement(const sqlite::PreparedStatement& stmt,
@@ -637,8 +987,13 @@ Result<sqlite::Result> SQLite::Implementation::runStatement(const sqlite::Prepar
     // way to get that over unfortunately).
     std::scoped_lock<std::mutex> lock(_stmt_mutex);
 
-    ScopeGuard reset_time([this]() { _stmt_t.reset(); });
+    ScopeGuard reset_time([this]() {
+        _stmt_t.reset();
+        _stmt_state = nullptr;
+    });
+
     _stmt_t = t;
+    _stmt_state = &stmt.state();
 
     sqlite::Result result;
     auto num_columns = ::sqlite3_column_count(stmt.statement());
@@ -647,6 +1002,7 @@ Result<sqlite::Result> SQLite::Implementation::runStatement(const sqlite::Prepar
     bool first_row = true;
     while ( (rc = ::sqlite3_step(stmt.statement())) == SQLITE_ROW ) {
         std::vector<Value> row;
+        row.reserve(num_columns);
 
         // Note: we can't precompute the columns, the types won't be valid before
         // we actually execute.
@@ -686,7 +1042,7 @@ Result<sqlite::Result> SQLite::Implementation::runStatement(const sqlite::Prepar
 
         first_row = false;
 
-        ZEEK_AGENT_DEBUG("sqlite", "statement result [{}]: {}", result.rows.size() + 1, to_string(row));
+        ZEEK_AGENT_TRACE("sqlite", "statement result [{}]: {}", result.rows.size() + 1, to_string(row));
         result.rows.push_back(std::move(row));
     }
 
@@ -760,7 +1116,7 @@ TEST_SUITE("SQLite") {
     TEST_CASE("statement snapshot tables") {
         class TestTable1 : public SnapshotTable {
         public:
-            Schema schema() const override {
+            Schema buildSchema() const override {
                 return {.name = "test_table1",
                         .columns = {{.name = "i1", .type = value::Type::Integer},
                                     {.name = "t1", .type = value::Type::Text}}};
@@ -784,13 +1140,15 @@ TEST_SUITE("SQLite") {
                 return x;
             }
 
+            auto constraints() const { return activeConstraints(); }
+
             bool extend = false;
             int active = 0;
         };
 
         class TestTable2 : public SnapshotTable {
         public:
-            Schema schema() const override {
+            Schema buildSchema() const override {
                 return {.name = "test_table2",
                         .columns = {
                             {.name = "i2", .type = value::Type::Integer},
@@ -824,10 +1182,11 @@ TEST_SUITE("SQLite") {
                              {2s},
                              {42L},
                              {true},
-                             {"10.0.0.1"},
-                             {Record{{true, value::Type::Bool}, {"192.168.1.1", value::Type::Address}}},
+                             {"10.0.0.1"_addr},
+                             {Record{{true, value::Type::Bool}, {"192.168.1.1"_addr, value::Type::Address}}},
                              {Port(42L, port::Protocol::TCP)},
-                             {Set(value::Type::Address, {"192.168.1.1", "192.168.1.2", "192.168.1.3"})},
+                             {Set(value::Type::Address,
+                                  {"192.168.1.1"_addr, "192.168.1.2"_addr, "192.168.1.3"_addr})},
                              {Vector(value::Type::Count, {10L, 20L, 30L})}});
                 x.push_back({{++counter},
                              {"foo2"},
@@ -838,10 +1197,11 @@ TEST_SUITE("SQLite") {
                              {4s},
                              {43L},
                              {false},
-                             {"10.0.0.2"},
-                             {Record{{false, value::Type::Bool}, {"192.168.1.2", value::Type::Address}}},
+                             {"10.0.0.2"_addr},
+                             {Record{{false, value::Type::Bool}, {"192.168.1.2"_addr, value::Type::Address}}},
                              {Port(43L, port::Protocol::TCP)},
-                             {Set(value::Type::Address, {"192.168.2.1", "192.168.2.2", "192.168.2.3"})},
+                             {Set(value::Type::Address,
+                                  {"192.168.2.1"_addr, "192.168.2.2"_addr, "192.168.2.3"_addr})},
                              {Vector(value::Type::Count, {100L, 200L, 300L})}});
                 x.push_back({{++counter},
                              {"foo3"},
@@ -852,10 +1212,11 @@ TEST_SUITE("SQLite") {
                              {6s},
                              {44L},
                              {true},
-                             {"10.0.0.3"},
-                             {Record{{true, value::Type::Bool}, {"192.168.1.3", value::Type::Address}}},
+                             {"10.0.0.3"_addr},
+                             {Record{{true, value::Type::Bool}, {"192.168.1.3"_addr, value::Type::Address}}},
                              {Port(44L, port::Protocol::TCP)},
-                             {Set(value::Type::Address, {"192.168.3.1", "192.168.3.2", "192.168.3.3"})},
+                             {Set(value::Type::Address,
+                                  {"192.168.3.1"_addr, "192.168.3.2"_addr, "192.168.3.3"_addr})},
                              {Vector(value::Type::Count, {1000L, 2000L, 3000L})}});
                 x.push_back({{++counter},
                              {"foo4"},
@@ -866,8 +1227,8 @@ TEST_SUITE("SQLite") {
                              {8s},
                              {45L},
                              {false},
-                             {"10.0.0.4"},
-                             {Record{{false, value::Type::Bool}, {"192.168.1.4", value::Type::Address}}},
+                             {"10.0.0.4"_addr},
+                             {Record{{false, value::Type::Bool}, {"192.168.1.4"_addr, value::Type::Address}}},
                              {Port(45L, port::Protocol::TCP)},
                              {Set(value::Type::Address, {})},
                              {Vector(value::Type::Count, {})}});
@@ -955,11 +1316,12 @@ TEST_SUITE("SQLite") {
             CHECK_EQ(std::get<Interval>(v1[6]), 2s);
             CHECK_EQ(std::get<int64_t>(v1[7]), 42U);
             CHECK_EQ(std::get<bool>(v1[8]), true);
-            CHECK_EQ(std::get<std::string>(v1[9]), "10.0.0.1");
+            CHECK_EQ(std::get<Address>(v1[9]), "10.0.0.1"_addr);
             CHECK_EQ(std::get<Record>(v1[10]),
-                     Record{{true, value::Type::Bool}, {"192.168.1.1", value::Type::Address}});
+                     Record{{true, value::Type::Bool}, {"192.168.1.1"_addr, value::Type::Address}});
             CHECK_EQ(std::get<Port>(v1[11]), Port(42, port::Protocol::TCP));
-            CHECK_EQ(std::get<Set>(v1[12]), Set(value::Type::Address, {"192.168.1.1", "192.168.1.2", "192.168.1.3"}));
+            CHECK_EQ(std::get<Set>(v1[12]),
+                     Set(value::Type::Address, {"192.168.1.1"_addr, "192.168.1.2"_addr, "192.168.1.3"_addr}));
             CHECK_EQ(std::get<Vector>(v1[13]), Vector(value::Type::Count, {10L, 20L, 30L}));
 
             result = sql.runStatement("SELECT * FROM test_table2 WHERE i2 == 4");
@@ -973,6 +1335,69 @@ TEST_SUITE("SQLite") {
             CHECK_EQ(std::get<Vector>(v4[13]), Vector(value::Type::Count, {}));
         }
 
+        SUBCASE("value functions") {
+            auto result = sql.runStatement("SELECT port_num(p2), record_get(re2, 1), record_get(re2, 0), record_get(re2, 2) "
+                                           "FROM test_table2 WHERE i2 == 1");
+            REQUIRE(result);
+            REQUIRE_EQ(result->rows.size(), 1);
+            CHECK_EQ(std::get<int64_t>(result->rows[0][0]), 42);
+            CHECK_EQ(std::get<std::string>(result->rows[0][1]), "192.168.1.1");
+            CHECK_EQ(std::get<int64_t>(result->rows[0][2]), 1);
+            CHECK(std::holds_alternative<std::monostate>(result->rows[0][3]));
+
+            result = sql.runStatement("SELECT i2 FROM test_table2 WHERE port_num(p2) > 43");
+            REQUIRE(result);
+            CHECK_EQ(result->rows.size(), 2);
+
+            result = sql.runStatement("SELECT i2 FROM test_table2 WHERE set_contains(s2, '192.168.2.2')");
+            REQUIRE(result);
+            REQUIRE_EQ(result->rows.size(), 1);
+            CHECK_EQ(std::get<int64_t>(result->rows[0][0]), 2);
+
+            result = sql.runStatement("SELECT i2 FROM test_table2 WHERE set_contains(v2, 3000)");
+            REQUIRE(result);
+            REQUIRE_EQ(result->rows.size(), 1);
+            CHECK_EQ(std::get<int64_t>(result->rows[0][0]), 3);
+
+            result = sql.runStatement("SELECT i2 FROM test_table2 WHERE set_contains(v2, 'foo') OR set_contains(s2, 1)");
+            REQUIRE(result);
+            CHECK_EQ(result->rows.size(), 0);
+
+            result = sql.runStatement("SELECT port_num(NULL), set_contains(s2, NULL) FROM test_table2 WHERE i2 == 1");
+            REQUIRE(result);
+            CHECK(std::holds_alternative<std::monostate>(result->rows[0][0]));
+            CHECK(std::holds_alternative<std::monostate>(result->rows[0][1]));
+
+            CHECK(! sql.runStatement("SELECT port_num(i2) FROM test_table2"));
+            CHECK(! sql.runStatement("SELECT set_contains(re2, 1) FROM test_table2"));
+        }
+
+        SUBCASE("address functions") {
+            auto result = sql.runStatement("SELECT i2 FROM test_table2 WHERE cidr_match(a2, '10.0.0.2/31')");
+            REQUIRE(result);
+            REQUIRE_EQ(result->rows.size(), 2);
+            CHECK_EQ(std::get<int64_t>(result->rows[0][0]), 2);
+            CHECK_EQ(std::get<int64_t>(result->rows[1][0]), 3);
+
+            result = sql.runStatement("SELECT i2 FROM test_table2 WHERE a2 = '10.0.0.3'");
+            REQUIRE(result);
+            CHECK_EQ(result->rows.size(), 1);
+
+            result = sql.runStatement(
+                "SELECT cidr_match(a2, '::/0'), cidr_match(t2, '10.0.0.0/8'), cidr_match(NULL, '10.0.0.0/8'), "
+                "is_private(a2), is_private('8.8.8.8'), is_private(t2) FROM test_table2 WHERE i2 == 1");
+            REQUIRE(result);
+            CHECK_EQ(std::get<int64_t>(result->rows[0][0]), 0);
+            CHECK(std::holds_alternative<std::monostate>(result->rows[0][1]));
+            CHECK(std::holds_alternative<std::monostate>(result->rows[0][2]));
+            CHECK_EQ(std::get<int64_t>(result->rows[0][3]), 1);
+            CHECK_EQ(std::get<int64_t>(result->rows[0][4]), 0);
+            CHECK(std::holds_alternative<std::monostate>(result->rows[0][5]));
+
+            CHECK(! sql.runStatement("SELECT cidr_match(a2, '10.0.0.0') FROM test_table2"));
+            CHECK(! sql.runStatement("SELECT cidr_match(a2, 42) FROM test_table2"));
+        }
+
         SUBCASE("statement with join") {
             CHECK_EQ(t1.active, 0);
             auto statement = sql.prepareStatement(
@@ -1030,6 +1455,23 @@ TEST_SUITE("SQLite") {
             statement2 = {};
             CHECK_EQ(t1.active, 0);
         }
+
+        SUBCASE("constraints") {
+            auto constraints = [&](const std::string& stmt) {
+                auto statement = sql.prepareStatement(stmt);
+                REQUIRE(statement);
+                auto c = t1.constraints();
+                REQUIRE_EQ(c.size(), 1);
+                return join(transform(c[0], [](const auto& x) { return table::to_string(x); }), ", ");
+            };
+
+            CHECK_EQ(constraints("SELECT * from test_table1"), "");
+            CHECK_EQ(constraints("SELECT * from test_table1 WHERE i1 >= 3 AND t1 = 'foo'"), "i1>=3, t1=foo");
+            CHECK_EQ(constraints("SELECT * from test_table1 WHERE 3 > i1 AND t1 != 'foo'"), "i1<3, t1!=foo");
+            CHECK_EQ(constraints("SELECT * from test_table1 WHERE i1 = 1 OR t1 = 'foo'"), "");
+            CHECK_EQ(constraints("SELECT * from test_table1 WHERE i1 IN (1, 2)"), "");
+            CHECK_EQ(constraints("SELECT a.t1 from test_table1 a, test_table1 b WHERE a.i1 = 1"), "");
+        }
     }
 
     TEST_CASE("statement event tables") {
@@ -1037,7 +1479,7 @@ TEST_SUITE("SQLite") {
         public:
             ~TestTable() override {}
 
-            Schema schema() const override {
+            Schema buildSchema() const override {
                 return {.name = "test_events",
                         .columns = {{.name = "time", .type = value::Type::Integer},
                                     {.name = "tag", .type = value::Type::Text}}};
@@ -1086,7 +1528,7 @@ TEST_SUITE("SQLite") {
     TEST_CASE("statement with table arguments") {
         class TestTable : public SnapshotTable {
         public:
-            Schema schema() const override {
+            Schema buildSchema() const override {
                 return {.name = "test_table",
                         .columns = {
                             {.name = "i", .type = value::Type::Integer},
@@ -1116,6 +1558,13 @@ TEST_SUITE("SQLite") {
                 auto val_def = std::get<std::string>(arg_def.expression);
                 CHECK_EQ(val_def, "default");
 
+                auto state = statementState<std::string>(args, [&]() {
+                    ++states_created;
+                    return std::make_shared<std::string>(val);
+                });
+
+                CHECK_EQ(*state, val);
+
                 std::vector<std::vector<Value>> x;
                 x.push_back({{1L}, "X", val, {"default"}});
                 x.push_back({{2L}, "X", val, {"default"}});
@@ -1123,6 +1572,10 @@ TEST_SUITE("SQLite") {
                 x.push_back({{4L}, "Y", val, {"default"}});
                 return x;
             }
+
+            auto constraints() const { return activeConstraints(); }
+
+            int states_created = 0;
         };
 
         TestTable t;
@@ -1133,6 +1586,11 @@ TEST_SUITE("SQLite") {
             auto statement = sql.prepareStatement("SELECT * from test_table(\"ARG\") WHERE c == 'X'");
             REQUIRE(statement);
 
+            auto constraints = t.constraints();
+            REQUIRE_EQ(constraints.size(), 1);
+            CHECK_EQ(join(transform(constraints[0], [](const auto& x) { return table::to_string(x); }), ", "),
+                     "c=X, _arg=ARG");
+
             auto result = sql.runStatement(**statement);
             REQUIRE(result);
             CHECK_EQ(result->rows.size(), 3);
@@ -1145,13 +1603,29 @@ TEST_SUITE("SQLite") {
             auto statement = sql.prepareStatement("SELECT * from test_table");
             REQUIRE(! statement);
         }
+
+        SUBCASE("statement state") {
+            auto statement1 = sql.prepareStatement("SELECT * from test_table(\"ARG\")");
+            REQUIRE(statement1);
+
+            CHECK(sql.runStatement(**statement1));
+            CHECK(sql.runStatement(**statement1));
+            CHECK_EQ(t.states_created, 1);
+            CHECK_EQ((*statement1)->state().size(), 1);
+
+            auto statement2 = sql.prepareStatement("SELECT * from test_table(\"ARG\")");
+            REQUIRE(statement2);
+
+            CHECK(sql.runStatement(**statement2));
+            CHECK_EQ(t.states_created, 2);
+        }
     }
 
     TEST_CASE("broken table implementation") {
         class BrokenTable : public SnapshotTable {
         public:
             BrokenTable(int error_type) : error_type(error_type) {}
-            Schema schema() const override {
+            Schema buildSchema() const override {
                 return {.name = "broken_table",
                         .columns = {{.name = "i", .type = value::Type::Integer},
                                     {.name = "c", .type = value::Type::Text}}};
@@ -1196,3 +1670,42 @@ TEST_SUITE("SQLite") {
         }
     }
 }
+
+ZEEK_AGENT_BENCHMARK("sqlite/vtab-scan") {
+    class BenchmarkTable : public SnapshotTable {
+    public:
+        BenchmarkTable() {
+            for ( int64_t i = 0; i < 10000; i++ )
+                data.push_back({i, frmt("process-{}", i % 100), static_cast<double>(i) / 3, "10.0.0.1"_addr,
+                                Record{{i, value::Type::Count}, {"foo", value::Type::Text}}});
+        }
+
+        Schema buildSchema() const override {
+            return {.name = "benchmark_table",
+                    .columns = {{.name = "c", .type = value::Type::Count},
+                                {.name = "t", .type = value::Type::Text},
+                                {.name = "d", .type = value::Type::Double},
+                                {.name = "a", .type = value::Type::Address},
+                                {.name = "r", .type = value::Type::Record}}};
+        }
+
+        std::vector<std::vector<Value>> snapshot(const std::vector<table::Argument>& args) override { return data; }
+
+        std::vector<std::vector<Value>> data;
+    };
+
+    BenchmarkTable t;
+    SQLite sql;
+    sql.addTable(&t);
+
+    auto stmt = sql.prepareStatement("SELECT * FROM benchmark_table");
+    if ( ! stmt )
+        throw InternalError(frmt("cannot prepare benchmark statement: {}", stmt.error()));
+
+    state.setItemsPerIteration(static_cast<int64_t>(t.data.size()));
+
+    while ( state.keepRunning() ) {
+        auto result = sql.runStatement(**stmt);
+        benchmark::doNotOptimize(result);
+    }
+}
@@ -8,7 +8,9 @@
 #include "util/result.h"
 
 #include <cassert>
+#include <map>
 #include <memory>
+#include <optional>
 #include <set>
 #include <string>
 #include <vector>
@@ -54,9 +56,11 @@ public:
      * `::sqlite3_prepare_v2`; the construcor takes ownership of the instance
      * @param tables set of tables that the statement accesses
      * @param columns  schema for each result columm, or unset if a column can't be described in advance
+     * @param constraints constraints that the statement places on each table's columns
      */
     PreparedStatement(::sqlite3_stmt* stmt, std::set<Table*> tables,
-                      std::vector<std::optional<sqlite::Column>> columns);
+                      std::vector<std::optional<sqlite::Column>> columns,
+                      std::map<Table*, std::vector<table::Constraint>> constraints = {});
     ~PreparedStatement();
 
     PreparedStatement(const PreparedStatement& other) = delete;
@@ -78,10 +82,15 @@ public:
         return _columns[i];
     }
 
+    // Returns storage for state that tables derive from the statement's
+    // arguments, kept across executions. For internal use only.
+    auto& state() const { return _state; }
+
 private:
     ::sqlite3_stmt* _statement;                          // as passed into constructor
     std::set<Table*> _tables;                            // as passed into constructor
     std::vector<std::optional<sqlite::Column>> _columns; // as passed into constructor
+    mutable table::StatementState _state;                // state that tables store with the statement
 };
 
 } // namespace sqlite
@@ -3,17 +3,30 @@
 
 #include "database.h"
 #include "logger.h"
+#include "util/benchmark.h"
 #include "util/fmt.h"
 #include "util/helpers.h"
 #include "util/testing.h"
 
 #include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <set>
 #include <utility>
 #include <variant>
 
 #include <nlohmann/json.hpp>
 
+#ifdef HAVE_WINDOWS
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+
 using namespace zeek::agent;
 
 std::string zeek::agent::value::to_string(const value::Type& type) {
@@ -79,9 +92,11 @@ std::string zeek::agent::to_string(const Value& value) {
         std::string operator()(bool x) { return frmt("{}", (x ? "true" : "false")); }
         std::string operator()(const Record& v) { return to_string(v); }
         std::string operator()(const Port& v) { return to_string(v); }
+        std::string operator()(const Address& v) { return to_string(v); }
         std::string operator()(const Set& v) { return to_string(v); }
         std::string operator()(const Vector& v) { return to_string(v); }
         std::string operator()(const std::string& x) { return x; }
+        std::string operator()(const InternedString& x) { return x.str(); }
         std::string operator()(double x) { return frmt("{}", x); }
         std::string operator()(int64_t x) { return frmt("{}", x); }
         std::string operator()(std::monostate) { return "(null)"; }
@@ -177,7 +192,9 @@ static nlohmann::json to_json(const Value& v, const value::Type& t) {
         nlohmann::json operator()(Interval x) { return x.count(); }
         nlohmann::json operator()(bool x) { return x; }
         nlohmann::json operator()(const std::string& x) { return x; }
+        nlohmann::json operator()(const InternedString& x) { return x.str(); }
         nlohmann::json operator()(const Port& x) { return to_json(x); }
+        nlohmann::json operator()(const Address& x) { return to_string(x); }
         nlohmann::json operator()(const Record& x) { return to_json(x); }
         nlohmann::json operator()(const Set& x) { return to_json(x); }
         nlohmann::json operator()(const Vector& x) { return to_json(x); }
@@ -206,7 +223,13 @@ static Value from_json(const nlohmann::json& value, const value::Type& type) {
         case value::Type::Count:
         case value::Type::Integer: return value.get<int64_t>();
 
-        case value::Type::Address:
+        case value::Type::Address: {
+            if ( auto a = Address::fromString(value.get<std::string>()) )
+                return *a;
+
+            return {};
+        }
+
         case value::Type::Blob:
         case value::Type::Enum:
         case value::Type::Text: return value.get<std::string>();
@@ -227,6 +250,401 @@ Value zeek::agent::from_json_string(const std::string_view& data, value::Type ty
     }
 }
 
+// Binary encoding, see `to_binary_string()`. Each value starts with a byte
+// holding its type, with the top bit set if the value is null. Integers are
+// stored as zigzag-encoded LEB128 varints; strings are prefixed with their
+// varint length; addresses take their 16 raw bytes; sets and vectors record
+// their element type once upfront, followed by the number of elements.
+
+static constexpr uint8_t BinaryNullFlag = 0x80;
+static constexpr int BinaryMaxDepth = 32; // maximum nesting depth we accept when decoding
+
+static void to_binary_varint(int64_t x, std::string* out) {
+    auto u = (static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63); // zigzag
+
+    while ( u >= 0x80 ) {
+        out->push_back(static_cast<char>((u & 0x7f) | 0x80));
+        u >>= 7;
+    }
+
+    out->push_back(static_cast<char>(u));
+}
+
+static void to_binary_bytes(const std::string& x, std::string* out) {
+    to_binary_varint(static_cast<int64_t>(x.size()), out);
+    out->append(x);
+}
+
+void zeek::agent::to_binary_string(const Value& value, value::Type type, std::string* out) {
+    if ( std::holds_alternative<std::monostate>(value) || type == value::Type::Null ) {
+        out->push_back(static_cast<char>(static_cast<uint8_t>(type) | BinaryNullFlag));
+        return;
+    }
+
+    out->push_back(static_cast<char>(type));
+
+    switch ( type ) {
+        case value::Type::Bool: out->push_back(std::get<bool>(value) ? 1 : 0); break;
+        case value::Type::Interval: to_binary_varint(std::get<Interval>(value).count(), out); break;
+        case value::Type::Time: to_binary_varint(std::get<Time>(value).time_since_epoch().count(), out); break;
+        case value::Type::Null: cannot_be_reached();
+
+        case value::Type::Count:
+        case value::Type::Integer: to_binary_varint(std::get<int64_t>(value), out); break;
+
+        case value::Type::Double: {
+            uint64_t bits;
+            auto d = std::get<double>(value);
+            memcpy(&bits, &d, sizeof(bits));
+
+            for ( int i = 0; i < 8; i++ )
+                out->push_back(static_cast<char>((bits >> (i * 8)) & 0xff));
+
+            break;
+        }
+
+        case value::Type::Address: {
+            const auto& a = std::get<Address>(value);
+            out->append(reinterpret_cast<const char*>(a.bytes.data()), a.bytes.size());
+            break;
+        }
+
+        case value::Type::Blob:
+        case value::Type::Enum:
+        case value::Type::Text: to_binary_bytes(*value::text(value), out); break;
+
+        case value::Type::Port: {
+            const auto& p = std::get<Port>(value);
+            to_binary_varint(p.port, out);
+            out->push_back(static_cast<char>(p.protocol));
+            break;
+        }
+
+        case value::Type::Record: {
+            const auto& r = std::get<Record>(value);
+            to_binary_varint(static_cast<int64_t>(r.size()), out);
+
+            for ( const auto& [v, t] : r )
+                to_binary_string(v, t, out);
+
+            break;
+        }
+
+        case value::Type::Set: {
+            const auto& s = std::get<Set>(value);
+            out->push_back(static_cast<char>(s.type));
+            to_binary_varint(static_cast<int64_t>(s.size()), out);
+
+            for ( const auto& v : s )
+                to_binary_string(v, s.type, out);
+
+            break;
+        }
+
+        case value::Type::Vector: {
+            const auto& v = std::get<Vector>(value);
+            out->push_back(static_cast<char>(v.type));
+            to_binary_varint(static_cast<int64_t>(v.size()), out);
+
+            for ( const auto& e : v )
+                to_binary_string(e, v.type, out);
+
+            break;
+        }
+    }
+}
+
+namespace {
+
+// Helper decoding a binary representation, with all accesses bounds-checked.
+class BinaryReader {
+public:
+    BinaryReader(std::string_view data) : _data(data) {}
+
+    bool atEnd() const { return _data.empty(); }
+
+    Result<uint8_t> byte() {
+        if ( _data.empty() )
+            return result::Error("truncated data");
+
+        auto b = static_cast<uint8_t>(_data[0]);
+        _data.remove_prefix(1);
+        return b;
+    }
+
+    Result<value::Type> type() {
+        auto b = byte();
+        if ( ! b )
+            return b.error();
+
+        if ( *b > static_cast<uint8_t>(value::Type::Vector) )
+            return result::Error(frmt("invalid type {}", *b));
+
+        return static_cast<value::Type>(*b);
+    }
+
+    Result<int64_t> varint() {
+        uint64_t u = 0;
+
+        for ( int shift = 0; shift < 64; shift += 7 ) {
+            auto b = byte();
+            if ( ! b )
+                return b.error();
+
+            u |= static_cast<uint64_t>(*b & 0x7f) << shift;
+
+            if ( (*b & 0x80) == 0 )
+                return static_cast<int64_t>((u >> 1) ^ (~(u & 1) + 1)); // zigzag
+        }
+
+        return result::Error("invalid varint");
+    }
+
+    // Reads a count of elements, each of which takes at least one more byte.
+    Result<size_t> count() {
+        auto n = varint();
+        if ( ! n )
+            return n.error();
+
+        if ( *n < 0 || static_cast<uint64_t>(*n) > _data.size() )
+            return result::Error("invalid element count");
+
+        return static_cast<size_t>(*n);
+    }
+
+    Result<std::string> bytes() {
+        auto n = varint();
+        if ( ! n )
+            return n.error();
+
+        if ( *n < 0 || static_cast<uint64_t>(*n) > _data.size() )
+            return result::Error("truncated data");
+
+        auto s = std::string(_data.substr(0, *n));
+        _data.remove_prefix(*n);
+        return s;
+    }
+
+    Result<Address> address() {
+        Address a;
+        if ( _data.size() < a.bytes.size() )
+            return result::Error("truncated data");
+
+        memcpy(a.bytes.data(), _data.data(), a.bytes.size());
+        _data.remove_prefix(a.bytes.size());
+        return a;
+    }
+
+    Result<double> float64() {
+        if ( _data.size() < 8 )
+            return result::Error("truncated data");
+
+        uint64_t bits = 0;
+        for ( int i = 0; i < 8; i++ )
+            bits |= static_cast<uint64_t>(static_cast<uint8_t>(_data[i])) << (i * 8);
+
+        _data.remove_prefix(8);
+
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    Result<std::pair<Value, value::Type>> value(std::optional<value::Type> expected, int depth);
+
+private:
+    std::string_view _data;
+};
+
+Result<std::pair<Value, value::Type>> BinaryReader::value(std::optional<value::Type> expected, int depth) {
+    if ( depth > BinaryMaxDepth )
+        return result::Error("values nested too deeply");
+
+    auto b = byte();
+    if ( ! b )
+        return b.error();
+
+    auto is_null = ((*b & BinaryNullFlag) != 0);
+    auto raw_type = static_cast<uint8_t>(*b & ~BinaryNullFlag);
+
+    if ( raw_type > static_cast<uint8_t>(value::Type::Vector) )
+        return result::Error(frmt("invalid type {}", raw_type));
+
+    auto type = static_cast<value::Type>(raw_type);
+
+    if ( expected && *expected != type )
+        return result::Error(frmt("unexpected type {} (expected {})", to_string(type), to_string(*expected)));
+
+    if ( is_null || type == value::Type::Null )
+        return std::make_pair(Value(), type);
+
+    // Decodes a single element of a container.
+    auto element = [&](value::Type t) -> Result<Value> {
+        auto v = value(t, depth + 1);
+        if ( ! v )
+            return v.error();
+
+        return std::move(v->first);
+    };
+
+    switch ( type ) {
+        case value::Type::Bool: {
+            auto x = byte();
+            if ( ! x )
+                return x.error();
+
+            return std::make_pair(Value(*x != 0), type);
+        }
+
+        case value::Type::Count:
+        case value::Type::Integer: {
+            auto x = varint();
+            if ( ! x )
+                return x.error();
+
+            return std::make_pair(Value(*x), type);
+        }
+
+        case value::Type::Interval: {
+            auto x = varint();
+            if ( ! x )
+                return x.error();
+
+            return std::make_pair(Value(Interval(*x)), type);
+        }
+
+        case value::Type::Time: {
+            auto x = varint();
+            if ( ! x )
+                return x.error();
+
+            return std::make_pair(Value(Time(Interval(*x))), type);
+        }
+
+        case value::Type::Double: {
+            auto x = float64();
+            if ( ! x )
+                return x.error();
+
+            return std::make_pair(Value(*x), type);
+        }
+
+        case value::Type::Address: {
+            auto x = address();
+            if ( ! x )
+                return x.error();
+
+            return std::make_pair(Value(*x), type);
+        }
+
+        case value::Type::Blob:
+        case value::Type::Enum:
+        case value::Type::Text: {
+            auto x = bytes();
+            if ( ! x )
+                return x.error();
+
+            return std::make_pair(Value(std::move(*x)), type);
+        }
+
+        case value::Type::Port: {
+            auto port = varint();
+            if ( ! port )
+                return port.error();
+
+            auto proto = byte();
+            if ( ! proto )
+                return proto.error();
+
+            return std::make_pair(Value(Port(*port, static_cast<int64_t>(*proto))), type);
+        }
+
+        case value::Type::Record: {
+            auto n = count();
+            if ( ! n )
+                return n.error();
+
+            Record r;
+            r.reserve(*n);
+
+            for ( size_t i = 0; i < *n; i++ ) {
+                auto v = value({}, depth + 1);
+                if ( ! v )
+                    return v.error();
+
+                r.emplace_back(std::move(*v));
+            }
+
+            return std::make_pair(Value(std::move(r)), type);
+        }
+
+        case value::Type::Set: {
+            auto t = this->type();
+            if ( ! t )
+                return t.error();
+
+            auto n = count();
+            if ( ! n )
+                return n.error();
+
+            Set s(*t);
+
+            for ( size_t i = 0; i < *n; i++ ) {
+                auto v = element(*t);
+                if ( ! v )
+                    return v.error();
+
+                s.insert(std::move(*v));
+            }
+
+            return std::make_pair(Value(std::move(s)), type);
+        }
+
+        case value::Type::Vector: {
+            auto t = this->type();
+            if ( ! t )
+                return t.error();
+
+            auto n = count();
+            if ( ! n )
+                return n.error();
+
+            Vector v(*t);
+            v.reserve(*n);
+
+            for ( size_t i = 0; i < *n; i++ ) {
+                auto e = element(*t);
+                if ( ! e )
+                    return e.error();
+
+                v.push_back(std::move(*e));
+            }
+
+            return std::make_pair(Value(std::move(v)), type);
+        }
+
+        case value::Type::Null: cannot_be_reached();
+    }
+
+    cannot_be_reached(); // thanks GCC
+}
+
+} // namespace
+
+Result<std::pair<Value, value::Type>> zeek::agent::from_binary_string(std::string_view data,
+                                                                      std::optional<value::Type> type) {
+    BinaryReader reader(data);
+
+    auto v = reader.value(type, 0);
+    if ( ! v )
+        return result::Error(frmt("invalid binary value: {}", v.error()));
+
+    if ( ! reader.atEnd() )
+        return result::Error("invalid binary value: trailing data");
+
+    return v;
+}
+
 std::string zeek::agent::to_string(const std::vector<Value>& values) {
     return join(transform(values, [](const auto& x) { return to_string(x); }), " ");
 }
@@ -243,6 +661,108 @@ std::string zeek::agent::to_string(const Port& v) {
     return frmt("{}/{}", v.port, proto);
 }
 
+Address Address::fromIPv4(const void* data) {
+    Address a;
+    memcpy(a.bytes.data(), V4MappedPrefix, sizeof(V4MappedPrefix));
+    memcpy(a.bytes.data() + sizeof(V4MappedPrefix), data, 4);
+    return a;
+}
+
+Address Address::fromIPv6(const void* data) {
+    Address a;
+    memcpy(a.bytes.data(), data, a.bytes.size());
+    return a;
+}
+
+std::optional<Address> Address::fromString(std::string_view s) {
+    char buffer[INET6_ADDRSTRLEN];
+    if ( s.size() >= sizeof(buffer) )
+        return {};
+
+    memcpy(buffer, s.data(), s.size());
+    buffer[s.size()] = '\0';
+
+    uint8_t bytes[16];
+
+    if ( ::inet_pton(AF_INET, buffer, bytes) == 1 )
+        return fromIPv4(bytes);
+
+    if ( ::inet_pton(AF_INET6, buffer, bytes) == 1 )
+        return fromIPv6(bytes);
+
+    return {};
+}
+
+std::string zeek::agent::to_string(const Address& v) {
+    char buffer[INET6_ADDRSTRLEN];
+
+    if ( v.isIPv4() )
+        return ::inet_ntop(AF_INET, v.bytes.data() + sizeof(Address::V4MappedPrefix), buffer, sizeof(buffer));
+    else
+        return ::inet_ntop(AF_INET6, v.bytes.data(), buffer, sizeof(buffer));
+}
+
+std::optional<address::Subnet> address::Subnet::fromString(std::string_view s) {
+    auto slash = s.find('/');
+    if ( slash == std::string_view::npos )
+        return {};
+
+    auto prefix = Address::fromString(s.substr(0, slash));
+    if ( ! prefix )
+        return {};
+
+    auto length_str = s.substr(slash + 1);
+    if ( length_str.empty() || length_str.size() > 3 ||
+         ! std::all_of(length_str.begin(), length_str.end(), [](auto c) { return isdigit(c); }) )
+        return {};
+
+    auto length = std::stoi(std::string(length_str));
+    if ( prefix->isIPv4() ) {
+        if ( length > 32 )
+            return {};
+
+        length += static_cast<int>(sizeof(Address::V4MappedPrefix) * 8);
+    }
+    else if ( length > 128 )
+        return {};
+
+    // Clear any bits past the prefix so that `contains()` can compare bytes directly.
+    for ( auto i = length; i < 128; i++ )
+        prefix->bytes[i / 8] &= ~(0x80 >> (i % 8));
+
+    return Subnet{.prefix = *prefix, .length = length};
+}
+
+bool address::Subnet::contains(const Address& a) const {
+    // IPv4 subnets cover at least the mapped prefix; anything shorter is IPv6 only.
+    if ( a.isIPv4() && length < static_cast<int>(sizeof(Address::V4MappedPrefix) * 8) )
+        return false;
+
+    auto full = static_cast<size_t>(length / 8);
+    if ( memcmp(a.bytes.data(), prefix.bytes.data(), full) != 0 )
+        return false;
+
+    if ( auto bits = length % 8 ) {
+        auto mask = static_cast<uint8_t>(0xff << (8 - bits));
+        return (a.bytes[full] & mask) == prefix.bytes[full];
+    }
+
+    return true;
+}
+
+bool address::isPrivate(const Address& a) {
+    static const std::vector<Subnet> private_space = [] {
+        std::vector<Subnet> subnets;
+        for ( const auto& s : {"10.0.0.0/8", "100.64.0.0/10", "127.0.0.0/8", "169.254.0.0/16", "172.16.0.0/12",
+                               "192.168.0.0/16", "::1/128", "fc00::/7", "fe80::/10"} )
+            subnets.push_back(*Subnet::fromString(s));
+
+        return subnets;
+    }();
+
+    return std::any_of(private_space.begin(), private_space.end(), [&](const auto& s) { return s.contains(a); });
+}
+
 std::string zeek::agent::to_string(const Record& v) {
     const std::vector<std::pair<Value, value::Type>>& base = v;
     return std::string("[") + join(transform(base, [](const auto& x) { return to_string(x.first); }), ", ") + "]";
@@ -258,10 +778,30 @@ std::string zeek::agent::to_string(const Vector& v) {
     return std::string("[") + join(transform(base, [](const auto& x) { return to_string(x); }), ", ") + "]";
 }
 
-std::optional<schema::Column> Schema::column(const std::string_view& name) {
-    for ( const auto& c : columns ) {
-        if ( name == c.name )
-            return c;
+void Schema::index() {
+    parameter_indices.clear();
+    column_indices.clear();
+
+    for ( auto i = 0U; i < columns.size(); i++ ) {
+        if ( columns[i].is_parameter )
+            parameter_indices.push_back(i);
+
+        column_indices.emplace(columns[i].name, i);
+    }
+}
+
+std::optional<size_t> Schema::columnIndex(std::string_view name) const {
+    if ( column_indices.size() == columns.size() ) {
+        if ( auto i = column_indices.find(name); i != column_indices.end() )
+            return i->second;
+
+        return {};
+    }
+
+    // Not indexed.
+    for ( auto i = 0U; i < columns.size(); i++ ) {
+        if ( name == columns[i].name )
+            return i;
     }
 
     return {};
@@ -277,6 +817,21 @@ std::string zeek::agent::table::to_string(const Argument& arg) {
     return frmt("{}={}", arg.column, ::zeek::agent::to_string(arg.expression));
 }
 
+std::string zeek::agent::table::to_string(const Constraint& c) {
+    std::string op;
+
+    switch ( c.op ) {
+        case Operator::Equal: op = "="; break;
+        case Operator::NotEqual: op = "!="; break;
+        case Operator::Less: op = "<"; break;
+        case Operator::LessEqual: op = "<="; break;
+        case Operator::Greater: op = ">"; break;
+        case Operator::GreaterEqual: op = ">="; break;
+    }
+
+    return frmt("{}{}{}", c.column, op, ::zeek::agent::to_string(c.value));
+}
+
 std::vector<schema::Column> zeek::agent::Schema::parameters() const {
     std::vector<schema::Column> result;
     for ( auto c : columns ) {
@@ -287,13 +842,23 @@ std::vector<schema::Column> zeek::agent::Schema::parameters() const {
     return result;
 }
 
+const Schema& Table::schema() const {
+    std::call_once(_schema_once, [this]() {
+        auto schema = buildSchema();
+        schema.index();
+        _schema = std::make_unique<const Schema>(std::move(schema));
+    });
+
+    return *_schema;
+}
+
 Table::~Table() {
-    if ( _current_connections != 0 )
+    if ( ! _statements.empty() )
         logger()->warn(
             "unbalanced connects/disconnects for table"); // note: cannot throw, and cannot call name() from dtor
 }
 
-bool Table::isActive() const { return _current_connections > 0; }
+bool Table::isActive() const { return ! _statements.empty(); }
 
 const Options& Table::options() const {
     if ( ! _db )
@@ -318,6 +883,13 @@ Time Table::currentTime() const {
     return _db->currentTime();
 }
 
+ThreadPool& Table::workerPool() const {
+    if ( ! _db )
+        throw InternalError("no database/worker pool available in table");
+
+    return _db->workerPool();
+}
+
 std::vector<Value> Table::generateMockRow(int i) {
     std::vector<Value> row;
 
@@ -334,7 +906,7 @@ std::vector<Value> Table::generateMockRow(int i) {
             case value::Type::Null: /* leave unset */ break;
             case value::Type::Text: v = frmt("text_{:c}_{:c}", ('a' + i % 65), ('a' + j % 65)); break;
             case value::Type::Time: v = to_time(1646252056 + 100 * (i + 1) + j); break;
-            case value::Type::Address: v = frmt("192.168.1.{}", i % 255 + 1 + j); break;
+            case value::Type::Address: v = *Address::fromString(frmt("192.168.1.{}", i % 255 + 1 + j)); break;
             case value::Type::Port: v = Port(10000 * (i + 1) + j, static_cast<port::Protocol>(j % 4)); break;
             case value::Type::Record:
                 v = Record({{static_cast<int64_t>(1000 * (i + 1) + j), value::Type::Count},
@@ -356,23 +928,46 @@ std::vector<Value> Table::generateMockRow(int i) {
     return row;
 }
 
-void Table::sqliteTrackStatement() {
-    if ( ++_current_connections == 1 ) {
-        ZEEK_AGENT_DEBUG("table", "activating table {}", name());
+void Table::sqliteTrackStatement(const void* stmt, std::vector<table::Constraint> constraints) {
+    ZEEK_AGENT_DEBUG("table", "table {} tracking statement with constraints [{}]", name(),
+                     join(transform(constraints, [](const auto& c) { return table::to_string(c); }), ", "));
 
-        if ( ! _use_mock_data )
-            activate();
+    _statements.emplace(stmt, std::move(constraints));
+
+    if ( _use_mock_data )
+        return;
+
+    if ( _statements.size() == 1 ) {
+        ZEEK_AGENT_DEBUG("table", "activating table {}", name());
+        activate();
     }
+    else
+        queriesChanged();
 }
 
-void Table::sqliteUntrackStatement() {
-    assert(_current_connections > 0);
-    if ( --_current_connections == 0 ) {
-        ZEEK_AGENT_DEBUG("table", "deactivating table {}", name());
+void Table::sqliteUntrackStatement(const void* stmt) {
+    assert(_statements.find(stmt) != _statements.end());
+    _statements.erase(stmt);
 
-        if ( ! _use_mock_data )
-            deactivate();
+    if ( _use_mock_data )
+        return;
+
+    if ( _statements.empty() ) {
+        ZEEK_AGENT_DEBUG("table", "deactivating table {}", name());
+        deactivate();
     }
+    else
+        queriesChanged();
+}
+
+std::vector<std::vector<table::Constraint>> Table::activeConstraints() const {
+    std::vector<std::vector<table::Constraint>> result;
+    result.reserve(_statements.size());
+
+    for ( const auto& [_, constraints] : _statements )
+        result.push_back(constraints);
+
+    return result;
 }
 
 std::vector<std::vector<Value>> SnapshotTable::rows(Time t, const std::vector<table::Argument>& args) {
@@ -398,6 +993,17 @@ void EventTable::newEvent(std::vector<Value> row) {
     _events.emplace_back(Event{.time = currentTime(), .row = std::move(row)});
 }
 
+void EventTable::newEvents(std::vector<std::vector<Value>> rows) {
+    if ( rows.empty() )
+        return;
+
+    const std::scoped_lock lock(_events_mutex);
+    auto t = currentTime();
+
+    for ( auto& row : rows )
+        _events.emplace_back(Event{.time = t, .row = std::move(row)});
+}
+
 void EventTable::newEvent(Time t, std::vector<Value> row) {
     const std::scoped_lock lock(_events_mutex);
 
@@ -447,6 +1053,12 @@ std::pair<Value, value::Type> zeek::agent::stringToValue(const std::string& str,
             case value::Type::Count:
             case value::Type::Integer: return {static_cast<int64_t>(std::stol(str)), type};
             case value::Type::Double: return {std::stod(str), type};
+            case value::Type::Address: {
+                if ( auto a = Address::fromString(str) )
+                    return {*a, type};
+
+                return {std::monostate(), value::Type::Null};
+            }
             default:
                 throw table::PermanentContentError(
                     frmt("unsupport colum type for `files_columns`: {}", to_string(type)));
@@ -463,7 +1075,7 @@ TEST_SUITE("Table") {
     class TestBaseTable : public Table {
     public:
         TestBaseTable(std::string name) : name(std::move(name)) {}
-        Schema schema() const override {
+        Schema buildSchema() const override {
             return {.name = name, .columns = {schema::Column{.name = "x", .type = value::Type::Integer}}};
         }
 
@@ -474,20 +1086,60 @@ TEST_SUITE("Table") {
 
     TEST_CASE("activation") {
         TestBaseTable t("T");
-        t.sqliteTrackStatement();
+        int s1, s2;
+        t.sqliteTrackStatement(&s1);
         CHECK(t.isActive());
-        t.sqliteTrackStatement();
+        t.sqliteTrackStatement(&s2);
         CHECK(t.isActive());
-        t.sqliteUntrackStatement();
+        t.sqliteUntrackStatement(&s1);
         CHECK(t.isActive());
-        t.sqliteUntrackStatement();
+        t.sqliteUntrackStatement(&s2);
         CHECK(! t.isActive());
     }
 
+    TEST_CASE("Schema") {
+        class TestTable : public TestBaseTable {
+        public:
+            TestTable() : TestBaseTable("T") {}
+
+            Schema buildSchema() const override {
+                ++calls;
+                return {.name = name,
+                        .columns = {
+                            {.name = "x", .type = value::Type::Integer},
+                            {.name = "_a", .type = value::Type::Text, .is_parameter = true},
+                            {.name = "y", .type = value::Type::Text},
+                            {.name = "_b", .type = value::Type::Count, .is_parameter = true},
+                        }};
+            }
+
+            mutable int calls = 0;
+        };
+
+        TestTable t;
+        const auto& schema = t.schema();
+        CHECK_EQ(&t.schema(), &schema);
+        CHECK_EQ(schema.name, "T");
+        CHECK_EQ(t.calls, 1);
+
+        CHECK_EQ(schema.parameter_indices, std::vector<size_t>{1, 3});
+        CHECK_EQ(schema.columnIndex("y"), 2);
+        CHECK_EQ(schema.columnIndex("_b"), 3);
+        CHECK(! schema.columnIndex("z"));
+        REQUIRE(schema.column("_a"));
+        CHECK_EQ(schema.column("_a")->type, value::Type::Text);
+
+        // Not indexed.
+        auto copy = t.buildSchema();
+        CHECK(copy.column_indices.empty());
+        CHECK_EQ(copy.columnIndex("y"), 2);
+        CHECK(! copy.column("z"));
+    }
+
     TEST_CASE("SnapshotTable") {
         class TestTable : public SnapshotTable {
         public:
-            Schema schema() const override {
+            Schema buildSchema() const override {
                 return {.name = "test_table", .columns = {schema::Column{.name = "x", .type = value::Type::Integer}}};
             }
 
@@ -528,7 +1180,7 @@ TEST_SUITE("Table") {
     TEST_CASE("EventTable") {
         class TestTable : public EventTable {
         public:
-            Schema schema() const override {
+            Schema buildSchema() const override {
                 return {.name = "test_table", .columns = {schema::Column{.name = "x", .type = value::Type::Integer}}};
             }
 
@@ -590,7 +1242,7 @@ TEST_SUITE("Table") {
 
     TEST_CASE("Record serialization") {
         Record v = {
-            {"1.2.3.4", value::Type::Address},
+            {"1.2.3.4"_addr, value::Type::Address},
             {"BLOB", value::Type::Blob},
             {true, value::Type::Bool},
             {42L, value::Type::Count},
@@ -615,4 +1267,349 @@ TEST_SUITE("Table") {
                  "[1, false], {1, "
                  "2, 4, 5}, [true, false, true]]");
     }
+
+    TEST_CASE("Containers") {
+        Record r1;
+        CHECK(r1.empty());
+        r1.emplace_back(1L, value::Type::Count);
+
+        auto r2 = r1;
+        r2.emplace_back("x", value::Type::Text);
+        r2.insert(r2.begin(), {true, value::Type::Bool});
+        CHECK_EQ(r1, Record{{1L, value::Type::Count}});
+        CHECK_EQ(r2, Record{{true, value::Type::Bool}, {1L, value::Type::Count}, {"x", value::Type::Text}});
+
+        Set s1(value::Type::Count, {1L, 2L});
+        auto s2 = s1;
+        s2.insert(3L);
+        CHECK_EQ(s1.size(), 2U);
+        CHECK_EQ(s2.count(3L), 1U);
+        CHECK_EQ(s1.count(3L), 0U);
+        CHECK_LT(Value(s1), Value(s2));
+
+        Vector v1(value::Type::Count, {1L});
+        auto v2 = v1;
+        v2.push_back(2L);
+        CHECK_EQ(v1, Vector(value::Type::Count, {1L}));
+        CHECK_EQ(v2, Vector(value::Type::Count, {1L, 2L}));
+    }
+
+    TEST_CASE("Value comparison") {
+        std::vector<Value> values = {{},
+                                     false,
+                                     true,
+                                     -1.5,
+                                     3.14,
+                                     -42L,
+                                     42L,
+                                     "",
+                                     "abc",
+                                     InternedString("abc"),
+                                     InternedString("abcd"),
+                                     "abd",
+                                     10s,
+                                     Port(80, port::Protocol::TCP),
+                                     Port(80, port::Protocol::UDP),
+                                     "1.2.3.4"_addr,
+                                     "::1"_addr,
+                                     10_time,
+                                     Record{{1L, value::Type::Count}},
+                                     Set(value::Type::Count, {1L}),
+                                     Vector(value::Type::Count, {1L, 2L})};
+
+        for ( const auto& a : values ) {
+            for ( const auto& b : values ) {
+                auto c = value::compare(a, b);
+                CHECK_EQ(c < 0, a < b);
+                CHECK_EQ(c == 0, a == b);
+                CHECK_EQ(c > 0, b < a);
+            }
+        }
+
+        // Interned and regular strings compare by content.
+        CHECK_EQ(Value(InternedString("abc")), Value("abc"));
+        CHECK_LT(Value("abb"), Value(InternedString("abc")));
+        CHECK_LT(Value(InternedString("abc")), Value("abd"));
+        CHECK_EQ(std::set<Value>{"abc", InternedString("abc"), InternedString("xyz")}.size(), 2U);
+        CHECK_EQ(to_string(Value(InternedString("abc"))), "abc");
+        CHECK_EQ(to_binary_string(InternedString("abc"), value::Type::Text),
+                 to_binary_string("abc", value::Type::Text));
+
+        CHECK(ValueVectorCompare({1L, "a"}, {1L, "b"}));
+        CHECK_FALSE(ValueVectorCompare({1L, "b"}, {1L, "a"}));
+        CHECK_FALSE(ValueVectorCompare({1L, "a"}, {1L, "a"}));
+        CHECK(ValueVectorCompare({2L}, {1L, "a"}));
+    }
+
+    TEST_CASE("Address") {
+        auto v4 = "192.168.1.2"_addr;
+        CHECK(v4.isIPv4());
+        CHECK_EQ(to_string(v4), "192.168.1.2");
+        CHECK_EQ(v4, Address::fromString("::ffff:192.168.1.2"));
+
+        auto v6 = "2001:DB8::1"_addr;
+        CHECK_FALSE(v6.isIPv4());
+        CHECK_EQ(to_string(v6), "2001:db8::1");
+        CHECK_LT(v4, v6);
+
+        uint8_t raw[4] = {10, 1, 2, 3};
+        CHECK_EQ(Address::fromIPv4(raw), "10.1.2.3"_addr);
+
+        CHECK_FALSE(Address::fromString(""));
+        CHECK_FALSE(Address::fromString("1.2.3"));
+        CHECK_FALSE(Address::fromString("foo"));
+        CHECK_FALSE(Address::fromString("1.2.3.4/8"));
+
+        auto net = address::Subnet::fromString("10.1.0.0/16");
+        REQUIRE(net);
+        CHECK(net->contains("10.1.255.3"_addr));
+        CHECK_FALSE(net->contains("10.2.0.1"_addr));
+        CHECK_FALSE(net->contains("::a01:1"_addr));
+
+        net = address::Subnet::fromString("172.16.99.1/12"); // host bits get cleared
+        REQUIRE(net);
+        CHECK(net->contains("172.31.0.1"_addr));
+        CHECK_FALSE(net->contains("172.32.0.1"_addr));
+
+        net = address::Subnet::fromString("2001:db8::/33");
+        REQUIRE(net);
+        CHECK(net->contains("2001:db8:7fff::1"_addr));
+        CHECK_FALSE(net->contains("2001:db8:8000::1"_addr));
+
+        net = address::Subnet::fromString("0.0.0.0/0");
+        REQUIRE(net);
+        CHECK(net->contains("8.8.8.8"_addr));
+        CHECK_FALSE(net->contains("::1"_addr));
+
+        net = address::Subnet::fromString("::/0");
+        REQUIRE(net);
+        CHECK(net->contains("::1"_addr));
+        CHECK_FALSE(net->contains("10.0.0.1"_addr));
+
+        net = address::Subnet::fromString("::ffff:0:0/96");
+        REQUIRE(net);
+        CHECK(net->contains("10.0.0.1"_addr));
+        CHECK_FALSE(net->contains("::1"_addr));
+
+        CHECK_FALSE(address::Subnet::fromString("10.0.0.0"));
+        CHECK_FALSE(address::Subnet::fromString("10.0.0.0/33"));
+        CHECK_FALSE(address::Subnet::fromString("10.0.0.0/"));
+        CHECK_FALSE(address::Subnet::fromString("10.0.0.0/-1"));
+        CHECK_FALSE(address::Subnet::fromString("::/129"));
+
+        CHECK(address::isPrivate("10.0.0.1"_addr));
+        CHECK(address::isPrivate("172.20.1.1"_addr));
+        CHECK(address::isPrivate("127.0.0.1"_addr));
+        CHECK(address::isPrivate("fd00::1"_addr));
+        CHECK(address::isPrivate("::1"_addr));
+        CHECK_FALSE(address::isPrivate("8.8.8.8"_addr));
+        CHECK_FALSE(address::isPrivate("2001:db8::1"_addr));
+    }
+
+    TEST_CASE("Binary serialization") {
+        Record v = {
+            {"1.2.3.4"_addr, value::Type::Address},
+            {"BLOB", value::Type::Blob},
+            {true, value::Type::Bool},
+            {42L, value::Type::Count},
+            {3.14, value::Type::Double},
+            {"FooBar::XYZ", value::Type::Enum},
+            {-42L, value::Type::Integer},
+            {10s, value::Type::Interval},
+            {Port(43L, port::Protocol::TCP), value::Type::Port},
+            {{}, value::Type::Null},
+            {{}, value::Type::Text},
+            {"TEXT", value::Type::Text},
+            {10_time, value::Type::Time},
+            {Record{{1L, value::Type::Count}, {false, value::Type::Bool}}, value::Type::Record},
+            {Set{value::Type::Count, {1L, 2L, 4L, 5L}}, value::Type::Set},
+            {Vector{value::Type::Bool, {true, false, true}}, value::Type::Vector},
+            {Vector{value::Type::Text}, value::Type::Vector},
+        };
+
+        auto x = to_binary_string(Value{v}, value::Type::Record);
+        auto y = from_binary_string(x, value::Type::Record);
+        REQUIRE(y);
+        CHECK_EQ(y->first, Value(v));
+        CHECK_EQ(y->second, value::Type::Record);
+        CHECK_LT(x.size(), to_json_string(Value{v}, value::Type::Record).size());
+
+        for ( auto i : {0L, 1L, -1L, 63L, -64L, 64L, std::numeric_limits<int64_t>::max(),
+                        std::numeric_limits<int64_t>::min()} ) {
+            auto z = from_binary_string(to_binary_string(i, value::Type::Integer));
+            REQUIRE(z);
+            CHECK_EQ(z->first, Value(i));
+        }
+
+        CHECK_EQ(to_binary_string(Port(80L, port::Protocol::UDP), value::Type::Port).size(), 4);
+        CHECK(! from_binary_string(x, value::Type::Set));
+        CHECK(! from_binary_string(x.substr(0, x.size() - 1)));
+        CHECK(! from_binary_string(x + "X"));
+        CHECK(! from_binary_string(""));
+        CHECK(! from_binary_string(std::string("\x0a\xff\xff\xff\xff\x0f", 6))); // huge record size
+        CHECK(! from_binary_string(std::string("\x7f", 1)));                         // unknown type
+        CHECK(! from_binary_string(std::string(100, '\x0a')));                         // nested too deeply
+    }
+
+    TEST_CASE("RowBuilder") {
+        using Row = RowBuilder<value::Type::Text, value::Type::Count, value::Type::Bool, value::Type::Text,
+                               value::Type::Interval>;
+
+        static_assert(Row::Size == 5);
+        static_assert(Row::ColumnTypes[1] == value::Type::Count);
+
+        Row row;
+        row.set<0>("foo");
+        row.set<1>(42U);
+        row.set<2>(true);
+        row.set<3>(static_cast<const char*>(nullptr));
+        row.set<4>(std::optional<Interval>());
+
+        CHECK_EQ(row.take(), std::vector<Value>{"foo", 42L, true, {}, {}});
+        CHECK_EQ(row.take(), std::vector<Value>(5));
+
+        row.set<0>(InternedString("bar"));
+        row.set<1>(std::optional<int64_t>(1));
+        row.set<4>(std::chrono::seconds(10));
+        CHECK_EQ(row.take(), std::vector<Value>{"bar", 1L, {}, {}, Interval(std::chrono::seconds(10))});
+
+        Schema schema = {.name = "test",
+                         .columns = {
+                             {.name = "a", .type = value::Type::Text},
+                             {.name = "b", .type = value::Type::Count},
+                             {.name = "c", .type = value::Type::Bool},
+                             {.name = "d", .type = value::Type::Text},
+                             {.name = "e", .type = value::Type::Interval},
+                         }};
+
+        CHECK(! schema.typed_rows);
+        CHECK(Row::schema(schema).typed_rows);
+
+        schema.columns[1].type = value::Type::Integer;
+        CHECK_THROWS_AS(Row::schema(schema), InternalError);
+
+        schema.columns.pop_back();
+        CHECK_THROWS_AS(Row::schema(schema), InternalError);
+    }
+}
+
+// Returns synthetic rows for benchmarks, the same each time for a given seed.
+static std::vector<std::vector<Value>> benchmarkRows(size_t n, unsigned int seed) {
+    std::mt19937 rng(seed);
+    std::vector<std::vector<Value>> rows;
+    rows.reserve(n);
+
+    for ( size_t i = 0; i < n; i++ ) {
+        auto x = rng();
+        rows.push_back({static_cast<int64_t>(x % 1000), frmt("process-{}", x % 100), static_cast<bool>(x & 1),
+                        value::fromAddressString(frmt("10.0.{}.{}", (x >> 8) % 256, x % 256)),
+                        to_time(1700000000 + x % 86400), Port(static_cast<int64_t>(x % 65536), port::Protocol::TCP)});
+    }
+
+    return rows;
+}
+
+ZEEK_AGENT_BENCHMARK("value/construct") {
+    std::mt19937 rng(42);
+    std::vector<uint32_t> seeds(1000);
+    std::generate(seeds.begin(), seeds.end(), rng);
+    auto addr = "192.168.1.1"_addr;
+    state.setItemsPerIteration(static_cast<int64_t>(seeds.size()));
+
+    while ( state.keepRunning() ) {
+        for ( auto x : seeds ) {
+            std::vector<Value> row = {static_cast<int64_t>(x),
+                                      std::string("ESTABLISHED"),
+                                      static_cast<bool>(x & 1),
+                                      addr,
+                                      to_time(x),
+                                      Set(value::Type::Count, {static_cast<int64_t>(x), 1L, 2L})};
+            benchmark::doNotOptimize(row);
+        }
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("value/compare") {
+    auto rows = benchmarkRows(1000, 42);
+    state.setItemsPerIteration(static_cast<int64_t>(rows.size() * rows[0].size()));
+
+    while ( state.keepRunning() ) {
+        int64_t less = 0;
+        for ( size_t i = 1; i < rows.size(); i++ ) {
+            for ( size_t j = 0; j < rows[i].size(); j++ )
+                less += (value::compare(rows[i - 1][j], rows[i][j]) < 0);
+        }
+
+        benchmark::doNotOptimize(less);
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("value/sort-rows") {
+    auto rows = benchmarkRows(10000, 42);
+    state.setItemsPerIteration(static_cast<int64_t>(rows.size()));
+
+    while ( state.keepRunning() ) {
+        state.pause();
+        auto copy = rows;
+        state.resume();
+
+        std::sort(copy.begin(), copy.end(), ValueVectorCompare);
+        benchmark::doNotOptimize(copy);
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("value/json") {
+    std::vector<Value> records;
+    for ( const auto& row : benchmarkRows(1000, 42) )
+        records.emplace_back(Record{{row[0], value::Type::Count},
+                                    {row[1], value::Type::Text},
+                                    {row[2], value::Type::Bool},
+                                    {row[3], value::Type::Address},
+                                    {row[4], value::Type::Time},
+                                    {row[5], value::Type::Port}});
+
+    state.setItemsPerIteration(static_cast<int64_t>(records.size()));
+
+    while ( state.keepRunning() ) {
+        for ( const auto& r : records ) {
+            auto x = from_json_string(to_json_string(r, value::Type::Record), value::Type::Record);
+            benchmark::doNotOptimize(x);
+        }
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("EventTable/ingest-expire") {
+    class BenchmarkTable : public EventTable {
+    public:
+        Schema buildSchema() const override {
+            return {.name = "benchmark_table",
+                    .columns = {{.name = "a", .type = value::Type::Count},
+                                {.name = "b", .type = value::Type::Text},
+                                {.name = "c", .type = value::Type::Bool},
+                                {.name = "d", .type = value::Type::Address},
+                                {.name = "e", .type = value::Type::Time},
+                                {.name = "f", .type = value::Type::Port}}};
+        }
+
+        using EventTable::newEvent;
+    };
+
+    auto rows = benchmarkRows(10000, 42);
+    state.setItemsPerIteration(static_cast<int64_t>(rows.size()));
+
+    while ( state.keepRunning() ) {
+        state.pause();
+        auto events = rows;
+        BenchmarkTable t;
+        state.resume();
+
+        uint64_t n = 0;
+        for ( auto& row : events )
+            t.newEvent(to_time(++n), std::move(row));
+
+        t.expire(to_time(n / 2));
+        auto remaining = t.rows(0_time, {});
+        t.expire(to_time(n + 1));
+        benchmark::doNotOptimize(remaining);
+    }
 }
@@ -4,13 +4,22 @@
 
 #include "configuration.h"
 #include "scheduler.h"
+#include "util/intern.h"
 #include "util/variant.h"
 
+#include <array>
+#include <cstring>
 #include <functional>
+#include <initializer_list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -22,25 +31,33 @@ namespace value {
  * Captures the type of a value inside a row of a table. The type defines what's stored in the `Value` variant, as
  * follows:
  *
- *      `Address` -> `string`
- *      `Blob` -> `string`
+ *      `Address` -> `value::Address`
+ *      `Blob` -> `string` or `InternedString`
  *      `Bool` -> `int64_t`
  *      `Count` -> `int64_t`
  *      `Double` -> `double`
- *      `Enum` -> `string`
+ *      `Enum` -> `string` or `InternedString`
  *      `Integer` -> `int64_t`
  *      `Interval` -> `Interval`
  *      `Null` -> `std::monostate`
  *      `Port` -> `value::Port`
  *      `Record` -> `value::Record`
  *      `Set` -> `value::Set`
- *      `Text` -> `string`
+ *      `Text` -> `string` or `InternedString`
  *      `Time` -> `Time`
  *      `Vector` -> `value::Vector`
  *
  * Behind the scenes, types that don't directly map into an SQLite type gets
- * serialized into a JSON represetnation for storage. Note that doing so makes
- * it difficult (or even impossible) to use SQL operators on them.
+ * serialized into a compact binary represetnation for storage (see
+ * `to_binary_string()`). Note that doing so makes it difficult to use SQL
+ * operators on them directly; the SQL functions `port_num()`,
+ * `record_get()`, and `set_contains()` provide access to their content.
+ * Addresses are an exception: they go to SQLite as text so that comparisons
+ * keep working, with `cidr_match()` and `is_private()` operating on them.
+ *
+ * Tables may store strings as `InternedString` if the same values keep
+ * repeating across rows. Values compare the same either way (see
+ * `value::compare()`).
  */
 enum class Type {
     Address,
@@ -70,6 +87,7 @@ Result<value::Type> from_string(const std::string& type);
 }
 
 struct Port;
+struct Address;
 struct Record;
 struct Set;
 struct Vector;
@@ -79,8 +97,8 @@ struct Vector;
  * corresponds to an unset (null) value. See `Type` for how value types map to
  * what's stored in the variant here.
  */
-using Value =
-    BetterVariant<std::monostate, bool, double, int64_t, std::string, Interval, Port, Time, Record, Set, Vector>;
+using Value = BetterVariant<std::monostate, bool, double, int64_t, std::string, InternedString, Interval, Port, Address,
+                            Time, Record, Set, Vector>;
 
 namespace port {
 enum class Protocol { ICMP = 1, TCP = 6, UDP = 17, Unknown = 0 };
@@ -90,10 +108,11 @@ enum class Protocol { ICMP = 1, TCP = 6, UDP = 17, Unknown = 0 };
  * Represents a port, including its protocol.
  *
  * Note that because we can't map a port to a natural SQLite type, we serialize
- * it into a JSON tuple for storage. That means one cannot easily use it in SQL
- * expressions, which can make using this type questionable (say, if you wanted
- * to do `... WHERE port < 1024`). The alternative is to just use an integer
- * and store the protocol informaton separately.
+ * it into a binary blob for storage. That means one cannot directly use it in
+ * SQL expressions; instead, the SQL function `port_num()` needs to extract
+ * the number first (say, if you wanted to do `... WHERE port_num(port) <
+ * 1024`). The alternative is to just use an integer and store the protocol
+ * informaton separately.
  */
 struct Port {
     Port(int64_t port, port::Protocol proto) : port(port), protocol(proto) {}
@@ -122,9 +141,177 @@ extern std::string to_string(const Port& v);
 /** Returns a JSON represenation of the value. */
 extern std::string Xto_json(const Port& v);
 
+/**
+ * Represents an IPv4 or IPv6 address. We always store the 16 bytes of an
+ * IPv6 address in network byte order, with IPv4 addresses mapped into IPv6
+ * space (i.e., `::ffff:a.b.c.d`). That keeps the type compact and turns
+ * comparisons into a `memcmp()`.
+ */
+struct Address {
+    Address() = default;
+
+    /** Instantiates an IPv4 address from its 4 bytes in network byte order (e.g., from an `in_addr`). */
+    static Address fromIPv4(const void* data);
+
+    /** Instantiates an IPv6 address from its 16 bytes in network byte order (e.g., from an `in6_addr`). */
+    static Address fromIPv6(const void* data);
+
+    /** Parses an address from its textual representation, returning unset if it's not valid. */
+    static std::optional<Address> fromString(std::string_view s);
+
+    /** Returns true if this is an IPv4 address. */
+    bool isIPv4() const { return memcmp(bytes.data(), V4MappedPrefix, sizeof(V4MappedPrefix)) == 0; }
+
+    std::array<uint8_t, 16> bytes{}; /**< address in network byte order */
+
+    bool operator<(const Address& other) const { return bytes < other.bytes; }
+    bool operator==(const Address& other) const { return bytes == other.bytes; }
+    bool operator!=(const Address& other) const { return bytes != other.bytes; }
+
+    /** Prefix of IPv6 addresses that hold an IPv4 address. */
+    static constexpr uint8_t V4MappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+};
+
+/** Returns a human-readable represenation of the value. */
+extern std::string to_string(const Address& v);
+
+/**
+ * Instantiates an address from a string literal. This is primarily meant for
+ * constants and tests; it throws an `InternalError` if the address isn't
+ * valid.
+ */
+inline Address operator"" _addr(const char* s, size_t n) {
+    if ( auto a = Address::fromString(std::string_view(s, n)) )
+        return *a;
+
+    throw InternalError(std::string("invalid address literal: ") + s);
+}
+
+namespace address {
+
+/** Represents a range of addresses in CIDR notation, such as `10.0.0.0/8`. */
+struct Subnet {
+    Address prefix; /**< first address of the subnet, with all bits past the prefix cleared */
+    int length = 0; /**< prefix length, in bits of the 128-bit IPv6 space */
+
+    /**
+     * Parses a subnet in CIDR notation. For IPv4 subnets, the length refers
+     * to IPv4's 32 bits. Returns unset if the subnet isn't valid.
+     */
+    static std::optional<Subnet> fromString(std::string_view s);
+
+    /**
+     * Returns true if the subnet contains an address. Address families
+     * don't mix: IPv4 addresses match only IPv4 subnets, or IPv6 subnets
+     * within the IPv4-mapped range `::ffff:0:0/96`. Shorter IPv6 prefixes,
+     * such as `::/0`, don't contain any IPv4 addresses.
+     */
+    bool contains(const Address& a) const;
+};
+
+/**
+ * Returns true if an address falls into private, loopback, or link-local
+ * space. For IPv4, that's 10.0.0.0/8, 100.64.0.0/10, 127.0.0.0/8,
+ * 169.254.0.0/16, 172.16.0.0/12, and 192.168.0.0/16; for IPv6, it's ::1,
+ * fc00::/7, and fe80::/10.
+ */
+extern bool isPrivate(const Address& a);
+
+} // namespace address
+
+namespace detail {
+
+/**
+ * Storage for the elements of the container values (`Record`, `Set`,
+ * `Vector`). We keep the elements out of line so that the containers don't
+ * inflate the size of every `Value`, most of which are just scalars. Copies
+ * share their elements until one of them gets modified (copy-on-write), which
+ * makes copying rows cheap. Equality and ordering follow the underlying
+ * container, with a shortcut for instances sharing their elements.
+ *
+ * Reading works as with the container itself, except that iterators are
+ * always constant. Modifications go through the methods forwarding to the
+ * container, or through `modify()`.
+ */
+template<typename Container>
+class CopyOnWrite {
+public:
+    using container_type = Container;                             /**< underlying container */
+    using value_type = typename Container::value_type;            /**< element type */
+    using size_type = typename Container::size_type;              /**< type for sizes and indices */
+    using const_iterator = typename Container::const_iterator;    /**< iterator type */
+    using iterator = typename Container::const_iterator;          /**< iterator type, constant as well */
+    using const_reference = typename Container::const_reference; /**< reference to element */
+
+    CopyOnWrite() = default;
+    CopyOnWrite(Container elements) {
+        if ( ! elements.empty() )
+            _elements = std::make_shared<Container>(std::move(elements));
+    }
+    CopyOnWrite(std::initializer_list<value_type> elements) : CopyOnWrite(Container(elements)) {}
+
+    /** Returns the underlying container for reading. */
+    const Container& elements() const { return _elements ? *_elements : emptyElements(); }
+    operator const Container&() const { return elements(); }
+
+    /**
+     * Returns the underlying container for modification. If the elements
+     * are currently shared with other instances, this makes a private copy
+     * first.
+     */
+    Container& modify() {
+        if ( ! _elements )
+            _elements = std::make_shared<Container>();
+        else if ( _elements.use_count() > 1 )
+            _elements = std::make_shared<Container>(*_elements);
+
+        return *_elements;
+    }
+
+    const_iterator begin() const { return elements().begin(); }
+    const_iterator end() const { return elements().end(); }
+    size_type size() const { return _elements ? _elements->size() : 0; }
+    bool empty() const { return ! _elements || _elements->empty(); }
+    const_reference operator[](size_type i) const { return elements()[i]; }
+    size_type count(const value_type& v) const { return elements().count(v); }
+
+    void clear() { _elements.reset(); }
+    void reserve(size_type n) { modify().reserve(n); }
+    void push_back(value_type v) { modify().push_back(std::move(v)); }
+    void insert(value_type v) { modify().insert(std::move(v)); }
+    void insert(const_iterator pos, value_type v) {
+        auto offset = pos - begin();
+        auto& elements = modify();
+        elements.insert(elements.begin() + offset, std::move(v));
+    }
+
+    template<typename... Args>
+    void emplace_back(Args&&... args) {
+        modify().emplace_back(std::forward<Args>(args)...);
+    }
+
+    bool operator==(const CopyOnWrite& other) const {
+        return _elements == other._elements || elements() == other.elements();
+    }
+    bool operator!=(const CopyOnWrite& other) const { return ! (*this == other); }
+    bool operator<(const CopyOnWrite& other) const {
+        return _elements != other._elements && elements() < other.elements();
+    }
+
+private:
+    static const Container& emptyElements() {
+        static const Container empty;
+        return empty;
+    }
+
+    std::shared_ptr<Container> _elements; // null if empty
+};
+
+} // namespace detail
+
 /** Represents a record (struct) of values. */
-struct Record : public std::vector<std::pair<Value, value::Type>> {
-    using std::vector<std::pair<Value, value::Type>>::vector;
+struct Record : public detail::CopyOnWrite<std::vector<std::pair<Value, value::Type>>> {
+    using detail::CopyOnWrite<std::vector<std::pair<Value, value::Type>>>::CopyOnWrite;
 };
 
 /** Returns a human-readable represenation of the value. */
@@ -134,8 +321,8 @@ extern std::string to_string(const Record& v);
 extern std::string Xto_json(const Record& v);
 
 /** Represents a set of values. */
-struct Set : public std::set<Value> {
-    Set(value::Type type, std::set<Value> values = {}) : std::set<Value>(std::move(values)), type(type) {}
+struct Set : public detail::CopyOnWrite<std::set<Value>> {
+    Set(value::Type type, std::set<Value> values = {}) : CopyOnWrite(std::move(values)), type(type) {}
 
     value::Type type; /**< Type of the values. */
 };
@@ -146,9 +333,9 @@ extern std::string to_string(const Set& v);
 /** Returns a JSON represenation of the value. */
 extern std::string Xto_json(const Set& v);
 
-/** Represents a set of values. */
-struct Vector : public std::vector<Value> {
-    Vector(value::Type type, std::vector<Value> values = {}) : std::vector<Value>(std::move(values)), type(type) {}
+/** Represents a vector of values. */
+struct Vector : public detail::CopyOnWrite<std::vector<Value>> {
+    Vector(value::Type type, std::vector<Value> values = {}) : CopyOnWrite(std::move(values)), type(type) {}
 
     value::Type type; /**< Type of the values. */
 };
@@ -156,16 +343,122 @@ struct Vector : public std::vector<Value> {
 /** Returns a human-readable represenation of the value. */
 extern std::string to_string(const Vector& v);
 
+// We store a lot of values, so make sure they remain compact; the largest
+// alternative is `std::string`.
+static_assert(sizeof(Value) <= sizeof(std::string) + sizeof(void*));
+
 /** Returns a JSON represenation of the value. */
 extern std::string Xto_json(const Vector& v);
 
 namespace value {
 
+/**
+ * Returns the string stored in a value of type `Text`, `Blob`, or `Enum`,
+ * regardless of whether it's interned. Returns null if the value doesn't
+ * hold a string.
+ */
+inline const std::string* text(const Value& v) {
+    if ( auto x = std::get_if<std::string>(&static_cast<const Value::Base&>(v)) )
+        return x;
+
+    if ( auto x = std::get_if<InternedString>(&static_cast<const Value::Base&>(v)) )
+        return &x->str();
+
+    return nullptr;
+}
+
+/**
+ * Compares two values, returning a negative number, zero, or a positive
+ * number if the first is less than, equal to, or greater than the second.
+ * Values holding different types order by the variant's index, except that
+ * strings compare by content whether they are interned or not. This is what
+ * `Value`'s comparison operators use as well, but calling it directly needs
+ * only a single comparison of the underlying data where the operators would
+ * need two (e.g., `!=` then `<`).
+ */
+inline int compare(const Value& a, const Value& b) {
+    if ( a.index() != b.index() ) {
+        if ( auto x = text(a) ) {
+            if ( auto y = text(b) )
+                return x->compare(*y);
+        }
+
+        return a.index() < b.index() ? -1 : 1;
+    }
+
+    return std::visit(
+        [&b](const auto& x) -> int {
+            using T = std::decay_t<decltype(x)>;
+            const auto& y = *std::get_if<T>(&static_cast<const Value::Base&>(b));
+
+            if constexpr ( std::is_same_v<T, std::monostate> )
+                return 0;
+            else if constexpr ( std::is_same_v<T, std::string> )
+                return x.compare(y);
+            else if constexpr ( std::is_same_v<T, InternedString> )
+                return x == y ? 0 : x.str().compare(y.str());
+            else if constexpr ( std::is_same_v<T, Address> )
+                return memcmp(x.bytes.data(), y.bytes.data(), x.bytes.size());
+            else
+                return x < y ? -1 : (y < x ? 1 : 0);
+        },
+        static_cast<const Value::Base&>(a));
+}
+
 /** Instantiates a `Value` from a C string. */
 inline Value fromOptionalString(const char* s) { return s ? s : Value(); }
 
+/** Instantiates a `Value` from an address's textual representation, leaving it unset if that's not valid. */
+inline Value fromAddressString(std::string_view s) {
+    if ( auto a = Address::fromString(s) )
+        return *a;
+
+    return {};
+}
+
+/**
+ * Maps a column type to the C++ type that `Value` stores for it, as
+ * `Storage<T>::type`. For string types, that's `std::string`, although values
+ * may use `InternedString` as well.
+ */
+template<Type T>
+struct Storage;
+
+// clang-format off
+template<> struct Storage<Type::Address> { using type = Address; };
+template<> struct Storage<Type::Blob> { using type = std::string; };
+template<> struct Storage<Type::Bool> { using type = bool; };
+template<> struct Storage<Type::Count> { using type = int64_t; };
+template<> struct Storage<Type::Double> { using type = double; };
+template<> struct Storage<Type::Enum> { using type = std::string; };
+template<> struct Storage<Type::Integer> { using type = int64_t; };
+template<> struct Storage<Type::Interval> { using type = Interval; };
+template<> struct Storage<Type::Null> { using type = std::monostate; };
+template<> struct Storage<Type::Port> { using type = Port; };
+template<> struct Storage<Type::Record> { using type = Record; };
+template<> struct Storage<Type::Set> { using type = Set; };
+template<> struct Storage<Type::Text> { using type = std::string; };
+template<> struct Storage<Type::Time> { using type = Time; };
+template<> struct Storage<Type::Vector> { using type = Vector; };
+// clang-format on
+
 } // namespace value
 
+// Comparison operators for values, overriding those of `std::variant` so that
+// strings compare the same whether they're interned or not.
+inline bool operator==(const Value& a, const Value& b) {
+    if ( a.index() == b.index() )
+        return static_cast<const Value::Base&>(a) == static_cast<const Value::Base&>(b);
+
+    return value::compare(a, b) == 0;
+}
+
+inline bool operator!=(const Value& a, const Value& b) { return ! (a == b); }
+inline bool operator<(const Value& a, const Value& b) { return value::compare(a, b) < 0; }
+inline bool operator>(const Value& a, const Value& b) { return value::compare(a, b) > 0; }
+inline bool operator<=(const Value& a, const Value& b) { return value::compare(a, b) <= 0; }
+inline bool operator>=(const Value& a, const Value& b) { return value::compare(a, b) >= 0; }
+
 /** Renders a value into a string representation for display. */
 extern std::string to_string(const Value& value);
 
@@ -178,6 +471,35 @@ extern std::string to_json_string(const Value& value, value::Type type);
 /** Restores a value from its JSON representation. */
 extern Value from_json_string(const std::string_view& data, value::Type t);
 
+/**
+ * Renders a value into a compact binary representation. This is what we
+ * use for passing values through SQLite that don't map to any of its native
+ * types. The encoding is self-describing: each value starts with a byte
+ * holding its type, followed by its content in a type-specific format.
+ *
+ * @param value value to encode
+ * @param type type of the value
+ * @param out string to append the encoding to
+ */
+extern void to_binary_string(const Value& value, value::Type type, std::string* out);
+
+/** Renders a value into a compact binary representation. See the other version for more. */
+inline std::string to_binary_string(const Value& value, value::Type type) {
+    std::string out;
+    to_binary_string(value, type, &out);
+    return out;
+}
+
+/**
+ * Restores a value from its binary representation.
+ *
+ * @param data binary representation, as returned by `to_binary_string()`
+ * @param type if given, the type the value must have
+ * @return the value along with its type, or an error if the data isn't a valid encoding of the expected type
+ */
+extern Result<std::pair<Value, value::Type>> from_binary_string(std::string_view data,
+                                                                std::optional<value::Type> type = {});
+
 namespace schema {
 
 /** Defines type and further meta-data for one column of a table. */
@@ -216,11 +538,36 @@ struct Schema {
     std::vector<Platform> platforms;     /**< platform that support the table */
     std::vector<schema::Column> columns; /**< the table's columns */
 
+    /**
+     * true if the table builds its rows through a `table::RowBuilder` matching
+     * the columns, so that they are known to be well-typed; set by
+     * `RowBuilder::schema()`, not manually
+     */
+    bool typed_rows = false;
+
+    /** Indices of the parameter columns, in order; set up by `index()`. */
+    std::vector<size_t> parameter_indices = {};
+
+    /** Maps column names to their indices; set up by `index()`. */
+    std::map<std::string, size_t, std::less<>> column_indices = {};
+
+    /**
+     * Precomputes `parameter_indices` and `column_indices` from the columns.
+     * `Table::schema()` does this once for each table's schema.
+     */
+    void index();
+
     /** Helper returning just the parameter columns. */
     std::vector<schema::Column> parameters() const;
 
+    /** Returns the index of a column by name, or null if it doesn't exist. */
+    std::optional<size_t> columnIndex(std::string_view name) const;
+
     /** Returns a column by name, or null if it doesn't exist. */
-    std::optional<schema::Column> column(const std::string_view& name);
+    const schema::Column* column(std::string_view name) const {
+        auto i = columnIndex(name);
+        return i ? &columns[*i] : nullptr;
+    }
 };
 
 /** Renders a table's schema into a string representation for display. */
@@ -237,14 +584,185 @@ struct Argument {
 /** Renders an argument into a string representation for display. */
 extern std::string to_string(const Argument& arg);
 
+/** Comparison operator of a `Constraint`. */
+enum class Operator { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+
+/**
+ * Captures a condition that a query's WHERE clause places on a table column,
+ * by comparing it against a constant. Rows a query will see are guaranteed
+ * to satisfy all of its constraints, but constraints are informational only:
+ * the query engine still filters rows itself.
+ */
+struct Constraint {
+    std::string column; /**< column being constrained */
+    Operator op;        /**< comparison operator, with the column on the left-hand side */
+    Value value;        /**< constant to compare against */
+
+    bool operator==(const Constraint& other) const {
+        return column == other.column && op == other.op && value == other.value;
+    }
+};
+
+/** Renders a constraint into a string representation for display. */
+extern std::string to_string(const Constraint& c);
+
 /** Exception for table implementations to signal an permanent error when retrieving data. */
 class PermanentContentError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+/**
+ * Storage for state that tables derive from a statement's arguments, like
+ * compiled regular expressions. Each prepared statement owns one instance,
+ * so that the state survives across executions of the same statement.
+ * Entries are indexed by the table and the arguments they derive from.
+ *
+ * Tables access this through `Table::statementState()`.
+ */
+class StatementState {
+public:
+    /** Key indexing entries: the table, and a rendering of its arguments. */
+    using Key = std::pair<const void*, std::string>;
+
+    /** Maximum number of entries to keep; once exceeded, all get discarded. */
+    static constexpr size_t MaxEntries = 64;
+
+    /** Returns the entry for a key, or null if none. */
+    std::shared_ptr<void> lookup(const Key& key) const {
+        if ( auto i = _entries.find(key); i != _entries.end() )
+            return i->second;
+        else
+            return nullptr;
+    }
+
+    /** Inserts an entry, replacing any existing one for the same key. */
+    void insert(Key key, std::shared_ptr<void> state) {
+        if ( _entries.size() >= MaxEntries )
+            // Arguments vary between executions, like inside a join.
+            _entries.clear();
+
+        _entries[std::move(key)] = std::move(state);
+    }
+
+    /** Returns the number of entries currently stored. */
+    size_t size() const { return _entries.size(); }
+
+private:
+    std::map<Key, std::shared_ptr<void>> _entries;
+};
+
+/**
+ * Builds rows for a table whose column types are fixed at compile time. A
+ * table declares its column types once, and then sets each row's values by
+ * column index:
+ *
+ *     using Row = table::RowBuilder<value::Type::Text, value::Type::Count>;
+ *
+ *     Schema buildSchema() const override { return Row::schema({ ... }); }
+ *
+ *     Row row;
+ *     row.set<0>(name);
+ *     row.set<1>(gid);
+ *     rows.push_back(row.take());
+ *
+ * Setting a value that doesn't convert to its column's type without narrowing
+ * fails to compile, so there's no need to check the rows' types at runtime.
+ * Values not set remain unset.
+ */
+template<value::Type... Types>
+class RowBuilder {
+public:
+    /** Number of columns. */
+    static constexpr size_t Size = sizeof...(Types);
+
+    /** Types of the columns. */
+    static constexpr std::array<value::Type, Size> ColumnTypes = {Types...};
+
+    RowBuilder() : _row(Size) {}
+
+    /**
+     * Sets the value of a column. Beyond values converting to the column's
+     * storage type (see `value::Storage`), this accepts `InternedString` for
+     * string columns, a null C string for leaving a string column unset, and
+     * a `std::optional` for leaving any column unset.
+     */
+    template<size_t I, typename T>
+    void set(T&& x) {
+        static_assert(I < Size, "column index out of range");
+        using Storage = typename value::Storage<ColumnTypes[I]>::type;
+        using Arg = std::decay_t<T>;
+
+        if constexpr ( isOptional<Arg>::value ) {
+            if ( x )
+                set<I>(*std::forward<T>(x));
+            else
+                unset<I>();
+        }
+        else if constexpr ( std::is_same_v<Storage, std::string> && std::is_same_v<Arg, InternedString> )
+            _row[I] = std::forward<T>(x);
+        else if constexpr ( std::is_same_v<Storage, std::string> &&
+                            (std::is_same_v<Arg, const char*> || std::is_same_v<Arg, char*>) )
+            _row[I] = value::fromOptionalString(x);
+        else {
+            static_assert(isConvertible<Storage, T>::value, "value does not convert to column type without narrowing");
+            _row[I] = Storage{std::forward<T>(x)};
+        }
+    }
+
+    /** Leaves a column unset. */
+    template<size_t I>
+    void unset() {
+        static_assert(I < Size, "column index out of range");
+        _row[I] = Value();
+    }
+
+    /** Returns the row built so far, and resets the builder for the next one. */
+    std::vector<Value> take() {
+        std::vector<Value> row(Size);
+        std::swap(row, _row);
+        return row;
+    }
+
+    /**
+     * Marks a table's schema as using this builder for its rows. Throws an
+     * `InternalError` if the schema's columns don't match the builder's types.
+     */
+    static Schema schema(Schema schema) {
+        if ( schema.columns.size() != Size )
+            throw InternalError(frmt("table {} has {} columns, but its row builder expects {}", schema.name,
+                                     schema.columns.size(), Size));
+
+        for ( size_t i = 0; i < Size; i++ ) {
+            if ( schema.columns[i].type != ColumnTypes[i] )
+                throw InternalError(
+                    frmt("column {} of table {} does not match its row builder", schema.columns[i].name, schema.name));
+        }
+
+        schema.typed_rows = true;
+        return schema;
+    }
+
+private:
+    // Braces reject narrowing conversions.
+    template<typename To, typename From, typename = void>
+    struct isConvertible : std::false_type {};
+
+    template<typename To, typename From>
+    struct isConvertible<To, From, std::void_t<decltype(To{std::declval<From>()})>> : std::true_type {};
+
+    template<typename T>
+    struct isOptional : std::false_type {};
+
+    template<typename T>
+    struct isOptional<std::optional<T>> : std::true_type {};
+
+    std::vector<Value> _row;
+};
+
 } // namespace table
 
 class Database;
+class ThreadPool;
 
 namespace sqlite {
 class PreparedStatement;
@@ -262,7 +780,7 @@ public:
     virtual ~Table();
 
     /** Shortcut to return the table's name, as provided by its schema. */
-    std::string name() const { return schema().name; }
+    const std::string& name() const { return schema().name; }
 
     /**
      * Returns true if the table is currently being used in any
@@ -271,11 +789,19 @@ public:
     bool isActive() const;
 
     /**
-     * Hook to return the table's schema.
+     * Returns the table's schema. It's computed through `buildSchema()` on
+     * first access and then remains the same for the table's lifetime, with
+     * its lookup indices set up.
+     */
+    const Schema& schema() const;
+
+    /**
+     * Hook to return the table's schema. This gets called only once per
+     * table; use `schema()` to access the schema.
      *
      * Must be provided by derived class.
      */
-    virtual Schema schema() const = 0;
+    virtual Schema buildSchema() const = 0;
 
     /**
      * Returns a set of rows representing the table's current data. If a
@@ -339,6 +865,18 @@ public:
      */
     virtual void deactivate() {} // guarnateed to be called at termination if active
 
+    /**
+     * Hook that will be called when a query against this table got added or
+     * removed while the table remains active. Derived classes can use
+     * `activeConstraints()` to get the constraints of the queries now
+     * active, for example to limit data collection to what they need.
+     *
+     * This hook will not be called when mock data has been enabled for the table.
+     *
+     * The default implementation does nothing.
+     */
+    virtual void queriesChanged() {}
+
     /**
      * Hook that will be called in regular, but not further defined, intervals
      * during the agent's main processing loop while the table is active.
@@ -368,14 +906,27 @@ public:
     /**
      * Internal callback from `SQLite` to signal that a new query against this
      * table became active.
+     *
+     * @param stmt opaque identifier for the query's statement
+     * @param constraints constraints that the statement places on the table's columns
      */
-    void sqliteTrackStatement();
+    void sqliteTrackStatement(const void* stmt, std::vector<table::Constraint> constraints = {});
 
     /**
      * Internal callback from `SQLite` to signal that an existing query against this
      * table went away.
+     *
+     * @param stmt identifier previously passed to `sqliteTrackStatement()`
+     */
+    void sqliteUntrackStatement(const void* stmt);
+
+    /**
+     * Internal callback from `SQLite` setting the state storage of the
+     * statement currently retrieving rows from the table.
+     *
+     * @param state storage of the current statement, or null to unset
      */
-    void sqliteUntrackStatement();
+    void sqliteSetStatementState(table::StatementState* state) { _statement_state = state; }
 
     /**
      * Switches the table into testing mode where it returns only determistic
@@ -435,6 +986,53 @@ protected:
     /** Returns the current time, per our database's scheduler. */
     Time currentTime() const;
 
+    /**
+     * Returns the constraints of all currently active queries against the
+     * table, with one entry per query. An empty entry means that the
+     * corresponding query does not constrain the table's columns. Table
+     * parameters show up as `Equal` constraints if the query passes them as
+     * constants.
+     */
+    std::vector<std::vector<table::Constraint>> activeConstraints() const;
+
+    /**
+     * Returns the worker pool shared by all tables for parallelizing data
+     * collection. Like `options()`, this won't be available during
+     * construction.
+     */
+    ThreadPool& workerPool() const;
+
+    /**
+     * Returns state that the table derives from a statement's arguments,
+     * computing it on first use. The state is stored with the statement
+     * currently executing, and reused when the same statement executes again
+     * with the same arguments. This is for state that's expensive to derive,
+     * like parsed specifications or compiled regular expressions.
+     *
+     * This must be called only while retrieving rows, i.e., from inside
+     * `rows()` or `snapshot()`.
+     *
+     * @tparam T type of the state
+     * @param args the arguments that the state derives from
+     * @param create function computing the state; it may throw `PermanentContentError`, in which case nothing gets stored
+     * @return the state, either computed freshly or retrieved from an earlier call
+     */
+    template<typename T>
+    std::shared_ptr<T> statementState(const std::vector<table::Argument>& args,
+                                      const std::function<std::shared_ptr<T>()>& create) {
+        if ( ! _statement_state )
+            return create();
+
+        auto rendered_args = join(transform(args, [](const auto& a) { return to_string(a); }), ",");
+        auto key = table::StatementState::Key(this, std::move(rendered_args));
+        if ( auto state = _statement_state->lookup(key) )
+            return std::static_pointer_cast<T>(state);
+
+        auto state = create();
+        _statement_state->insert(std::move(key), state);
+        return state;
+    }
+
     /**
      * Helpers that returns one row of mock data. The value types will match
      * the schema, but the content is fake, and won't make sense semantically.
@@ -447,9 +1045,12 @@ protected:
 
 private:
     Database* _db = nullptr;      // database set through `setDatabase()`
-    int _current_connections = 0; // counter of active queries against this table
+    std::map<const void*, std::vector<table::Constraint>> _statements; // active queries with their constraints
     mutable Time _last_time = {};
     bool _use_mock_data = false; // if true, have table return mock data for testing
+    table::StatementState* _statement_state = nullptr; // state of statement currently retrieving rows, if any
+    mutable std::once_flag _schema_once;               // guards computing `_schema`
+    mutable std::unique_ptr<const Schema> _schema;     // schema, computed on first access
 };
 
 /**
@@ -506,6 +1107,17 @@ public:
      */
     void newEvent(std::vector<Value> row);
 
+    /**
+     * Records a batch of events that have occured, all with the same
+     * internal time. This is cheaper than calling `newEvent()` for each,
+     * as it acquires the event buffer's lock just once.
+     *
+     * Derived classes may call this from any thread.
+     *
+     * @param rows the column values associated with each event, which must match the table's schema
+     */
+    void newEvents(std::vector<std::vector<Value>> rows);
+
     /** Implements the parent class' corresponding method. */
     void expire(Time t) override;
 
@@ -541,9 +1153,9 @@ inline auto ValueVectorCompare = [](const std::vector<Value>& a, const std::vect
     if ( a_size != b.size() )
         return a_size < b.size();
 
-    for ( auto i = 0; i < a_size; i++ ) {
-        if ( a[i] != b[i] )
-            return a[i] < b[i];
+    for ( size_t i = 0; i < a_size; i++ ) {
+        if ( auto c = value::compare(a[i], b[i]) )
+            return c < 0;
     }
 
     return false;
@@ -0,0 +1,602 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#include "load-test.h"
+
+#include "autogen/config.h"
+#include "core/configuration.h"
+#include "core/database.h"
+#include "core/logger.h"
+#include "core/scheduler.h"
+#include "core/table.h"
+#include "io/zeek.h"
+#include "util/fmt.h"
+#include "util/helpers.h"
+#include "util/testing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef HAVE_WINDOWS
+#include <sys/resource.h>
+#endif
+
+#include <ixwebsocket/IXNetSystem.h>
+#include <ixwebsocket/IXWebSocket.h>
+#include <ixwebsocket/IXWebSocketServer.h>
+#include <nlohmann/json.hpp>
+
+using namespace zeek::agent;
+using namespace zeek::agent::load_test;
+
+// Name of the event the fake Zeek instances ask to receive query results as.
+static const char* ResultEventName = "LoadTest::result";
+
+// How long we wait for the agent to connect and install all queries.
+static const auto ConnectTimeout = 30s;
+
+// Returns a monotonic timestamp in nanoseconds, for measuring latencies
+// within the process.
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Returns the user plus system CPU time the process has consumed so far, and
+// its peak resident set size in KB.
+static std::pair<double, int64_t> resourceUsage() {
+#ifndef HAVE_WINDOWS
+    struct rusage r {};
+    if ( getrusage(RUSAGE_SELF, &r) != 0 )
+        return {0.0, 0};
+
+    auto cpu = to_interval(r.ru_utime) + to_interval(r.ru_stime);
+#ifdef HAVE_DARWIN
+    int64_t rss_kb = r.ru_maxrss / 1024; // bytes on macOS
+#else
+    int64_t rss_kb = r.ru_maxrss;
+#endif
+    return {std::chrono::duration<double>(cpu).count(), rss_kb};
+#else
+    return {0.0, 0}; // not supported
+#endif
+}
+
+namespace {
+
+// Synthetic event table that the load test queries. Each event records a
+// sequence number and the time it was generated at.
+class LoadTestEvents : public EventTable {
+public:
+    using Row = table::RowBuilder<value::Type::Count, value::Type::Count, value::Type::Text>;
+
+    Schema buildSchema() const override {
+        return Row::schema({
+            // clang-format off
+            .name = "load_test_events",
+            .summary = "synthetic events for load testing",
+            .description = R"(
+                The table is used internally by the agent's load test and
+                not available during normal operation. It generates events
+                at a configurable rate.
+            )",
+            .platforms = { Platform::Darwin, Platform::Linux, Platform::Windows },
+            .columns = {
+                {.name = "seq", .type = value::Type::Count, .summary = "sequence number of the event"},
+                {.name = "created", .type = value::Type::Count, .summary = "monotonic time of generation, in ns"},
+                {.name = "payload", .type = value::Type::Text, .summary = "filler text"}
+            }
+            // clang-format on
+        });
+    }
+};
+
+// Latency histogram with millisecond buckets. Latencies beyond the last
+// bucket count towards it.
+class Histogram {
+public:
+    void record(int64_t ns) {
+        auto ms = std::min(ns / 1'000'000, static_cast<int64_t>(_buckets.size() - 1));
+        ++_buckets[std::max(ms, int64_t(0))];
+        ++_count;
+        _max_ns = std::max(_max_ns, ns);
+    }
+
+    void merge(const Histogram& other) {
+        for ( size_t i = 0; i < _buckets.size(); i++ )
+            _buckets[i] += other._buckets[i];
+
+        _count += other._count;
+        _max_ns = std::max(_max_ns, other._max_ns);
+    }
+
+    // Returns the upper bound of the bucket containing the given percentile,
+    // capped by the maximum.
+    double percentile(double p) const {
+        if ( _count == 0 )
+            return 0.0;
+
+        auto rank = static_cast<int64_t>(p / 100.0 * static_cast<double>(_count));
+        int64_t seen = 0;
+
+        for ( size_t i = 0; i < _buckets.size(); i++ ) {
+            seen += _buckets[i];
+            if ( seen > rank )
+                return std::min(static_cast<double>(i + 1), max());
+        }
+
+        return max();
+    }
+
+    double max() const { return static_cast<double>(_max_ns) / 1e6; }
+
+private:
+    std::vector<int64_t> _buckets = std::vector<int64_t>(60'000);
+    int64_t _count = 0;
+    int64_t _max_ns = 0;
+};
+
+// Stand-in for a Zeek instance. It speaks just enough of Broker's WebSocket
+// protocol to say hello to an agent, install queries, and time the results
+// coming back.
+class FakeZeek {
+public:
+    FakeZeek(std::string id, const Parameters& params) : _id(std::move(id)), _params(params) {}
+
+    // Starts listening on the first available local port at or after the
+    // given one.
+    Result<Nothing> start(int64_t first_port);
+
+    // Stops listening, terminating any connections.
+    void stop();
+
+    // Returns the port we are listening on.
+    int64_t port() const { return _port; }
+
+    // Returns the address the agent should connect to.
+    std::string destination() const { return frmt("127.0.0.1:{}", _port); }
+
+    // Returns true once the agent has connected and been sent all queries.
+    bool installed() const { return _installed; }
+
+    // Returns the number of query results received that add rows.
+    int64_t messages() const { return _messages; }
+
+    // Returns the number of query results received that delete rows.
+    int64_t deletes() const { return _deletes; }
+
+    // Returns the monotonic time when the most recent query result arrived.
+    int64_t lastMessage() const { return _last_message_ns; }
+
+    // Returns the latencies of the query results received. Must only be
+    // called once stopped.
+    const Histogram& latencies() const { return _latencies; }
+
+private:
+    void processMessage(ix::WebSocket& socket, const std::string& msg);
+    void sendHello(ix::WebSocket& socket);
+    void sendEvent(ix::WebSocket& socket, const std::string& name, nlohmann::json args);
+
+    std::string _id;
+    Parameters _params;
+    int64_t _port = 0;
+    std::unique_ptr<ix::WebSocketServer> _server;
+
+    // Accessed only from the server's connection thread.
+    std::string _topic; // topic the agent subscribed to, set once it has connected
+    Histogram _latencies;
+    std::atomic<bool> _installed = false;
+    std::atomic<int64_t> _messages = 0;
+    std::atomic<int64_t> _deletes = 0;
+    std::atomic<int64_t> _last_message_ns = 0;
+};
+
+} // namespace
+
+// Wraps a value into Broker's JSON representation.
+static nlohmann::json data(const char* type, nlohmann::json value) {
+    return nlohmann::json{{"@data-type", type}, {"data", std::move(value)}};
+}
+
+Result<Nothing> FakeZeek::start(int64_t first_port) {
+    for ( auto port = first_port; port < first_port + 100 && port < 65536; port++ ) {
+        auto server = std::make_unique<ix::WebSocketServer>(static_cast<int>(port), "127.0.0.1");
+        if ( ! server->listen().first )
+            continue;
+
+        server->setOnClientMessageCallback(
+            [this](const std::shared_ptr<ix::ConnectionState>& /* state */, ix::WebSocket& socket,
+                   const ix::WebSocketMessagePtr& msg) {
+                if ( msg->type == ix::WebSocketMessageType::Message )
+                    processMessage(socket, msg->str);
+            });
+
+        server->start();
+        _server = std::move(server);
+        _port = port;
+        ZEEK_AGENT_DEBUG("load-test", "[{}] listening on port {}", _id, _port);
+        return Nothing();
+    }
+
+    return result::Error(frmt("no local port available for fake Zeek endpoint (tried {}-{})", first_port,
+                              first_port + 99));
+}
+
+void FakeZeek::stop() {
+    if ( ! _server )
+        return;
+
+    _server->stop();
+    _server.reset();
+}
+
+void FakeZeek::processMessage(ix::WebSocket& socket, const std::string& msg) {
+    try {
+        auto json = nlohmann::json::parse(msg);
+
+        if ( json.is_array() ) {
+            // The agent's initial list of topics to subscribe to.
+            _topic = json.at(0).get<std::string>();
+            socket.send(nlohmann::json{{"type", "ack"}, {"endpoint", _id}, {"version", "2.7.0"}}.dump());
+            sendHello(socket);
+
+            auto subscription =
+                (_params.subscription == "differences" ? "ZeekAgent::Differences" : "ZeekAgent::Events");
+            auto interval = std::chrono::duration_cast<std::chrono::seconds>(_params.interval).count();
+
+            for ( int64_t i = 0; i < _params.queries; i++ ) {
+                auto query = nlohmann::json::array({
+                    data("string", "SELECT * FROM load_test_events"),
+                    data("timespan", frmt("{}s", interval)),
+                    data("enum-value", subscription),
+                    data("vector", nlohmann::json::array({data("string", ResultEventName)})),
+                    data("string", frmt("{}-{}", _id, i)), // cookie
+                    data("set", nlohmann::json::array()),  // requires_tables
+                    data("set", nlohmann::json::array()),  // if_missing_tables
+                });
+
+                sendEvent(socket, "ZeekAgentAPI::install_query_v1",
+                          nlohmann::json::array({data("string", frmt("{}-query-{}", _id, i)),
+                                                 data("vector", std::move(query))}));
+            }
+
+            ZEEK_AGENT_DEBUG("load-test", "[{}] agent connected, installed {} queries", _id, _params.queries);
+            _installed = true;
+            return;
+        }
+
+        if ( json.at("type") != "data-message" )
+            return;
+
+        const auto& event = json.at("data").at(2).at("data");
+        if ( event.at(0).at("data") != ResultEventName )
+            return; // ignore agent hellos etc.
+
+        auto now = now_ns();
+        const auto& args = event.at(1).at("data");
+        const auto& change = args.at(0).at("data").at(3).at("data");
+        const auto& columns = args.at(1).at("data");
+
+        // Deletes don't correspond to newly generated events, so they count
+        // separately and don't contribute to latencies.
+        if ( change == "ZeekAgent::Delete" )
+            ++_deletes;
+        else {
+            _latencies.record(now - columns.at(1).at("data").get<int64_t>());
+            ++_messages;
+        }
+
+        _last_message_ns = now;
+
+    } catch ( const std::exception& e ) {
+        ZEEK_AGENT_DEBUG("load-test", "[{}] cannot parse message: {} ({})", _id, e.what(), msg);
+    }
+}
+
+void FakeZeek::sendHello(ix::WebSocket& socket) {
+    auto record = nlohmann::json::array({data("string", "7.0.0"), data("count", 70000), data("string", "2.2.8")});
+    sendEvent(socket, "ZeekAgentAPI::zeek_hello_v1", nlohmann::json::array({data("vector", std::move(record))}));
+}
+
+void FakeZeek::sendEvent(ix::WebSocket& socket, const std::string& name, nlohmann::json args) {
+    // All events Zeek sends start with the ID of the sending instance.
+    args.insert(args.begin(), data("string", _id));
+
+    auto event = nlohmann::json::array({data("string", name), data("vector", std::move(args))});
+    auto msg =
+        data("vector", nlohmann::json::array({data("count", 1), data("count", 1), data("vector", std::move(event))}));
+
+    msg["type"] = "data-message";
+    msg["topic"] = _topic;
+    socket.send(msg.dump());
+}
+
+Result<Parameters> load_test::parseParameters(const std::string& spec) {
+    Parameters params;
+
+    for ( const auto& kv : split(spec, ",") ) {
+        if ( trim(kv).empty() )
+            continue;
+
+        auto [key, value] = split1(kv, "=");
+        key = trim(key);
+        value = trim(value);
+
+        if ( key == "subscription" ) {
+            if ( value != "events" && value != "differences" )
+                return result::Error(frmt("invalid load test subscription '{}' (want 'events' or 'differences')",
+                                          value));
+
+            params.subscription = value;
+            continue;
+        }
+
+        int64_t n = 0;
+
+        try {
+            size_t end = 0;
+            n = std::stoll(value, &end);
+            if ( end != value.size() || n <= 0 )
+                throw std::invalid_argument("");
+        } catch ( const std::exception& ) {
+            return result::Error(frmt("invalid value for load test parameter '{}' (want positive integer)", key));
+        }
+
+        if ( key == "zeeks" )
+            params.zeeks = n;
+        else if ( key == "queries" )
+            params.queries = n;
+        else if ( key == "rate" )
+            params.rate = n;
+        else if ( key == "duration" )
+            params.duration = to_interval_from_secs(n);
+        else if ( key == "interval" )
+            params.interval = to_interval_from_secs(n);
+        else if ( key == "port" && n < 65536 )
+            params.port = n;
+        else
+            return result::Error(frmt("invalid load test parameter '{}'", kv));
+    }
+
+    return params;
+}
+
+std::string Results::json() const {
+    nlohmann::ordered_json j;
+    j["events"] = events;
+    j["expected"] = expected;
+    j["messages"] = messages;
+    j["deletes"] = deletes;
+    j["seconds"] = seconds;
+    j["messages_per_second"] = messages_per_second;
+    j["latency_p50_ms"] = latency_p50_ms;
+    j["latency_p90_ms"] = latency_p90_ms;
+    j["latency_p99_ms"] = latency_p99_ms;
+    j["latency_max_ms"] = latency_max_ms;
+    j["cpu_seconds"] = cpu_seconds;
+    j["rss_max_kb"] = rss_max_kb;
+    return j.dump();
+}
+
+Result<Results> load_test::run(const Parameters& params) {
+    // Talk to the fake Zeek instances without TLS. They say hello only once,
+    // so keep them from timing out however long the test runs.
+    std::stringstream options{"[zeek]\nssl_disable = true\nreconnect_interval = 1.0\ntimeout = 86400.0\n"};
+    Configuration cfg;
+    if ( auto rc = cfg.read(options, "<load-test>"); ! rc )
+        return rc.error();
+
+    LoadTestEvents events_table;
+    Scheduler scheduler;
+    Database db(&cfg, &scheduler);
+    db.addTable(&events_table);
+
+    // Needed for the agent's hellos, which run as one query per connection.
+    auto agent_table = Database::findRegisteredTable("zeek_agent");
+    if ( agent_table )
+        db.addTable(agent_table);
+
+    ix::initNetSystem();
+
+    std::vector<std::unique_ptr<FakeZeek>> zeeks;
+    std::vector<std::string> destinations;
+
+    auto _ = ScopeGuard([&]() {
+        for ( const auto& z : zeeks )
+            z->stop();
+    });
+
+    for ( int64_t i = 0; i < params.zeeks; i++ ) {
+        auto port = (zeeks.empty() ? params.port : zeeks.back()->port() + 1);
+        auto zeek = std::make_unique<FakeZeek>(frmt("fake-zeek-{}", i), params);
+        if ( auto rc = zeek->start(port); ! rc )
+            return rc.error();
+
+        destinations.push_back(zeek->destination());
+        zeeks.push_back(std::move(zeek));
+    }
+
+    Zeek zeek(&db, &scheduler);
+    zeek.start(destinations);
+
+    // Generates events at the requested rate on a separate thread, in batches
+    // every few milliseconds. Events carry their creation time to measure
+    // latency.
+    const int64_t total_events =
+        params.rate * std::chrono::duration_cast<std::chrono::seconds>(params.duration).count();
+    std::atomic<int64_t> generated = 0;
+    std::atomic<bool> stop_generator = false;
+
+    auto generate = [&]() {
+        auto start = now_ns();
+
+        while ( ! stop_generator && generated < total_events ) {
+            auto elapsed = std::chrono::duration<double>(std::chrono::nanoseconds(now_ns() - start)).count();
+            auto target = std::min(total_events, static_cast<int64_t>(elapsed * static_cast<double>(params.rate)));
+
+            std::vector<std::vector<Value>> rows;
+            rows.reserve(target - generated);
+
+            for ( auto seq = generated.load(); seq < target; seq++ ) {
+                LoadTestEvents::Row row;
+                row.set<0>(seq);
+                row.set<1>(now_ns());
+                row.set<2>(frmt("load test event #{}", seq));
+                rows.push_back(row.take());
+            }
+
+            generated = target;
+            events_table.newEvents(std::move(rows));
+            std::this_thread::sleep_for(5ms);
+        }
+    };
+
+    // Drives the test through its phases: waiting for the agent to connect
+    // and install all queries, generating events, and then waiting for the
+    // final results to arrive.
+    enum class Phase { Connecting, Generating, Draining };
+    auto phase = Phase::Connecting;
+    auto phase_start = std::chrono::steady_clock::now();
+    std::unique_ptr<std::thread> generator;
+    std::optional<std::string> error;
+    int64_t start_ns = 0;
+    double start_cpu = 0.0;
+
+    const auto expected_queries = static_cast<size_t>(params.zeeks * (params.queries + (agent_table ? 1 : 0)));
+
+    scheduler.schedule(scheduler.currentTime(), [&](timer::ID) -> Interval {
+        auto now = std::chrono::steady_clock::now();
+
+        switch ( phase ) {
+            case Phase::Connecting: {
+                auto installed = std::all_of(zeeks.begin(), zeeks.end(), [](const auto& z) { return z->installed(); });
+                if ( installed && db.numberQueries() >= expected_queries ) {
+                    ZEEK_AGENT_DEBUG("load-test", "all queries installed, generating {} events", total_events);
+                    start_ns = now_ns();
+                    start_cpu = resourceUsage().first;
+                    generator = std::make_unique<std::thread>(generate);
+                    phase = Phase::Generating;
+                    phase_start = now;
+                }
+
+                else if ( now - phase_start > ConnectTimeout ) {
+                    error = "agent did not connect to all fake Zeek endpoints and install their queries in time";
+                    scheduler.terminate();
+                }
+
+                break;
+            }
+
+            case Phase::Generating: {
+                if ( generated >= total_events ) {
+                    ZEEK_AGENT_DEBUG("load-test", "all events generated, waiting for remaining results");
+                    phase = Phase::Draining;
+                    phase_start = now;
+                }
+
+                break;
+            }
+
+            case Phase::Draining: {
+                // Give the queries two more rounds to report all results.
+                if ( now - phase_start > 2 * params.interval + 1s )
+                    scheduler.terminate();
+
+                break;
+            }
+        }
+
+        return 100ms;
+    });
+
+    while ( scheduler.loop() ) {
+        db.poll();
+        zeek.poll();
+        db.expire();
+    }
+
+    stop_generator = true;
+    if ( generator )
+        generator->join();
+
+    zeek.stop();
+
+    for ( const auto& z : zeeks )
+        z->stop();
+
+    if ( error )
+        return result::Error(*error);
+
+    auto [cpu, rss_max_kb] = resourceUsage();
+
+    Histogram latencies;
+    Results results;
+    int64_t last_message_ns = start_ns;
+
+    for ( const auto& z : zeeks ) {
+        latencies.merge(z->latencies());
+        results.messages += z->messages();
+        results.deletes += z->deletes();
+        last_message_ns = std::max(last_message_ns, z->lastMessage());
+    }
+
+    results.events = generated;
+    results.expected = results.events * params.zeeks * params.queries;
+    results.seconds = static_cast<double>(last_message_ns - start_ns) / 1e9;
+    results.messages_per_second =
+        (results.seconds > 0 ? static_cast<double>(results.messages) / results.seconds : 0.0);
+    results.latency_p50_ms = latencies.percentile(50);
+    results.latency_p90_ms = latencies.percentile(90);
+    results.latency_p99_ms = latencies.percentile(99);
+    results.latency_max_ms = latencies.max();
+    results.cpu_seconds = cpu - start_cpu;
+    results.rss_max_kb = rss_max_kb;
+    return results;
+}
+
+TEST_SUITE("Zeek") {
+    TEST_CASE("load test parameters") {
+        auto defaults = parseParameters("");
+        REQUIRE(defaults);
+        CHECK_EQ(defaults->zeeks, 1);
+        CHECK_EQ(defaults->subscription, "events");
+
+        auto params = parseParameters("zeeks=3, queries=5,rate=200,duration=2,interval=1,subscription=differences");
+        REQUIRE(params);
+        CHECK_EQ(params->zeeks, 3);
+        CHECK_EQ(params->queries, 5);
+        CHECK_EQ(params->rate, 200);
+        CHECK_EQ(params->duration, 2s);
+        CHECK_EQ(params->interval, 1s);
+        CHECK_EQ(params->subscription, "differences");
+
+        CHECK_FALSE(parseParameters("zeeks=0"));
+        CHECK_FALSE(parseParameters("rate=fast"));
+        CHECK_FALSE(parseParameters("foo=1"));
+        CHECK_FALSE(parseParameters("subscription=snapshots"));
+    }
+
+    // Binds local ports and takes several seconds, with results that depend
+    // on the machine keeping up. Skipped by default, run with `zeek-agent
+    // --test --no-skip -tc="load test"`.
+    TEST_CASE("load test" * doctest::timeout(60.0) * doctest::skip()) {
+        auto params = parseParameters("zeeks=2,queries=2,rate=50,duration=1,interval=1,port=37760");
+        REQUIRE(params);
+
+        auto results = run(*params);
+        REQUIRE(results);
+        CHECK_EQ(results->events, 50);
+        CHECK_EQ(results->expected, 200);
+        CHECK_EQ(results->messages, results->expected);
+        CHECK_EQ(results->deletes, 0);
+        CHECK_GT(results->latency_max_ms, 0.0);
+        CHECK_LE(results->latency_p50_ms, results->latency_max_ms);
+    }
+}
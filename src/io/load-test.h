@@ -0,0 +1,82 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// End-to-end load test for sizing agents. This runs the agent's full
+// pipeline (table, SQLite, result diffing, Zeek connection, WebSocket)
+// against local stand-ins for Zeek, with no real Zeek needed:
+//
+// - A synthetic event table generates events at a configurable rate. Each
+//   event carries its creation time.
+//
+// - Fake Zeek instances, each with its own WebSocket endpoint speaking
+//   Broker's JSON protocol, connect the agent and install a number of
+//   queries against the table. Then they time how long each event takes to
+//   come back as a query result. That includes waiting for the query's next
+//   scheduled run, so latencies reflect the query interval as well.
+//
+// `zeek-agent --load-test[=<PARAMS>]` runs it, with parameters given as a
+// comma-separated list of `key=value` pairs (see `Parameters`), and outputs
+// one line of JSON with the results.
+
+#pragma once
+
+#include "util/helpers.h"
+#include "util/result.h"
+
+#include <cstdint>
+#include <string>
+
+namespace zeek::agent::load_test {
+
+/** Parameters for a load test run. */
+struct Parameters {
+    int64_t zeeks = 1;                   /**< number of fake Zeek instances (key `zeeks`) */
+    int64_t queries = 10;                /**< number of queries each Zeek instance installs (key `queries`) */
+    int64_t rate = 1000;                 /**< events generated per second (key `rate`) */
+    Interval duration = 10s;             /**< how long to generate events, in seconds (key `duration`) */
+    Interval interval = 1s;              /**< how often the queries run, in seconds (key `interval`) */
+    std::string subscription = "events"; /**< query subscription type, `events` or `differences` (key `subscription`) */
+    int64_t port = 27760;                /**< first local port to try for the fake Zeek endpoints (key `port`) */
+};
+
+/**
+ * Parses load test parameters from a comma-separated list of `key=value`
+ * pairs. Keys not mentioned keep their defaults.
+ *
+ * @param spec parameters to parse; may be empty
+ * @return parsed parameters, or an error if the list isn't valid
+ */
+Result<Parameters> parseParameters(const std::string& spec);
+
+/**
+ * Results of a load test run. CPU and memory cover the whole process,
+ * including the fake Zeek instances and the event generator.
+ */
+struct Results {
+    int64_t events = 0;               /**< events generated by the synthetic table */
+    int64_t expected = 0;             /**< query results expected across all Zeek instances */
+    int64_t messages = 0;             /**< query results adding rows received across all Zeek instances */
+    int64_t deletes = 0;              /**< query results deleting rows received across all Zeek instances */
+    double seconds = 0.0;             /**< wall time from the first event generated to the last result received */
+    double messages_per_second = 0.0; /**< `messages` over `seconds` */
+    double latency_p50_ms = 0.0;      /**< median time from generating an event to receiving a result for it */
+    double latency_p90_ms = 0.0;      /**< 90th percentile of the latency */
+    double latency_p99_ms = 0.0;      /**< 99th percentile of the latency */
+    double latency_max_ms = 0.0;      /**< maximum latency */
+    double cpu_seconds = 0.0;         /**< user plus system CPU time while generating and draining */
+    int64_t rss_max_kb = 0;           /**< peak resident set size of the process */
+
+    /** Returns the results as a single line of JSON. */
+    std::string json() const;
+};
+
+/**
+ * Runs a load test until all events have been generated and their results
+ * have had time to arrive. The agent uses its default configuration, except
+ * for options needed to talk to the fake Zeek instances.
+ *
+ * @param params parameters for the run
+ * @return results, or an error if the test couldn't run
+ */
+Result<Results> run(const Parameters& params);
+
+} // namespace zeek::agent::load_test
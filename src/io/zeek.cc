@@ -9,6 +9,7 @@
 #include "core/scheduler.h"
 #include "core/table.h"
 #include "platform/platform.h"
+#include "util/benchmark.h"
 #include "util/fmt.h"
 #include "util/helpers.h"
 #include "util/testing.h"
@@ -309,7 +310,7 @@ static nlohmann::json to_json(const Value& v, const value::Type& t) {
 
             case value::Type::Address: {
                 type = "address";
-                value = std::get<std::string>(v);
+                value = to_string(std::get<Address>(v));
                 break;
             }
 
@@ -704,7 +705,7 @@ static broker::data to_broker(const Value& v, const value::Type& t) {
 
             case value::Type::Address: {
                 broker::address addr;
-                if ( addr.convert_from(std::get<std::string>(v)) )
+                if ( addr.convert_from(to_string(std::get<Address>(v))) )
                     value = addr;
                 break;
             }
@@ -1433,7 +1434,7 @@ void ZeekConnection::transmitEvent(const std::string& event_name, Record args,
     context.emplace_back(std::move(change_data), value::Type::Enum);
     context.emplace_back(v_cookie, value::Type::Text);
 
-    args.insert(args.begin(), 1, {std::move(context), value::Type::Record});
+    args.insert(args.begin(), {std::move(context), value::Type::Record});
 
     for ( const auto& transport : _transports ) {
         if ( zeek_instance ) {
@@ -1531,6 +1532,79 @@ void Zeek::poll() {
     pimpl()->poll();
 }
 
+// Returns a synthetic event as sent for query results, for benchmarking.
+static Value benchmarkEvent(int64_t i) {
+    auto columns = Record{{i, value::Type::Count},
+                          {frmt("/usr/bin/process-{}", i), value::Type::Text},
+                          {"10.0.0.1"_addr, value::Type::Address},
+                          {Port(i % 65536, port::Protocol::TCP), value::Type::Port},
+                          {to_time(1700000000 + i), value::Type::Time},
+                          {Set(value::Type::Count, {i, i + 1}), value::Type::Set}};
+
+    auto args = Record{{Record{{std::string("zeek-agent-id"), value::Type::Text},
+                               {std::string("query-id"), value::Type::Text},
+                               {std::string("add"), value::Type::Enum}},
+                        value::Type::Record},
+                       {std::move(columns), value::Type::Record}};
+
+    return Record{{Value(1L), value::Type::Count},
+                  {Value(1L), value::Type::Count},
+                  {Record{{Value(std::string("ZeekAgent::process_add")), value::Type::Text},
+                          {std::move(args), value::Type::Record}},
+                   value::Type::Record}};
+}
+
+ZEEK_AGENT_BENCHMARK("zeek/json-encode") {
+    std::vector<Value> events;
+    for ( int64_t i = 0; i < 1000; i++ )
+        events.push_back(benchmarkEvent(i));
+
+    state.setItemsPerIteration(static_cast<int64_t>(events.size()));
+
+    while ( state.keepRunning() ) {
+        for ( const auto& e : events ) {
+            nlohmann::json msg = to_json(e, value::Type::Record);
+            msg["type"] = "data-message";
+            msg["topic"] = "/zeek-agent/response/all";
+            auto data = msg.dump();
+            benchmark::doNotOptimize(data);
+        }
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("zeek/json-decode") {
+    // Messages from Zeek don't contain all the types that we send, so we
+    // decode query requests instead.
+    std::vector<std::string> messages;
+    for ( int64_t i = 0; i < 1000; i++ ) {
+        auto query = Record{{frmt("query-{}", i), value::Type::Text},
+                            {std::string("SELECT * FROM processes"), value::Type::Text},
+                            {Set(value::Type::Text, {std::string("agent-1"), std::string("agent-2")}),
+                             value::Type::Set},
+                            {i, value::Type::Count},
+                            {std::string("ZeekAgent::Differences"), value::Type::Enum}};
+
+        auto event = Record{{Value(1L), value::Type::Count},
+                            {Value(1L), value::Type::Count},
+                            {Record{{Value(std::string("ZeekAgentAPI::install_query_v1")), value::Type::Text},
+                                    {Record{{std::move(query), value::Type::Record}}, value::Type::Record}},
+                             value::Type::Record}};
+
+        nlohmann::json msg = to_json(event, value::Type::Record);
+        msg["type"] = "data-message";
+        messages.push_back(msg.dump());
+    }
+
+    state.setItemsPerIteration(static_cast<int64_t>(messages.size()));
+
+    while ( state.keepRunning() ) {
+        for ( const auto& m : messages ) {
+            auto x = from_json(nlohmann::json::parse(m));
+            benchmark::doNotOptimize(x);
+        }
+    }
+}
+
 TEST_SUITE("Zeek") {
 #ifdef HAVE_BROKER
     TEST_CASE("connect/hello/disconnect/reconnect - native Broker" * doctest::timeout(10.0)) {
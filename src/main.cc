@@ -8,9 +8,11 @@
 #include "core/signal.h"
 #include "core/table.h"
 #include "io/console.h"
+#include "io/load-test.h"
 #include "io/zeek.h"
 #include "platform/platform.h"
 #include "spdlog/common.h"
+#include "util/benchmark.h"
 #include "util/fmt.h"
 #include "util/helpers.h"
 #include "util/socket.h"
@@ -145,6 +147,39 @@ int main(int argc, char** argv) {
 #endif
         }
 
+        case options::Mode::Benchmark: {
+#ifndef DOCTEST_CONFIG_DISABLE
+            options::default_log_level = (options.log_level ? *options.log_level : options::LogLevel::off);
+            logger()->set_level(options::default_log_level);
+            platform::setenv("TZ", "GMT", 1);
+            benchmark::run(options.benchmark_filter, std::cout);
+            return 0;
+#else
+            std::cerr << "benchmarks not compiled in" << std::endl;
+            return 1;
+#endif
+        }
+
+        case options::Mode::LoadTest: {
+            options::default_log_level = (options.log_level ? *options.log_level : options::LogLevel::warn);
+            logger()->set_level(options::default_log_level);
+
+            auto params = load_test::parseParameters(options.load_test);
+            if ( ! params ) {
+                std::cerr << params.error() << std::endl;
+                return 1;
+            }
+
+            auto results = load_test::run(*params);
+            if ( ! results ) {
+                std::cerr << results.error() << std::endl;
+                return 1;
+            }
+
+            std::cout << results->json() << std::endl;
+            return 0;
+        }
+
         case options::Mode::AutoDoc: {
             std::cout << Database::documentRegisteredTables() << std::endl;
             return 0;
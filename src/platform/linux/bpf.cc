@@ -5,11 +5,18 @@
 #include "autogen/config.h"
 #include "core/logger.h"
 #include "platform.h"
+#include "util/testing.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <utility>
 
+#include <time.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
 #include <bpf/libbpf.h>
 
 using namespace zeek::agent;
@@ -21,6 +28,10 @@ using bpf_attach = int (*)(void*);
 using bpf_detach = void (*)(void*);
 using bpf_destroy = void (*)(void*);
 
+// Interval at which we recalibrate the offset between boot time and wall
+// clock, to track adjustments to the latter (e.g., through NTP).
+static const auto BootTimeCalibrationInterval = 10s;
+
 BPF* platform::linux::bpf() {
     static auto bpf = std::unique_ptr<BPF>{};
 
@@ -51,6 +62,7 @@ static int libbpf_print_fn(enum libbpf_print_level level, const char* format, va
 BPF::BPF() {
     libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
     libbpf_set_print(libbpf_print_fn);
+    calibrateBootTimeOffset();
     _thread = std::make_unique<std::thread>([&]() { poll(); });
 }
 
@@ -169,10 +181,44 @@ Result<Nothing> BPF::destroy(const std::string& name) {
     return Nothing();
 }
 
+Result<std::string> BPF::readIterator(void* link) const {
+    if ( ! link )
+        return result::Error("iterator program not attached");
+
+    auto fd = bpf_iter_create(bpf_link__fd(reinterpret_cast<struct bpf_link*>(link)));
+    if ( fd < 0 )
+        return result::Error(frmt("cannot create BPF iterator: {}", strerror(-fd)));
+
+    ScopeGuard _([&]() { close(fd); });
+
+    std::string data;
+    char buffer[65536];
+
+    while ( true ) {
+        auto n = ::read(fd, buffer, sizeof(buffer));
+        if ( n == 0 )
+            break;
+
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            return result::Error(frmt("cannot read from BPF iterator: {}", strerror(errno)));
+        }
+
+        data.append(buffer, n);
+    }
+
+    return data;
+}
+
 void BPF::poll() {
     ZEEK_AGENT_DEBUG("bpf", "polling thread starting up");
 
     while ( ! _stopping ) {
+        if ( std::chrono::steady_clock::now() - _last_calibration >= BootTimeCalibrationInterval )
+            calibrateBootTimeOffset();
+
         if ( _ring_buffers )
             ring_buffer__poll(_ring_buffers, 100);
         else
@@ -181,3 +227,49 @@ void BPF::poll() {
 
     ZEEK_AGENT_DEBUG("bpf", "polling thread shutting down");
 }
+
+void BPF::calibrateBootTimeOffset() {
+    auto to_ns = [](const struct timespec& ts) {
+        return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + static_cast<int64_t>(ts.tv_nsec);
+    };
+
+    // Bracket the boot time reading with two wall clock readings and use
+    // their midpoint to minimize the error from getting preempted in between.
+    struct timespec real1, boot, real2;
+    if ( clock_gettime(CLOCK_REALTIME, &real1) < 0 || clock_gettime(CLOCK_BOOTTIME, &boot) < 0 ||
+         clock_gettime(CLOCK_REALTIME, &real2) < 0 ) {
+        logger()->warn(frmt("cannot calibrate BPF event timestamps: {}", strerror(errno)));
+        return;
+    }
+
+    auto real = to_ns(real1) + (to_ns(real2) - to_ns(real1)) / 2;
+    _boot_time_offset.store(real - to_ns(boot), std::memory_order_relaxed);
+    _last_calibration = std::chrono::steady_clock::now();
+}
+
+TEST_SUITE("Platform") {
+    TEST_CASE("BPF boot time conversion") {
+        SUBCASE("fixed offset") {
+            CHECK_EQ(BPF::bootTimeToTime(0, 0), Time());
+            CHECK_EQ(BPF::bootTimeToTime(5'000'000'000, 1'700'000'000'000'000'000), to_time(1700000005));
+            CHECK_EQ(BPF::bootTimeToTime(1'500, 1'000), Time(std::chrono::nanoseconds(2'500)));
+        }
+
+        SUBCASE("calibrated offset") {
+            auto to_ns = [](const struct timespec& ts) {
+                return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + static_cast<int64_t>(ts.tv_nsec);
+            };
+
+            struct timespec real, boot;
+            REQUIRE_EQ(clock_gettime(CLOCK_REALTIME, &real), 0);
+            REQUIRE_EQ(clock_gettime(CLOCK_BOOTTIME, &boot), 0);
+
+            auto offset = to_ns(real) - to_ns(boot);
+            auto bpf = platform::linux::bpf();
+            CHECK_LE(std::abs(bpf->bootTimeOffset() - offset), 50'000'000); // 50ms
+
+            auto t = bpf->bootTimeToTime(static_cast<uint64_t>(to_ns(boot)));
+            CHECK_LE(std::chrono::abs(t - Time(std::chrono::nanoseconds(to_ns(real)))), 50ms);
+        }
+    }
+}
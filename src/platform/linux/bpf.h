@@ -1,9 +1,11 @@
 // Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
 
+#include "util/helpers.h"
 #include "util/pimpl.h"
 #include "util/result.h"
 
 #include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -59,14 +61,56 @@ public:
     Result<Nothing> detach(const std::string& name) const;
     Result<Nothing> destroy(const std::string& name);
 
+    /**
+     * Runs a BPF iterator program to completion, returning everything it
+     * wrote into its output sequence.
+     *
+     * @param link the program's link, as created by attaching its skeleton
+     * (i.e., `skel->links.<program>`)
+     */
+    Result<std::string> readIterator(void* link) const;
+
+    /**
+     * Converts a timestamp recorded inside a BPF program through
+     * `bpf_ktime_get_boot_ns()` into wall clock time. This uses an offset
+     * between `CLOCK_BOOTTIME` and `CLOCK_REALTIME` that the polling thread
+     * recalibrates periodically, so that conversion does not need a system
+     * call per event.
+     *
+     * @param ns nanoseconds since boot, as recorded by the kernel
+     */
+    Time bootTimeToTime(uint64_t ns) const { return bootTimeToTime(ns, bootTimeOffset()); }
+
+    /**
+     * Converts a timestamp in nanoseconds since boot into wall clock time,
+     * given the offset between the two clocks.
+     *
+     * @param ns nanoseconds since boot
+     * @param offset nanoseconds to add to `CLOCK_BOOTTIME` to get `CLOCK_REALTIME`
+     */
+    static Time bootTimeToTime(uint64_t ns, int64_t offset) {
+        return Time(
+            std::chrono::duration_cast<Time::duration>(std::chrono::nanoseconds(static_cast<int64_t>(ns) + offset)));
+    }
+
+    /**
+     * Returns the current calibration of the offset that `bootTimeToTime()`
+     * uses, in nanoseconds to add to `CLOCK_BOOTTIME` to get
+     * `CLOCK_REALTIME`.
+     */
+    int64_t bootTimeOffset() const { return _boot_time_offset.load(std::memory_order_relaxed); }
+
 private:
     friend BPF* bpf();
 
     BPF();
     Result<void*> load(Skeleton skel);
     void poll();
+    void calibrateBootTimeOffset();
 
     std::atomic<bool> _stopping = false;
+    std::atomic<int64_t> _boot_time_offset = 0;              // nsecs to add to CLOCK_BOOTTIME to get CLOCK_REALTIME
+    std::chrono::steady_clock::time_point _last_calibration; // last recalibration, monotonic; polling thread only
     std::unique_ptr<std::thread> _thread;
     mutable std::mutex _skeletons_mutex;
     std::map<std::string, Skeleton> _skeletons;
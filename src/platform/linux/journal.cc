@@ -0,0 +1,794 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#include "journal.h"
+
+#include "core/logger.h"
+#include "util/fmt.h"
+#include "util/helpers.h"
+#include "util/testing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <thread>
+
+#include <dlfcn.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace zeek::agent;
+using namespace zeek::agent::platform::linux::journal;
+
+// On-disk layout, per systemd's `journal-def.h`. All integers are little-endian.
+static const char Signature[8] = {'L', 'P', 'K', 'S', 'H', 'H', 'R', 'H'};
+
+static const uint64_t HeaderIncompatibleFlags = 12; // le32
+static const uint64_t HeaderState = 16;             // uint8
+static const uint64_t HeaderHeaderSize = 88;        // le64
+static const uint64_t HeaderTailObjectOffset = 136; // le64
+static const uint64_t HeaderTailEntrySeqnum = 160;  // le64
+static const uint64_t HeaderSizeMin = 208;          // size of the oldest header version we support
+
+static const uint32_t IncompatibleCompressedXZ = 1;
+static const uint32_t IncompatibleCompressedLZ4 = 2;
+static const uint32_t IncompatibleKeyedHash = 4;
+static const uint32_t IncompatibleCompressedZSTD = 8;
+static const uint32_t IncompatibleCompact = 16;
+static const uint32_t IncompatibleSupported = IncompatibleCompressedXZ | IncompatibleCompressedLZ4 |
+                                              IncompatibleKeyedHash | IncompatibleCompressedZSTD | IncompatibleCompact;
+
+static const uint8_t StateOffline = 0;
+static const uint8_t StateOnline = 1;
+static const uint8_t StateArchived = 2;
+
+static const uint64_t ObjectHeaderSize = 16; // type (uint8), flags (uint8), reserved[6], size (le64)
+static const uint8_t ObjectData = 1;
+static const uint8_t ObjectEntry = 3;
+
+static const uint8_t ObjectCompressedXZ = 1;
+static const uint8_t ObjectCompressedLZ4 = 2;
+static const uint8_t ObjectCompressedZSTD = 4;
+static const uint8_t ObjectCompressed = ObjectCompressedXZ | ObjectCompressedLZ4 | ObjectCompressedZSTD;
+
+static const uint64_t DataPayload = 64;        // offset of payload inside data object
+static const uint64_t DataPayloadCompact = 72; // offset of payload inside data object in compact mode
+
+static const uint64_t EntrySeqnum = 16;         // le64
+static const uint64_t EntryRealtime = 24;       // le64
+static const uint64_t EntryItems = 64;          // offset of item array inside entry object
+static const uint64_t EntryItemSize = 16;       // object offset (le64), hash (le64)
+static const uint64_t EntryItemSizeCompact = 4; // object offset (le32)
+
+// Maximum size we accept for a decompressed field.
+static const size_t MaxDecompressedSize = 64 * 1024 * 1024;
+
+// Maximum size we accept for an object; larger ones must be corrupt.
+static const uint64_t MaxObjectSize = 256 * 1024 * 1024;
+
+// Minimum amount of data we read from a file at a time.
+static const uint64_t ReadWindowSize = 64 * 1024;
+
+// Interval at which we rescan directories even without notification.
+static const auto RescanInterval = std::chrono::seconds(10);
+
+static uint64_t align8(uint64_t x) { return (x + 7) & ~static_cast<uint64_t>(7); }
+
+static uint8_t u8(const char* p) { return static_cast<uint8_t>(*p); }
+
+static uint32_t le32(const char* p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return le32toh(x);
+}
+
+static uint64_t le64(const char* p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return le64toh(x);
+}
+
+namespace {
+
+// Interface to compression libraries. Like journald itself, we load them
+// dynamically on first use, so that they remain optional. XZ isn't
+// supported; it's been superseded as journald's default long ago.
+class Decompressor {
+public:
+    static Decompressor& get() {
+        static Decompressor decompressor;
+        return decompressor;
+    }
+
+    // Decompresses a data object's payload.
+    bool decompress(uint8_t flags, const char* data, size_t len, std::string* out) {
+        if ( flags & ObjectCompressedZSTD )
+            return decompressZSTD(data, len, out);
+
+        if ( flags & ObjectCompressedLZ4 )
+            return decompressLZ4(data, len, out);
+
+        return false;
+    }
+
+private:
+    using ZSTD_getFrameContentSize_t = unsigned long long (*)(const void*, size_t);
+    using ZSTD_decompress_t = size_t (*)(void*, size_t, const void*, size_t);
+    using ZSTD_isError_t = unsigned (*)(size_t);
+    using LZ4_decompress_safe_t = int (*)(const char*, char*, int, int);
+
+    Decompressor() {
+        if ( auto zstd = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL) ) {
+            _zstd_content_size = reinterpret_cast<ZSTD_getFrameContentSize_t>(dlsym(zstd, "ZSTD_getFrameContentSize"));
+            _zstd_decompress = reinterpret_cast<ZSTD_decompress_t>(dlsym(zstd, "ZSTD_decompress"));
+            _zstd_is_error = reinterpret_cast<ZSTD_isError_t>(dlsym(zstd, "ZSTD_isError"));
+        }
+
+        if ( auto lz4 = dlopen("liblz4.so.1", RTLD_NOW | RTLD_LOCAL) )
+            _lz4_decompress = reinterpret_cast<LZ4_decompress_safe_t>(dlsym(lz4, "LZ4_decompress_safe"));
+
+        ZEEK_AGENT_DEBUG("journal", "decompression available: zstd={} lz4={}",
+                         (_zstd_content_size && _zstd_decompress && _zstd_is_error), (_lz4_decompress != nullptr));
+    }
+
+    bool decompressZSTD(const char* data, size_t len, std::string* out) {
+        if ( ! (_zstd_content_size && _zstd_decompress && _zstd_is_error) )
+            return false;
+
+        auto size = _zstd_content_size(data, len);
+        if ( size > MaxDecompressedSize ) // includes the error values
+            return false;
+
+        out->resize(size);
+        auto n = _zstd_decompress(out->data(), out->size(), data, len);
+        if ( _zstd_is_error(n) )
+            return false;
+
+        out->resize(n);
+        return true;
+    }
+
+    bool decompressLZ4(const char* data, size_t len, std::string* out) {
+        // journald prefixes the LZ4 block with the uncompressed size.
+        if ( ! _lz4_decompress || len < 8 )
+            return false;
+
+        uint64_t size;
+        memcpy(&size, data, sizeof(size));
+        size = le64toh(size);
+
+        if ( size > MaxDecompressedSize )
+            return false;
+
+        out->resize(size);
+        auto n = _lz4_decompress(data + 8, out->data(), static_cast<int>(len - 8), static_cast<int>(size));
+        if ( n < 0 )
+            return false;
+
+        out->resize(n);
+        return true;
+    }
+
+    ZSTD_getFrameContentSize_t _zstd_content_size = nullptr;
+    ZSTD_decompress_t _zstd_decompress = nullptr;
+    ZSTD_isError_t _zstd_is_error = nullptr;
+    LZ4_decompress_safe_t _lz4_decompress = nullptr;
+};
+
+} // namespace
+
+namespace zeek::agent::platform::linux::journal {
+
+// A single journal file being followed. We walk the objects sequentially, as
+// journald only ever appends, and remember where to continue. We read the
+// file through pread() rather than mapping it, so that it getting truncated
+// underneath us can't crash the process with SIGBUS.
+class File {
+public:
+    ~File() {
+        if ( _fd >= 0 )
+            ::close(_fd);
+    }
+
+    // Opens a file, returning null if it's not a journal file we can read. If
+    // `at_tail`, the file's current entries will be skipped; otherwise reading
+    // starts at offset `next`, or at the first object if that's zero.
+    static std::unique_ptr<File> open(const filesystem::path& path, bool at_tail, uint64_t next = 0) {
+        auto file = std::unique_ptr<File>(new File());
+        file->_path = path;
+        file->_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if ( file->_fd < 0 )
+            return nullptr;
+
+        struct stat st;
+        if ( fstat(file->_fd, &st) < 0 )
+            return nullptr;
+
+        file->_dev = st.st_dev;
+        file->_ino = st.st_ino;
+
+        if ( ! file->readHeader() || memcmp(file->_header, Signature, sizeof(Signature)) != 0 ) {
+            ZEEK_AGENT_DEBUG("journal", "{} is not a journal file", path.native());
+            return nullptr;
+        }
+
+        auto incompatible = le32(file->_header + HeaderIncompatibleFlags);
+        if ( incompatible & ~IncompatibleSupported ) {
+            ZEEK_AGENT_DEBUG("journal", "{} uses unsupported features ({:#x})", path.native(), incompatible);
+            return nullptr;
+        }
+
+        auto header_size = le64(file->_header + HeaderHeaderSize);
+        if ( header_size < HeaderSizeMin || header_size % 8 != 0 )
+            return nullptr;
+
+        file->_compact = (incompatible & IncompatibleCompact);
+        file->_next = std::max(header_size, next);
+
+        if ( at_tail ) {
+            // Skip all objects up to the last complete entry.
+            auto tail = le64(file->_header + HeaderTailObjectOffset);
+            auto tail_seqnum = le64(file->_header + HeaderTailEntrySeqnum);
+
+            while ( tail && file->_next <= tail ) {
+                auto object = file->fetch(file->_next, EntryRealtime + 8);
+                if ( ! object || le64(object + 8) < ObjectHeaderSize )
+                    break;
+
+                if ( u8(object) == ObjectEntry && ! complete(object, tail_seqnum) )
+                    break;
+
+                file->_next = align8(file->_next + le64(object + 8));
+            }
+        }
+
+        ZEEK_AGENT_DEBUG("journal", "following {}{}", path.native(), (file->_compact ? " (compact)" : ""));
+        return file;
+    }
+
+    // Returns the file's state as of the last read, one of the `State*` constants.
+    uint8_t state() const { return u8(_header + HeaderState); }
+
+    // Returns the file's path.
+    const filesystem::path& path() const { return _path; }
+
+    // Returns the file's identity.
+    std::pair<dev_t, ino_t> id() const { return {_dev, _ino}; }
+
+    // Returns the offset where reading will continue.
+    uint64_t next() const { return _next; }
+
+    // Reads all complete entries appended since the last call. The file's
+    // state is updated before reading, so once it says that journald is done
+    // with the file, we have seen all its entries.
+    size_t read(const std::vector<std::string>& prefixes, Entry* entry, std::string* buffer,
+                const std::function<void(const Entry&)>& callback) {
+        _window_size = 0; // journald may have written to the file since we filled the window
+
+        if ( ! readHeader() )
+            return 0;
+
+        auto tail = le64(_header + HeaderTailObjectOffset);
+        auto tail_seqnum = le64(_header + HeaderTailEntrySeqnum);
+
+        size_t n = 0;
+
+        while ( tail && _next <= tail ) {
+            auto object = fetch(_next, ObjectHeaderSize);
+            if ( ! object )
+                break;
+
+            auto type = u8(object);
+            auto size = le64(object + 8);
+
+            if ( size == 0 )
+                break; // allocated but not filled in yet, try again next time
+
+            if ( size < ObjectHeaderSize || size > MaxObjectSize ) {
+                logger()->warn(frmt("journal file {} appears corrupt at offset {}, skipping remainder",
+                                    _path.native(), _next));
+                _next = std::numeric_limits<uint64_t>::max();
+                break;
+            }
+
+            if ( type == ObjectEntry ) {
+                object = fetch(_next, size);
+                if ( ! object )
+                    break;
+
+                // journald fills in a new entry only after adding it to the
+                // file, and links it into the header once it's done. If
+                // we're ahead of that, we'll get another notification.
+                if ( size >= EntryItems && ! complete(object, tail_seqnum) )
+                    break;
+
+                if ( decodeEntry(object, size, prefixes, entry, buffer) ) {
+                    callback(*entry);
+                    ++n;
+                }
+            }
+
+            _next = align8(_next + size);
+        }
+
+        return n;
+    }
+
+private:
+    File() = default;
+
+    // Returns true if an entry object has been completely written.
+    static bool complete(const char* entry, uint64_t tail_seqnum) {
+        auto seqnum = le64(entry + EntrySeqnum);
+        return seqnum != 0 && seqnum <= tail_seqnum && le64(entry + EntryRealtime) != 0;
+    }
+
+    // Reads the file's current header.
+    bool readHeader() { return pread(_header, sizeof(_header), 0) == sizeof(_header); }
+
+    // Returns a pointer to `len` bytes of the file starting at `offset`, or
+    // null if the file isn't that large. The data remains valid until the
+    // next call. We read ahead into a window buffer, so that walking
+    // consecutive objects takes few system calls.
+    const char* fetch(uint64_t offset, uint64_t len) {
+        if ( offset >= _window_offset && offset - _window_offset + len <= _window_size )
+            return _window.data() + (offset - _window_offset);
+
+        _window.resize(std::max(len, ReadWindowSize));
+        _window_offset = offset;
+        _window_size = pread(_window.data(), _window.size(), offset);
+
+        if ( _window_size < len )
+            return nullptr;
+
+        return _window.data();
+    }
+
+    // Reads up to `len` bytes at `offset`, returning how many we got.
+    uint64_t pread(char* dst, uint64_t len, uint64_t offset) {
+        uint64_t n = 0;
+
+        while ( n < len ) {
+            auto rc = ::pread(_fd, dst + n, len - n, static_cast<off_t>(offset + n));
+            if ( rc < 0 && errno == EINTR )
+                continue;
+
+            if ( rc <= 0 )
+                break;
+
+            n += rc;
+        }
+
+        return n;
+    }
+
+    bool decodeEntry(const char* object, uint64_t size, const std::vector<std::string>& prefixes, Entry* entry,
+                     std::string* buffer) {
+        if ( size < EntryItems )
+            return false;
+
+        entry->realtime = le64(object + EntryRealtime);
+        entry->values.assign(prefixes.size(), std::nullopt);
+
+        // Fetching the data objects below moves the window, so copy the items first.
+        _items.assign(object + EntryItems, size - EntryItems);
+
+        auto item_size = (_compact ? EntryItemSizeCompact : EntryItemSize);
+        auto items = _items.size() / item_size;
+        auto missing = prefixes.size();
+
+        for ( uint64_t i = 0; i < items && missing > 0; i++ ) {
+            auto item = _items.data() + i * item_size;
+            auto data = (_compact ? le32(item) : le64(item));
+
+            if ( data == 0 || data % 8 != 0 )
+                continue;
+
+            auto header = fetch(data, ObjectHeaderSize);
+            if ( ! header || u8(header) != ObjectData )
+                continue;
+
+            auto flags = u8(header + 1);
+            auto data_size = le64(header + 8);
+            auto payload = (_compact ? DataPayloadCompact : DataPayload);
+            if ( data_size < payload || data_size > MaxObjectSize )
+                continue;
+
+            auto object = fetch(data, data_size);
+            if ( ! object )
+                continue;
+
+            auto field = std::string_view(object + payload, data_size - payload);
+
+            if ( flags & ObjectCompressed ) {
+                if ( ! Decompressor::get().decompress(flags, field.data(), field.size(), buffer) )
+                    continue;
+
+                field = *buffer;
+            }
+
+            for ( size_t j = 0; j < prefixes.size(); j++ ) {
+                const auto& prefix = prefixes[j];
+
+                if ( ! entry->values[j] && startsWith(field, prefix) ) {
+                    entry->values[j] = std::string(field.substr(prefix.size()));
+                    --missing;
+                    break;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    static bool startsWith(std::string_view s, std::string_view prefix) {
+        return s.size() >= prefix.size() && memcmp(s.data(), prefix.data(), prefix.size()) == 0;
+    }
+
+    filesystem::path _path;
+    int _fd = -1;
+    dev_t _dev = 0;
+    ino_t _ino = 0;
+    char _header[HeaderSizeMin] = {}; // file header as of the last read
+    std::string _window;              // buffer holding data read from the file
+    uint64_t _window_offset = 0;      // file offset of the window's first byte
+    uint64_t _window_size = 0;        // number of valid bytes in the window
+    std::string _items;               // item array of the entry being decoded
+    uint64_t _next = 0;               // offset of the next object to examine
+    bool _compact = false;            // true if the file uses the compact format
+};
+
+} // namespace zeek::agent::platform::linux::journal
+
+Reader::Reader(std::vector<std::string> fields, std::vector<filesystem::path> directories)
+    : _directories(std::move(directories)) {
+    for ( auto& f : fields )
+        _fields.push_back(f + "=");
+}
+
+Reader::~Reader() {
+    if ( _inotify_fd >= 0 )
+        ::close(_inotify_fd);
+}
+
+Result<Nothing> Reader::open() {
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ( _inotify_fd < 0 )
+        ZEEK_AGENT_DEBUG("journal", "inotify not available, will poll for changes");
+
+    scanDirectories(true);
+
+    if ( _files.empty() )
+        return result::Error("no journal files found");
+
+    return Nothing();
+}
+
+size_t Reader::read(const std::function<void(const Entry&)>& callback) {
+    if ( _rescan || std::chrono::steady_clock::now() - _last_scan >= RescanInterval )
+        scanDirectories(false);
+
+    size_t n = 0;
+
+    for ( auto i = _files.begin(); i != _files.end(); ) {
+        n += (*i)->read(_fields, &_entry, &_decompressed, callback);
+
+        // Let go of files that journald is done with. It archives files when
+        // rotating them, and takes files offline when it's idle or doesn't
+        // need them anymore (e.g., after flushing /run to /var). We remember
+        // where we left off with the latter, in case they come back online.
+        switch ( (*i)->state() ) {
+            case StateOnline: ++i; break;
+
+            case StateOffline:
+                ZEEK_AGENT_DEBUG("journal", "{} went offline, closing", (*i)->path().native());
+                _offline[(*i)->path()] = {(*i)->id(), (*i)->next()};
+                i = _files.erase(i);
+                break;
+
+            default:
+                ZEEK_AGENT_DEBUG("journal", "{} has been archived, closing", (*i)->path().native());
+                i = _files.erase(i);
+                break;
+        }
+    }
+
+    return n;
+}
+
+bool Reader::wait(std::chrono::milliseconds timeout) {
+    if ( _inotify_fd < 0 ) {
+        // Without notifications, we can't tell if new files showed up.
+        std::this_thread::sleep_for(timeout);
+        _rescan = true;
+        return true;
+    }
+
+    struct pollfd p = {.fd = _inotify_fd, .events = POLLIN, .revents = 0};
+    if ( ::poll(&p, 1, static_cast<int>(timeout.count())) <= 0 )
+        return false;
+
+    alignas(struct inotify_event) char buffer[4096];
+
+    while ( true ) {
+        auto n = ::read(_inotify_fd, buffer, sizeof(buffer));
+        if ( n <= 0 )
+            break;
+
+        for ( char* p = buffer; p < buffer + n; ) {
+            auto ev = reinterpret_cast<struct inotify_event*>(p);
+            if ( ev->mask & (IN_CREATE | IN_MOVED_TO | IN_Q_OVERFLOW) )
+                _rescan = true;
+
+            // Pick up offline files again once journald writes to them.
+            if ( ev->len > 0 && std::any_of(_offline.begin(), _offline.end(), [&](const auto& f) {
+                     return f.first.filename() == ev->name;
+                 }) )
+                _rescan = true;
+
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    return true;
+}
+
+void Reader::scanDirectories(bool at_tail) {
+    for ( const auto& dir : _directories ) {
+        std::error_code ec;
+        if ( ! filesystem::is_directory(dir, ec) )
+            continue;
+
+        scanDirectory(dir, at_tail);
+
+        // journald places files into subdirectories named after the machine ID.
+        for ( const auto& sub : filesystem::directory_iterator(dir, ec) ) {
+            if ( sub.is_directory(ec) )
+                scanDirectory(sub.path(), at_tail);
+        }
+    }
+
+    // Forget offline files that have gone away.
+    for ( auto i = _offline.begin(); i != _offline.end(); ) {
+        std::error_code ec;
+        if ( filesystem::exists(i->first, ec) )
+            ++i;
+        else
+            i = _offline.erase(i);
+    }
+
+    _rescan = false;
+    _last_scan = std::chrono::steady_clock::now();
+}
+
+void Reader::scanDirectory(const filesystem::path& dir, bool at_tail) {
+    addWatch(dir);
+
+    std::error_code ec;
+    for ( const auto& f : filesystem::directory_iterator(dir, ec) ) {
+        // Only active files change, archived ones have an '@' in their names.
+        auto name = f.path().filename().native();
+        if ( name.find('@') != std::string::npos || f.path().extension() != ".journal" || ! f.is_regular_file(ec) )
+            continue;
+
+        struct stat st;
+        if ( stat(f.path().c_str(), &st) < 0 )
+            continue;
+
+        auto known = std::any_of(_files.begin(), _files.end(), [&](const auto& file) {
+            return file->id() == std::make_pair(st.st_dev, st.st_ino);
+        });
+
+        if ( known )
+            continue;
+
+        // Continue where we left off with files that were offline. We check
+        // them on each rescan, which costs little as long as they stay offline.
+        uint64_t next = 0;
+        if ( auto o = _offline.find(f.path()); o != _offline.end() ) {
+            if ( o->second.id == std::make_pair(st.st_dev, st.st_ino) )
+                next = o->second.next;
+
+            _offline.erase(o);
+        }
+
+        // Files showing up later are new, so we read them from the beginning.
+        if ( auto file = File::open(f.path(), at_tail && ! next, next) )
+            _files.push_back(std::move(file));
+    }
+}
+
+void Reader::addWatch(const filesystem::path& dir) {
+    if ( _inotify_fd < 0 || std::find(_watched.begin(), _watched.end(), dir) != _watched.end() )
+        return;
+
+    // journald truncates files after writing to them, to trigger IN_MODIFY
+    // for readers; it doesn't write() to them.
+    if ( inotify_add_watch(_inotify_fd, dir.c_str(), IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB) >= 0 )
+        _watched.push_back(dir);
+}
+
+namespace {
+
+// Helper writing a minimal journal file for testing, with just data and
+// entry objects, and without hash tables or entry arrays.
+class TestJournalWriter {
+public:
+    TestJournalWriter(const filesystem::path& path, bool compact) : _path(path), _compact(compact) {
+        _data.resize(HeaderSizeMin);
+        memcpy(_data.data(), Signature, sizeof(Signature));
+        put32(HeaderIncompatibleFlags, compact ? IncompatibleCompact : 0);
+        put64(HeaderHeaderSize, HeaderSizeMin);
+        _data[HeaderState] = StateOnline;
+        flush();
+    }
+
+    // If not `complete`, the entry is left the way journald initially adds
+    // it, until `completeEntry()` gets called.
+    void addEntry(uint64_t realtime, const std::vector<std::string>& fields, bool complete = true) {
+        std::vector<uint64_t> offsets;
+
+        for ( const auto& f : fields ) {
+            auto payload = (_compact ? DataPayloadCompact : DataPayload);
+            offsets.push_back(addObject(ObjectData, payload, f));
+        }
+
+        auto item_size = (_compact ? EntryItemSizeCompact : EntryItemSize);
+        std::string items(offsets.size() * item_size, '\0');
+        for ( size_t i = 0; i < offsets.size(); i++ ) {
+            uint64_t x = htole64(offsets[i]);
+            memcpy(items.data() + i * item_size, &x, _compact ? 4 : 8);
+        }
+
+        _entry = addObject(ObjectEntry, EntryItems, items);
+        _realtime = realtime;
+        put64(HeaderTailObjectOffset, _entry);
+
+        if ( complete )
+            completeEntry();
+        else
+            flush();
+    }
+
+    void completeEntry() {
+        put64(_entry + EntrySeqnum, ++_seqnum);
+        put64(_entry + EntryRealtime, _realtime);
+        put64(HeaderTailEntrySeqnum, _seqnum);
+        flush();
+    }
+
+    void setState(uint8_t state) {
+        _data[HeaderState] = static_cast<char>(state);
+        flush();
+    }
+
+private:
+    uint64_t addObject(uint8_t type, uint64_t payload_offset, std::string_view payload) {
+        auto offset = align8(_data.size());
+        _data.resize(offset + payload_offset);
+        _data[offset] = static_cast<char>(type);
+        put64(offset + 8, payload_offset + payload.size());
+        _data.append(payload);
+        return offset;
+    }
+
+    void put32(uint64_t offset, uint32_t x) {
+        x = htole32(x);
+        memcpy(_data.data() + offset, &x, sizeof(x));
+    }
+
+    void put64(uint64_t offset, uint64_t x) {
+        x = htole64(x);
+        memcpy(_data.data() + offset, &x, sizeof(x));
+    }
+
+    void flush() {
+        // Rewrite in place so that the inode stays the same.
+        auto f = std::fstream(_path, std::ios::in | std::ios::out | std::ios::binary);
+        if ( ! f )
+            f = std::fstream(_path, std::ios::out | std::ios::binary);
+
+        f.write(_data.data(), static_cast<std::streamsize>(_data.size()));
+    }
+
+    filesystem::path _path;
+    bool _compact;
+    std::string _data;
+    uint64_t _entry = 0;    // offset of last entry added
+    uint64_t _realtime = 0; // timestamp of last entry added
+    uint64_t _seqnum = 0;   // sequence number of last entry completed
+};
+
+} // namespace
+
+TEST_SUITE("Platform") {
+    TEST_CASE("journal reader") {
+        auto dir = filesystem::temp_directory_path() / frmt("zeek-agent-journal-{}", ::getpid());
+        ScopeGuard _([dir] { filesystem::remove_all(dir); });
+        filesystem::create_directories(dir / "machine-id");
+
+        for ( auto compact : {false, true} ) {
+            CAPTURE(compact);
+
+            auto path = dir / "machine-id" / "system.journal";
+            filesystem::remove(path);
+
+            TestJournalWriter writer(path, compact);
+            writer.addEntry(1, {"MESSAGE=old", "PRIORITY=6"});
+
+            Reader reader({"MESSAGE", "PRIORITY", "_EXE"}, {dir});
+            REQUIRE(reader.open().hasValue());
+            CHECK_EQ(reader.numberFiles(), 1);
+
+            std::vector<Entry> entries;
+            auto collect = [&](const Entry& e) { entries.push_back(e); };
+
+            // Existing entries are skipped.
+            CHECK_EQ(reader.read(collect), 0);
+
+            writer.addEntry(2, {"_BOOT_ID=x", "MESSAGE=new 1", "PRIORITY=3", "MESSAGE=duplicate", "_EXE=/bin/sh"});
+            writer.addEntry(3, {"MESSAGE=new 2"});
+            CHECK_EQ(reader.read(collect), 2);
+            CHECK_EQ(reader.read(collect), 0);
+
+            REQUIRE_EQ(entries.size(), 2);
+            CHECK_EQ(entries[0].realtime, 2U);
+            CHECK_EQ(*entries[0].values[0], "new 1");
+            CHECK_EQ(*entries[0].values[1], "3");
+            CHECK_EQ(*entries[0].values[2], "/bin/sh");
+            CHECK_EQ(entries[1].realtime, 3U);
+            CHECK_EQ(*entries[1].values[0], "new 2");
+            CHECK_FALSE(entries[1].values[1].has_value());
+            CHECK_FALSE(entries[1].values[2].has_value());
+
+            // Entries that journald hasn't finished writing yet are held back.
+            entries.clear();
+            writer.addEntry(4, {"MESSAGE=partial"}, false);
+            CHECK_EQ(reader.read(collect), 0);
+            writer.completeEntry();
+            CHECK_EQ(reader.read(collect), 1);
+
+            // Offline files get closed, and picked up again when coming back online.
+            writer.setState(StateOffline);
+            CHECK_EQ(reader.read(collect), 0);
+            CHECK_EQ(reader.numberFiles(), 0);
+
+            writer.setState(StateOnline);
+            writer.addEntry(5, {"MESSAGE=online"});
+            reader.wait(std::chrono::milliseconds(100));
+            CHECK_EQ(reader.read(collect), 1);
+            CHECK_EQ(reader.numberFiles(), 1);
+
+            REQUIRE_EQ(entries.size(), 2);
+            CHECK_EQ(entries[0].realtime, 4U);
+            CHECK_EQ(*entries[0].values[0], "partial");
+            CHECK_EQ(*entries[1].values[0], "online");
+
+            // Rotation: the old file gets archived and renamed, and a new one shows up.
+            writer.addEntry(6, {"MESSAGE=last"});
+            writer.setState(StateArchived);
+            filesystem::rename(path, dir / "machine-id" / "system@0001.journal");
+
+            TestJournalWriter writer2(path, compact);
+            writer2.addEntry(7, {"MESSAGE=first"});
+
+            reader.wait(std::chrono::milliseconds(100));
+            entries.clear();
+            CHECK_EQ(reader.read(collect), 2);
+            REQUIRE_EQ(entries.size(), 2);
+            CHECK_EQ(*entries[0].values[0], "last");
+            CHECK_EQ(*entries[1].values[0], "first");
+            CHECK_EQ(reader.numberFiles(), 1);
+        }
+    }
+
+    TEST_CASE("journal reader without files") {
+        Reader reader({"MESSAGE"}, {"/does/not/exist"});
+        CHECK_FALSE(reader.open().hasValue());
+    }
+}
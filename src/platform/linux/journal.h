@@ -0,0 +1,121 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Reader for systemd journal files, following what journald appends to them.
+// It reads the files' objects and decodes the on-disk format directly,
+// without going through libsystemd or journalctl. See
+// https://systemd.io/JOURNAL_FILE_FORMAT for the format.
+
+#pragma once
+
+#include "util/filesystem.h"
+#include "util/result.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace zeek::agent::platform::linux::journal {
+
+/** Default directories that journald stores its files in. */
+inline const std::vector<filesystem::path> DefaultDirectories = {"/run/log/journal", "/var/log/journal"};
+
+/** A journal entry, limited to the fields that the reader was asked for. */
+struct Entry {
+    uint64_t realtime = 0; /**< wallclock time of the entry, in microseconds since the epoch */
+
+    /**
+     * Values of the requested fields, in the order they were passed to the
+     * reader; unset if not present in the entry. If a field appears
+     * multiple times, this is the first value.
+     */
+    std::vector<std::optional<std::string>> values;
+};
+
+class File;
+
+/**
+ * Reader following the active journal files in a set of directories. It
+ * picks up files that journald creates or rotates while running, and lets
+ * go of files once journald archives them or takes them offline. Entries
+ * are reported in the order they appear within each file, but not merged
+ * across files.
+ *
+ * Instances are not thread-safe.
+ */
+class Reader {
+public:
+    /**
+     * Constructor.
+     *
+     * @param fields names of the fields to extract from entries
+     * @param directories directories to search for journal files, including their immediate subdirectories
+     */
+    Reader(std::vector<std::string> fields, std::vector<filesystem::path> directories = DefaultDirectories);
+    ~Reader();
+
+    Reader(const Reader& other) = delete;
+    Reader(Reader&& other) = delete;
+    Reader& operator=(const Reader& other) = delete;
+    Reader& operator=(Reader&& other) = delete;
+
+    /**
+     * Opens all active journal files, positioning the reader at their
+     * current ends, and sets up notification for changes.
+     *
+     * @returns an error if no journal file could be opened
+     */
+    Result<Nothing> open();
+
+    /**
+     * Reads entries appended since the last call, or since `open()` for the
+     * first call.
+     *
+     * @param callback function receiving each new entry; the entry remains valid only during the call
+     * @returns the number of entries read
+     */
+    size_t read(const std::function<void(const Entry&)>& callback);
+
+    /**
+     * Blocks until journald changes any of the files, or the timeout
+     * expires.
+     *
+     * @returns true if there may be changes to read
+     */
+    bool wait(std::chrono::milliseconds timeout);
+
+    /** Returns the number of journal files currently being followed. */
+    size_t numberFiles() const { return _files.size(); }
+
+private:
+    // A file that we stopped following because journald took it offline.
+    struct OfflineFile {
+        std::pair<dev_t, ino_t> id; // file's identity
+        uint64_t next;              // offset to continue reading at if it comes back online
+    };
+
+    void scanDirectories(bool at_tail);
+    void scanDirectory(const filesystem::path& dir, bool at_tail);
+    void addWatch(const filesystem::path& dir);
+
+    std::vector<std::string> _fields;                 // as passed into constructor
+    std::vector<filesystem::path> _directories;       // as passed into constructor
+    std::vector<std::unique_ptr<File>> _files;        // files currently being followed
+    std::map<filesystem::path, OfflineFile> _offline; // files closed after journald took them offline
+    std::vector<filesystem::path> _watched;           // directories with an inotify watch
+    int _inotify_fd = -1;                             // inotify FD, or -1 if not available
+    bool _rescan = false;                             // true if directories need to be rescanned for new files
+    std::chrono::steady_clock::time_point _last_scan; // time directories were last scanned
+    Entry _entry;                                     // entry being decoded, reused across calls
+    std::string _decompressed;                        // buffer for decompressing data objects
+};
+
+} // namespace zeek::agent::platform::linux::journal
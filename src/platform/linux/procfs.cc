@@ -0,0 +1,464 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#include "procfs.h"
+
+#include "util/benchmark.h"
+#include "util/testing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <pfs/procfs.hpp>
+
+using namespace zeek::agent::platform::linux::procfs;
+
+// Layout of entries returned by getdents64(), which glibc doesn't declare.
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Skips to beginning of next space-separated field.
+static const char* skipField(const char* p, const char* end) {
+    while ( p < end && *p != ' ' )
+        ++p;
+
+    while ( p < end && *p == ' ' )
+        ++p;
+
+    return p;
+}
+
+// Parses a signed decimal integer at the beginning of `p`, advancing it.
+static bool parseSigned(const char** p, const char* end, int64_t* result) {
+    const char* s = *p;
+    bool negative = false;
+
+    if ( s < end && *s == '-' ) {
+        negative = true;
+        ++s;
+    }
+
+    if ( s == end || *s < '0' || *s > '9' )
+        return false;
+
+    uint64_t x = 0;
+    while ( s < end && *s >= '0' && *s <= '9' )
+        x = x * 10 + (*s++ - '0');
+
+    *result = negative ? -static_cast<int64_t>(x) : static_cast<int64_t>(x);
+    *p = s;
+    return true;
+}
+
+// Parses an unsigned decimal integer at the beginning of `p`, advancing it.
+static bool parseUnsigned(const char** p, const char* end, uint64_t* result) {
+    const char* s = *p;
+
+    if ( s == end || *s < '0' || *s > '9' )
+        return false;
+
+    uint64_t x = 0;
+    while ( s < end && *s >= '0' && *s <= '9' )
+        x = x * 10 + (*s++ - '0');
+
+    *result = x;
+    *p = s;
+    return true;
+}
+
+// Parses the first two values of a "Uid:" or "Gid:" line in
+// `/proc/<pid>/status`, which are the real and effective IDs.
+static bool parseIDs(const char* data, const char* end, const char* key, int64_t* real, int64_t* effective) {
+    auto key_len = strlen(key);
+
+    for ( const char* p = data; p < end; ) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if ( ! eol )
+            eol = end;
+
+        if ( static_cast<size_t>(eol - p) > key_len && memcmp(p, key, key_len) == 0 ) {
+            p += key_len;
+
+            while ( p < eol && (*p == '\t' || *p == ' ') )
+                ++p;
+
+            if ( ! parseSigned(&p, eol, real) )
+                return false;
+
+            while ( p < eol && (*p == '\t' || *p == ' ') )
+                ++p;
+
+            return parseSigned(&p, eol, effective);
+        }
+
+        p = eol + 1;
+    }
+
+    return false;
+}
+
+Reader::Reader(const char* root) { _root_fd = ::open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC); }
+
+Reader::~Reader() {
+    if ( _root_fd >= 0 )
+        ::close(_root_fd);
+}
+
+bool Reader::parseInt(const char* s, int64_t* result) {
+    uint64_t x;
+    const char* end = s + strlen(s);
+
+    if ( ! parseUnsigned(&s, end, &x) || s != end )
+        return false;
+
+    *result = static_cast<int64_t>(x);
+    return true;
+}
+
+void Reader::formatPath(char (&path)[32], int64_t pid, const char* file) {
+    char digits[24];
+    int n = 0;
+
+    do {
+        digits[n++] = static_cast<char>('0' + (pid % 10));
+        pid /= 10;
+    } while ( pid > 0 && n < static_cast<int>(sizeof(digits)) );
+
+    char* p = path;
+    while ( n > 0 )
+        *p++ = digits[--n];
+
+    *p++ = '/';
+
+    auto len = std::min(strlen(file), sizeof(path) - (p - path) - 1);
+    memcpy(p, file, len);
+    p[len] = '\0';
+}
+
+int Reader::openDirectory(const char* path) const {
+    return ::openat(_root_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+void Reader::closeDirectory(int fd) const { ::close(fd); }
+
+bool Reader::rewindDirectory(int fd) { return ::lseek(fd, 0, SEEK_SET) == 0; }
+
+long Reader::readDirectory(int fd, char (&dirents)[DirentsSize]) {
+    return ::syscall(SYS_getdents64, fd, dirents, sizeof(dirents));
+}
+
+const char* Reader::nextDirectoryEntry(const char (&dirents)[DirentsSize], long* offset) {
+    auto d = reinterpret_cast<const linux_dirent64*>(dirents + *offset);
+    *offset += d->d_reclen;
+
+    if ( d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')) )
+        return nullptr;
+
+    return d->d_name;
+}
+
+bool Reader::readSocketLink(int dirfd, const char* name, ino_t* inode) {
+    char target[64];
+    auto n = ::readlinkat(dirfd, name, target, sizeof(target));
+    if ( n <= 0 )
+        return false;
+
+    // Socket links look like "socket:[<inode>]".
+    if ( n < 10 || memcmp(target, "socket:[", 8) != 0 || target[n - 1] != ']' )
+        return false;
+
+    const char* p = target + 8;
+    uint64_t x;
+    if ( ! parseUnsigned(&p, target + n - 1, &x) )
+        return false;
+
+    *inode = static_cast<ino_t>(x);
+    return true;
+}
+
+ssize_t Reader::readFile(const char* path) {
+    int fd = ::openat(_root_fd, path, O_RDONLY | O_CLOEXEC);
+    if ( fd < 0 )
+        return -1;
+
+    ssize_t len = 0;
+    while ( len < static_cast<ssize_t>(sizeof(_buffer)) - 1 ) {
+        auto n = ::read(fd, _buffer + len, sizeof(_buffer) - 1 - len);
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            len = -1;
+            break;
+        }
+
+        if ( n == 0 )
+            break;
+
+        len += n;
+    }
+
+    ::close(fd);
+
+    if ( len >= 0 )
+        _buffer[len] = '\0';
+
+    return len;
+}
+
+bool Reader::readProcess(int64_t pid, Process* process) {
+    char path[32];
+
+    // Parse /proc/<pid>/stat, which looks like this, with the name possibly
+    // containing spaces and parentheses itself:
+    //
+    //   <pid> (<comm>) <state> <ppid> <pgrp> ...
+    formatPath(path, pid, "stat");
+    auto len = readFile(path);
+    if ( len <= 0 )
+        return false;
+
+    const char* end = _buffer + len;
+    const char* lparen = static_cast<const char*>(memchr(_buffer, '(', len));
+    const char* rparen = static_cast<const char*>(memrchr(_buffer, ')', len));
+    if ( ! lparen || ! rparen || rparen < lparen )
+        return false;
+
+    auto comm_len = std::min(static_cast<size_t>(rparen - lparen - 1), CommMax - 1);
+    memcpy(process->comm, lparen + 1, comm_len);
+    process->comm[comm_len] = '\0';
+    process->pid = pid;
+
+    // Fields following the name, numbered as in proc(5).
+    const char* p = rparen + 2; // field 3, state
+    int field = 3;
+
+    auto advance_to = [&](int target) {
+        while ( field < target && p < end ) {
+            p = skipField(p, end);
+            ++field;
+        }
+
+        return p < end;
+    };
+
+    int64_t x;
+    uint64_t u;
+
+    if ( ! (advance_to(4) && parseSigned(&p, end, &x)) )
+        return false;
+
+    process->ppid = x;
+
+    if ( ! (advance_to(14) && parseUnsigned(&p, end, &u)) )
+        return false;
+
+    process->utime = u;
+
+    if ( ! (advance_to(15) && parseUnsigned(&p, end, &u)) )
+        return false;
+
+    process->stime = u;
+
+    if ( ! (advance_to(18) && parseSigned(&p, end, &x)) )
+        return false;
+
+    process->priority = x;
+
+    if ( ! (advance_to(22) && parseUnsigned(&p, end, &u)) )
+        return false;
+
+    process->starttime = u;
+
+    if ( ! (advance_to(23) && parseUnsigned(&p, end, &u)) )
+        return false;
+
+    process->vsize = u;
+
+    if ( ! (advance_to(24) && parseSigned(&p, end, &x)) )
+        return false;
+
+    process->rss = x;
+
+    // Parse the IDs out of /proc/<pid>/status.
+    formatPath(path, pid, "status");
+    len = readFile(path);
+    if ( len <= 0 )
+        return false;
+
+    end = _buffer + len;
+    return parseIDs(_buffer, end, "Uid:", &process->ruid, &process->uid) &&
+           parseIDs(_buffer, end, "Gid:", &process->rgid, &process->gid);
+}
+
+bool Reader::readComm(int64_t pid, char (&comm)[CommMax]) {
+    char path[32];
+    formatPath(path, pid, "comm");
+
+    auto len = readFile(path);
+    if ( len <= 0 )
+        return false;
+
+    if ( _buffer[len - 1] == '\n' )
+        --len;
+
+    auto n = std::min(static_cast<size_t>(len), CommMax - 1);
+    memcpy(comm, _buffer, n);
+    comm[n] = '\0';
+    return true;
+}
+
+TEST_SUITE("Platform") {
+    TEST_CASE("procfs parse int") {
+        int64_t x;
+        CHECK(Reader::parseInt("0", &x));
+        CHECK_EQ(x, 0);
+        CHECK(Reader::parseInt("4194304", &x));
+        CHECK_EQ(x, 4194304);
+        CHECK_FALSE(Reader::parseInt("", &x));
+        CHECK_FALSE(Reader::parseInt("self", &x));
+        CHECK_FALSE(Reader::parseInt("12a", &x));
+        CHECK_FALSE(Reader::parseInt("-1", &x));
+    }
+
+    TEST_CASE("procfs read process") {
+        Reader reader;
+        REQUIRE(reader.isOpen());
+
+        Process p;
+        REQUIRE(reader.readProcess(getpid(), &p));
+        CHECK_EQ(p.pid, getpid());
+        CHECK_EQ(p.ppid, getppid());
+        CHECK_EQ(p.uid, geteuid());
+        CHECK_EQ(p.ruid, getuid());
+        CHECK_EQ(p.gid, getegid());
+        CHECK_EQ(p.rgid, getgid());
+        CHECK(p.vsize > 0);
+        CHECK(p.rss > 0);
+        CHECK(p.starttime > 0);
+
+        char comm[CommMax];
+        REQUIRE(reader.readComm(getpid(), comm));
+        CHECK_EQ(std::string(comm), std::string(p.comm));
+
+        bool found_self = false;
+        CHECK(reader.forEachProcess([&](int64_t pid) {
+            if ( pid == getpid() )
+                found_self = true;
+
+            return true;
+        }));
+
+        CHECK(found_self);
+        CHECK_FALSE(reader.readProcess(0, &p));
+    }
+
+    TEST_CASE("procfs sockets") {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        REQUIRE(fd >= 0);
+
+        struct stat st;
+        REQUIRE_EQ(fstat(fd, &st), 0);
+
+        Reader reader;
+        bool found = false;
+        CHECK(reader.forEachSocket(getpid(), [&](ino_t inode) {
+            if ( inode == st.st_ino )
+                found = true;
+
+            return true;
+        }));
+
+        CHECK(found);
+        close(fd);
+    }
+}
+
+// Compare our reader against pfs, which we used before. To measure with a
+// large number of processes, spawn them before running `zeek-agent
+// --bench=procfs/`.
+
+ZEEK_AGENT_BENCHMARK("procfs/processes") {
+    while ( state.keepRunning() ) {
+        Reader reader;
+        Process p;
+        int64_t n = 0;
+        reader.forEachProcess([&](int64_t pid) {
+            if ( reader.readProcess(pid, &p) )
+                ++n;
+
+            return true;
+        });
+
+        state.setItemsPerIteration(n);
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("procfs/processes-pfs") {
+    while ( state.keepRunning() ) {
+        int64_t n = 0;
+        pfs::procfs pfs;
+
+        for ( const auto& p : pfs.get_processes() ) {
+            try {
+                p.get_stat();
+                p.get_status();
+                p.get_comm();
+                ++n;
+            } catch ( const std::exception& ) {
+            }
+        }
+
+        state.setItemsPerIteration(n);
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("procfs/sockets") {
+    while ( state.keepRunning() ) {
+        Reader reader;
+        int64_t n = 0;
+        reader.forEachProcess([&](int64_t pid) {
+            reader.forEachSocket(pid, [&](ino_t) {
+                ++n;
+                return true;
+            });
+
+            return true;
+        });
+
+        state.setItemsPerIteration(n);
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("procfs/sockets-pfs") {
+    while ( state.keepRunning() ) {
+        int64_t n = 0;
+        pfs::procfs pfs;
+
+        for ( const auto& p : pfs.get_processes() ) {
+            try {
+                for ( const auto& [id, fd] : p.get_fds() ) {
+                    try {
+                        fd.get_target_stat();
+                        ++n;
+                    } catch ( const std::exception& ) {
+                    }
+                }
+            } catch ( const std::exception& ) {
+            }
+        }
+
+        state.setItemsPerIteration(n);
+    }
+}
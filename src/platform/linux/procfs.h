@@ -0,0 +1,176 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Minimal reader for the /proc file system, optimized for the snapshot
+// tables' hot paths. It parses just the fields we need, works relative to a
+// directory FD, and does not allocate memory or throw exceptions; errors
+// are reported through return values.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+
+namespace zeek::agent::platform::linux::procfs {
+
+/** Maximum length of a process name, including the terminating null byte (TASK_COMM_LEN). */
+constexpr size_t CommMax = 16;
+
+/** Process information collected from `/proc/<pid>/{stat,status}`. */
+struct Process {
+    int64_t pid = 0;          /**< process ID */
+    char comm[CommMax] = {0}; /**< null-terminated process name */
+    int64_t ppid = 0;         /**< parent's process ID */
+    int64_t priority = 0;     /**< scheduling priority, as reported by `stat` */
+    uint64_t utime = 0;       /**< user CPU time, in clock ticks */
+    uint64_t stime = 0;       /**< system CPU time, in clock ticks */
+    uint64_t starttime = 0;   /**< time the process started, in clock ticks since boot */
+    uint64_t vsize = 0;       /**< virtual memory size, in bytes */
+    int64_t rss = 0;          /**< resident set size, in pages */
+    int64_t uid = 0;          /**< effective user ID */
+    int64_t gid = 0;          /**< effective group ID */
+    int64_t ruid = 0;         /**< real user ID */
+    int64_t rgid = 0;         /**< real group ID */
+};
+
+/**
+ * Reader for `/proc`. An instance keeps an FD to the root directory open, plus
+ * an internal buffer for reading files, so it's cheap to reuse across many
+ * processes. Instances are not thread-safe, use one per thread.
+ */
+class Reader {
+public:
+    /**
+     * Constructor opening `/proc`.
+     *
+     * @param root path to the proc file system, for testing
+     */
+    Reader(const char* root = "/proc");
+    ~Reader();
+
+    Reader(const Reader& other) = delete;
+    Reader(Reader&& other) = delete;
+    Reader& operator=(const Reader& other) = delete;
+    Reader& operator=(Reader&& other) = delete;
+
+    /** Returns true if `/proc` could be opened. */
+    bool isOpen() const { return _root_fd >= 0; }
+
+    /**
+     * Calls a function for each process currently listed in `/proc`. The
+     * iteration stops early if the callback returns false.
+     *
+     * @param callback function receiving each PID
+     * @returns false if the directory could not be read
+     */
+    template<typename Callback>
+    bool forEachProcess(Callback callback) {
+        return iterateDirectory(_root_fd, _root_dirents, [&](const char* name) {
+            int64_t pid;
+            if ( ! parseInt(name, &pid) || pid <= 0 )
+                return true;
+
+            return callback(pid);
+        });
+    }
+
+    /**
+     * Reads the information for a process.
+     *
+     * @param pid process to read
+     * @param process receives the information
+     * @returns false if the information could not be read, most likely
+     * because of missing permissions or because the process is gone
+     */
+    bool readProcess(int64_t pid, Process* process);
+
+    /**
+     * Reads just the name of a process.
+     *
+     * @param pid process to read
+     * @param comm buffer receiving the null-terminated name
+     * @returns false if the name could not be read
+     */
+    bool readComm(int64_t pid, char (&comm)[CommMax]);
+
+    /**
+     * Calls a function for the inode of each socket that a process has open,
+     * as found through the links in `/proc/<pid>/fd`. The iteration stops
+     * early if the callback returns false.
+     *
+     * @param pid process to examine
+     * @param callback function receiving each socket inode
+     * @returns false if the process' FDs could not be read
+     */
+    template<typename Callback>
+    bool forEachSocket(int64_t pid, Callback callback) {
+        char path[32];
+        formatPath(path, pid, "fd");
+
+        int fd = openDirectory(path);
+        if ( fd < 0 )
+            return false;
+
+        auto rc = iterateDirectory(fd, _fd_dirents, [&](const char* name) {
+            ino_t inode;
+            if ( ! readSocketLink(fd, name, &inode) )
+                return true;
+
+            return callback(inode);
+        });
+
+        closeDirectory(fd);
+        return rc;
+    }
+
+    /**
+     * Parses a non-negative decimal integer that must make up the full
+     * string.
+     *
+     * @returns false if the string is not a valid integer
+     */
+    static bool parseInt(const char* s, int64_t* result);
+
+private:
+    static constexpr size_t DirentsSize = 16384;
+
+    // Calls function for each entry in directory, skipping "." and "..".
+    template<typename Callback>
+    bool iterateDirectory(int fd, char (&dirents)[DirentsSize], Callback callback) {
+        if ( ! rewindDirectory(fd) )
+            return false;
+
+        while ( true ) {
+            auto n = readDirectory(fd, dirents);
+            if ( n < 0 )
+                return false;
+
+            if ( n == 0 )
+                return true;
+
+            for ( long offset = 0; offset < n; ) {
+                const char* name = nextDirectoryEntry(dirents, &offset);
+                if ( name && ! callback(name) )
+                    return true;
+            }
+        }
+    }
+
+    static void formatPath(char (&path)[32], int64_t pid, const char* file);
+    static bool rewindDirectory(int fd);
+    static long readDirectory(int fd, char (&dirents)[DirentsSize]);
+    static const char* nextDirectoryEntry(const char (&dirents)[DirentsSize], long* offset);
+    static bool readSocketLink(int dirfd, const char* name, ino_t* inode);
+
+    int openDirectory(const char* path) const;
+    void closeDirectory(int fd) const;
+    ssize_t readFile(const char* path);
+
+    int _root_fd = -1;                          // FD for /proc
+    alignas(8) char _root_dirents[DirentsSize]; // buffer for iterating /proc
+    alignas(8) char _fd_dirents[DirentsSize];   // buffer for iterating /proc/<pid>/fd
+    char _buffer[4096];                         // buffer for reading files
+};
+
+} // namespace zeek::agent::platform::linux::procfs
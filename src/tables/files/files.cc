@@ -3,11 +3,13 @@
 #include "files.h"
 
 #include "autogen/config.h"
+#include "core/logger.h"
 #include "util/helpers.h"
 #include "util/testing.h"
 
 #include <algorithm>
 #include <filesystem>
+#include <sstream>
 #include <variant>
 
 using namespace zeek::agent;
@@ -42,6 +44,25 @@ Result<table::FilesColumnsCommon::Columns> table::FilesColumnsCommon::parseColum
     return columns;
 }
 
+void table::FilesBase::expandPaths(const std::string& pattern,
+                                   const std::function<void(const filesystem::path& path)>& callback) {
+    auto limit = static_cast<size_t>(options().glob_limit);
+
+    auto truncated = forEachGlobMatch(pattern, limit, [&](const filesystem::path& p) {
+        callback(p);
+        return true;
+    });
+
+    if ( ! truncated ) {
+        _truncated_patterns.erase(pattern);
+        return;
+    }
+
+    if ( _truncated_patterns.insert(pattern).second )
+        logger()->warn("pattern '{}' matches more than {} paths, ignoring the rest (see option 'glob-limit')", pattern,
+                       limit);
+}
+
 TEST_SUITE("Tables") {
     TEST_CASE("files_columns - parse spec") {
         using Columns = table::FilesColumnsCommon::Columns;
@@ -79,6 +100,13 @@ TEST_CASE_FIXTURE(test::TableFixture, "files_list" * doctest::test_suite("Tables
 
     result = query(frmt("SELECT path from files_list(\"{}\")", (dir / "sub" / "*").string()));
     REQUIRE_EQ(result.rows.size(), 2);
+
+    std::stringstream limit;
+    limit << "glob-limit = 2\n";
+    REQUIRE(cfg.read(limit, "<test>"));
+
+    result = query(frmt("SELECT path from files_list(\"{}\")", (dir / "*").string()));
+    REQUIRE_EQ(result.rows.size(), 2);
 }
 
 TEST_CASE_FIXTURE(test::TableFixture, "files_lines" * doctest::test_suite("Tables")) {
@@ -2,6 +2,8 @@
 
 #include "core/table.h"
 
+#include <functional>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -10,12 +12,24 @@ namespace zeek::agent::table {
 
 class FilesBase : public SnapshotTable {
 protected:
-    std::pair<std::string, std::vector<filesystem::path>> expandPaths(const std::vector<table::Argument>& args);
+    /**
+     * Expands a glob pattern, passing all matching paths to a callback as
+     * they are found. If the pattern matches more paths than the
+     * `glob-limit` option permits, this ignores the rest. It logs a warning
+     * about that once, until the pattern stays within the limit again.
+     *
+     * @param pattern glob to expand
+     * @param callback function receiving the matching paths
+     */
+    void expandPaths(const std::string& pattern, const std::function<void(const filesystem::path& path)>& callback);
+
+private:
+    std::set<std::string> _truncated_patterns; // patterns we have warned about matching too many paths
 };
 
 class FilesListCommon : public FilesBase {
 public:
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             // clang-format off
             .name = "files_list",
@@ -50,7 +64,7 @@ public:
 
 class FilesLinesCommon : public FilesBase {
 public:
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             // clang-format off
             .name = "files_lines",
@@ -79,7 +93,7 @@ public:
 
 class FilesColumnsCommon : public FilesBase {
 public:
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             // clang-format off
             .name = "files_columns",
@@ -146,4 +160,79 @@ public:
     static Result<Columns> parseColumnsSpec(const std::string& spec);
 };
 
+class FilesHashesCommon : public FilesBase {
+public:
+    Schema buildSchema() const override {
+        return {
+            // clang-format off
+            .name = "files_hashes",
+            .summary = "cryptographic hashes of selected files",
+            .description = R"(
+                The table returns SHA256 and MD5 hashes of the content of
+                selected files, for monitoring their integrity. The files of
+                interest get specified through a mandatory table parameter,
+                which is a glob matching all relevant paths. For example,
+                `SELECT path, sha256 FROM files_hashes("/usr/bin/*")` will
+                hash all system binaries.
+
+                The table remembers hashes across queries. It hashes a file
+                again only if its device, inode, size, modification time, or
+                status change time have changed since it computed the previous
+                hash, so repeating a query over files that don't change costs
+                little more than a `stat()` for each. Paths that aren't regular
+                files, or can't be read, are returned with their hashes unset.
+                )",
+            .platforms = { Platform::Darwin, Platform::Linux },
+            .columns = {
+                {.name = "_pattern", .type = value::Type::Text, .summary = "glob matching all files of interest", .is_parameter = true },
+                {.name = "path", .type = value::Type::Text, .summary = "absolute path" },
+                {.name = "size", .type = value::Type::Count, .summary = "file size in bytes"},
+                {.name = "mtime", .type = value::Type::Time, .summary = "time of last modification"},
+                {.name = "sha256", .type = value::Type::Text, .summary = "SHA256 hash of the file's content, as hex string"},
+                {.name = "md5", .type = value::Type::Text, .summary = "MD5 hash of the file's content, as hex string"},
+        }
+            // clang-format on
+        };
+    }
+};
+
+class FilesTailEventsCommon : public EventTable {
+public:
+    Schema buildSchema() const override {
+        return {
+            // clang-format off
+            .name = "files_tail_events",
+            .summary = "lines appended to selected ASCII files",
+            .description = R"(
+                The table follows selected ASCII files, similar to `tail -F`,
+                and returns lines appended to them as events. The files of
+                interest get specified through a mandatory table parameter,
+                which is a glob matching all relevant paths. For example,
+                `SELECT * FROM files_tail_events("/var/log/auth.log")` will
+                return new authentication messages as they get logged.
+
+                Once a query starts, the table returns only lines that get
+                appended after that. For files that the pattern starts matching
+                later, that includes all their content. The table keeps
+                following files when they get rotated or truncated. Unlike
+                `files_lines`, it reads only new data as it arrives, instead of
+                whole files on every query.
+
+                This is an evented table that captures lines as they appear.
+                New lines will be returned with the next query. The pattern
+                needs to be a constant.
+                )",
+            .platforms = { Platform::Linux },
+            .columns = {
+                {.name = "_pattern", .type = value::Type::Text, .summary = "glob matching all files of interest", .is_parameter = true },
+                {.name = "time", .type = value::Type::Time, .summary = "time line was read"},
+                {.name = "path", .type = value::Type::Text, .summary = "absolute path" },
+                {.name = "offset", .type = value::Type::Count, .summary = "offset of line inside the file"},
+                {.name = "content", .type = value::Type::Blob, .summary = "content of line, without line terminator"},
+        }
+            // clang-format on
+        };
+    }
+};
+
 } // namespace zeek::agent::table
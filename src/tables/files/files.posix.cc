@@ -8,7 +8,9 @@
 #include "platform/platform.h"
 #include "util/fmt.h"
 #include "util/helpers.h"
+#include "util/line-reader.h"
 
+#include <string_view>
 #include <variant>
 
 #include <regex.h>
@@ -36,26 +38,43 @@ namespace {
 database::RegisterTable<FilesListPosix> _1;
 database::RegisterTable<FilesLinesPosix> _2;
 database::RegisterTable<FilesColumnsPosix> _3;
-} // namespace
 
-std::pair<std::string, std::vector<filesystem::path>> FilesBase::expandPaths(const std::vector<table::Argument>& args) {
-    std::pair<std::string, std::vector<filesystem::path>> result;
+// Returns true if a regular expression matches a string, without requiring
+// the string to be null-terminated if the platform supports that.
+bool regexMatches(const regex_t& re, std::string_view s) {
+#ifdef REG_STARTEND
+    regmatch_t m;
+    m.rm_so = 0;
+    m.rm_eo = static_cast<regoff_t>(s.size());
+    return regexec(&re, s.data(), 1, &m, REG_STARTEND) == 0;
+#else
+    return regexec(&re, std::string(s).c_str(), 0, nullptr, 0) == 0;
+#endif
+}
 
-    auto pattern = Table::getArgument<std::string>(args, "_pattern");
-    result.first = pattern;
+// State that files_columns derives from its arguments, cached per statement.
+struct ColumnsState {
+    FilesColumnsCommon::Columns columns; // parsed column specification
+    std::optional<regex_t> ignore_regex; // compiled ignore expression, if any
 
-    for ( auto p : glob(pattern) )
-        result.second.push_back(std::move(p));
+    ColumnsState() = default;
+    ColumnsState(const ColumnsState& other) = delete;
+    ColumnsState& operator=(const ColumnsState& other) = delete;
 
-    return result;
-}
+    ~ColumnsState() {
+        if ( ignore_regex )
+            regfree(&*ignore_regex);
+    }
+};
+
+} // namespace
 
 std::vector<std::vector<Value>> FilesListPosix::snapshot(const std::vector<table::Argument>& args) {
     std::vector<std::vector<Value>> rows;
 
-    auto [pattern, paths] = expandPaths(args);
+    auto pattern = Table::getArgument<std::string>(args, "_pattern");
 
-    for ( const auto& p : paths ) {
+    expandPaths(pattern, [&](const filesystem::path& p) {
         Value path = p.string();
         Value type;
         Value uid;
@@ -89,7 +108,7 @@ std::vector<std::vector<Value>> FilesListPosix::snapshot(const std::vector<table
         }
 
         rows.push_back({pattern, path, type, uid, gid, mode, mtime, size});
-    }
+    });
 
     return rows;
 }
@@ -97,28 +116,32 @@ std::vector<std::vector<Value>> FilesListPosix::snapshot(const std::vector<table
 std::vector<std::vector<Value>> FilesLinesPosix::snapshot(const std::vector<table::Argument>& args) {
     std::vector<std::vector<Value>> rows;
 
-    auto [pattern, paths] = expandPaths(args);
+    auto pattern = Table::getArgument<std::string>(args, "_pattern");
+    LineReader reader;
 
-    for ( const auto& p : paths ) {
-        std::ifstream in(p);
-        if ( in.fail() ) {
+    expandPaths(pattern, [&](const filesystem::path& p) {
+        if ( ! reader.open(p) ) {
             // If file simply doesn't exist, we silently ignore the error.
-            // Otherwise we add one row with `line` unset as an error indicator.
+            // Otherwise we add one row with `number` unset as an error indicator.
             if ( filesystem::exists(p) )
-                rows.push_back({p, {}, "<failed to open file>"});
+                rows.push_back({pattern, p.native(), {}, "<failed to open file>"});
 
-            continue;
+            return;
         }
 
+        Value path = p.native();
         int64_t number = 0;
-        std::string content;
 
-        // TODO: should use a version of getline() that can abort at a given max-size.
-        while ( std::getline(in, content) )
-            rows.push_back({pattern, p.native(), ++number, trim(content)});
+        while ( auto line = reader.next() ) {
+            if ( reader.truncated() )
+                ZEEK_AGENT_DEBUG("files_lines", "line {} of {} exceeds maximum size, truncating", number + 1,
+                                 p.native());
 
-        in.close();
-    }
+            rows.push_back({pattern, path, ++number, std::string(trimView(*line))});
+        }
+
+        reader.close();
+    });
 
     return rows;
 }
@@ -126,71 +149,80 @@ std::vector<std::vector<Value>> FilesLinesPosix::snapshot(const std::vector<tabl
 std::vector<std::vector<Value>> FilesColumnsPosix::snapshot(const std::vector<table::Argument>& args) {
     std::vector<std::vector<Value>> rows;
 
-    // TODO: We don't have a way currently to preprocess column-spec and
-    // ignore-expression ahead of time, so need to recompile it every time. The
-    // problem is that there's not way to attach state to the current query.
-    // Not sure how to do that, but in practice it probably doesn't matter much
-    // anyways.
-
     auto separator = Table::getArgument<std::string>(args, "_separator");
-    auto [pattern, paths] = expandPaths(args);
-
     auto spec = Table::getArgument<std::string>(args, "_columns");
-    auto columns = parseColumnsSpec(spec);
-    if ( ! columns )
-        throw table::PermanentContentError(frmt("invalid column specification for 'files_columns': {}", spec));
-
     auto ignore = Table::getArgument<std::string>(args, "_ignore");
-    std::optional<regex_t> ignore_regex;
+    auto pattern = Table::getArgument<std::string>(args, "_pattern");
 
-    if ( ! ignore.empty() ) {
-        ignore_regex = regex_t();
-        if ( auto rc = regcomp(&*ignore_regex, ignore.c_str(), REG_EXTENDED | REG_NOSUB) )
-            throw table::PermanentContentError(frmt("invalid ignore regex for 'files_columns': {}", ignore));
-    }
+    // Column specification and ignore expression get compiled only once per
+    // statement, not each time it executes.
+    auto state = statementState<ColumnsState>(args, [&]() {
+        auto state = std::make_shared<ColumnsState>();
 
-    ScopeGuard _([&ignore_regex] {
-        if ( ignore_regex )
-            regfree(&*ignore_regex);
+        auto columns = parseColumnsSpec(spec);
+        if ( ! columns )
+            throw table::PermanentContentError(frmt("invalid column specification for 'files_columns': {}", spec));
+
+        state->columns = std::move(*columns);
+
+        if ( ! ignore.empty() ) {
+            state->ignore_regex = regex_t();
+            if ( regcomp(&*state->ignore_regex, ignore.c_str(), REG_EXTENDED | REG_NOSUB) != 0 ) {
+                state->ignore_regex.reset(); // nothing to free
+                throw table::PermanentContentError(frmt("invalid ignore regex for 'files_columns': {}", ignore));
+            }
+        }
+
+        return state;
     });
 
-    for ( const auto& p : paths ) {
-        std::ifstream in(p);
-        if ( in.fail() )
+    const auto& columns = state->columns;
+    const auto& ignore_regex = state->ignore_regex;
+
+    LineReader reader;
+    std::vector<std::string_view> m; // reused across lines
+
+    expandPaths(pattern, [&](const filesystem::path& p) {
+        if ( ! reader.open(p) )
             // We silently ignore any errors. If the file doesn't exist, we
             // assume that's legitimate. For other errors, we don't have good
             // way to record them.
-            continue;
+            return;
 
+        Value path = p.native();
         int64_t number = 0;
-        std::string line;
 
-        // TODO: should use a version of getline() that can abort at a given max-size.
-        while ( std::getline(in, line) ) {
-            if ( ignore_regex && regexec(&*ignore_regex, line.data(), line.size(), nullptr, 0) == 0 )
+        while ( auto line = reader.next() ) {
+            if ( reader.truncated() )
+                ZEEK_AGENT_DEBUG("files_columns", "line {} of {} exceeds maximum size, truncating", number + 1,
+                                 p.native());
+
+            if ( ignore_regex && regexMatches(*ignore_regex, *line) )
                 continue;
 
-            std::vector<std::string> m;
             if ( ! separator.empty() )
-                m = split(line, separator);
+                splitView(*line, separator, &m);
             else
-                m = split(line);
+                splitView(*line, &m);
 
+            // Only the selected columns get turned into strings.
             Record value;
-            for ( const auto& [nr, type] : *columns ) {
+            value.reserve(columns.size());
+
+            for ( const auto& [nr, type] : columns ) {
                 if ( nr == 0 )
-                    value.emplace_back(stringToValue(line, type));
+                    value.emplace_back(stringToValue(std::string(*line), type));
                 else if ( nr >= 1 && nr <= m.size() )
-                    value.emplace_back(stringToValue(m[nr - 1], type));
+                    value.emplace_back(stringToValue(std::string(m[nr - 1]), type));
                 else
                     value.emplace_back(std::monostate(), value::Type::Null);
             }
 
-            rows.push_back({pattern, spec, separator, ignore, p.native(), ++number, std::move(value)});
+            rows.push_back({pattern, spec, separator, ignore, path, ++number, std::move(value)});
         }
 
-        in.close();
-    }
+        reader.close();
+    });
 
     return rows;
 }
@@ -46,24 +46,12 @@ database::RegisterTable<FilesLinesWindows> _2;
 database::RegisterTable<FilesColumnsWindows> _3;
 } // namespace
 
-std::pair<std::string, std::vector<filesystem::path>> FilesBase::expandPaths(const std::vector<table::Argument>& args) {
-    std::pair<std::string, std::vector<filesystem::path>> result;
-
-    auto glob = Table::getArgument<std::string>(args, "_pattern");
-    result.first = glob;
-
-    for ( auto p : zeek::agent::glob(glob) )
-        result.second.push_back(std::move(p));
-
-    return result;
-}
-
 std::vector<std::vector<Value>> FilesListWindows::snapshot(const std::vector<table::Argument>& args) {
     std::vector<std::vector<Value>> rows;
 
-    auto [pattern, paths] = expandPaths(args);
+    auto pattern = Table::getArgument<std::string>(args, "_pattern");
 
-    for ( const auto& p : paths ) {
+    expandPaths(pattern, [&](const filesystem::path& p) {
         Value path = p.string();
         Value type;
         Value mode;
@@ -74,7 +62,7 @@ std::vector<std::vector<Value>> FilesListWindows::snapshot(const std::vector<tab
         auto status = filesystem::status(p, ec);
         if ( ec ) {
             ZEEK_AGENT_DEBUG("FilesListWindows", "Failed to get file status: {}", ec.message());
-            continue;
+            return;
         }
 
         mode = frmt("{:o}", static_cast<int64_t>(status.permissions()));
@@ -88,7 +76,7 @@ std::vector<std::vector<Value>> FilesListWindows::snapshot(const std::vector<tab
                 size = static_cast<int64_t>(filesystem::file_size(p, ec));
                 if ( ec ) {
                     ZEEK_AGENT_DEBUG("FilesListWindows", "Failed to get file size: {}", ec.message());
-                    continue;
+                    return;
                 }
                 break;
             case filesystem::file_type::directory: type = "dir"; break;
@@ -101,11 +89,11 @@ std::vector<std::vector<Value>> FilesListWindows::snapshot(const std::vector<tab
         mtime = filesystem::last_write_time(p, ec);
         if ( ec ) {
             ZEEK_AGENT_DEBUG("FilesListWindows", "Failed to get file mtime: {}", ec.message());
-            continue;
+            return;
         }
 
         rows.push_back({pattern, path, type, {}, {}, mode, mtime, size});
-    }
+    });
 
     return rows;
 }
@@ -113,8 +101,8 @@ std::vector<std::vector<Value>> FilesListWindows::snapshot(const std::vector<tab
 std::vector<std::vector<Value>> FilesLinesWindows::snapshot(const std::vector<table::Argument>& args) {
     std::vector<std::vector<Value>> rows;
 
-    auto [pattern, paths] = expandPaths(args);
-    for ( const auto& p : paths ) {
+    auto pattern = Table::getArgument<std::string>(args, "_pattern");
+    expandPaths(pattern, [&](const filesystem::path& p) {
         std::ifstream in(p);
         if ( in.fail() ) {
             // If file simply doesn't exist, we silently ignore the error.
@@ -125,7 +113,7 @@ std::vector<std::vector<Value>> FilesLinesWindows::snapshot(const std::vector<ta
                 // but we're only inserting 3.
                 rows.push_back({p.string(), {}, "<failed to open file>"});
 
-            continue;
+            return;
         }
 
         int64_t number = 0;
@@ -136,7 +124,7 @@ std::vector<std::vector<Value>> FilesLinesWindows::snapshot(const std::vector<ta
             rows.push_back({pattern, p.string(), ++number, trim(content)});
 
         in.close();
-    }
+    });
 
     return rows;
 }
@@ -167,15 +155,15 @@ std::vector<std::vector<Value>> FilesColumnsWindows::snapshot(const std::vector<
         }
     }
 
-    auto [pattern, paths] = expandPaths(args);
+    auto pattern = Table::getArgument<std::string>(args, "_pattern");
 
-    for ( const auto& p : paths ) {
+    expandPaths(pattern, [&](const filesystem::path& p) {
         std::ifstream in(p);
         if ( in.fail() )
             // We silently ignore any errors. If the file doesn't exist, we
             // assume that's legitimate. For other errors, we don't have good
             // way to record them.
-            continue;
+            return;
 
         int64_t number = 0;
         std::string line;
@@ -206,7 +194,7 @@ std::vector<std::vector<Value>> FilesColumnsWindows::snapshot(const std::vector<
         }
 
         in.close();
-    }
+    });
 
     return rows;
 }
@@ -0,0 +1,444 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Hashes file content. To avoid reading files again that haven't changed,
+// we remember digests across queries, keyed by device and inode, and
+// validated by size, modification time, and status change time. A file that
+// got modified will have at least one of those changed.
+
+#include "files.h"
+
+#include "autogen/config.h"
+#include "core/database.h"
+#include "core/logger.h"
+#include "util/fmt.h"
+#include "util/helpers.h"
+#include "util/testing.h"
+#include "util/thread-pool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <sys/stat.h>
+
+using namespace zeek::agent;
+using namespace zeek::agent::table;
+
+namespace {
+
+// Number of bytes to read from a file at a time.
+static const size_t ReadBlockSize = 1024 * 1024;
+
+// Maximum number of files to keep digests for. Once exceeded, we drop the
+// digests that queries haven't used for the longest time.
+static const size_t MaxCacheEntries = 100000;
+
+// Digests computed for a file's content.
+struct Digests {
+    std::string sha256; // SHA256, as hex string
+    std::string md5;    // MD5, as hex string
+
+    bool operator==(const Digests& other) const { return sha256 == other.sha256 && md5 == other.md5; }
+};
+
+// Returns a file's modification time with nanosecond resolution.
+int64_t modificationTime(const struct ::stat& st) {
+#ifdef HAVE_DARWIN
+    return st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+}
+
+// Returns a file's status change time with nanosecond resolution.
+int64_t changeTime(const struct ::stat& st) {
+#ifdef HAVE_DARWIN
+    return st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+    return st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+}
+
+// Digests of files we have hashed before. All methods are thread-safe.
+class DigestCache {
+public:
+    // Returns the digests for a file if we have them and the file hasn't
+    // changed since we computed them.
+    std::optional<Digests> lookup(const struct ::stat& st) {
+        std::scoped_lock lock(_mutex);
+
+        auto i = _entries.find({st.st_dev, st.st_ino});
+        if ( i == _entries.end() )
+            return {};
+
+        auto& entry = i->second;
+        if ( entry.size != st.st_size || entry.mtime != modificationTime(st) || entry.ctime != changeTime(st) )
+            return {};
+
+        entry.last_used = _generation;
+        return entry.digests;
+    }
+
+    // Records the digests for a file, as described by its status.
+    void insert(const struct ::stat& st, Digests digests) {
+        std::scoped_lock lock(_mutex);
+
+        _entries[{st.st_dev, st.st_ino}] = Entry{.size = st.st_size,
+                                                 .mtime = modificationTime(st),
+                                                 .ctime = changeTime(st),
+                                                 .digests = std::move(digests),
+                                                 .last_used = _generation};
+    }
+
+    // Signals the end of a query. This drops entries that haven't been used
+    // for the longest time if we're above the maximum size.
+    void expire(size_t max_entries = MaxCacheEntries) {
+        std::scoped_lock lock(_mutex);
+
+        ++_generation;
+
+        if ( _entries.size() <= max_entries )
+            return;
+
+        // Find the generation that keeps at most half the maximum.
+        std::vector<uint64_t> generations;
+        generations.reserve(_entries.size());
+        for ( const auto& [key, entry] : _entries )
+            generations.push_back(entry.last_used);
+
+        auto keep = max_entries / 2;
+        auto cutoff = generations.begin() + (generations.size() - keep);
+        std::nth_element(generations.begin(), cutoff, generations.end());
+        auto cutoff_generation = *cutoff;
+
+        for ( auto i = _entries.begin(); i != _entries.end(); ) {
+            if ( i->second.last_used < cutoff_generation )
+                i = _entries.erase(i);
+            else
+                ++i;
+        }
+
+        // Many entries may share the cutoff generation, for example if a
+        // single query hashed more files than the maximum. We drop arbitrary
+        // ones of those until we're down to what we want to keep.
+        for ( auto i = _entries.begin(); i != _entries.end() && _entries.size() > keep; ) {
+            if ( i->second.last_used == cutoff_generation )
+                i = _entries.erase(i);
+            else
+                ++i;
+        }
+    }
+
+    // Returns the number of files we currently have digests for.
+    size_t size() const {
+        std::scoped_lock lock(_mutex);
+        return _entries.size();
+    }
+
+private:
+    struct Entry {
+        int64_t size;       // file size when hashed
+        int64_t mtime;      // modification time when hashed, in ns
+        int64_t ctime;      // status change time when hashed, in ns
+        Digests digests;    // digests computed
+        uint64_t last_used; // generation of last query using the entry
+    };
+
+    mutable std::mutex _mutex;
+    std::map<std::pair<dev_t, ino_t>, Entry> _entries;
+    uint64_t _generation = 0;
+};
+
+// Hashes a file's content, reading it through a caller-provided buffer. On
+// success, returns the digests along with the file's status before reading
+// it. If the file changes while we read it, the status will be reset to
+// signal that the digests cannot be cached. Returns an error if reading or
+// hashing fails, including failures inside OpenSSL.
+Result<Digests> hashFile(const filesystem::path& path, std::vector<char>* buffer, std::optional<struct ::stat>* st) {
+    st->reset();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    if ( fd < 0 )
+        return result::Error(frmt("cannot open {}: {}", path.native(), strerror(errno)));
+
+    ScopeGuard close_fd([fd]() { ::close(fd); });
+
+    struct ::stat before;
+    if ( ::fstat(fd, &before) < 0 )
+        return result::Error(frmt("cannot stat {}: {}", path.native(), strerror(errno)));
+
+    if ( ! S_ISREG(before.st_mode) )
+        return result::Error(frmt("{} is not a regular file", path.native()));
+
+    auto sha256 = ::EVP_MD_CTX_new();
+    auto md5 = ::EVP_MD_CTX_new();
+    ScopeGuard free_ctxs([sha256, md5]() {
+        ::EVP_MD_CTX_free(sha256);
+        ::EVP_MD_CTX_free(md5);
+    });
+
+    if ( ! sha256 || ! md5 || ! ::EVP_DigestInit_ex(sha256, ::EVP_sha256(), nullptr) ||
+         ! ::EVP_DigestInit_ex(md5, ::EVP_md5(), nullptr) )
+        return result::Error("cannot initialize digests");
+
+    buffer->resize(ReadBlockSize);
+
+    while ( true ) {
+        auto n = ::read(fd, buffer->data(), buffer->size());
+        if ( n < 0 && errno == EINTR )
+            continue;
+
+        if ( n < 0 )
+            return result::Error(frmt("cannot read {}: {}", path.native(), strerror(errno)));
+
+        if ( n == 0 )
+            break;
+
+        if ( ! ::EVP_DigestUpdate(sha256, buffer->data(), n) || ! ::EVP_DigestUpdate(md5, buffer->data(), n) )
+            return result::Error(frmt("cannot update digests for {}", path.native()));
+    }
+
+    auto finalize = [](::EVP_MD_CTX* ctx) -> std::optional<std::string> {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int len = 0;
+        if ( ! ::EVP_DigestFinal_ex(ctx, digest, &len) )
+            return {};
+
+        std::string hex;
+        hex.reserve(len * 2);
+        for ( unsigned int i = 0; i < len; i++ )
+            hex += frmt("{:02x}", digest[i]);
+
+        return hex;
+    };
+
+    auto sha256_hex = finalize(sha256);
+    auto md5_hex = finalize(md5);
+    if ( ! sha256_hex || ! md5_hex )
+        return result::Error(frmt("cannot finalize digests for {}", path.native()));
+
+    auto digests = Digests{.sha256 = std::move(*sha256_hex), .md5 = std::move(*md5_hex)};
+
+    struct ::stat after;
+    if ( ::fstat(fd, &after) == 0 && after.st_size == before.st_size &&
+         modificationTime(after) == modificationTime(before) && changeTime(after) == changeTime(before) )
+        *st = before;
+
+    return digests;
+}
+
+} // namespace
+
+namespace zeek::agent::table {
+
+class FilesHashesPosix : public FilesHashesCommon {
+public:
+    std::vector<std::vector<Value>> snapshot(const std::vector<table::Argument>& args) override;
+
+private:
+    DigestCache _cache;
+};
+
+namespace {
+database::RegisterTable<FilesHashesPosix> _1;
+}
+
+std::vector<std::vector<Value>> FilesHashesPosix::snapshot(const std::vector<table::Argument>& args) {
+    auto pattern = Table::getArgument<std::string>(args, "_pattern");
+
+    std::vector<filesystem::path> paths;
+    expandPaths(pattern, [&](const filesystem::path& p) { paths.push_back(p); });
+
+    // First pass: stat all files and take what we can from the cache.
+    std::vector<std::vector<Value>> rows;
+    rows.reserve(paths.size());
+
+    std::vector<size_t> misses; // indices of files we need to hash
+
+    for ( size_t i = 0; i < paths.size(); i++ ) {
+        const auto& p = paths[i];
+        Value size;
+        Value mtime;
+        Value sha256;
+        Value md5;
+
+        struct ::stat st;
+        if ( ::stat(p.c_str(), &st) == 0 ) {
+            size = static_cast<int64_t>(st.st_size);
+            mtime = to_time(st.st_mtime);
+
+            if ( S_ISREG(st.st_mode) ) {
+                if ( auto digests = _cache.lookup(st) ) {
+                    sha256 = std::move(digests->sha256);
+                    md5 = std::move(digests->md5);
+                }
+                else
+                    misses.push_back(i);
+            }
+        }
+
+        rows.push_back({pattern, p.native(), size, mtime, sha256, md5});
+    }
+
+    // Second pass: hash the remaining files in parallel. Each shard gets its
+    // own read buffer, and writes only into its own rows.
+    if ( ! misses.empty() ) {
+        auto& pool = workerPool();
+        auto shards = pool.shards(misses.size(), 1);
+
+        pool.run(shards, [&](size_t shard) {
+            auto begin = misses.size() * shard / shards;
+            auto end = misses.size() * (shard + 1) / shards;
+
+            std::vector<char> buffer;
+            std::optional<struct ::stat> st;
+
+            for ( auto i = begin; i < end; i++ ) {
+                auto idx = misses[i];
+                auto digests = hashFile(paths[idx], &buffer, &st);
+                if ( ! digests ) {
+                    ZEEK_AGENT_DEBUG("files_hashes", "{}", digests.error());
+                    continue;
+                }
+
+                if ( st )
+                    _cache.insert(*st, *digests);
+
+                rows[idx][4] = std::move(digests->sha256);
+                rows[idx][5] = std::move(digests->md5);
+            }
+        });
+    }
+
+    _cache.expire();
+    return rows;
+}
+
+} // namespace zeek::agent::table
+
+TEST_SUITE("Tables") {
+    TEST_CASE("files_hashes - digests") {
+        auto dir = std::filesystem::temp_directory_path() / frmt("zeek-agent-files_hashes-{}", ::getpid());
+        ScopeGuard _([dir] { std::filesystem::remove_all(dir); });
+        std::filesystem::create_directory(dir);
+
+        auto write = [&](const std::string& name, const std::string& data) {
+            std::ofstream out(dir / name, std::ios::trunc | std::ios::binary);
+            out << data;
+        };
+
+        write("abc", "abc");
+        write("empty", "");
+        write("large", std::string(ReadBlockSize * 2 + 17, 'x'));
+
+        std::vector<char> buffer;
+        std::optional<struct ::stat> st;
+
+        auto digests = hashFile(dir / "abc", &buffer, &st);
+        REQUIRE(digests);
+        CHECK(st.has_value());
+        CHECK_EQ(digests->sha256, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        CHECK_EQ(digests->md5, "900150983cd24fb0d6963f7d28e17f72");
+
+        digests = hashFile(dir / "empty", &buffer, &st);
+        REQUIRE(digests);
+        CHECK_EQ(digests->sha256, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        CHECK_EQ(digests->md5, "d41d8cd98f00b204e9800998ecf8427e");
+
+        digests = hashFile(dir / "large", &buffer, &st);
+        REQUIRE(digests);
+        CHECK_EQ(digests->sha256.size(), 64);
+
+        CHECK(! hashFile(dir, &buffer, &st));
+        CHECK(! hashFile(dir / "does-not-exist", &buffer, &st));
+    }
+
+    TEST_CASE("files_hashes - cache") {
+        auto path = std::filesystem::temp_directory_path() / frmt("zeek-agent-files_hashes-cache-{}", ::getpid());
+        ScopeGuard _([path] { std::filesystem::remove(path); });
+        std::ofstream(path, std::ios::trunc | std::ios::binary) << "abc";
+
+        struct ::stat st;
+        REQUIRE_EQ(::stat(path.c_str(), &st), 0);
+
+        DigestCache cache;
+        CHECK_FALSE(cache.lookup(st).has_value());
+
+        auto digests = Digests{.sha256 = "sha", .md5 = "md5"};
+        cache.insert(st, digests);
+        CHECK_EQ(cache.lookup(st), digests);
+
+        SUBCASE("modified") {
+            std::ofstream(path, std::ios::app | std::ios::binary) << "def";
+            REQUIRE_EQ(::stat(path.c_str(), &st), 0);
+            CHECK_FALSE(cache.lookup(st).has_value());
+        }
+
+        SUBCASE("expire") {
+            auto other = st;
+            for ( int i = 1; i <= 10; i++ ) {
+                other.st_ino = st.st_ino + i;
+                cache.insert(other, digests);
+                cache.expire(100);
+            }
+
+            CHECK_EQ(cache.size(), 11);
+
+            CHECK(cache.lookup(st).has_value()); // mark as recently used
+            cache.expire(4);
+            CHECK_EQ(cache.size(), 2);
+            CHECK(cache.lookup(st).has_value());
+        }
+
+        SUBCASE("expire within a single query") {
+            auto other = st;
+            for ( int i = 1; i <= 10; i++ ) {
+                other.st_ino = st.st_ino + i;
+                cache.insert(other, digests);
+            }
+
+            CHECK_EQ(cache.size(), 11);
+            cache.expire(4);
+            CHECK_EQ(cache.size(), 2);
+        }
+    }
+}
+
+TEST_CASE_FIXTURE(test::TableFixture, "files_hashes" * doctest::test_suite("Tables")) {
+    auto dir = std::filesystem::temp_directory_path() / frmt("zeek-agent-files_hashes-table-{}", ::getpid());
+    ScopeGuard _([dir] { std::filesystem::remove_all(dir); });
+    std::filesystem::create_directory(dir);
+
+    std::ofstream(dir / "file1", std::ios::binary) << "abc";
+    std::ofstream(dir / "file2", std::ios::binary) << "";
+    std::filesystem::create_directory(dir / "sub");
+
+    useTable("files_hashes");
+
+    for ( auto round = 0; round < 2; round++ ) { // second round uses the cache
+        CAPTURE(round);
+
+        auto result = query(frmt("SELECT path, size, sha256, md5 from files_hashes(\"{}\") ORDER BY path",
+                                 (dir / "*").string()));
+        REQUIRE_EQ(result.rows.size(), 3);
+        CHECK_EQ(*result.get<int64_t>(0, "size"), 3);
+        CHECK_EQ(*result.get<std::string>(0, "sha256"),
+                 "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        CHECK_EQ(*result.get<std::string>(0, "md5"), "900150983cd24fb0d6963f7d28e17f72");
+        CHECK_EQ(*result.get<std::string>(1, "md5"), "d41d8cd98f00b204e9800998ecf8427e");
+        CHECK(result.get<std::monostate>(2, "sha256")); // directory
+    }
+}
@@ -0,0 +1,617 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Follows files like `tail -F`. A dedicated thread keeps an offset per file,
+// identified by device and inode, and reads just what got appended since
+// last time. It wakes up through inotify watches on the files' directories,
+// and also checks periodically in case it missed something.
+
+#include "files.h"
+
+#include "core/database.h"
+#include "core/logger.h"
+#include "util/fmt.h"
+#include "util/helpers.h"
+#include "util/testing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+using namespace zeek::agent;
+using namespace zeek::agent::table;
+
+namespace {
+
+// Timeout for waiting on file changes before checking for termination.
+static const auto ReaderPollTimeout = std::chrono::milliseconds(100);
+
+// Interval to check files for new data even without notification.
+static const auto PollInterval = std::chrono::seconds(1);
+
+// Interval to expand patterns again even without notification.
+static const auto RescanInterval = std::chrono::seconds(5);
+
+// Number of bytes to read from a file at a time.
+static const size_t ReadChunkSize = 65536;
+
+// Maximum number of bytes to buffer for a line whose end we haven't seen yet;
+// once exceeded, we return what we have as a line of its own. No line we
+// return is ever longer than this.
+static const size_t MaxLineSize = 65536;
+
+// Maximum number of events to buffer before handing them to the table.
+static const size_t MaxBatchSize = 1024;
+
+// Follows all files matching a glob pattern, reading lines appended to them.
+//
+// Instances are not thread-safe.
+class PatternTail {
+public:
+    // Callback receiving a file's path, the offset of a line inside the file,
+    // and the line's content. The content remains valid only during the call.
+    using Callback = std::function<void(const filesystem::path& path, uint64_t offset, std::string_view line)>;
+
+    PatternTail(std::string pattern, size_t glob_limit = DefaultGlobLimit)
+        : _pattern(std::move(pattern)), _glob_limit(glob_limit) {}
+    ~PatternTail() {
+        for ( auto& [_, f] : _files )
+            ::close(f.fd);
+    }
+
+    PatternTail(const PatternTail& other) = delete;
+    PatternTail(PatternTail&& other) = delete;
+    PatternTail& operator=(const PatternTail& other) = delete;
+    PatternTail& operator=(PatternTail&& other) = delete;
+
+    // Expands the pattern again, starting to follow files that now match it
+    // and letting go of files that no longer do. Lines still pending in
+    // files let go get passed to the callback first. On the first call, the
+    // tail starts at the files' current ends; later, new files get read from
+    // their beginning.
+    void rescan(const Callback& callback);
+
+    // Reads lines appended to the files since the last call.
+    void read(const Callback& callback);
+
+    // Returns the directories that may see changes relevant to the pattern.
+    std::set<filesystem::path> directories() const;
+
+    // Returns the paths of the files currently being followed.
+    std::vector<filesystem::path> paths() const {
+        std::vector<filesystem::path> paths;
+        for ( const auto& [_, f] : _files )
+            paths.push_back(f.path);
+
+        return paths;
+    }
+
+private:
+    struct File {
+        filesystem::path path; // most recent name the file was found under
+        int fd = -1;           // open file descriptor
+        uint64_t offset = 0;   // offset up to which we have read the file
+        uint64_t line = 0;     // offset where the line in `partial` starts
+        std::string partial;   // start of a line whose end we haven't seen yet
+    };
+
+    using ID = std::pair<dev_t, ino_t>;
+
+    void readFile(File* f, const Callback& callback);
+    void appendPartial(File* f, std::string_view data, const Callback& callback);
+    void flushLine(File* f, const Callback& callback);
+
+    std::string _pattern;        // as passed into constructor
+    size_t _glob_limit;          // as passed into constructor
+    bool _truncated = false;     // true once we have warned about the pattern matching too many files
+    std::map<ID, File> _files;   // files currently being followed, indexed by device and inode
+    bool _initialized = false;   // true after first call to `rescan()`
+    std::vector<char> _buffer;   // buffer for reading file data
+};
+
+void PatternTail::rescan(const Callback& callback) {
+    std::set<ID> seen;
+
+    bool truncated = false;
+    auto paths = glob(_pattern, _glob_limit, &truncated);
+
+    if ( truncated && ! _truncated )
+        logger()->warn("[files_tail_events] pattern '{}' matches more than {} paths, ignoring the rest (see option "
+                       "'glob-limit')",
+                       _pattern, _glob_limit);
+
+    _truncated = truncated;
+
+    for ( const auto& p : paths ) {
+        struct stat st;
+        if ( ::stat(p.c_str(), &st) < 0 || ! S_ISREG(st.st_mode) )
+            continue;
+
+        ID id = {st.st_dev, st.st_ino};
+        seen.insert(id);
+
+        if ( auto f = _files.find(id); f != _files.end() ) {
+            // Already following, but may have been renamed.
+            f->second.path = p;
+            continue;
+        }
+
+        auto fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if ( fd < 0 )
+            continue;
+
+        // Make sure we have opened what we have stat'ed.
+        if ( ::fstat(fd, &st) < 0 || st.st_dev != id.first || st.st_ino != id.second ) {
+            ::close(fd);
+            continue;
+        }
+
+        auto offset = (_initialized ? 0 : static_cast<uint64_t>(st.st_size));
+        ZEEK_AGENT_DEBUG("files_tail", "following {} from offset {}", p.native(), offset);
+        _files.emplace(id, File{.path = p, .fd = fd, .offset = offset, .line = offset, .partial = {}});
+    }
+
+    for ( auto i = _files.begin(); i != _files.end(); ) {
+        if ( seen.find(i->first) != seen.end() ) {
+            ++i;
+            continue;
+        }
+
+        // Gone, or renamed to something not matching anymore. Read what's
+        // left first, which catches everything written before a rotation.
+        ZEEK_AGENT_DEBUG("files_tail", "no longer following {}", i->second.path.native());
+        readFile(&i->second, callback);
+        flushLine(&i->second, callback);
+        ::close(i->second.fd);
+        i = _files.erase(i);
+    }
+
+    _initialized = true;
+}
+
+void PatternTail::read(const Callback& callback) {
+    for ( auto& [_, f] : _files )
+        readFile(&f, callback);
+}
+
+void PatternTail::readFile(File* f, const Callback& callback) {
+    struct stat st;
+    if ( ::fstat(f->fd, &st) < 0 )
+        return;
+
+    if ( static_cast<uint64_t>(st.st_size) < f->offset ) {
+        // Truncated, start over.
+        ZEEK_AGENT_DEBUG("files_tail", "{} got truncated", f->path.native());
+        f->offset = f->line = 0;
+        f->partial.clear();
+    }
+
+    if ( static_cast<uint64_t>(st.st_size) == f->offset )
+        return;
+
+    _buffer.resize(ReadChunkSize);
+
+    while ( true ) {
+        auto n = ::pread(f->fd, _buffer.data(), _buffer.size(), static_cast<off_t>(f->offset));
+        if ( n <= 0 )
+            break;
+
+        const char* p = _buffer.data();
+        const char* end = p + n;
+
+        while ( p < end ) {
+            auto nl = static_cast<const char*>(memchr(p, '\n', end - p));
+            if ( ! nl ) {
+                appendPartial(f, std::string_view(p, end - p), callback);
+                break;
+            }
+
+            if ( f->partial.empty() && static_cast<size_t>(nl - p) <= MaxLineSize )
+                // Fast path: line is completely inside the buffer.
+                callback(f->path, f->line, std::string_view(p, nl - p));
+            else {
+                appendPartial(f, std::string_view(p, nl - p), callback);
+                callback(f->path, f->line, f->partial);
+                f->partial.clear();
+            }
+
+            f->line = f->offset + (nl - _buffer.data()) + 1;
+            p = nl + 1;
+        }
+
+        f->offset += n;
+
+        if ( static_cast<size_t>(n) < _buffer.size() )
+            break;
+    }
+}
+
+// Appends data to a file's partial line, splitting off a line of its own
+// whenever the partial line would exceed `MaxLineSize`.
+void PatternTail::appendPartial(File* f, std::string_view data, const Callback& callback) {
+    while ( true ) {
+        auto n = std::min(data.size(), MaxLineSize - f->partial.size());
+        f->partial.append(data.data(), n);
+        data.remove_prefix(n);
+
+        if ( data.empty() )
+            return;
+
+        flushLine(f, callback);
+    }
+}
+
+void PatternTail::flushLine(File* f, const Callback& callback) {
+    if ( f->partial.empty() )
+        return;
+
+    callback(f->path, f->line, f->partial);
+    f->line += f->partial.size();
+    f->partial.clear();
+}
+
+std::set<filesystem::path> PatternTail::directories() const {
+    std::set<filesystem::path> dirs;
+
+    for ( const auto& [_, f] : _files )
+        dirs.insert(f.path.parent_path());
+
+    // Add the deepest directory not containing any wildcards, so that we
+    // notice when matching files show up there.
+    filesystem::path prefix;
+    for ( const auto& c : filesystem::path(_pattern).parent_path() ) {
+        if ( c.native().find_first_of("*?[") != std::string::npos )
+            break;
+
+        prefix /= c;
+    }
+
+    if ( ! prefix.empty() )
+        dirs.insert(prefix);
+
+    return dirs;
+}
+
+class FilesTailLinux : public FilesTailEventsCommon {
+public:
+    void activate() override;
+    void deactivate() override;
+    void queriesChanged() override;
+    std::vector<std::vector<Value>> rows(Time t, const std::vector<table::Argument>& args) override;
+
+private:
+    std::set<std::string> patterns();
+    void readerThread();
+    void addWatches(int inotify_fd, std::set<filesystem::path>* watched);
+
+    std::unique_ptr<std::thread> _thread; // reader thread, set while active
+
+    std::mutex _mutex;                 // protects `_stop`, `_patterns`, and `_patterns_changed`
+    std::condition_variable _cv;       // signals changes to `_stop`
+    std::atomic<bool> _stop = false;   // true to signal the reader thread to terminate
+    std::set<std::string> _patterns;   // patterns of the active queries
+    size_t _glob_limit = 0;            // maximum number of files to follow per pattern; set on activation
+    bool _patterns_changed = false;    // true if the reader thread hasn't picked up `_patterns` yet
+};
+
+database::RegisterTable<FilesTailLinux> _;
+
+std::set<std::string> FilesTailLinux::patterns() {
+    std::set<std::string> patterns;
+
+    for ( const auto& constraints : activeConstraints() ) {
+        bool found = false;
+
+        for ( const auto& c : constraints ) {
+            if ( c.column == "_pattern" && c.op == table::Operator::Equal ) {
+                if ( auto p = std::get_if<std::string>(&c.value) ) {
+                    patterns.insert(*p);
+                    found = true;
+                }
+            }
+        }
+
+        if ( ! found )
+            logger()->warn("[files_tail_events] pattern is not a constant, query will not see any lines");
+    }
+
+    return patterns;
+}
+
+void FilesTailLinux::activate() {
+    assert(! _thread);
+
+    _stop = false;
+    _glob_limit = static_cast<size_t>(options().glob_limit);
+    _patterns = patterns();
+    _patterns_changed = true;
+    _thread = std::make_unique<std::thread>([this]() { readerThread(); });
+}
+
+void FilesTailLinux::deactivate() {
+    if ( ! _thread )
+        return;
+
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _cv.notify_all();
+    _thread->join();
+    _thread.reset();
+}
+
+void FilesTailLinux::queriesChanged() {
+    auto patterns = FilesTailLinux::patterns();
+
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if ( patterns == _patterns )
+        return;
+
+    _patterns = std::move(patterns);
+    _patterns_changed = true;
+}
+
+std::vector<std::vector<Value>> FilesTailLinux::rows(Time t, const std::vector<table::Argument>& args) {
+    auto rows = EventTable::rows(t, args);
+
+    if ( usesMockData() )
+        return rows;
+
+    // We record events for all active patterns, so need to pick the ones
+    // for this query; SQLite leaves filtering on table parameters to us.
+    Value pattern = Table::getArgument<std::string>(args, "_pattern");
+    rows.erase(std::remove_if(rows.begin(), rows.end(), [&](const auto& row) { return row[0] != pattern; }),
+               rows.end());
+
+    return rows;
+}
+
+void FilesTailLinux::readerThread() {
+    std::map<std::string, std::unique_ptr<PatternTail>> tails;
+    std::vector<std::vector<Value>> batch;
+    std::set<filesystem::path> watched;
+
+    auto inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ( inotify_fd < 0 )
+        ZEEK_AGENT_DEBUG("files_tail", "inotify not available, will poll for changes");
+
+    ScopeGuard _([&]() {
+        if ( inotify_fd >= 0 )
+            ::close(inotify_fd);
+    });
+
+    // Pattern and path repeat for every line, and the events may remain
+    // buffered for a while, so we store them interned. Lines from the same
+    // file come in sequence, allowing us to reuse the most recent path.
+    InternedString current_pattern;
+    InternedString current_path;
+
+    auto callback = [&](const filesystem::path& path, uint64_t offset, std::string_view line) {
+        if ( ! line.empty() && line.back() == '\r' )
+            line.remove_suffix(1);
+
+        if ( current_path.str() != path.native() )
+            current_path = InternedString(path.native());
+
+        batch.push_back({current_pattern, Time(std::chrono::system_clock::now()), current_path,
+                         static_cast<int64_t>(offset), std::string(line)});
+
+        if ( batch.size() >= MaxBatchSize ) {
+            newEvents(std::move(batch));
+            batch.clear();
+        }
+    };
+
+    auto for_each_tail = [&](auto f) {
+        for ( auto& [pattern, tail] : tails ) {
+            current_pattern = InternedString(pattern);
+            f(tail.get());
+        }
+    };
+
+    auto last_read = std::chrono::steady_clock::now();
+    auto last_scan = last_read;
+
+    while ( ! _stop ) {
+        bool rescan = false;
+        bool changed = false;
+
+        {
+            const std::lock_guard<std::mutex> lock(_mutex);
+            if ( _patterns_changed ) {
+                for ( auto i = tails.begin(); i != tails.end(); ) {
+                    if ( _patterns.find(i->first) == _patterns.end() )
+                        i = tails.erase(i);
+                    else
+                        ++i;
+                }
+
+                for ( const auto& p : _patterns ) {
+                    if ( tails.find(p) == tails.end() ) {
+                        ZEEK_AGENT_DEBUG("files_tail", "starting to follow pattern {}", p);
+                        tails.emplace(p, std::make_unique<PatternTail>(p, _glob_limit));
+                        rescan = true;
+                    }
+                }
+
+                _patterns_changed = false;
+            }
+        }
+
+        if ( inotify_fd >= 0 ) {
+            struct pollfd p = {.fd = inotify_fd, .events = POLLIN, .revents = 0};
+            if ( ! rescan && ::poll(&p, 1, static_cast<int>(ReaderPollTimeout.count())) > 0 ) {
+                alignas(struct inotify_event) char buffer[4096];
+
+                while ( true ) {
+                    auto n = ::read(inotify_fd, buffer, sizeof(buffer));
+                    if ( n <= 0 )
+                        break;
+
+                    for ( char* p = buffer; p < buffer + n; ) {
+                        auto ev = reinterpret_cast<struct inotify_event*>(p);
+                        if ( ev->mask & (IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_Q_OVERFLOW) )
+                            rescan = true;
+
+                        changed = true;
+                        p += sizeof(struct inotify_event) + ev->len;
+                    }
+                }
+            }
+        }
+        else if ( ! rescan ) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait_for(lock, ReaderPollTimeout, [this]() { return _stop.load(); });
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        if ( rescan || now - last_scan >= RescanInterval ) {
+            for_each_tail([&](PatternTail* tail) { tail->rescan(callback); });
+
+            if ( inotify_fd >= 0 ) {
+                for ( const auto& [_, tail] : tails ) {
+                    for ( const auto& dir : tail->directories() ) {
+                        if ( watched.find(dir) != watched.end() )
+                            continue;
+
+                        if ( inotify_add_watch(inotify_fd, dir.c_str(),
+                                               IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) >= 0 )
+                            watched.insert(dir);
+                    }
+                }
+            }
+
+            last_scan = now;
+            changed = true;
+        }
+
+        if ( changed || now - last_read >= PollInterval ) {
+            for_each_tail([&](PatternTail* tail) { tail->read(callback); });
+            last_read = now;
+        }
+
+        if ( ! batch.empty() ) {
+            newEvents(std::move(batch));
+            batch.clear();
+        }
+    }
+}
+
+} // namespace
+
+TEST_SUITE("Tables") {
+    TEST_CASE("files_tail_events - following files") {
+        auto dir = std::filesystem::temp_directory_path() / frmt("zeek-agent-files_tail-{}", ::getpid());
+        ScopeGuard _([dir] { std::filesystem::remove_all(dir); });
+        std::filesystem::create_directory(dir);
+
+        std::vector<std::string> lines;
+        auto callback = [&](const filesystem::path& path, uint64_t offset, std::string_view line) {
+            lines.push_back(frmt("{}:{}:{}", path.filename().native(), offset, line));
+        };
+
+        auto append = [&](const std::string& name, const std::string& data) {
+            std::ofstream out(dir / name, std::ios::app | std::ios::binary);
+            out << data;
+        };
+
+        append("a.log", "old1\nold2\n");
+
+        PatternTail tail((dir / "*.log").native());
+        tail.rescan(callback);
+        tail.read(callback);
+        CHECK(lines.empty()); // starts at end of existing files
+
+        SUBCASE("appends") {
+            append("a.log", "new1\nne");
+            tail.read(callback);
+            CHECK_EQ(lines, std::vector<std::string>{"a.log:10:new1"});
+
+            append("a.log", "w2\n");
+            tail.read(callback);
+            CHECK_EQ(lines, std::vector<std::string>{"a.log:10:new1", "a.log:15:new2"});
+        }
+
+        SUBCASE("new file") {
+            append("b.log", "b1\n");
+            tail.rescan(callback);
+            tail.read(callback);
+            CHECK_EQ(lines, std::vector<std::string>{"b.log:0:b1"});
+        }
+
+        SUBCASE("truncation") {
+            std::ofstream(dir / "a.log", std::ios::trunc) << "t1\n";
+            tail.read(callback);
+            CHECK_EQ(lines, std::vector<std::string>{"a.log:0:t1"});
+        }
+
+        SUBCASE("rotation") {
+            append("a.log", "last\npartial");
+            std::filesystem::rename(dir / "a.log", dir / "a.log.1");
+            append("a.log", "first\n");
+
+            tail.rescan(callback);
+            tail.read(callback);
+            CHECK_EQ(lines, std::vector<std::string>{"a.log:10:last", "a.log:15:partial", "a.log:0:first"});
+            CHECK_EQ(tail.paths(), std::vector<filesystem::path>{dir / "a.log"});
+        }
+
+        SUBCASE("rename within pattern") {
+            std::filesystem::rename(dir / "a.log", dir / "c.log");
+            tail.rescan(callback);
+            append("c.log", "c1\n");
+            tail.read(callback);
+            CHECK_EQ(lines, std::vector<std::string>{"c.log:10:c1"}); // not read from the beginning again
+        }
+
+        SUBCASE("long line") {
+            append("a.log", std::string(MaxLineSize + 10, 'x') + "\n");
+            tail.read(callback);
+            REQUIRE_EQ(lines.size(), 2);
+            CHECK_EQ(lines[0].size(), frmt("a.log:10:").size() + MaxLineSize);
+            CHECK_EQ(lines[1], frmt("a.log:{}:xxxxxxxxxx", 10 + MaxLineSize));
+        }
+
+        SUBCASE("long line across reads") {
+            // The partial line from the first read must count towards the
+            // limit when the second one continues it.
+            append("a.log", "abc");
+            tail.read(callback);
+            CHECK(lines.empty());
+
+            append("a.log", std::string(2 * MaxLineSize, 'x') + "\n");
+            tail.read(callback);
+            REQUIRE_EQ(lines.size(), 3);
+            CHECK_EQ(lines[0], frmt("a.log:10:abc{}", std::string(MaxLineSize - 3, 'x')));
+            CHECK_EQ(lines[1], frmt("a.log:{}:{}", 10 + MaxLineSize, std::string(MaxLineSize, 'x')));
+            CHECK_EQ(lines[2], frmt("a.log:{}:xxx", 10 + 2 * MaxLineSize));
+        }
+    }
+
+    TEST_CASE("files_tail_events - directories") {
+        CHECK_EQ(PatternTail("/var/log/*.log").directories(), std::set<filesystem::path>{"/var/log"});
+        CHECK_EQ(PatternTail("/home/*/log/x").directories(), std::set<filesystem::path>{"/home"});
+    }
+}
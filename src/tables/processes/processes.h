@@ -8,7 +8,7 @@ namespace zeek::agent::table {
 
 class ProcessesCommon : public SnapshotTable {
 public:
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             // clang-format off
             .name = "processes",
@@ -40,7 +40,7 @@ public:
 
 class ProcessesEventsCommon : public EventTable {
 public:
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             // clang-format off
             .name = "processes_events",
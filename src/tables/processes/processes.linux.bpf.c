@@ -40,6 +40,15 @@ struct {
     __uint(max_entries, 1000);
 } process_table SEC(".maps");
 
+// Executables of execve() calls still in progress, keyed by task. We record
+// them as the process' name only once we know that the call succeeded.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, const void*); // process key
+    __type(value, char[BPF_PROCESS_NAME_MAX]);
+    __uint(max_entries, 1000);
+} exec_table SEC(".maps");
+
 static struct bpfProcess* startNewProcess(const void* key, int seed_name) {
     struct bpfProcess process;
     bzero(&process, sizeof(process));
@@ -120,6 +129,19 @@ struct mm_struct {
     // ...
 };
 
+// From vmlinux.
+typedef struct {
+    int counter;
+} atomic_t;
+
+// From vmlinux.
+//
+// Accessed through CO-RE, so only declaring fields we need.
+struct signal_struct {
+    atomic_t live; // number of threads that haven't started exiting yet
+    // ...
+};
+
 // From vmlinux.
 //
 // Accessed through CO-RE, so only declaring fields we need.
@@ -130,12 +152,30 @@ struct task_struct {
     const struct cred* cred;
     const struct cred* real_cred;
     struct task_struct* real_parent;
-    __u64 utime; // in nsecs since 4.11.0
-    __u64 stime; // in nsecs since 4.11.0
+    struct task_struct* group_leader;
+    __u64 utime;          // in nsecs since 4.11.0
+    __u64 stime;          // in nsecs since 4.11.0
+    __u64 start_boottime; // in nsecs since boot; since 5.5.0
     struct mm_struct* mm;
+    struct signal_struct* signal;
     // ...
 };
 
+// From vmlinux before 5.5.0, which named the field differently.
+struct task_struct___pre_5_5 {
+    __u64 real_start_time; // in nsecs since boot
+};
+
+// Returns the time the task's process started, in nsecs since boot.
+static __u64 processStartTime(struct task_struct* task) {
+    struct task_struct* leader = BPF_CORE_READ(task, group_leader);
+
+    if ( bpf_core_field_exists(leader->start_boottime) )
+        return BPF_CORE_READ(leader, start_boottime);
+    else
+        return BPF_CORE_READ((struct task_struct___pre_5_5*)leader, real_start_time);
+}
+
 static void sendProcessEvent(struct bpfProcess* process, struct task_struct* task, enum bpfProcessState state) {
     struct bpfProcessEvent* ev = bpf_ringbuf_reserve(&ring_buffer, sizeof(struct bpfProcessEvent), 0);
     if ( ! ev )
@@ -151,7 +191,9 @@ static void sendProcessEvent(struct bpfProcess* process, struct task_struct* tas
     ev->life_time = (__s64)(process->start_time >= 0 ? (bpf_ktime_get_boot_ns() - process->start_time) : -1);
     ev->ruid = BPF_CORE_READ(task, cred, uid.val);
     ev->rgid = BPF_CORE_READ(task, cred, gid.val);
-    ev->ppid = BPF_CORE_READ(task, real_parent, pid);
+    ev->tid = BPF_CORE_READ(task, pid);
+    ev->ppid = BPF_CORE_READ(task, real_parent, tgid);
+    ev->start_time = processStartTime(task);
     ev->priority = BPF_CORE_READ(task, prio);
 
     ev->utime = BPF_CORE_READ(task, utime);
@@ -167,6 +209,7 @@ static void sendProcessEvent(struct bpfProcess* process, struct task_struct* tas
     ev->vsize = BPF_CORE_READ(task, mm, total_vm);
 
     ev->state = state;
+    ev->ts = bpf_ktime_get_boot_ns();
     bpf_ringbuf_submit(ev, 0);
 }
 
@@ -190,18 +233,30 @@ int BPF_KSYSCALL(execve, const char* filename, const char* const* argv, const ch
         return 0; // make verifier happy
 
     if ( name_len > 1 )
-        bpf_probe_read_user_str(process->event.name, sizeof(process->event.name), filename);
+        bpf_map_update_elem(&exec_table, &task, name, BPF_ANY);
+    else
+        bpf_map_delete_elem(&exec_table, &task);
 
     return 0;
 }
 
 SEC("kretsyscall/execve")
-int BPF_KSYSCALL(execve_ret, int rc) {
+int BPF_KRETPROBE(execve_ret, long rc) {
     struct task_struct* task = (struct task_struct*)bpf_get_current_task();
 
+    char* name = bpf_map_lookup_elem(&exec_table, &task);
     struct bpfProcess* process = lookupProcess(task);
-    if ( process )
+
+    if ( rc == 0 && process ) {
+        if ( name )
+            memcpy(process->event.name, name, sizeof(process->event.name));
+
         sendProcessEvent(process, task, BPF_PROCESS_STATE_STARTED);
+    }
+
+    // If execve() failed, the process continues running its current executable.
+    if ( name )
+        bpf_map_delete_elem(&exec_table, &task);
 
     return 0;
 }
@@ -221,6 +276,12 @@ int BPF_KPROBE(do_exit, long code) {
         process->start_time = -1;
     }
 
+    // The exiting thread still counts as live when we get here, so it's the
+    // last one if the count is down to one. (If the last threads exit
+    // concurrently, none of them may see that; user space reconciles that
+    // through its periodic rescans.)
+    process->event.group_dead = (BPF_CORE_READ(task, signal, live.counter) <= 1);
+
     sendProcessEvent(process, task, BPF_PROCESS_STATE_STOPPED);
     removeProcess(task);
 
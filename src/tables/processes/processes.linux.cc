@@ -6,19 +6,34 @@
 #include "core/configuration.h"
 #include "core/database.h"
 #include "core/logger.h"
+#include "core/scheduler.h"
 #include "core/table.h"
 #include "processes.linux.event.h"
+#include "processes.linux.h"
+#include "util/benchmark.h"
 #include "util/fmt.h"
+#include "util/testing.h"
+#include "util/thread-pool.h"
 
 // clang-format off
 #include "platform/linux/bpf.h"
+#include "platform/linux/procfs.h"
 
 #define _Bool bool
 #include "autogen/bpf/processes.skel.h"
+#include "autogen/bpf/processes_iter.skel.h"
 #undef _Bool
 // clang-format on
 
-#include <pfs/procfs.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
 
 namespace zeek::agent::table {
 
@@ -26,61 +41,362 @@ class ProcessesLinux : public ProcessesCommon {
 public:
     std::vector<std::vector<Value>> snapshot(const std::vector<table::Argument>& args) override;
     Init init() override;
+    void activate() override;
+    void deactivate() override;
+    void poll() override;
+
+    // Backends for `snapshot()`, public for testing.
+    std::vector<std::vector<Value>> snapshotFromTaskIterator();
+    std::vector<std::vector<Value>> snapshotFromProcFS();
+
+    // Returns true if the BPF task iterator is available for use.
+    bool haveTaskIterator() const { return _task_iterator != nullptr; }
+
+    // Returns true if we are serving snapshots from the live process table.
+    bool haveLiveTable() const { return _live_table_attached; }
+
+    // Callback for BPF process events feeding the live table.
+    void processEvent(const bpfProcessEvent* ev);
 
 private:
+    std::vector<std::vector<Value>> scan();
+    void initTaskIterator();
+    void initLiveTable();
+
     uint64_t _clock_tick;
+    int64_t _page_size;
+    processes_iter* _task_iterator = nullptr;        // set if we could load the BPF task iterator
+    std::unique_ptr<LiveProcessTable> _live_table;   // set if we can keep the table current through BPF events
+    bool _live_table_attached = false;               // true while the live table's BPF program is attached
+    std::atomic<bool> _live_table_reseeding = false; // true while a background reseed is queued or running
 };
 
 namespace {
 database::RegisterTable<ProcessesLinux> _1;
 }
 
+// Interval at which we rescan all processes to refresh the live table.
+static const auto LiveTableRescanInterval = 10s;
+
+// Converts a process' start time, in nanoseconds since boot, into the value
+// of the `startup` column, which is wall clock time as an interval since the
+// epoch, like on other platforms. We round to seconds so that the value stays
+// stable across recalibrations of the boot time offset.
+static Value startupFromBootTime(uint64_t ns) {
+    auto t = platform::linux::bpf()->bootTimeToTime(ns);
+    return to_interval_from_secs(std::chrono::duration_cast<std::chrono::seconds>(t.time_since_epoch()).count());
+}
+
+// Minimum number of processes that a shard of a parallel /proc scan
+// processes; below that, the threading overhead isn't worth it.
+static const size_t ProcFSMinProcessesPerShard = 128;
+
 EventTable::Init ProcessesLinux::init() {
     _clock_tick = sysconf(_SC_CLK_TCK);
+    _page_size = getpagesize();
+
+    if ( platform::linux::bpf()->isAvailable() ) {
+        initTaskIterator();
+        initLiveTable();
+    }
+
     return Init::Available;
 }
 
+void ProcessesLinux::initTaskIterator() {
+    auto bpf = platform::linux::bpf();
+
+    auto skel = platform::linux::BPF::Skeleton{.name = "ProcessesIter",
+                                               .open = reinterpret_cast<void*>(processes_iter__open),
+                                               .load = reinterpret_cast<void*>(processes_iter__load),
+                                               .attach = reinterpret_cast<void*>(processes_iter__attach),
+                                               .detach = reinterpret_cast<void*>(processes_iter__detach),
+                                               .destroy = reinterpret_cast<void*>(processes_iter__destroy)};
+
+    auto our_bpf = bpf->load<processes_iter>(std::move(skel));
+    if ( ! our_bpf ) {
+        ZEEK_AGENT_DEBUG("processes", "BPF task iterator not available, using procfs ({})", our_bpf.error());
+        return;
+    }
+
+    if ( auto rc = bpf->attach("ProcessesIter"); ! rc ) {
+        ZEEK_AGENT_DEBUG("processes", "BPF task iterator not available, using procfs ({})", rc.error());
+        (void)bpf->destroy("ProcessesIter");
+        return;
+    }
+
+    ZEEK_AGENT_DEBUG("processes", "using BPF task iterator");
+    _task_iterator = *our_bpf;
+}
+
+static int handle_live_event(void* ctx, void* data, size_t data_sz) {
+    auto table = reinterpret_cast<ProcessesLinux*>(ctx);
+    table->processEvent(reinterpret_cast<const bpfProcessEvent*>(data));
+    return 1;
+}
+
+void ProcessesLinux::initLiveTable() {
+    auto bpf = platform::linux::bpf();
+
+    // This loads a separate instance of the program that `processes_events`
+    // uses, so that we can keep it attached independent of that table.
+    auto skel = platform::linux::BPF::Skeleton{.name = "ProcessesLive",
+                                               .open = reinterpret_cast<void*>(processes__open),
+                                               .load = reinterpret_cast<void*>(processes__load),
+                                               .attach = reinterpret_cast<void*>(processes__attach),
+                                               .detach = reinterpret_cast<void*>(processes__detach),
+                                               .destroy = reinterpret_cast<void*>(processes__destroy),
+                                               .event_callback = handle_live_event,
+                                               .event_context = this};
+
+    auto our_bpf = bpf->load<processes>(std::move(skel));
+    if ( ! our_bpf ) {
+        ZEEK_AGENT_DEBUG("processes", "live process table not available ({})", our_bpf.error());
+        return;
+    }
+
+    if ( auto rc = bpf->init("ProcessesLive", (*our_bpf)->maps.ring_buffer); ! rc ) {
+        ZEEK_AGENT_DEBUG("processes", "live process table not available ({})", rc.error());
+        return;
+    }
+
+    // We attach the program and seed the table only once a query needs it.
+    _live_table = std::make_unique<LiveProcessTable>();
+    ZEEK_AGENT_DEBUG("processes", "using live process table");
+}
+
+void ProcessesLinux::activate() {
+    if ( ! _live_table )
+        return;
+
+    // Attach first so that events arriving during seeding get recorded.
+    if ( auto rc = platform::linux::bpf()->attach("ProcessesLive"); ! rc ) {
+        logger()->warn(frmt("could not attach BPF program, scanning processes on each query ({})", rc.error()));
+        return;
+    }
+
+    _live_table->reseed([this]() { return scan(); });
+    _live_table_attached = true;
+}
+
+void ProcessesLinux::deactivate() {
+    if ( ! _live_table_attached )
+        return;
+
+    _live_table_attached = false;
+
+    if ( auto rc = platform::linux::bpf()->detach("ProcessesLive"); ! rc )
+        logger()->error(frmt("could not detach BPF program: {}", rc.error()));
+}
+
+void ProcessesLinux::processEvent(const bpfProcessEvent* ev) {
+    if ( ! _live_table )
+        return;
+
+    auto pid = static_cast<int64_t>(ev->pid);
+
+    switch ( ev->state ) {
+        case BPF_PROCESS_STATE_STARTED: {
+            // After exec, the kernel sets the process name to the executable's
+            // basename, truncated to TASK_COMM_LEN - 1.
+            std::string_view path = ev->name;
+            if ( auto i = path.rfind('/'); i != std::string_view::npos )
+                path = path.substr(i + 1);
+
+            Value name = std::string(path.substr(0, BPF_PROCESS_COMM_MAX - 1));
+            Value pid_ = pid;
+            Value ppid = static_cast<int64_t>(ev->ppid);
+            Value uid = static_cast<int64_t>(ev->uid);
+            Value gid = static_cast<int64_t>(ev->gid);
+            Value ruid = static_cast<int64_t>(ev->ruid);
+            Value rgid = static_cast<int64_t>(ev->rgid);
+            Value priority = std::to_string(ev->priority - 100); // TODO: That's MAX_RT_PRIO, require kernel header?
+            Value startup = startupFromBootTime(ev->start_time);
+            Value vsize = static_cast<int64_t>(ev->vsize * _page_size);
+            Value rsize = static_cast<int64_t>(ev->rsize * _page_size);
+            Value utime = to_interval_from_ns(ev->utime);
+            Value stime = to_interval_from_ns(ev->stime);
+
+            _live_table->update(pid, {name, pid_, ppid, uid, gid, ruid, rgid, priority, startup, vsize, rsize, utime,
+                                      stime});
+            break;
+        }
+
+        case BPF_PROCESS_STATE_STOPPED:
+            if ( ev->group_dead ) // ignore threads exiting while others keep running
+                _live_table->remove(pid);
+
+            break;
+
+        case BPF_PROCESS_STATE_UNKNOWN: break;
+    }
+}
+
+void ProcessesLinux::poll() {
+    if ( ! isActive() || ! _live_table_attached )
+        return;
+
+    if ( std::chrono::steady_clock::now() - _live_table->lastRescan() < LiveTableRescanInterval )
+        return;
+
+    if ( _live_table_reseeding.exchange(true) )
+        return; // still busy with the previous one
+
+    // We refresh the live table in the background so that neither queries
+    // nor the main loop have to wait for the scan.
+    workerPool().submit([this]() {
+        try {
+            _live_table->reseed([this]() { return scan(); });
+        } catch ( const std::exception& e ) {
+            logger()->warn(frmt("could not refresh live process table: {}", e.what()));
+        }
+
+        _live_table_reseeding = false;
+    });
+}
+
 std::vector<std::vector<Value>> ProcessesLinux::snapshot(const std::vector<table::Argument>& args) {
-    std::vector<std::vector<Value>> rows;
+    if ( ! _live_table_attached )
+        return scan();
+
+    return _live_table->rows();
+}
+
+std::vector<std::vector<Value>> ProcessesLinux::scan() {
+    if ( _task_iterator )
+        return snapshotFromTaskIterator();
+    else
+        return snapshotFromProcFS();
+}
+
+std::vector<std::vector<Value>> ProcessesLinux::snapshotFromTaskIterator() {
+    auto data = platform::linux::bpf()->readIterator(_task_iterator->links.dump_task);
+    if ( ! data ) {
+        logger()->warn(frmt("cannot read BPF task iterator, falling back to procfs ({})", data.error()));
+        return snapshotFromProcFS();
+    }
 
-    try {
-        pfs::procfs pfs;
-
-        for ( const auto& p : pfs.get_processes() ) {
-            try {
-                auto stat = p.get_stat();
-                auto status = p.get_status();
-                Value name = p.get_comm();
-                Value pid = static_cast<int64_t>(p.id());
-                Value ppid = static_cast<int64_t>(stat.ppid);
-                Value uid = static_cast<int64_t>(status.uid.effective);
-                Value gid = static_cast<int64_t>(status.gid.effective);
-                Value ruid = static_cast<int64_t>(status.uid.real);
-                Value rgid = static_cast<int64_t>(status.gid.real);
-                Value priority = std::to_string(stat.priority);
-                Value startup = {};
-                Value vsize = static_cast<int64_t>(stat.vsize);
-                Value rsize = static_cast<int64_t>(stat.rss * getpagesize());
-                Value utime = to_interval_from_secs(stat.utime / _clock_tick);
-                Value stime = to_interval_from_secs(stat.stime / _clock_tick);
-
-                rows.push_back({name, pid, ppid, uid, gid, ruid, rgid, priority, startup, vsize, rsize, utime, stime});
-            } catch ( std::system_error& ) {
-                // ignore, most likely a permission problem
-            } catch ( std::runtime_error& ) {
-                // ignore, most likely a permission problem
-            }
+    if ( data->size() % sizeof(bpfProcessTask) != 0 )
+        throw InternalError("unexpected amount of data from BPF task iterator");
+
+    auto tasks = reinterpret_cast<const bpfProcessTask*>(data->data());
+    auto num_tasks = data->size() / sizeof(bpfProcessTask);
+
+    // The iterator visits all threads, ordered by thread ID. We sum up CPU
+    // times across each process' threads, like /proc does.
+    struct Process {
+        const bpfProcessTask* leader = nullptr;
+        uint64_t utime = 0;
+        uint64_t stime = 0;
+    };
+
+    std::unordered_map<uint64_t, Process> processes;
+    processes.reserve(num_tasks);
+
+    for ( size_t i = 0; i < num_tasks; i++ ) {
+        const auto* t = &tasks[i];
+        auto& p = processes[t->tgid];
+        p.utime += t->utime;
+        p.stime += t->stime;
+
+        if ( t->pid == t->tgid ) {
+            p.leader = t;
+            p.utime += t->dead_utime;
+            p.stime += t->dead_stime;
         }
+    }
 
-    } catch ( std::system_error& ) {
-        logger()->warn("cannot read /proc filesystem (system error)");
-    } catch ( std::runtime_error& ) {
-        logger()->warn("cannot read /proc filesystem (runtime error)");
+    std::vector<std::vector<Value>> rows;
+    rows.reserve(processes.size());
+
+    for ( const auto& [_, p] : processes ) {
+        if ( ! p.leader )
+            continue; // leader exited while iterating
+
+        Value name = std::string(p.leader->comm, strnlen(p.leader->comm, sizeof(p.leader->comm)));
+        Value pid = static_cast<int64_t>(p.leader->tgid);
+        Value ppid = static_cast<int64_t>(p.leader->ppid);
+        Value uid = static_cast<int64_t>(p.leader->uid);
+        Value gid = static_cast<int64_t>(p.leader->gid);
+        Value ruid = static_cast<int64_t>(p.leader->ruid);
+        Value rgid = static_cast<int64_t>(p.leader->rgid);
+        Value priority = std::to_string(p.leader->priority - 100); // TODO: That's MAX_RT_PRIO, require kernel header?
+        Value startup = startupFromBootTime(p.leader->start_time);
+        Value vsize = static_cast<int64_t>(p.leader->vsize * _page_size);
+        Value rsize = static_cast<int64_t>(p.leader->rsize * _page_size);
+        Value utime = to_interval_from_ns(p.utime);
+        Value stime = to_interval_from_ns(p.stime);
+
+        rows.push_back({name, pid, ppid, uid, gid, ruid, rgid, priority, startup, vsize, rsize, utime, stime});
     }
 
     return rows;
 }
 
+std::vector<std::vector<Value>> ProcessesLinux::snapshotFromProcFS() {
+    std::vector<int64_t> pids;
+
+    platform::linux::procfs::Reader reader;
+    auto success = reader.forEachProcess([&](int64_t pid) {
+        pids.push_back(pid);
+        return true;
+    });
+
+    if ( ! success ) {
+        logger()->warn("cannot read /proc filesystem");
+        return {};
+    }
+
+    // Parse the processes in parallel, with each shard filling its own row
+    // buffer that we merge at the end.
+    auto& pool = workerPool();
+    auto shards = pool.shards(pids.size(), ProcFSMinProcessesPerShard);
+    std::vector<std::vector<std::vector<Value>>> buffers(shards);
+
+    pool.run(shards, [&](size_t shard) {
+        auto begin = pids.size() * shard / shards;
+        auto end = pids.size() * (shard + 1) / shards;
+
+        auto& rows = buffers[shard];
+        rows.reserve(end - begin);
+
+        platform::linux::procfs::Reader reader;
+        platform::linux::procfs::Process p;
+
+        for ( auto i = begin; i < end; i++ ) {
+            if ( ! reader.readProcess(pids[i], &p) )
+                continue; // ignore, most likely a permission problem or process is gone
+
+            Value name = p.comm;
+            Value pid = p.pid;
+            Value ppid = p.ppid;
+            Value uid = p.uid;
+            Value gid = p.gid;
+            Value ruid = p.ruid;
+            Value rgid = p.rgid;
+            Value priority = std::to_string(p.priority);
+            Value startup = startupFromBootTime(p.starttime * 1'000'000'000 / _clock_tick);
+            Value vsize = static_cast<int64_t>(p.vsize);
+            Value rsize = static_cast<int64_t>(p.rss * _page_size);
+            Value utime = to_interval_from_ns(p.utime * 1'000'000'000 / _clock_tick);
+            Value stime = to_interval_from_ns(p.stime * 1'000'000'000 / _clock_tick);
+
+            rows.push_back({name, pid, ppid, uid, gid, ruid, rgid, priority, startup, vsize, rsize, utime, stime});
+        }
+    });
+
+    if ( shards == 1 )
+        return std::move(buffers[0]);
+
+    std::vector<std::vector<Value>> rows;
+    rows.reserve(pids.size());
+
+    for ( auto& buffer : buffers )
+        std::move(buffer.begin(), buffer.end(), std::back_inserter(rows));
+
+    return rows;
+}
+
 class ProcessesEventsLinux : public ProcessesEventsCommon {
 public:
     Init init() override;
@@ -123,8 +439,8 @@ static int handle_event(void* ctx, void* data, size_t data_sz) {
         case BPF_PROCESS_STATE_UNKNOWN: break; // leave unset
     }
 
-    table->newEvent({table->systemTime(), name, pid, ppid, uid, gid, ruid, rgid, priority, startup, vsize, rsize, utime,
-                     stime, state});
+    auto t = platform::linux::bpf()->bootTimeToTime(ev->ts);
+    table->newEvent({t, name, pid, ppid, uid, gid, ruid, rgid, priority, startup, vsize, rsize, utime, stime, state});
 
     return 1;
 }
@@ -169,3 +485,77 @@ void ProcessesEventsLinux::deactivate() {
 
 
 } // namespace zeek::agent::table
+
+using namespace zeek::agent;
+
+TEST_CASE_FIXTURE(test::TableFixture, "processes backends" * doctest::test_suite("Tables")) {
+    useTable("processes");
+
+    auto table = dynamic_cast<table::ProcessesLinux*>(Database::registeredTables().at("processes").get());
+    REQUIRE(table);
+
+    if ( ! table->haveTaskIterator() )
+        return; // BPF not available (e.g., not root)
+
+    // Both backends must see ourselves, with the same information.
+    auto find_self = [](const std::vector<std::vector<Value>>& rows) -> std::optional<std::vector<Value>> {
+        for ( const auto& row : rows ) {
+            if ( std::get<int64_t>(row[1]) == getpid() )
+                return row;
+        }
+
+        return {};
+    };
+
+    auto bpf = find_self(table->snapshotFromTaskIterator());
+    auto procfs = find_self(table->snapshotFromProcFS());
+    REQUIRE(bpf);
+    REQUIRE(procfs);
+
+    for ( auto i : {0, 1, 2, 3, 4, 5, 6, 7} ) // name, pid, ppid, uid, gid, ruid, rgid, priority
+        CHECK_EQ((*bpf)[i], (*procfs)[i]);
+
+    // Times differ in precision (nsecs vs clock ticks), and CPU times keep
+    // increasing between the two snapshots, so allow some slack there.
+    auto check_close = [&](int i, Interval tolerance) {
+        CAPTURE(i);
+        auto delta = std::get<Interval>((*procfs)[i]) - std::get<Interval>((*bpf)[i]);
+        CHECK_LE(std::chrono::abs(delta), tolerance);
+    };
+
+    check_close(8, 1s);     // startup, which is rounded to seconds
+    check_close(11, 250ms); // utime
+    check_close(12, 250ms); // stime
+}
+
+// Runs one of the `processes` backends as a benchmark. To measure with a
+// large number of tasks, spawn them before running `zeek-agent
+// --bench=processes/`. Reports zero iterations if the backend isn't
+// available.
+static void benchmarkBackend(benchmark::State& state,
+                             std::vector<std::vector<Value>> (table::ProcessesLinux::*snapshot)()) {
+    Configuration cfg;
+    Scheduler scheduler;
+    Database db(&cfg, &scheduler);
+
+    auto table = dynamic_cast<table::ProcessesLinux*>(Database::registeredTables().at("processes").get());
+    if ( ! table )
+        return;
+
+    db.addTable(table);
+
+    if ( snapshot == &table::ProcessesLinux::snapshotFromTaskIterator && ! table->haveTaskIterator() )
+        return;
+
+    while ( state.keepRunning() ) {
+        auto rows = (table->*snapshot)();
+        state.setItemsPerIteration(static_cast<int64_t>(rows.size()));
+        benchmark::doNotOptimize(rows);
+    }
+}
+
+ZEEK_AGENT_BENCHMARK("processes/procfs") { benchmarkBackend(state, &table::ProcessesLinux::snapshotFromProcFS); }
+
+ZEEK_AGENT_BENCHMARK("processes/bpf-iter") {
+    benchmarkBackend(state, &table::ProcessesLinux::snapshotFromTaskIterator);
+}
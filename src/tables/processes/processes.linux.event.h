@@ -6,22 +6,48 @@
 
 #define BPF_PROCESS_NAME_MAX 128
 #define BPF_PROCESS_PRIORITY_MAX 16
+#define BPF_PROCESS_COMM_MAX 16 // TASK_COMM_LEN
 
 enum bpfProcessState { BPF_PROCESS_STATE_UNKNOWN = 0, BPF_PROCESS_STATE_STARTED, BPF_PROCESS_STATE_STOPPED };
 
 struct bpfProcessEvent {
     char name[BPF_PROCESS_NAME_MAX];
     __u64 pid;
+    __u64 tid; // thread reporting the event
     __u64 ppid;
     __u64 uid;
     __u64 gid;
     __u64 ruid;
     __u64 rgid;
-    __s64 life_time; // -1 for unknown
-    int priority;    // + MAX_RT_PRIO
-    __u64 vsize;     // bytes
-    __u64 rsize;     // pages
-    __u64 utime;     // nsecs
-    __u64 stime;     // nsecs
+    __s64 life_time;  // -1 for unknown
+    __u64 start_time; // nsecs since boot (CLOCK_BOOTTIME) when the process started
+    int priority;     // + MAX_RT_PRIO
+    __u64 vsize;      // bytes
+    __u64 rsize;      // pages
+    __u64 utime;      // nsecs
+    __u64 stime;      // nsecs
     enum bpfProcessState state;
+    __u32 group_dead; // for STOPPED, non-zero if the process' last thread is exiting
+    __u64 ts;         // nsecs since boot (CLOCK_BOOTTIME) when event was recorded
+};
+
+// Record emitted by the task iterator for each thread, see
+// processes.linux.iter.bpf.c. User space aggregates threads by `tgid`.
+struct bpfProcessTask {
+    char comm[BPF_PROCESS_COMM_MAX];
+    __u64 pid;        // thread ID
+    __u64 tgid;       // process ID
+    __u64 ppid;       // parent's process ID
+    __u64 uid;        // effective
+    __u64 gid;        // effective
+    __u64 ruid;       // real
+    __u64 rgid;       // real
+    __s64 priority;   // + MAX_RT_PRIO
+    __u64 vsize;      // pages
+    __u64 rsize;      // pages
+    __u64 utime;      // nsecs, this thread only
+    __u64 stime;      // nsecs, this thread only
+    __u64 dead_utime; // nsecs, accumulated by exited threads of process
+    __u64 dead_stime; // nsecs, accumulated by exited threads of process
+    __u64 start_time; // nsecs since boot (CLOCK_BOOTTIME) when the process started
 };
@@ -0,0 +1,135 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include "core/table.h"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace zeek::agent::table {
+
+/**
+ * In-memory table of running processes, keyed by PID. We seed it with a
+ * full scan and then keep it current through the BPF process events. A
+ * periodic rescan refreshes resource counters and reconciles anything the
+ * events didn't tell us about (e.g., processes forking without exec). Rows
+ * follow the `processes` table's schema, with the PID in column 1.
+ *
+ * All public methods are thread-safe.
+ */
+class LiveProcessTable {
+public:
+    /**
+     * Replaces the table's content with the rows of a full scan. Updates
+     * and removals recorded while the scan is running get re-applied on top
+     * of its rows, as they may be more recent. Concurrent calls run one
+     * after the other. If the scan throws, the table keeps its content.
+     *
+     * @param scan function returning the rows of a full scan
+     */
+    void reseed(const std::function<std::vector<std::vector<Value>>()>& scan) {
+        const std::lock_guard<std::mutex> reseed_lock(_reseed_mutex);
+
+        {
+            const std::lock_guard<std::mutex> lock(_mutex);
+            _rescanning = true;
+            _pending.clear();
+        }
+
+        std::vector<std::vector<Value>> rows;
+
+        try {
+            rows = scan();
+        } catch ( ... ) {
+            const std::lock_guard<std::mutex> lock(_mutex);
+            _rescanning = false;
+            _pending.clear();
+            throw;
+        }
+
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _processes.clear();
+        _processes.reserve(rows.size());
+
+        for ( auto& row : rows ) {
+            auto pid = std::get<int64_t>(row[1]);
+            _processes.insert_or_assign(pid, std::move(row));
+        }
+
+        // Re-apply what happened while scanning.
+        for ( auto& [pid, row] : _pending ) {
+            if ( row )
+                _processes.insert_or_assign(pid, std::move(*row));
+            else
+                _processes.erase(pid);
+        }
+
+        _pending.clear();
+        _rescanning = false;
+        _last_rescan = std::chrono::steady_clock::now();
+    }
+
+    /** Returns the time of the last full scan. */
+    auto lastRescan() const {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        return _last_rescan;
+    }
+
+    /**
+     * Records a new or updated process.
+     *
+     * @param pid the process' ID
+     * @param row the process' row
+     */
+    void update(int64_t pid, std::vector<Value> row) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        if ( _rescanning )
+            _pending.emplace_back(pid, row);
+
+        _processes.insert_or_assign(pid, std::move(row));
+    }
+
+    /**
+     * Records a process as having terminated.
+     *
+     * @param pid the process' ID
+     */
+    void remove(int64_t pid) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        if ( _rescanning )
+            _pending.emplace_back(pid, std::nullopt);
+
+        _processes.erase(pid);
+    }
+
+    /** Returns all current processes. */
+    std::vector<std::vector<Value>> rows() const {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        std::vector<std::vector<Value>> rows;
+        rows.reserve(_processes.size());
+
+        for ( const auto& [_, row] : _processes )
+            rows.push_back(row);
+
+        return rows;
+    }
+
+private:
+    std::mutex _reseed_mutex;                                                    // serializes reseed()
+    mutable std::mutex _mutex;                                                   // protects the following
+    std::unordered_map<int64_t, std::vector<Value>> _processes;                  // PID -> row
+    std::vector<std::pair<int64_t, std::optional<std::vector<Value>>>> _pending; // events received during a rescan
+    bool _rescanning = false;                                                    // true while reseed() is scanning
+    std::chrono::steady_clock::time_point _last_rescan;                          // time of last full scan
+};
+
+} // namespace zeek::agent::table
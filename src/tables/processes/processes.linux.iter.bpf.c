@@ -0,0 +1,171 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Task iterator backing the `processes` snapshot table. Reading from an
+// iterator FD runs the program once for each task in the system, and we write
+// a fixed-size `bpfProcessTask` record for each into the output sequence.
+
+#include "processes.linux.event.h"
+
+// clang-format off
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+// clang-format on
+
+#include <string.h>
+
+#include <sys/types.h>
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL"; // don't change; must be a license known by kernel
+
+// From vmlinux.
+typedef struct {
+    uid_t val;
+} kuid_t;
+
+// From vmlinux.
+typedef struct {
+    gid_t val;
+} kgid_t;
+
+// From vmlinux.
+struct cred {
+    kuid_t uid;
+    kgid_t gid;
+    kuid_t suid;
+    kgid_t sgid;
+    kuid_t euid;
+    kgid_t egid;
+    kuid_t fsuid;
+    kgid_t fsgid;
+};
+
+// From vmlinux.
+typedef struct {
+    __s64 counter;
+} atomic64_t;
+
+// From vmlinux.
+typedef atomic64_t atomic_long_t;
+
+// From vmlinux.
+enum {
+    MM_FILEPAGES,  /* Resident file mapping pages */
+    MM_ANONPAGES,  /* Resident anonymous pages */
+    MM_SWAPENTS,   /* Anonymous swap entries */
+    MM_SHMEMPAGES, /* Resident shared memory pages */
+    NR_MM_COUNTERS
+};
+
+// From vmlinux.
+struct mm_rss_stat {
+    atomic_long_t count[4];
+};
+
+// From vmlinux.
+//
+// Accessed through CO-RE, so only declaring fields we need.
+struct mm_struct {
+    struct {
+        struct mm_rss_stat rss_stat;
+        long unsigned int total_vm;
+    };
+    // ...
+};
+
+// From vmlinux.
+//
+// Accessed through CO-RE, so only declaring fields we need.
+struct signal_struct {
+    __u64 utime; // of dead threads
+    __u64 stime; // of dead threads
+    // ...
+};
+
+// From vmlinux.
+//
+// Accessed through CO-RE, so only declaring fields we need.
+struct task_struct {
+    pid_t pid;
+    pid_t tgid;
+    int prio;
+    const struct cred* cred;
+    const struct cred* real_cred;
+    struct task_struct* real_parent;
+    __u64 utime;          // in nsecs since 4.11.0
+    __u64 stime;          // in nsecs since 4.11.0
+    __u64 start_boottime; // in nsecs since boot; since 5.5.0
+    struct mm_struct* mm;
+    struct signal_struct* signal;
+    char comm[BPF_PROCESS_COMM_MAX];
+    // ...
+};
+
+// From vmlinux before 5.5.0, which named the field differently.
+struct task_struct___pre_5_5 {
+    __u64 real_start_time; // in nsecs since boot
+};
+
+// From vmlinux.
+struct seq_file;
+
+// From vmlinux.
+struct bpf_iter_meta {
+    struct seq_file* seq;
+    __u64 session_id;
+    __u64 seq_num;
+};
+
+// From vmlinux.
+struct bpf_iter__task {
+    struct bpf_iter_meta* meta;
+    struct task_struct* task;
+};
+
+SEC("iter/task")
+int dump_task(struct bpf_iter__task* ctx) {
+    struct seq_file* seq = ctx->meta->seq;
+    struct task_struct* task = ctx->task;
+
+    if ( ! task )
+        return 0; // end of iteration
+
+    struct bpfProcessTask t;
+    bzero(&t, sizeof(t));
+
+    t.pid = BPF_CORE_READ(task, pid);
+    t.tgid = BPF_CORE_READ(task, tgid);
+    t.utime = BPF_CORE_READ(task, utime);
+    t.stime = BPF_CORE_READ(task, stime);
+
+    if ( t.pid == t.tgid ) {
+        // Thread group leader, fill in the process-wide information.
+        BPF_CORE_READ_STR_INTO(&t.comm, task, comm);
+        t.ppid = BPF_CORE_READ(task, real_parent, tgid);
+        t.uid = BPF_CORE_READ(task, cred, euid.val);
+        t.gid = BPF_CORE_READ(task, cred, egid.val);
+        t.ruid = BPF_CORE_READ(task, cred, uid.val);
+        t.rgid = BPF_CORE_READ(task, cred, gid.val);
+        t.priority = BPF_CORE_READ(task, prio);
+        t.dead_utime = BPF_CORE_READ(task, signal, utime);
+        t.dead_stime = BPF_CORE_READ(task, signal, stime);
+
+        if ( bpf_core_field_exists(task->start_boottime) )
+            t.start_time = BPF_CORE_READ(task, start_boottime);
+        else
+            t.start_time = BPF_CORE_READ((struct task_struct___pre_5_5*)task, real_start_time);
+
+        // Same computation as in processes.linux.bpf.c, which follows what
+        // /proc/<PID>/stat reports. Kernel threads don't have an `mm`, and
+        // the reads will return zero for them.
+        __s64 file_pages = BPF_CORE_READ(task, mm, rss_stat.count[MM_FILEPAGES].counter);
+        __s64 shmem_pages = BPF_CORE_READ(task, mm, rss_stat.count[MM_SHMEMPAGES].counter);
+        __s64 anon_pages = BPF_CORE_READ(task, mm, rss_stat.count[MM_ANONPAGES].counter);
+        t.rsize = (file_pages + shmem_pages + anon_pages);
+        t.vsize = BPF_CORE_READ(task, mm, total_vm);
+    }
+
+    bpf_seq_write(seq, &t, sizeof(t));
+    return 0;
+}
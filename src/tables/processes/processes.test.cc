@@ -5,6 +5,15 @@
 #include "autogen/config.h"
 #include "util/testing.h"
 
+#ifdef HAVE_LINUX
+#include "processes.linux.h"
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#endif
+
 using namespace zeek::agent;
 
 TEST_CASE_FIXTURE(test::TableFixture, "processes" * doctest::test_suite("Tables")) {
@@ -28,3 +37,69 @@ TEST_CASE_FIXTURE(test::TableFixture, "processes" * doctest::test_suite("Tables"
     auto result = query(frmt("SELECT pid from processes WHERE name = \"{}\" AND pid = {}", name, getpid()));
     REQUIRE_EQ(result.rows.size(), 1);
 }
+
+#ifdef HAVE_LINUX
+TEST_CASE("live process table" * doctest::test_suite("Tables")) {
+    table::LiveProcessTable table;
+
+    auto row = [](const std::string& name, int64_t pid) { return std::vector<Value>{name, pid}; };
+
+    // Returns the table's content as a map of PID to name.
+    auto content = [&]() {
+        std::map<int64_t, std::string> m;
+        for ( const auto& r : table.rows() )
+            m[std::get<int64_t>(r[1])] = std::get<std::string>(r[0]);
+
+        return m;
+    };
+
+    SUBCASE("update and remove") {
+        table.update(1, row("init", 1));
+        table.update(2, row("sh", 2));
+        table.update(2, row("ls", 2));
+        table.remove(1);
+        table.remove(3);
+        CHECK_EQ(content(), std::map<int64_t, std::string>{{2, "ls"}});
+    }
+
+    SUBCASE("reseed") {
+        table.update(1, row("init", 1));
+        table.update(2, row("sh", 2));
+
+        auto before = table.lastRescan();
+        table.reseed([&]() { return std::vector<std::vector<Value>>{row("init", 1), row("cat", 3)}; });
+        CHECK_EQ(content(), std::map<int64_t, std::string>{{1, "init"}, {3, "cat"}});
+        CHECK(table.lastRescan() > before);
+    }
+
+    SUBCASE("events during reseed") {
+        table.reseed([&]() {
+            // These happen after the scan has looked at the processes, so they
+            // must win over its rows.
+            table.update(2, row("ls", 2));
+            table.update(4, row("vi", 4));
+            table.remove(3);
+            return std::vector<std::vector<Value>>{row("init", 1), row("sh", 2), row("cat", 3)};
+        });
+
+        CHECK_EQ(content(), std::map<int64_t, std::string>{{1, "init"}, {2, "ls"}, {4, "vi"}});
+
+        // Events after the reseed don't get re-applied by the next one.
+        table.update(5, row("top", 5));
+        table.reseed([&]() { return std::vector<std::vector<Value>>{row("init", 1)}; });
+        CHECK_EQ(content(), std::map<int64_t, std::string>{{1, "init"}});
+    }
+
+    SUBCASE("failing reseed") {
+        table.update(1, row("init", 1));
+
+        auto scan = [&]() -> std::vector<std::vector<Value>> {
+            table.update(2, row("sh", 2));
+            throw std::runtime_error("boom");
+        };
+
+        CHECK_THROWS_AS(table.reseed(scan), std::runtime_error);
+        CHECK_EQ(content(), std::map<int64_t, std::string>{{1, "init"}, {2, "sh"}});
+    }
+}
+#endif
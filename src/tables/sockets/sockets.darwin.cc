@@ -92,12 +92,10 @@ void SocketsDarwin::addSocketsForProcess(std::vector<std::vector<Value>>* rows,
 
 void SocketsDarwin::addSocket(std::vector<std::vector<Value>>* rows, int pid, Value process,
                               const struct socket_info& si) {
-    static auto addr_to_string = [](const auto& addr, int family) -> std::string {
-        char buffer[INET6_ADDRSTRLEN];
-
+    static auto to_address = [](const auto& addr, int family) -> Address {
         switch ( family ) {
-            case PF_INET: return inet_ntop(family, &addr.ina_46.i46a_addr4, buffer, sizeof(buffer));
-            case PF_INET6: return inet_ntop(family, &addr.ina_6, buffer, sizeof(buffer));
+            case PF_INET: return Address::fromIPv4(&addr.ina_46.i46a_addr4);
+            case PF_INET6: return Address::fromIPv6(&addr.ina_6);
             default: cannot_be_reached();
         }
     };
@@ -112,8 +110,8 @@ void SocketsDarwin::addSocket(std::vector<std::vector<Value>>* rows, int pid, Va
     Value protocol = si.soi_protocol;
     Value local_port = ntohs(si.soi_proto.pri_in.insi_lport);
     Value remote_port = ntohs(si.soi_proto.pri_in.insi_fport);
-    Value local_addr = addr_to_string(si.soi_proto.pri_in.insi_laddr, si.soi_family);
-    Value remote_addr = addr_to_string(si.soi_proto.pri_in.insi_faddr, si.soi_family);
+    Value local_addr = to_address(si.soi_proto.pri_in.insi_laddr, si.soi_family);
+    Value remote_addr = to_address(si.soi_proto.pri_in.insi_faddr, si.soi_family);
 
     Value state;
     switch ( si.soi_protocol ) {
@@ -8,7 +8,7 @@ namespace zeek::agent::table {
 
 class SocketsCommon : public SnapshotTable {
 public:
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             // clang-format off
             .name = "sockets",
@@ -36,7 +36,7 @@ public:
 
 class SocketsEventsCommon : public EventTable {
 public:
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             // clang-format off
             .name = "sockets_events",
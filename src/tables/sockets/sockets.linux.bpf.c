@@ -134,6 +134,7 @@ static void sendSocketEventTCP(struct bpfFlow* flow, struct trace_event_raw_inet
             break;
     }
 
+    ev->ts = bpf_ktime_get_boot_ns();
     flow->event = *ev;
     bpf_ringbuf_submit(ev, 0);
 }
@@ -298,6 +299,7 @@ static void sendSocketEventUDP(struct bpfFlow* flow, struct sock* sk, enum bpfSo
         ev->state = state;
     }
 
+    ev->ts = bpf_ktime_get_boot_ns();
     flow->event = *ev;
     bpf_ringbuf_submit(ev, 0);
 }
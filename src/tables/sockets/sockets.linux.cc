@@ -7,36 +7,342 @@
 #include "core/logger.h"
 #include "core/table.h"
 #include "sockets.linux.event.h"
+#include "sockets.linux.h"
 #include "util/fmt.h"
 #include "util/helpers.h"
+#include "util/thread-pool.h"
 
 // clang-format off
 #include "platform/linux/bpf.h"
+#include "platform/linux/procfs.h"
 #include "autogen/bpf/sockets.skel.h"
+#include "autogen/bpf/sockets_owners.skel.h"
 // clang-format on
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 #include <arpa/inet.h>
 #include <linux/bpf.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <pfs/procfs.hpp>
 
 namespace zeek::agent::table {
 
-class SocketsLinux : public SocketsCommon {
-public:
-    std::vector<std::vector<Value>> snapshot(const std::vector<table::Argument>& args) override;
-};
+// Minimum number of processes that a shard of a parallel /proc scan
+// processes; below that, the threading overhead isn't worth it.
+static const size_t ProcFSMinProcessesPerShard = 128;
+
+// Converts an address in network byte order, as the kernel reports it, into
+// our address type.
+static Address to_address(const void* addr, int family) {
+    return family == AF_INET ? Address::fromIPv4(addr) : Address::fromIPv6(addr);
+}
+
+// Returns the processes owning socket inodes, limited to the ones in
+// `wanted` if given. Spreads the scan across the worker pool.
+static InodeMap socketOwners(ThreadPool& pool, const std::unordered_set<ino_t>* wanted) {
+    if ( wanted && wanted->empty() )
+        return {};
+
+    std::vector<int64_t> pids;
+
+    platform::linux::procfs::Reader reader;
+    auto success = reader.forEachProcess([&](int64_t pid) {
+        pids.push_back(pid);
+        return true;
+    });
+
+    if ( ! success ) {
+        logger()->warn("cannot read /proc filesystem");
+        return {};
+    }
+
+    // Each shard fills its own map, which we merge at the end.
+    auto shards = pool.shards(pids.size(), ProcFSMinProcessesPerShard);
+    std::vector<InodeMap> buffers(shards);
+
+    pool.run(shards, [&](size_t shard) {
+        auto begin = pids.size() * shard / shards;
+        auto end = pids.size() * (shard + 1) / shards;
+
+        auto& inodes = buffers[shard];
+        platform::linux::procfs::Reader reader;
+        char comm[platform::linux::procfs::CommMax];
+
+        for ( auto i = begin; i < end; i++ ) {
+            auto pid = pids[i];
+            bool have_comm = false;
+
+            reader.forEachSocket(pid, [&](ino_t inode) {
+                if ( wanted && wanted->find(inode) == wanted->end() )
+                    return true;
+
+                if ( ! have_comm ) {
+                    if ( ! reader.readComm(pid, comm) )
+                        comm[0] = '\0';
+
+                    have_comm = true;
+                }
+
+                inodes.emplace(inode, std::make_pair(pid, std::string(comm)));
+                return true;
+            });
+        }
+    });
+
+    auto inodes = std::move(buffers[0]);
+
+    for ( size_t i = 1; i < buffers.size(); i++ )
+        inodes.merge(buffers[i]);
+
+    return inodes;
+}
 
 namespace {
 database::RegisterTable<SocketsLinux> _;
 }
 
-// Maps inodes to pairs (pid, process name).
-using InodeMap = std::unordered_map<ino_t, std::pair<int64_t, std::string>>;
+// Interval for reconciling our socket owner index with /proc.
+static const auto SocketOwnersRescanInterval = 60s;
+
+// Minimum interval between scans of /proc for sockets missing from our index.
+static const auto SocketOwnersMissScanInterval = 5s;
+
+// Kernel TCP states, per include/net/tcp_states.h. Index is the kernel's
+// value, we leave out TCP_NEW_SYN_RECV which is never reported.
+static const char* TCPStates[] = {nullptr,      "ESTABLISHED", "SYN_SENT",   "SYN_RECEIVED", "FIN_WAIT_1", "FIN_WAIT_2",
+                                  "TIME_WAIT",  "CLOSED",      "CLOSE_WAIT", "LAST_ACK",     "LISTEN",     "CLOSING"};
+
+static const uint32_t NumTCPStates = sizeof(TCPStates) / sizeof(TCPStates[0]);
+
+Schema SocketsLinux::buildSchema() const {
+    auto schema = SocketsCommon::buildSchema();
+
+    // clang-format off
+    schema.columns.push_back({.name = "_states", .type = value::Type::Text, .summary = "comma-separated list of TCP states to limit the result to; empty for all sockets", .is_parameter = true, .default_ = {""}});
+    schema.columns.push_back({.name = "_port", .type = value::Type::Count, .summary = "port number to limit the result to, matching either local or remote port; 0 for all sockets", .is_parameter = true, .default_ = {static_cast<int64_t>(0)}});
+    // clang-format on
+
+    return schema;
+}
+
+EventTable::Init SocketsLinux::init() {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if ( fd >= 0 ) {
+        _use_netlink = true;
+        close(fd);
+    }
+    else
+        ZEEK_AGENT_DEBUG("sockets", "sock_diag not available, using procfs ({})", strerror(errno));
+
+    initOwnerIndex();
+    return Init::Available;
+}
+
+static int handle_owner_event(void* ctx, void* data, size_t data_sz) {
+    auto index = reinterpret_cast<SocketOwnerIndex*>(ctx);
+    auto ev = reinterpret_cast<const bpfSocketOwnerEvent*>(data);
+
+    switch ( ev->action ) {
+        case BPF_SOCKET_OWNER_ADD:
+            index->add(static_cast<ino_t>(ev->inode), static_cast<int64_t>(ev->pid), ev->name);
+            break;
+
+        case BPF_SOCKET_OWNER_EXIT: index->removeProcess(static_cast<int64_t>(ev->pid)); break;
+        case BPF_SOCKET_OWNER_UNKNOWN: break;
+    }
+
+    return 1;
+}
+
+void SocketsLinux::initOwnerIndex() {
+    auto bpf = platform::linux::bpf();
+    if ( ! bpf->isAvailable() )
+        return;
+
+    auto index = std::make_unique<SocketOwnerIndex>();
+
+    auto skel = platform::linux::BPF::Skeleton{.name = "SocketOwners",
+                                               .open = reinterpret_cast<void*>(sockets_owners__open),
+                                               .load = reinterpret_cast<void*>(sockets_owners__load),
+                                               .attach = reinterpret_cast<void*>(sockets_owners__attach),
+                                               .detach = reinterpret_cast<void*>(sockets_owners__detach),
+                                               .destroy = reinterpret_cast<void*>(sockets_owners__destroy),
+                                               .event_callback = handle_owner_event,
+                                               .event_context = index.get()};
+
+    auto our_bpf = bpf->load<sockets_owners>(std::move(skel));
+    if ( ! our_bpf ) {
+        ZEEK_AGENT_DEBUG("sockets", "cannot track socket ownership through BPF, scanning /proc instead ({})",
+                         our_bpf.error());
+        return;
+    }
+
+    if ( auto rc = bpf->init("SocketOwners", (*our_bpf)->maps.ring_buffer); ! rc ) {
+        ZEEK_AGENT_DEBUG("sockets", "cannot track socket ownership through BPF, scanning /proc instead ({})",
+                         rc.error());
+        return;
+    }
+
+    // We attach the program and seed the index only once a query needs it.
+    _owner_index = std::move(index);
+}
+
+void SocketsLinux::activate() {
+    if ( ! _owner_index )
+        return;
+
+    // Attach before seeding so that we don't miss anything in between.
+    if ( auto rc = platform::linux::bpf()->attach("SocketOwners"); ! rc ) {
+        logger()->warn(frmt("could not attach BPF program, scanning /proc for socket owners instead ({})", rc.error()));
+        return;
+    }
+
+    _owner_index->rescan([this]() { return socketOwners(workerPool(), nullptr); });
+    _owner_index_attached = true;
+}
+
+void SocketsLinux::deactivate() {
+    if ( ! _owner_index_attached )
+        return;
+
+    _owner_index_attached = false;
+
+    if ( auto rc = platform::linux::bpf()->detach("SocketOwners"); ! rc )
+        logger()->error(frmt("could not detach BPF program: {}", rc.error()));
+}
+
+void SocketsLinux::poll() {
+    if ( ! isActive() || ! _owner_index_attached )
+        return;
+
+    if ( std::chrono::steady_clock::now() - _owner_index->lastRescan() < SocketOwnersRescanInterval )
+        return;
+
+    if ( _owner_scan_running.exchange(true) )
+        return; // still busy with the previous scan
+
+    // We rescan in the background so that neither queries nor the main loop
+    // have to wait for it.
+    workerPool().submit([this]() {
+        _owner_index->rescan([this]() { return socketOwners(workerPool(), nullptr); });
+        _owner_scan_running = false;
+    });
+}
+
+InodeMap SocketsLinux::resolveOwners(const std::unordered_set<ino_t>& inodes) {
+    if ( ! _owner_index_attached )
+        return socketOwners(workerPool(), &inodes);
+
+    std::unordered_set<ino_t> missing;
+    auto owners = _owner_index->lookup(inodes, &missing);
+
+    // Sockets can legitimately remain without known owner (e.g., if they
+    // belong to the kernel), so we rate-limit looking for them. We search in
+    // the background, so owners we find will show up with the next query.
+    missing.erase(0);
+    if ( missing.empty() )
+        return owners;
+
+    auto now = std::chrono::steady_clock::now();
+    if ( now - _last_miss_scan < SocketOwnersMissScanInterval || _owner_scan_running.exchange(true) )
+        return owners;
+
+    _last_miss_scan = now;
+
+    workerPool().submit([this, missing = std::move(missing)]() {
+        _owner_index->add(socketOwners(workerPool(), &missing));
+        _owner_scan_running = false;
+    });
+
+    return owners;
+}
+
+SocketsLinux::Filter SocketsLinux::parseFilter(const std::vector<table::Argument>& args) const {
+    Filter filter;
+
+    for ( const auto& s : split(getArgument<std::string>(args, "_states"), ",") ) {
+        auto state = toupper(trim(s));
+        if ( state.empty() )
+            continue;
+
+        uint32_t i = 1;
+        for ( ; i < NumTCPStates; i++ ) {
+            if ( state == TCPStates[i] )
+                break;
+        }
+
+        if ( i == NumTCPStates )
+            throw table::PermanentContentError(frmt("unknown TCP state '{}' for 'sockets'", state));
+
+        filter.tcp_states |= (1U << i);
+    }
+
+    auto port = getArgument<int64_t>(args, "_port");
+    if ( port < 0 || port > 65535 )
+        throw table::PermanentContentError(frmt("invalid port '{}' for 'sockets'", port));
+
+    if ( port > 0 )
+        filter.port = static_cast<uint16_t>(port);
+
+    return filter;
+}
+
+std::vector<std::vector<Value>> SocketsLinux::snapshot(const std::vector<table::Argument>& args) {
+    auto filter = parseFilter(args);
+
+    std::vector<std::vector<Value>> rows;
+
+    if ( _use_netlink ) {
+        if ( auto netlink = snapshotFromNetlink(filter) )
+            rows = std::move(*netlink);
+        else {
+            logger()->warn(frmt("cannot dump sockets through sock_diag, falling back to procfs ({})", netlink.error()));
+            rows = snapshotFromProcFS(filter);
+        }
+    }
+    else
+        rows = snapshotFromProcFS(filter);
+
+    // Add the values of our parameters.
+    for ( auto& row : rows ) {
+        row.emplace_back(getArgument<std::string>(args, "_states"));
+        row.emplace_back(getArgument<int64_t>(args, "_port"));
+    }
+
+    return rows;
+}
 
 static void addSockets(std::vector<std::vector<Value>>* rows, const std::vector<pfs::net_socket>& sockets,
-                       int64_t proto, std::string family, const InodeMap& inodes) {
+                       int64_t proto, std::string family, const InodeMap& inodes, const SocketsLinux::Filter& filter) {
     for ( const auto& s : sockets ) {
+        if ( filter.port ) {
+            // For raw and ping sockets, /proc reports the protocol number or
+            // ICMP ID in place of the port. They don't have ports, so like
+            // sock_diag we never match them.
+            if ( proto != IPPROTO_TCP && proto != IPPROTO_UDP && proto != IPPROTO_UDPLITE )
+                continue;
+
+            if ( s.local_port != *filter.port && s.remote_port != *filter.port )
+                continue;
+        }
+
         Value pid;
         Value process;
         if ( auto x = inodes.find(s.inode); x != inodes.end() ) {
@@ -48,8 +354,8 @@ static void addSockets(std::vector<std::vector<Value>>* rows, const std::vector<
         Value protocol = proto;
         Value local_port = static_cast<int64_t>(s.local_port);
         Value remote_port = static_cast<int64_t>(s.remote_port);
-        Value local_addr = s.local_ip.to_string();
-        Value remote_addr = s.remote_ip.to_string();
+        Value local_addr = value::fromAddressString(s.local_ip.to_string());
+        Value remote_addr = value::fromAddressString(s.remote_ip.to_string());
 
         Value state;
         switch ( proto ) {
@@ -71,45 +377,45 @@ static void addSockets(std::vector<std::vector<Value>>* rows, const std::vector<
             }
         }
 
+        if ( filter.tcp_states ) {
+            if ( proto != IPPROTO_TCP )
+                continue;
+
+            auto i = std::find_if(TCPStates + 1, TCPStates + NumTCPStates,
+                                  [&](const char* x) { return std::get<std::string>(state) == x; });
+            if ( ! (filter.tcp_states & (1U << (i - TCPStates))) )
+                continue;
+        }
+
         rows->push_back({pid, process, family, protocol, local_addr, local_port, remote_addr, remote_port, state});
     }
 }
 
-std::vector<std::vector<Value>> SocketsLinux::snapshot(const std::vector<table::Argument>& args) {
+std::vector<std::vector<Value>> SocketsLinux::snapshotFromProcFS(const Filter& filter) {
     std::vector<std::vector<Value>> rows;
 
     try {
         pfs::procfs pfs;
+        auto net = pfs.get_net();
 
-        InodeMap inodes;
-        for ( const auto& p : pfs.get_processes() ) {
-            try {
-                for ( const auto& [id, fd] : p.get_fds() ) {
-                    try {
-                        auto inode = fd.get_target_stat().st_ino;
-                        inodes.emplace(inode, std::make_pair(static_cast<int64_t>(p.id()), p.get_comm()));
-                    } catch ( const std::system_error& ) {
-                        // ignore, most likely a permission problem
-                    }
-                }
-            } catch ( std::system_error& ) {
-                // ignore, most likely a permission problem
-            } catch ( std::runtime_error& ) {
-                // ignore, most likely a permission problem
-            }
+        std::vector<std::tuple<std::vector<pfs::net_socket>, int64_t, std::string>> lists = {
+            {net.get_icmp(), IPPROTO_ICMP, "IPv4"},       {net.get_icmp6(), IPPROTO_ICMPV6, "IPv6"},
+            {net.get_raw(), IPPROTO_RAW, "IPv4"},         {net.get_raw6(), IPPROTO_RAW, "IPv6"},
+            {net.get_tcp(), IPPROTO_TCP, "IPv4"},         {net.get_tcp6(), IPPROTO_TCP, "IPv6"},
+            {net.get_udp(), IPPROTO_UDP, "IPv4"},         {net.get_udp6(), IPPROTO_UDP, "IPv6"},
+            {net.get_udplite(), IPPROTO_UDPLITE, "IPv4"}, {net.get_udplite6(), IPPROTO_UDPLITE, "IPv4"},
+        };
+
+        std::unordered_set<ino_t> wanted;
+        for ( const auto& [sockets, proto, family] : lists ) {
+            for ( const auto& s : sockets )
+                wanted.insert(s.inode);
         }
 
-        auto net = pfs.get_net();
-        addSockets(&rows, net.get_icmp(), IPPROTO_ICMP, "IPv4", inodes);
-        addSockets(&rows, net.get_icmp6(), IPPROTO_ICMPV6, "IPv6", inodes);
-        addSockets(&rows, net.get_raw(), IPPROTO_RAW, "IPv4", inodes);
-        addSockets(&rows, net.get_raw6(), IPPROTO_RAW, "IPv6", inodes);
-        addSockets(&rows, net.get_tcp(), IPPROTO_TCP, "IPv4", inodes);
-        addSockets(&rows, net.get_tcp6(), IPPROTO_TCP, "IPv6", inodes);
-        addSockets(&rows, net.get_udp(), IPPROTO_UDP, "IPv4", inodes);
-        addSockets(&rows, net.get_udp6(), IPPROTO_UDP, "IPv6", inodes);
-        addSockets(&rows, net.get_udplite(), IPPROTO_UDPLITE, "IPv4", inodes);
-        addSockets(&rows, net.get_udplite6(), IPPROTO_UDPLITE, "IPv4", inodes);
+        auto inodes = resolveOwners(wanted);
+
+        for ( const auto& [sockets, proto, family] : lists )
+            addSockets(&rows, sockets, proto, family, inodes, filter);
 
     } catch ( std::system_error& ) {
         logger()->warn("cannot read /proc filesystem (system error)");
@@ -120,6 +426,224 @@ std::vector<std::vector<Value>> SocketsLinux::snapshot(const std::vector<table::
     return rows;
 }
 
+// Bytecode for sock_diag matching sockets with either source or destination
+// port equal to `port`. See `inet_diag_bc_run()` in the kernel for the
+// semantics: we accept by jumping to exactly the end of the program, and
+// reject by jumping 4 bytes beyond it. Offsets are in bytes, relative to the
+// current op; port comparisons take 8 bytes including their operand.
+//
+// The kernel's `inet_diag_bc_audit()` only accepts programs whose `yes`
+// branches form a linear chain through all ops, with every `no` branch
+// landing on an op along that chain or right past the end. Hence we accept
+// a matching source port through an unconditional jump (which always takes
+// `no`) instead of through a `yes` branch.
+static std::vector<inet_diag_bc_op> portFilterBytecode(uint16_t port) {
+    return {
+        {INET_DIAG_BC_S_GE, 8, 20}, {0, 0, port}, //  0: sport >= port ? next : check dport
+        {INET_DIAG_BC_S_LE, 8, 12}, {0, 0, port}, //  8: sport <= port ? next : check dport
+        {INET_DIAG_BC_JMP, 4, 20},                // 16: accept
+        {INET_DIAG_BC_D_GE, 8, 20}, {0, 0, port}, // 20: dport >= port ? next : reject
+        {INET_DIAG_BC_D_LE, 8, 12}, {0, 0, port}, // 28: dport <= port ? accept : reject
+    };
+}
+
+// Sends a sock_diag dump request for one family/protocol combination and
+// collects all response messages. Returns false if the kernel doesn't
+// support dumping the protocol.
+static Result<bool> dumpSockets(int fd, uint8_t family, uint8_t protocol, uint32_t states,
+                                const std::vector<inet_diag_bc_op>& bytecode,
+                                const std::function<void(const inet_diag_msg*)>& callback) {
+    struct {
+        nlmsghdr nlh;
+        inet_diag_req_v2 req;
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.req.sdiag_family = family;
+    request.req.sdiag_protocol = protocol;
+    request.req.idiag_states = states;
+
+    if ( protocol == IPPROTO_RAW )
+        // For raw sockets, this field is `sdiag_raw_protocol`; IPPROTO_RAW matches all.
+        request.req.pad = IPPROTO_RAW;
+
+    nlattr attr;
+    attr.nla_type = INET_DIAG_REQ_BYTECODE;
+    attr.nla_len = NLA_HDRLEN + bytecode.size() * sizeof(inet_diag_bc_op);
+
+    sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+
+    iovec iov[3] = {{&request, sizeof(request)}, {&attr, NLA_HDRLEN}, {nullptr, 0}};
+    int iovlen = 1;
+
+    if ( ! bytecode.empty() ) {
+        request.nlh.nlmsg_len += NLA_ALIGN(attr.nla_len);
+        iov[2] = {const_cast<inet_diag_bc_op*>(bytecode.data()), bytecode.size() * sizeof(inet_diag_bc_op)};
+        iovlen = 3;
+    }
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &sa;
+    msg.msg_namelen = sizeof(sa);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovlen;
+
+    if ( sendmsg(fd, &msg, 0) < 0 )
+        return result::Error(frmt("cannot send sock_diag request: {}", strerror(errno)));
+
+    alignas(nlmsghdr) char buffer[32768];
+
+    while ( true ) {
+        auto len = recv(fd, buffer, sizeof(buffer), 0);
+        if ( len < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            return result::Error(frmt("cannot receive sock_diag response: {}", strerror(errno)));
+        }
+
+        for ( auto nlh = reinterpret_cast<nlmsghdr*>(buffer); NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len) ) {
+            switch ( nlh->nlmsg_type ) {
+                case NLMSG_DONE: return true;
+
+                case NLMSG_ERROR: {
+                    auto err = reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(nlh));
+                    if ( err->error == -ENOENT || err->error == -EOPNOTSUPP )
+                        return false; // protocol not supported by kernel (e.g., raw_diag missing)
+
+                    if ( err->error == -EINVAL && ! bytecode.empty() )
+                        // Our filter is rejected by the kernel's audit, which is a bug on our end.
+                        return result::Error("sock_diag rejected filter bytecode as invalid (internal bug)");
+
+                    return result::Error(frmt("sock_diag error: {}", strerror(-err->error)));
+                }
+
+                case SOCK_DIAG_BY_FAMILY: callback(reinterpret_cast<const inet_diag_msg*>(NLMSG_DATA(nlh))); break;
+
+                default: break;
+            }
+        }
+    }
+}
+
+Result<std::vector<std::vector<Value>>> SocketsLinux::snapshotFromNetlink(const Filter& filter) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if ( fd < 0 )
+        return result::Error(frmt("cannot open netlink socket: {}", strerror(errno)));
+
+    ScopeGuard _([&]() { close(fd); });
+
+    struct Socket {
+        uint8_t family;
+        uint8_t protocol;
+        uint8_t state;
+        inet_diag_sockid id;
+        ino_t inode;
+    };
+
+    std::vector<Socket> sockets;
+    std::unordered_set<ino_t> inodes;
+
+    std::vector<inet_diag_bc_op> bytecode;
+    if ( filter.port )
+        bytecode = portFilterBytecode(*filter.port);
+
+    // A state filter applies to TCP only, so we skip other protocols then.
+    // Likewise for raw sockets with a port filter, as they don't have ports.
+    std::vector<uint8_t> protocols = {IPPROTO_TCP};
+
+    if ( ! filter.tcp_states ) {
+        protocols.push_back(IPPROTO_UDP);
+        protocols.push_back(IPPROTO_UDPLITE);
+
+        if ( ! filter.port )
+            protocols.push_back(IPPROTO_RAW);
+    }
+
+    for ( auto family : {AF_INET, AF_INET6} ) {
+        for ( auto protocol : protocols ) {
+            uint32_t states = (protocol == IPPROTO_TCP && filter.tcp_states ? filter.tcp_states : 0xffffffff);
+
+            auto rc = dumpSockets(fd, family, protocol, states, bytecode, [&](const inet_diag_msg* m) {
+                sockets.push_back({.family = m->idiag_family,
+                                   .protocol = protocol,
+                                   .state = m->idiag_state,
+                                   .id = m->id,
+                                   .inode = m->idiag_inode});
+                inodes.insert(m->idiag_inode);
+            });
+
+            if ( ! rc )
+                return rc.error();
+
+            if ( ! *rc )
+                ZEEK_AGENT_DEBUG("sockets", "sock_diag does not support protocol {} for family {}",
+                                 static_cast<int>(protocol), family);
+        }
+    }
+
+    auto owners = resolveOwners(inodes);
+
+    std::vector<std::vector<Value>> rows;
+    rows.reserve(sockets.size());
+
+    for ( const auto& s : sockets ) {
+        Value pid;
+        Value process;
+        if ( auto x = owners.find(s.inode); x != owners.end() ) {
+            pid = x->second.first;
+            process = x->second.second;
+        }
+
+        Value family = (s.family == AF_INET ? "IPv4" : "IPv6");
+        Value protocol = static_cast<int64_t>(s.protocol);
+        Value local_addr = to_address(s.id.idiag_src, s.family);
+        Value local_port = static_cast<int64_t>(ntohs(s.id.idiag_sport));
+        Value remote_addr = to_address(s.id.idiag_dst, s.family);
+        Value remote_port = static_cast<int64_t>(ntohs(s.id.idiag_dport));
+
+        Value state;
+        if ( s.protocol == IPPROTO_TCP && s.state < NumTCPStates && TCPStates[s.state] )
+            state = TCPStates[s.state];
+
+        rows.push_back({pid, process, family, protocol, local_addr, local_port, remote_addr, remote_port, state});
+    }
+
+    // sock_diag doesn't support ping sockets, get them from procfs.
+    if ( ! filter.tcp_states && ! filter.port ) {
+        try {
+            pfs::procfs pfs;
+            auto net = pfs.get_net();
+            auto icmp = net.get_icmp();
+            auto icmp6 = net.get_icmp6();
+
+            if ( ! (icmp.empty() && icmp6.empty()) ) {
+                std::unordered_set<ino_t> icmp_inodes;
+                for ( const auto& s : icmp )
+                    icmp_inodes.insert(s.inode);
+                for ( const auto& s : icmp6 )
+                    icmp_inodes.insert(s.inode);
+
+                auto icmp_owners = resolveOwners(icmp_inodes);
+                addSockets(&rows, icmp, IPPROTO_ICMP, "IPv4", icmp_owners, filter);
+                addSockets(&rows, icmp6, IPPROTO_ICMPV6, "IPv6", icmp_owners, filter);
+            }
+        } catch ( std::system_error& ) {
+            logger()->warn("cannot read /proc filesystem (system error)");
+        } catch ( std::runtime_error& ) {
+            logger()->warn("cannot read /proc filesystem (runtime error)");
+        }
+    }
+
+    return rows;
+}
+
 class SocketsEventsLinux : public SocketsEventsCommon {
 public:
     Init init() override;
@@ -137,7 +661,7 @@ Value to_val(const S& i) {
 }
 
 static int handle_event(void* ctx, void* data, size_t data_sz) {
-    static auto addr_to_string = [](const void* addr, uint64_t family) -> Value {
+    static auto addr_to_value = [](const void* addr, uint64_t family) -> Value {
         switch ( family ) {
             case AF_INET:
                 if ( memcmp(addr, "\x00\x00\x00\x00", 4) == 0 )
@@ -151,11 +675,10 @@ static int handle_event(void* ctx, void* data, size_t data_sz) {
 
                 break;
 
-            default: break;
+            default: return {};
         }
 
-        char buffer[INET6_ADDRSTRLEN];
-        return inet_ntop(static_cast<int>(family), addr, buffer, sizeof(buffer));
+        return to_address(addr, static_cast<int>(family));
     };
 
     auto table = reinterpret_cast<SocketsEventsLinux*>(ctx);
@@ -174,9 +697,9 @@ static int handle_event(void* ctx, void* data, size_t data_sz) {
     }
 
     auto protocol = to_val<int64_t>(ev->protocol);
-    auto local_addr = addr_to_string(&ev->local_addr, ev->family);
+    auto local_addr = addr_to_value(&ev->local_addr, ev->family);
     auto local_port = to_val<int64_t>(ev->local_port);
-    auto remote_addr = addr_to_string(&ev->remote_addr, ev->family);
+    auto remote_addr = addr_to_value(&ev->remote_addr, ev->family);
     auto remote_port = to_val<int64_t>(ntohs(ev->remote_port));
 
     Value state;
@@ -189,8 +712,9 @@ static int handle_event(void* ctx, void* data, size_t data_sz) {
         case BPF_SOCKET_STATE_UNKNOWN: break; // leave unset
     }
 
-    table->newEvent({table->systemTime(), pid, process, uid, gid, family, protocol, local_addr, local_port, remote_addr,
-                     remote_port, state});
+    auto t = platform::linux::bpf()->bootTimeToTime(ev->ts);
+    table->newEvent(
+        {t, pid, process, uid, gid, family, protocol, local_addr, local_port, remote_addr, remote_port, state});
 
     return 1;
 }
@@ -31,4 +31,19 @@ struct bpfSocketEvent {
     __u8 remote_addr[16];
     __u64 remote_port;
     enum bpfSocketState state;
+    __u64 ts; // nsecs since boot (CLOCK_BOOTTIME) when event was recorded
+};
+
+enum bpfSocketOwnerAction {
+    BPF_SOCKET_OWNER_UNKNOWN = 0,
+    BPF_SOCKET_OWNER_ADD,  // process allocated a socket
+    BPF_SOCKET_OWNER_EXIT, // last thread of process exited, all its sockets are gone
+};
+
+// Event reported by sockets.linux.owners.bpf.c to maintain our inode index.
+struct bpfSocketOwnerEvent {
+    __u64 pid;
+    char name[BPF_PROCESS_NAME_MAX];
+    __u64 inode; // valid only for BPF_SOCKET_OWNER_ADD
+    enum bpfSocketOwnerAction action;
 };
@@ -0,0 +1,247 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include "core/table.h"
+#include "sockets.h"
+#include "util/result.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace zeek::agent::table {
+
+/** Maps socket inodes to pairs (pid, process name) of their owners. */
+using InodeMap = std::unordered_map<ino_t, std::pair<int64_t, std::string>>;
+
+/**
+ * Persistent index mapping socket inodes to the processes owning them. We
+ * seed it through a full scan of /proc, then keep it current through BPF
+ * events reporting new sockets and exiting processes. A periodic full rescan
+ * reconciles anything we missed (e.g., sockets passed on to forked children,
+ * or events dropped because the ring buffer was full).
+ *
+ * All public methods are thread-safe.
+ */
+class SocketOwnerIndex {
+public:
+    /**
+     * Replaces the index's content with the result of a full scan. Sockets
+     * and process exits recorded while the scan is running get re-applied on
+     * top of its result, as they may be more recent. Concurrent calls run
+     * one after the other.
+     *
+     * @param scan function returning the owners of all sockets
+     */
+    void rescan(const std::function<InodeMap()>& scan) {
+        const std::lock_guard<std::mutex> rescan_lock(_rescan_mutex);
+
+        {
+            const std::lock_guard<std::mutex> lock(_mutex);
+            _rescanning = true;
+            _pending.clear();
+        }
+
+        InodeMap owners;
+
+        try {
+            owners = scan();
+        } catch ( ... ) {
+            const std::lock_guard<std::mutex> lock(_mutex);
+            _rescanning = false;
+            _pending.clear();
+            throw;
+        }
+
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _owners = std::move(owners);
+        _by_pid.clear();
+
+        for ( const auto& [inode, owner] : _owners )
+            _by_pid[owner.first].insert(inode);
+
+        // Re-apply what we learned while scanning.
+        for ( auto& [pid, socket] : _pending ) {
+            if ( socket )
+                addLocked(socket->first, std::make_pair(pid, std::move(socket->second)));
+            else
+                removeProcessLocked(pid);
+        }
+
+        _pending.clear();
+        _rescanning = false;
+        _last_rescan = std::chrono::steady_clock::now();
+    }
+
+    /** Returns the time of the last full rescan. */
+    auto lastRescan() const {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        return _last_rescan;
+    }
+
+    /**
+     * Records a new socket.
+     *
+     * @param inode the socket's inode
+     * @param pid ID of the process owning the socket
+     * @param name name of the process owning the socket
+     */
+    void add(ino_t inode, int64_t pid, std::string name) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        if ( _rescanning )
+            _pending.emplace_back(pid, std::make_pair(inode, name));
+
+        addLocked(inode, std::make_pair(pid, std::move(name)));
+    }
+
+    /**
+     * Merges externally found owners into the index.
+     *
+     * @param owners owners to merge
+     */
+    void add(const InodeMap& owners) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        for ( const auto& [inode, owner] : owners )
+            addLocked(inode, owner);
+    }
+
+    /**
+     * Removes all sockets owned by a process that has exited entirely.
+     *
+     * @param pid the process' ID
+     */
+    void removeProcess(int64_t pid) {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        if ( _rescanning )
+            _pending.emplace_back(pid, std::nullopt);
+
+        removeProcessLocked(pid);
+    }
+
+    /**
+     * Looks up the owners of a set of inodes.
+     *
+     * @param inodes the inodes to look up
+     * @param missing receives the inodes that we don't know
+     * @return the owners we know
+     */
+    InodeMap lookup(const std::unordered_set<ino_t>& inodes, std::unordered_set<ino_t>* missing) const {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        InodeMap result;
+        result.reserve(inodes.size());
+
+        for ( auto inode : inodes ) {
+            if ( auto i = _owners.find(inode); i != _owners.end() )
+                result.emplace(inode, i->second);
+            else
+                missing->insert(inode);
+        }
+
+        return result;
+    }
+
+private:
+    void addLocked(ino_t inode, std::pair<int64_t, std::string> owner) {
+        if ( auto o = _owners.find(inode); o != _owners.end() && o->second.first != owner.first ) {
+            // Inode has been reused, or passed on to another process.
+            if ( auto i = _by_pid.find(o->second.first); i != _by_pid.end() ) {
+                i->second.erase(inode);
+                if ( i->second.empty() )
+                    _by_pid.erase(i);
+            }
+        }
+
+        _by_pid[owner.first].insert(inode);
+        _owners.insert_or_assign(inode, std::move(owner));
+    }
+
+    void removeProcessLocked(int64_t pid) {
+        auto i = _by_pid.find(pid);
+        if ( i == _by_pid.end() )
+            return;
+
+        for ( auto inode : i->second ) {
+            if ( auto o = _owners.find(inode); o != _owners.end() && o->second.first == pid )
+                _owners.erase(o);
+        }
+
+        _by_pid.erase(i);
+    }
+
+    // An event recorded during a rescan: the owning process' ID, plus the
+    // socket's inode and the process' name if it's a new socket, or unset if
+    // the process exited.
+    using PendingEvent = std::pair<int64_t, std::optional<std::pair<ino_t, std::string>>>;
+
+    std::mutex _rescan_mutex;                                       // serializes rescan()
+    mutable std::mutex _mutex;                                      // protects the following
+    InodeMap _owners;                                               // inode -> owner
+    std::unordered_map<int64_t, std::unordered_set<ino_t>> _by_pid; // pid -> inodes, for removal on exit
+    std::vector<PendingEvent> _pending;                             // events received during a rescan
+    bool _rescanning = false;                                       // true while rescan() is scanning
+    std::chrono::steady_clock::time_point _last_rescan;             // time of last full rescan
+};
+
+/** Implementation of the `sockets` table for Linux. */
+class SocketsLinux : public SocketsCommon {
+public:
+    Schema buildSchema() const override;
+    std::vector<std::vector<Value>> snapshot(const std::vector<table::Argument>& args) override;
+    Init init() override;
+    void activate() override;
+    void deactivate() override;
+    void poll() override;
+
+    /** Filter to apply to the sockets we report. */
+    struct Filter {
+        uint32_t tcp_states = 0;      /**< bitmask of TCP states (`1 << TCP_*`) to include; 0 for no filtering */
+        std::optional<uint16_t> port; /**< port number that either the local or remote port must match */
+    };
+
+    /**
+     * Returns sockets through the kernel's sock_diag interface. Public for
+     * testing, `snapshot()` picks the backend.
+     *
+     * @param filter filter to apply
+     * @return matching sockets, or an error if sock_diag isn't usable
+     */
+    Result<std::vector<std::vector<Value>>> snapshotFromNetlink(const Filter& filter);
+
+    /**
+     * Returns sockets through /proc. Public for testing, `snapshot()` picks
+     * the backend.
+     *
+     * @param filter filter to apply
+     * @return matching sockets
+     */
+    std::vector<std::vector<Value>> snapshotFromProcFS(const Filter& filter);
+
+private:
+    Filter parseFilter(const std::vector<table::Argument>& args) const;
+    InodeMap resolveOwners(const std::unordered_set<ino_t>& inodes);
+    void initOwnerIndex();
+
+    bool _use_netlink = false;                             // true if sock_diag is available
+    std::unique_ptr<SocketOwnerIndex> _owner_index;        // set if we can track socket ownership through BPF
+    bool _owner_index_attached = false;                    // true while the index's BPF program is attached
+    std::atomic<bool> _owner_scan_running = false;         // true while a background scan of /proc is queued or running
+    std::chrono::steady_clock::time_point _last_miss_scan; // last time we scanned /proc for unknown inodes
+};
+
+} // namespace zeek::agent::table
@@ -0,0 +1,101 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Tracks which processes own which socket inodes, so that the `sockets`
+// table doesn't need to scan all file descriptors on each query.
+
+#include "sockets.linux.event.h"
+
+// clang-format off
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+// clang-format on
+
+#include <string.h>
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL"; // don't change; must be a license known by kernel
+
+// Ringer buffer for passing events to user land.
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 64 * 1024);
+} ring_buffer SEC(".maps");
+
+// From vmlinux.
+//
+// Accessed through CO-RE, so only declaring fields we need.
+struct inode {
+    long unsigned int i_ino;
+    // ...
+};
+
+// From vmlinux.
+//
+// Accessed through CO-RE, so only declaring fields we need.
+struct file {
+    struct inode* f_inode;
+    // ...
+};
+
+// From vmlinux.
+typedef struct {
+    int counter;
+} atomic_t;
+
+// From vmlinux.
+//
+// Accessed through CO-RE, so only declaring fields we need.
+struct signal_struct {
+    atomic_t live;
+    // ...
+};
+
+// From vmlinux.
+//
+// Accessed through CO-RE, so only declaring fields we need.
+struct task_struct {
+    struct signal_struct* signal;
+    // ...
+};
+
+static void sendOwnerEvent(__u64 inode, enum bpfSocketOwnerAction action) {
+    struct bpfSocketOwnerEvent* ev = bpf_ringbuf_reserve(&ring_buffer, sizeof(struct bpfSocketOwnerEvent), 0);
+    if ( ! ev )
+        return; // no space; periodic rescan in user land will catch up
+
+    bzero(ev, sizeof(*ev));
+    ev->pid = (bpf_get_current_pid_tgid() >> 32);
+    bpf_get_current_comm(ev->name, BPF_PROCESS_NAME_MAX);
+    ev->inode = inode;
+    ev->action = action;
+    bpf_ringbuf_submit(ev, 0);
+}
+
+// Called for all new sockets, both from socket()/socketpair() and accept().
+SEC("kretprobe/sock_alloc_file")
+int BPF_KRETPROBE(sock_alloc_file_return, struct file* file) {
+    if ( ! file || (unsigned long)file >= (unsigned long)-4095 )
+        return 0; // failed, IS_ERR()
+
+    __u64 inode = BPF_CORE_READ(file, f_inode, i_ino);
+    if ( inode )
+        sendOwnerEvent(inode, BPF_SOCKET_OWNER_ADD);
+
+    return 0;
+}
+
+// Called for each exiting thread. The thread group's sockets go away only
+// with its last thread, which isn't necessarily the leader. do_exit()
+// decrements the group's count of live threads before the tracepoint fires,
+// so the last one to exit sees zero. (Threads exiting concurrently may both
+// see zero; reporting the exit twice is harmless.)
+SEC("tracepoint/sched/sched_process_exit")
+int sched_process_exit(void* ctx) {
+    struct task_struct* task = (struct task_struct*)bpf_get_current_task();
+    if ( BPF_CORE_READ(task, signal, live.counter) != 0 )
+        return 0; // other threads of the process are still alive
+
+    sendOwnerEvent(0, BPF_SOCKET_OWNER_EXIT);
+    return 0;
+}
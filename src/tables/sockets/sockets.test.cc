@@ -13,6 +13,14 @@
 #include <netinet/in.h>
 #endif
 
+#ifdef HAVE_LINUX
+#include "sockets.linux.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#endif
+
 using namespace zeek::agent;
 
 TEST_CASE_FIXTURE(test::TableFixture, "sockets" * doctest::test_suite("Tables")) {
@@ -67,6 +75,16 @@ TEST_CASE_FIXTURE(test::TableFixture, "sockets" * doctest::test_suite("Tables"))
     CHECK_EQ(result.get<int64_t>(0, "pid"), getpid());
     CHECK_EQ(result.get<std::string>(0, "state"), std::string("LISTEN"));
 
+#ifdef HAVE_LINUX
+    // Same through the filters that we can push down into the kernel.
+    result = query(frmt("SELECT pid, state from sockets WHERE _port = {} AND _states = 'LISTEN'", port));
+    REQUIRE_EQ(result.rows.size(), 1);
+    CHECK_EQ(result.get<int64_t>(0, "pid"), getpid());
+
+    result = query(frmt("SELECT pid from sockets WHERE _port = {} AND _states = 'ESTABLISHED,TIME_WAIT'", port));
+    CHECK_EQ(result.rows.size(), 0);
+#endif
+
     // Clean up
 #ifdef HAVE_WINDOWS
     closesocket(fd);
@@ -75,3 +93,111 @@ TEST_CASE_FIXTURE(test::TableFixture, "sockets" * doctest::test_suite("Tables"))
     close(fd);
 #endif
 }
+
+#ifdef HAVE_LINUX
+TEST_CASE_FIXTURE(test::TableFixture, "sockets backends with port filter" * doctest::test_suite("Tables")) {
+    useTable("sockets");
+
+    auto table = dynamic_cast<table::SocketsLinux*>(Database::registeredTables().at("sockets").get());
+    REQUIRE(table);
+
+    // /proc reports a raw socket's protocol number in place of its local
+    // port. Neither backend must match that against a port filter.
+    const int protocol = 253; // reserved for experimentation
+    int fd = socket(AF_INET, SOCK_RAW, protocol);
+    if ( fd < 0 )
+        return; // not permitted (e.g., not root)
+
+    auto have_raw = [](const std::vector<std::vector<Value>>& rows) {
+        return std::any_of(rows.begin(), rows.end(),
+                           [](const auto& row) { return std::get<int64_t>(row[3]) == IPPROTO_RAW; });
+    };
+
+    auto filter = table::SocketsLinux::Filter{.port = static_cast<uint16_t>(protocol)};
+
+    CHECK(have_raw(table->snapshotFromProcFS({})));
+    CHECK_FALSE(have_raw(table->snapshotFromProcFS(filter)));
+
+    if ( auto netlink = table->snapshotFromNetlink({}) ) {
+        CHECK(have_raw(*netlink));
+
+        netlink = table->snapshotFromNetlink(filter);
+        REQUIRE(netlink);
+        CHECK_FALSE(have_raw(*netlink));
+    }
+
+    close(fd);
+}
+
+TEST_CASE("socket owner index" * doctest::test_suite("Tables")) {
+    table::SocketOwnerIndex index;
+
+    // Returns the owner PIDs of a set of inodes, with -1 for missing ones.
+    auto owners = [&](const std::unordered_set<ino_t>& inodes) {
+        std::unordered_set<ino_t> missing;
+        std::map<ino_t, int64_t> result;
+
+        for ( const auto& [inode, owner] : index.lookup(inodes, &missing) )
+            result[inode] = owner.first;
+
+        for ( auto inode : missing )
+            result[inode] = -1;
+
+        return result;
+    };
+
+    SUBCASE("add and remove") {
+        index.add(10, 1, "a");
+        index.add(11, 1, "a");
+        index.add(20, 2, "b");
+        index.add(table::InodeMap{{30, {3, "c"}}});
+        CHECK_EQ(owners({10, 11, 20, 30, 40}), std::map<ino_t, int64_t>{{10, 1}, {11, 1}, {20, 2}, {30, 3}, {40, -1}});
+
+        index.removeProcess(1);
+        index.removeProcess(4);
+        CHECK_EQ(owners({10, 11, 20, 30}), std::map<ino_t, int64_t>{{10, -1}, {11, -1}, {20, 2}, {30, 3}});
+    }
+
+    SUBCASE("socket changing owner") {
+        index.add(10, 1, "a");
+        index.add(10, 2, "b");
+
+        // The first process exiting must not take the socket with it.
+        index.removeProcess(1);
+        CHECK_EQ(owners({10}), std::map<ino_t, int64_t>{{10, 2}});
+
+        index.removeProcess(2);
+        CHECK_EQ(owners({10}), std::map<ino_t, int64_t>{{10, -1}});
+    }
+
+    SUBCASE("rescan") {
+        index.add(10, 1, "a");
+
+        auto before = index.lastRescan();
+        index.rescan([]() { return table::InodeMap{{20, {2, "b"}}, {21, {2, "b"}}}; });
+        CHECK_EQ(owners({10, 20, 21}), std::map<ino_t, int64_t>{{10, -1}, {20, 2}, {21, 2}});
+        CHECK(index.lastRescan() > before);
+
+        index.removeProcess(2);
+        CHECK_EQ(owners({20, 21}), std::map<ino_t, int64_t>{{20, -1}, {21, -1}});
+    }
+
+    SUBCASE("events during rescan") {
+        index.rescan([&]() {
+            // These happen after the scan has looked at the processes, so
+            // they must win over its result.
+            index.add(30, 3, "c");
+            index.add(11, 4, "d");
+            index.removeProcess(2);
+            return table::InodeMap{{10, {1, "a"}}, {11, {1, "a"}}, {20, {2, "b"}}};
+        });
+
+        CHECK_EQ(owners({10, 11, 20, 30}), std::map<ino_t, int64_t>{{10, 1}, {11, 4}, {20, -1}, {30, 3}});
+
+        // Events after the rescan don't get re-applied by the next one.
+        index.add(40, 5, "e");
+        index.rescan([]() { return table::InodeMap{{10, {1, "a"}}}; });
+        CHECK_EQ(owners({10, 40}), std::map<ino_t, int64_t>{{10, 1}, {40, -1}});
+    }
+}
+#endif
@@ -30,8 +30,8 @@ struct Socket {
     int64_t protocol;
     int64_t local_port;
     int64_t remote_port;
-    std::string local_addr;
-    std::string remote_addr;
+    Value local_addr;
+    Value remote_addr; // unset for UDP
     std::string status;
 };
 
@@ -84,8 +84,6 @@ void SocketsWindows::getTCPSockets(std::vector<Socket>& result) const {
     if ( ret != NO_ERROR )
         return;
 
-    char addr_str[16]{};
-
     auto tcp_table = reinterpret_cast<PMIB_TCPTABLE_OWNER_MODULE>(table.get());
     for ( DWORD i = 0; i < tcp_table->dwNumEntries; i++ ) {
         Socket s{};
@@ -97,13 +95,8 @@ void SocketsWindows::getTCPSockets(std::vector<Socket>& result) const {
         s.remote_port = ntohs(static_cast<uint16_t>(tcp_table->table[i].dwRemotePort));
         s.status = getTCPStateString(tcp_table->table[i].dwState);
 
-        auto* ia_in = reinterpret_cast<struct in_addr*>(&tcp_table->table[i].dwLocalAddr);
-        inet_ntop(AF_INET, ia_in, addr_str, sizeof(addr_str));
-        s.local_addr = addr_str;
-
-        ia_in = reinterpret_cast<struct in_addr*>(&tcp_table->table[i].dwRemoteAddr);
-        inet_ntop(AF_INET, ia_in, addr_str, sizeof(addr_str));
-        s.remote_addr = addr_str;
+        s.local_addr = Address::fromIPv4(&tcp_table->table[i].dwLocalAddr);
+        s.remote_addr = Address::fromIPv4(&tcp_table->table[i].dwRemoteAddr);
 
         result.push_back(std::move(s));
     }
@@ -120,8 +113,6 @@ void SocketsWindows::getTCP6Sockets(std::vector<Socket>& result) const {
     if ( ret != NO_ERROR )
         return;
 
-    char addr_str[128]{};
-
     auto tcp_table = reinterpret_cast<PMIB_TCP6TABLE_OWNER_MODULE>(table.get());
     for ( DWORD i = 0; i < tcp_table->dwNumEntries; i++ ) {
         Socket s{};
@@ -133,13 +124,8 @@ void SocketsWindows::getTCP6Sockets(std::vector<Socket>& result) const {
         s.remote_port = ntohs(static_cast<uint16_t>(tcp_table->table[i].dwRemotePort));
         s.status = getTCPStateString(tcp_table->table[i].dwState);
 
-        auto* ia_in = reinterpret_cast<struct in6_addr*>(&tcp_table->table[i].ucLocalAddr);
-        inet_ntop(AF_INET6, ia_in, addr_str, sizeof(addr_str));
-        s.local_addr = addr_str;
-
-        ia_in = reinterpret_cast<struct in6_addr*>(&tcp_table->table[i].ucRemoteAddr);
-        inet_ntop(AF_INET6, ia_in, addr_str, sizeof(addr_str));
-        s.remote_addr = addr_str;
+        s.local_addr = Address::fromIPv6(tcp_table->table[i].ucLocalAddr);
+        s.remote_addr = Address::fromIPv6(tcp_table->table[i].ucRemoteAddr);
 
         result.push_back(std::move(s));
     }
@@ -156,8 +142,6 @@ void SocketsWindows::getUDPSockets(std::vector<Socket>& result) const {
     if ( ret != NO_ERROR )
         return;
 
-    char addr_str[16]{};
-
     auto udp_table = reinterpret_cast<PMIB_UDPTABLE_OWNER_MODULE>(table.get());
     for ( DWORD i = 0; i < udp_table->dwNumEntries; i++ ) {
         Socket s{};
@@ -167,9 +151,7 @@ void SocketsWindows::getUDPSockets(std::vector<Socket>& result) const {
         s.protocol = IPPROTO_UDP;
         s.local_port = ntohs(static_cast<uint16_t>(udp_table->table[i].dwLocalPort));
 
-        auto* ia_in = reinterpret_cast<struct in_addr*>(&udp_table->table[i].dwLocalAddr);
-        inet_ntop(AF_INET, ia_in, addr_str, sizeof(addr_str));
-        s.local_addr = addr_str;
+        s.local_addr = Address::fromIPv4(&udp_table->table[i].dwLocalAddr);
 
         result.push_back(std::move(s));
     }
@@ -186,8 +168,6 @@ void SocketsWindows::getUDP6Sockets(std::vector<Socket>& result) const {
     if ( ret != NO_ERROR )
         return;
 
-    char addr_str[128]{};
-
     auto udp_table = reinterpret_cast<PMIB_UDP6TABLE_OWNER_MODULE>(table.get());
     for ( DWORD i = 0; i < udp_table->dwNumEntries; i++ ) {
         Socket s{};
@@ -197,9 +177,7 @@ void SocketsWindows::getUDP6Sockets(std::vector<Socket>& result) const {
         s.protocol = IPPROTO_UDP;
         s.local_port = ntohs(static_cast<uint16_t>(udp_table->table[i].dwLocalPort));
 
-        auto* ia_in = reinterpret_cast<struct in6_addr*>(&udp_table->table[i].ucLocalAddr);
-        inet_ntop(AF_INET6, ia_in, addr_str, sizeof(addr_str));
-        s.local_addr = addr_str;
+        s.local_addr = Address::fromIPv6(udp_table->table[i].ucLocalAddr);
 
         result.push_back(std::move(s));
     }
@@ -8,7 +8,7 @@ namespace zeek::agent::table {
 
 class SystemLogs : public EventTable {
 public:
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             // clang-format off
             .name = "system_logs_events",
@@ -1,20 +1,42 @@
 // Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
 //
-// Interface to journald. To avoid dependencies on external libraries, we spawn
+// Interface to journald. To avoid dependencies on external libraries, we read
+// journald's files directly if we can access them. Otherwise, we spawn
 // journalctl as a child process if we find it, reading from its output.
+//
+// A dedicated thread follows the journal as new entries become available, so
+// that we don't fall behind during log bursts. With journalctl, it splits the
+// output into json-seq records in place and extracts just the fields we need
+// with a single-pass scanner, instead of building full JSON objects.
+//
+// We look at the WHERE clauses of the active queries to skip entries that
+// none of them wants: constraints on `level` and `process` turn into match
+// arguments for journalctl, or into a filter for entries that we read from
+// the files directly.
 
 #include "system_logs.h"
 
 #include "core/database.h"
 #include "core/logger.h"
+#include "platform/linux/journal.h"
 #include "util/fmt.h"
 #include "util/helpers.h"
+#include "util/testing.h"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <chrono>
-#include <iostream>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
-#include <nlohmann/json.hpp>
 #include <reproc++/run.hpp>
 
 using namespace zeek::agent;
@@ -22,26 +44,692 @@ using namespace zeek::agent::table;
 
 namespace {
 
+// Timeout for waiting on new journal entries before checking for termination.
+static const auto ReaderPollTimeout = reproc::milliseconds(100);
+
+// Delay before restarting journalctl after it exited.
+static const auto RestartDelay = std::chrono::seconds(1);
+
+// Number of bytes to read from journalctl at a time.
+static const size_t ReadChunkSize = 65536;
+
+// Maximum size of a single json-seq record; anything larger gets discarded.
+static const size_t MaxRecordSize = 4 * 1024 * 1024;
+
+// Maximum number of events to buffer before handing them to the table.
+static const size_t MaxBatchSize = 1024;
+
+// Fields we read from journal files, in the order we prefer them for the
+// process column.
+static const std::vector<std::string> JournalFields = {"MESSAGE", "PRIORITY", "_COMM", "_EXE", "SYSLOG_IDENTIFIER"};
+
+// Journal fields that the process column may come from.
+static const std::vector<std::string> ProcessFields = {"_COMM", "_EXE", "SYSLOG_IDENTIFIER"};
+
+// Range of journal priorities.
+static const int MinPriority = 0;
+static const int MaxPriority = 7;
+
+// Maximum number of match groups to pass to journalctl; if we'd need more,
+// we read everything instead.
+static const size_t MaxMatchGroups = 64;
+
+// Selection of journal entries that the active queries want. It's a
+// disjunction of terms, with one term per query. Matching may include
+// entries that the queries then filter out, but never misses any they want.
+class JournalFilter {
+public:
+    struct Term {
+        int min_priority = MinPriority;     // lowest priority of interest, inclusive
+        int max_priority = MaxPriority;     // highest priority of interest, inclusive
+        std::optional<std::string> process; // process of interest, or unset for all
+
+        // Returns true if the term selects all entries.
+        bool all() const { return min_priority == MinPriority && max_priority == MaxPriority && ! process; }
+    };
+
+    // Builds a filter from the queries' constraints, with one entry per
+    // query. Returns unset if we need all entries.
+    static std::optional<JournalFilter> fromConstraints(const std::vector<std::vector<table::Constraint>>& queries) {
+        JournalFilter filter;
+
+        for ( const auto& constraints : queries ) {
+            Term term;
+            bool possible = true;
+
+            for ( const auto& c : constraints ) {
+                if ( c.column == "level" ) {
+                    auto p = priority(c.value);
+                    if ( ! p )
+                        continue;
+
+                    switch ( c.op ) {
+                        case table::Operator::Equal:
+                            term.min_priority = std::max(term.min_priority, *p);
+                            term.max_priority = std::min(term.max_priority, *p);
+                            break;
+                        case table::Operator::Less: term.max_priority = std::min(term.max_priority, *p - 1); break;
+                        case table::Operator::LessEqual: term.max_priority = std::min(term.max_priority, *p); break;
+                        case table::Operator::Greater: term.min_priority = std::max(term.min_priority, *p + 1); break;
+                        case table::Operator::GreaterEqual: term.min_priority = std::max(term.min_priority, *p); break;
+                        case table::Operator::NotEqual: break;
+                    }
+                }
+
+                else if ( c.column == "process" && c.op == table::Operator::Equal ) {
+                    auto process = std::get_if<std::string>(&c.value);
+                    if ( ! process )
+                        continue;
+
+                    if ( term.process && *term.process != *process )
+                        possible = false;
+
+                    term.process = *process;
+                }
+            }
+
+            if ( ! possible || term.min_priority > term.max_priority )
+                continue; // query cannot match anything
+
+            if ( term.all() )
+                return {};
+
+            filter._terms.push_back(std::move(term));
+        }
+
+        if ( filter.numberGroups() > MaxMatchGroups )
+            return {};
+
+        return filter;
+    }
+
+    // Returns true if no entries match.
+    bool empty() const { return _terms.empty(); }
+
+    // Returns the number of match groups that `journalctlMatches()` produces.
+    size_t numberGroups() const {
+        size_t n = 0;
+
+        for ( const auto& t : _terms )
+            n += (t.process ? ProcessFields.size() : 1);
+
+        return n;
+    }
+
+    // Returns true if an entry read from the journal files matches.
+    bool matches(const platform::linux::journal::Entry& entry) const {
+        const auto& values = entry.values; // in the order of `JournalFields`
+
+        const std::string* process = nullptr;
+        for ( auto i : {2, 3, 4} ) {
+            if ( values[i] ) {
+                process = &*values[i];
+                break;
+            }
+        }
+
+        return matches(values[1], process);
+    }
+
+    // Returns true if an entry with the given values for the `level` and
+    // `process` columns matches.
+    bool matches(const std::optional<std::string>& priority, const std::string* process) const {
+        std::optional<int> p;
+        if ( priority )
+            p = JournalFilter::priority(*priority);
+
+        for ( const auto& t : _terms ) {
+            if ( t.process && (! process || *t.process != *process) )
+                continue;
+
+            if ( t.min_priority != MinPriority || t.max_priority != MaxPriority ) {
+                // If we don't understand the priority, let the query decide.
+                if ( p && (*p < t.min_priority || *p > t.max_priority) )
+                    continue;
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // Returns match arguments for journalctl selecting the filter's entries.
+    // Matches for the same field are alternatives, matches for different
+    // fields must all apply, and "+" separates groups of matches that are
+    // alternatives.
+    std::vector<std::string> journalctlMatches() const {
+        std::vector<std::string> matches;
+        size_t groups = 0;
+
+        for ( const auto& t : _terms ) {
+            std::vector<std::string> priorities;
+            if ( t.min_priority != MinPriority || t.max_priority != MaxPriority ) {
+                for ( auto p = t.min_priority; p <= t.max_priority; p++ )
+                    priorities.emplace_back(frmt("PRIORITY={}", p));
+            }
+
+            // The process may come from any of several fields, each of which
+            // then needs its own group.
+            std::vector<std::optional<std::string>> processes = {std::nullopt};
+            if ( t.process )
+                processes = transform(ProcessFields, [&](const auto& f) -> std::optional<std::string> {
+                    return frmt("{}={}", f, *t.process);
+                });
+
+            for ( const auto& process : processes ) {
+                if ( groups++ > 0 )
+                    matches.emplace_back("+");
+
+                matches.insert(matches.end(), priorities.begin(), priorities.end());
+
+                if ( process )
+                    matches.push_back(*process);
+            }
+        }
+
+        return matches;
+    }
+
+    bool operator==(const JournalFilter& other) const { return journalctlMatches() == other.journalctlMatches(); }
+    bool operator!=(const JournalFilter& other) const { return ! (*this == other); }
+
+private:
+    // Extracts a priority from a constraint's value. The `level` column is
+    // text, so SQLite compares values as strings; those agree with numerical
+    // comparison only for single digits, which is all we accept.
+    static std::optional<int> priority(const Value& v) {
+        if ( auto i = std::get_if<int64_t>(&v); i && *i >= 0 && *i <= 9 )
+            return static_cast<int>(*i);
+
+        if ( auto s = std::get_if<std::string>(&v) )
+            return priority(*s);
+
+        return {};
+    }
+
+    static std::optional<int> priority(const std::string& s) {
+        if ( s.size() == 1 && s[0] >= '0' && s[0] <= '9' )
+            return s[0] - '0';
+        else
+            return {};
+    }
+
+    std::vector<Term> _terms;
+};
+
+// Fields extracted from a journal entry.
+struct JournalEntry {
+    std::optional<std::string> cursor;  // __CURSOR
+    std::optional<int64_t> realtime;    // __REALTIME_TIMESTAMP, in microseconds since the epoch
+    std::optional<std::string> process; // first available of _COMM, _EXE, SYSLOG_IDENTIFIER
+    std::optional<std::string> priority;
+    std::optional<std::string> message;
+    int process_rank = 0; // preference of the field `process` came from, lower is better
+};
+
+// Single-pass scanner extracting the fields of a `JournalEntry` from a
+// journal entry in JSON format. It skips over all other fields without
+// decoding them.
+//
+// Following journalctl's JSON output, field values are strings, null if
+// too large, arrays of bytes if not valid UTF-8, or arrays of those if a
+// field appears multiple times, in which case we take the first.
+class JournalEntryScanner {
+public:
+    JournalEntryScanner(std::string_view data) : _p(data.data()), _end(data.data() + data.size()) {}
+
+    // Scans the entry, returning false if it's not valid JSON.
+    bool scan(JournalEntry* entry) {
+        skipWhitespace();
+        if ( ! consume('{') )
+            return false;
+
+        skipWhitespace();
+        if ( consume('}') )
+            return true;
+
+        while ( true ) {
+            std::string_view key;
+            bool escaped;
+            if ( ! rawString(&key, &escaped) )
+                return false;
+
+            skipWhitespace();
+            if ( ! consume(':') )
+                return false;
+
+            if ( ! scanField(key, entry) )
+                return false;
+
+            skipWhitespace();
+            if ( consume(',') ) {
+                skipWhitespace();
+                continue;
+            }
+
+            return consume('}');
+        }
+    }
+
+private:
+    bool scanField(std::string_view key, JournalEntry* entry) {
+        int process_rank = 0;
+
+        if ( key == "MESSAGE" )
+            return decodeValue(&entry->message);
+
+        else if ( key == "PRIORITY" )
+            return decodeValue(&entry->priority);
+
+        else if ( key == "__CURSOR" )
+            return decodeValue(&entry->cursor);
+
+        else if ( key == "__REALTIME_TIMESTAMP" ) {
+            std::optional<std::string> x;
+            if ( ! decodeValue(&x) )
+                return false;
+
+            int64_t t;
+            if ( x && std::from_chars(x->data(), x->data() + x->size(), t).ec == std::errc() )
+                entry->realtime = t;
+
+            return true;
+        }
+
+        else if ( key == "_COMM" )
+            process_rank = 1;
+
+        else if ( key == "_EXE" )
+            process_rank = 2;
+
+        else if ( key == "SYSLOG_IDENTIFIER" )
+            process_rank = 3;
+
+        else
+            return skipValue();
+
+        std::optional<std::string> x;
+        if ( ! decodeValue(&x) )
+            return false;
+
+        if ( x && (! entry->process || process_rank < entry->process_rank) ) {
+            entry->process = std::move(x);
+            entry->process_rank = process_rank;
+        }
+
+        return true;
+    }
+
+    void skipWhitespace() {
+        while ( _p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r') )
+            ++_p;
+    }
+
+    bool consume(char c) {
+        if ( _p < _end && *_p == c ) {
+            ++_p;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Scans a string, returning its raw content without decoding escapes.
+    bool rawString(std::string_view* s, bool* escaped) {
+        if ( ! consume('"') )
+            return false;
+
+        *escaped = false;
+        auto start = _p;
+
+        while ( _p < _end ) {
+            if ( *_p == '\\' ) {
+                *escaped = true;
+                _p += 2;
+            }
+            else if ( *_p == '"' ) {
+                *s = std::string_view(start, _p - start);
+                ++_p;
+                return true;
+            }
+            else
+                ++_p;
+        }
+
+        return false;
+    }
+
+    bool decodeString(std::string* dst) {
+        std::string_view raw;
+        bool escaped;
+        if ( ! rawString(&raw, &escaped) )
+            return false;
+
+        if ( ! escaped ) {
+            dst->assign(raw);
+            return true;
+        }
+
+        return unescape(raw, dst);
+    }
+
+    // Decodes a field value, leaving `dst` unset for null.
+    bool decodeValue(std::optional<std::string>* dst) {
+        skipWhitespace();
+        if ( _p >= _end )
+            return false;
+
+        if ( *_p == '"' ) {
+            std::string s;
+            if ( ! decodeString(&s) )
+                return false;
+
+            *dst = std::move(s);
+            return true;
+        }
+
+        if ( *_p != '[' )
+            return skipValue(); // null, or something unexpected we ignore
+
+        ++_p;
+        skipWhitespace();
+
+        if ( _p < _end && (*_p == '"' || *_p == '[' || *_p == 'n') ) {
+            // Multiple values, take the first and skip the rest.
+            if ( ! decodeValue(dst) )
+                return false;
+
+            while ( true ) {
+                skipWhitespace();
+                if ( ! consume(',') )
+                    break;
+
+                if ( ! skipValue() )
+                    return false;
+            }
+
+            skipWhitespace();
+            return consume(']');
+        }
+
+        // Array of bytes.
+        std::string bytes;
+
+        while ( true ) {
+            skipWhitespace();
+            if ( consume(']') )
+                break;
+
+            unsigned int byte;
+            auto [ptr, ec] = std::from_chars(_p, _end, byte);
+            if ( ec != std::errc() || byte > 255 )
+                return false;
+
+            bytes.push_back(static_cast<char>(byte));
+            _p = ptr;
+
+            skipWhitespace();
+            if ( consume(']') )
+                break;
+
+            if ( ! consume(',') )
+                return false;
+        }
+
+        *dst = std::move(bytes);
+        return true;
+    }
+
+    bool skipValue() {
+        skipWhitespace();
+        if ( _p >= _end )
+            return false;
+
+        if ( *_p == '"' ) {
+            std::string_view s;
+            bool escaped;
+            return rawString(&s, &escaped);
+        }
+
+        if ( *_p == '{' || *_p == '[' ) {
+            int depth = 0;
+
+            while ( _p < _end ) {
+                if ( *_p == '"' ) {
+                    std::string_view s;
+                    bool escaped;
+                    if ( ! rawString(&s, &escaped) )
+                        return false;
+
+                    continue;
+                }
+
+                if ( *_p == '{' || *_p == '[' )
+                    ++depth;
+                else if ( *_p == '}' || *_p == ']' ) {
+                    if ( --depth == 0 ) {
+                        ++_p;
+                        return true;
+                    }
+                }
+
+                ++_p;
+            }
+
+            return false;
+        }
+
+        // Number or literal.
+        auto start = _p;
+        while ( _p < _end && ! strchr(",}] \t\r\n", *_p) )
+            ++_p;
+
+        return _p > start;
+    }
+
+    static void appendUTF8(uint32_t cp, std::string* dst) {
+        if ( cp < 0x80 )
+            dst->push_back(static_cast<char>(cp));
+        else if ( cp < 0x800 ) {
+            dst->push_back(static_cast<char>(0xc0 | (cp >> 6)));
+            dst->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+        else if ( cp < 0x10000 ) {
+            dst->push_back(static_cast<char>(0xe0 | (cp >> 12)));
+            dst->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+            dst->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+        else {
+            dst->push_back(static_cast<char>(0xf0 | (cp >> 18)));
+            dst->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+            dst->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+            dst->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+    }
+
+    static bool parseHex4(std::string_view s, size_t i, uint32_t* cp) {
+        if ( i + 4 > s.size() )
+            return false;
+
+        auto [ptr, ec] = std::from_chars(s.data() + i, s.data() + i + 4, *cp, 16);
+        return ec == std::errc() && ptr == s.data() + i + 4;
+    }
+
+    static bool unescape(std::string_view raw, std::string* dst) {
+        dst->clear();
+        dst->reserve(raw.size());
+
+        for ( size_t i = 0; i < raw.size(); i++ ) {
+            if ( raw[i] != '\\' ) {
+                dst->push_back(raw[i]);
+                continue;
+            }
+
+            if ( ++i >= raw.size() )
+                return false;
+
+            switch ( raw[i] ) {
+                case '"':
+                case '\\':
+                case '/': dst->push_back(raw[i]); break;
+                case 'b': dst->push_back('\b'); break;
+                case 'f': dst->push_back('\f'); break;
+                case 'n': dst->push_back('\n'); break;
+                case 'r': dst->push_back('\r'); break;
+                case 't': dst->push_back('\t'); break;
+                case 'u': {
+                    uint32_t cp;
+                    if ( ! parseHex4(raw, i + 1, &cp) )
+                        return false;
+
+                    i += 4;
+
+                    if ( cp >= 0xd800 && cp < 0xdc00 && i + 6 < raw.size() && raw[i + 1] == '\\' &&
+                         raw[i + 2] == 'u' ) {
+                        // Surrogate pair.
+                        uint32_t low;
+                        if ( parseHex4(raw, i + 3, &low) && low >= 0xdc00 && low < 0xe000 ) {
+                            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                            i += 6;
+                        }
+                    }
+
+                    appendUTF8(cp, dst);
+                    break;
+                }
+
+                default: return false;
+            }
+        }
+
+        return true;
+    }
+
+    const char* _p;   // current position
+    const char* _end; // end of input
+};
+
+// Buffer accumulating journalctl output, from which we then take complete
+// json-seq records. Consumed space at the front gets reclaimed by moving the
+// remaining partial record there once we run out of room at the end, so the
+// buffer's size stays bounded by the chunk size plus the longest record.
+class RecordBuffer {
+public:
+    // Returns space for appending up to `n` bytes, to be followed by `commit()`.
+    char* prepare(size_t n) {
+        if ( _data.size() - _end < n ) {
+            if ( _begin > 0 ) {
+                memmove(_data.data(), _data.data() + _begin, _end - _begin);
+                _end -= _begin;
+                _scanned -= _begin;
+                _begin = 0;
+            }
+
+            if ( _data.size() - _end < n )
+                _data.resize(std::max(_data.size() * 2, _end + n));
+        }
+
+        return _data.data() + _end;
+    }
+
+    // Marks `n` bytes as appended to the space that `prepare()` returned.
+    void commit(size_t n) { _end += n; }
+
+    // Returns the number of bytes buffered that aren't part of a complete record yet.
+    size_t pending() const { return _end - _begin; }
+
+    // Drops any partial record, along with its remainder once that arrives.
+    void discardPartial() {
+        _begin = _scanned = _end = 0;
+        _discarding = true;
+    }
+
+    // Calls a function with each complete record, removing them from the
+    // buffer. The record's data remains valid only during the call.
+    template<typename Callback>
+    void forEachRecord(Callback callback) {
+        while ( _scanned < _end ) {
+            auto nl = static_cast<char*>(memchr(_data.data() + _scanned, '\n', _end - _scanned));
+            if ( ! nl ) {
+                _scanned = _end;
+                break;
+            }
+
+            auto start = _data.data() + _begin;
+            while ( start < nl && *start == '\x1e' ) // pre-record separator
+                ++start;
+
+            if ( _discarding )
+                _discarding = false;
+            else if ( start < nl )
+                callback(std::string_view(start, nl - start));
+
+            _begin = _scanned = (nl - _data.data()) + 1;
+        }
+
+        if ( _begin == _end )
+            _begin = _scanned = _end = 0;
+    }
+
+private:
+    std::vector<char> _data;  // buffer space
+    size_t _begin = 0;        // offset of first byte not yet consumed
+    size_t _scanned = 0;      // offset up to which we have searched for the end of a record
+    size_t _end = 0;          // offset of first byte not yet written
+    bool _discarding = false; // true to drop the next record because its start was discarded
+};
+
 class SystemLogsLinux : public SystemLogs {
 public:
     Init init() override;
     void activate() override;
     void deactivate() override;
-    void poll() override;
+    void queriesChanged() override;
 
-    void startProcess();
+    // Decodes a single journal entry in JSON format into a table row. If
+    // `cursor` is given, sets it to the entry's cursor.
+    static std::optional<std::vector<Value>> parseEntry(std::string_view data, std::string* cursor = nullptr);
+
+    // Turns an entry read from a journal file into a table row.
+    static std::vector<Value> convertEntry(const platform::linux::journal::Entry& entry);
+
+private:
+    void startProcess(const std::optional<JournalFilter>& filter);
     void stopProcess();
-    void parseJSON(const std::string& object);
+    bool updateFilter(std::optional<JournalFilter>* filter);
+    void readerThread();
+    void readJournalFiles(platform::linux::journal::Reader* reader);
+    void readJournalctl();
+    void readOutput(std::vector<std::vector<Value>>* batch);
+
+    bool _have_journal_files = false; // true if we can read journal files directly
+    std::optional<filesystem::path> _journalctl;
+    std::unique_ptr<reproc::process> _process; // accessed only by reader thread while it's running
+    RecordBuffer _buffer;                      // accessed only by reader thread while it's running
+    std::string _cursor;                  // last entry read from journalctl; accessed only by reader thread while it's running
+    std::unique_ptr<std::thread> _thread; // reader thread, set while active
 
-    std::optional<filesystem::path> journalctl;
-    std::unique_ptr<reproc::process> process;
-    std::string buffer;
+    std::mutex _mutex;           // protects `_stop`, `_filter`, and `_filter_changed`
+    std::condition_variable _cv; // signals changes to `_stop` and `_filter`
+    std::atomic<bool> _stop = false;
+    std::optional<JournalFilter> _filter; // entries the active queries want, or unset for all
+    bool _filter_changed = false;         // true if reader thread hasn't picked up `_filter` yet
 };
 
 database::RegisterTable<SystemLogsLinux> _;
 
 Table::Init SystemLogsLinux::init() {
-    // See if we find 'journalctl'
+    // See if we can read the journal files ourselves.
+    platform::linux::journal::Reader reader(JournalFields);
+    if ( auto rc = reader.open() ) {
+        ZEEK_AGENT_DEBUG("system_logs", "reading journal files directly");
+        _have_journal_files = true;
+    }
+    else
+        ZEEK_AGENT_DEBUG("system_logs", "cannot read journal files directly: {}", rc.error());
+
+    // See if we find 'journalctl' as a fallback.
     std::set<filesystem::path> candidates = {"/usr/bin/journalctl", "/usr/local/sbin/journalctl"};
 
     for ( const auto& p : candidates ) {
@@ -57,42 +745,56 @@ Table::Init SystemLogsLinux::init() {
         auto [status, ec] = reproc::run(std::vector<std::string>{p.native(), "--version"}, options);
         if ( status == 0 ) {
             // It works.
-            journalctl = p;
+            _journalctl = p;
             break;
         }
     }
 
-    if ( journalctl )
-        ZEEK_AGENT_DEBUG("system_logs", "found journalctrl: {}", journalctl->native());
+    if ( _journalctl )
+        ZEEK_AGENT_DEBUG("system_logs", "found journalctrl: {}", _journalctl->native());
     else
         ZEEK_AGENT_DEBUG("system_logs", "did not find journalctrl");
 
-    return journalctl ? Init::Available : Init::PermanentlyUnavailable;
+    return (_have_journal_files || _journalctl) ? Init::Available : Init::PermanentlyUnavailable;
 }
 
-void SystemLogsLinux::startProcess() {
-    if ( ! journalctl )
+void SystemLogsLinux::startProcess(const std::optional<JournalFilter>& filter) {
+    if ( ! _journalctl )
         return;
 
-    buffer.clear();
+    _buffer = RecordBuffer();
 
     reproc::options options;
     options.redirect.in.type = reproc::redirect::discard;
     options.redirect.out.type = reproc::redirect::default_;
     options.redirect.err.type = reproc::redirect::default_;
 
-    process = std::make_unique<reproc::process>();
-    std::vector<std::string> args = {journalctl->native(), "-f", "-o", "json-seq",
-                                     "--output-fields=MESSAGE,PRIORITY,_EXE"};
-    if ( auto ec = process->start(args, options) ) {
-        logger()->warn("[system_logs] execution of {} failed, will not have data", journalctl->native());
-        process.reset();
-        journalctl.reset();
+    _process = std::make_unique<reproc::process>();
+    std::vector<std::string> args = {_journalctl->native(), "-f", "-o", "json-seq",
+                                     "--output-fields=MESSAGE,PRIORITY,_COMM,_EXE,SYSLOG_IDENTIFIER"};
+
+    if ( ! _cursor.empty() ) {
+        // Continue where the previous process left off.
+        args.emplace_back("--lines=all");
+        args.emplace_back(frmt("--after-cursor={}", _cursor));
+    }
+
+    if ( filter ) {
+        auto matches = filter->journalctlMatches();
+        args.insert(args.end(), matches.begin(), matches.end());
+    }
+
+    ZEEK_AGENT_DEBUG("system_logs", "starting: {}", join(args, " "));
+
+    if ( auto ec = _process->start(args, options) ) {
+        logger()->warn(frmt("[system_logs] execution of {} failed, will not have data", _journalctl->native()));
+        _process.reset();
+        _journalctl.reset();
     }
 }
 
 void SystemLogsLinux::stopProcess() {
-    if ( ! process )
+    if ( ! _process )
         return;
 
     auto stop = reproc::stop_actions{
@@ -101,90 +803,385 @@ void SystemLogsLinux::stopProcess() {
         .third = {.action = reproc::stop::kill, .timeout = reproc::milliseconds::max()},
     };
 
-    if ( auto [status, ec] = process->stop(stop); ec ) {
+    if ( auto [status, ec] = _process->stop(stop); ec ) {
         logger()->warn("[system_logs] could not stop journalctl; will stop using it");
-        journalctl.reset();
+        _journalctl.reset();
     }
 
-    process.reset();
+    _process.reset();
 }
 
 void SystemLogsLinux::activate() {
-    assert(! process);
-    startProcess();
-}
+    assert(! _thread);
 
-void SystemLogsLinux::deactivate() { stopProcess(); }
+    if ( ! (_have_journal_files || _journalctl) )
+        return;
 
-#include <iostream>
+    _stop = false;
+    _filter = JournalFilter::fromConstraints(activeConstraints());
+    _filter_changed = true;
+    _cursor.clear();
+    _thread = std::make_unique<std::thread>([this]() { readerThread(); });
+}
 
-void SystemLogsLinux::poll() {
-    if ( ! process )
+void SystemLogsLinux::deactivate() {
+    if ( ! _thread )
         return;
 
-    auto [events, ec] = process->poll(reproc::event::out | reproc::event::exit, reproc::milliseconds(10));
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
 
-    if ( events & reproc::event::out ) {
-        std::array<uint8_t, 4096> data;
-        if ( auto [size, ec] = process->read(reproc::stream::out, data.begin(), data.size()); size && ! ec )
-            buffer.append(reinterpret_cast<const char*>(data.begin()), size);
+    _cv.notify_all();
+    _thread->join();
+    _thread.reset();
+}
 
-        // Chop buffer into JSON blocks.
-        size_t cur = 0;
-        while ( cur < buffer.size() ) {
-            while ( buffer[cur] == '\x1e' ) // pre-msg separator
-                ++cur;
+void SystemLogsLinux::queriesChanged() {
+    auto filter = JournalFilter::fromConstraints(activeConstraints());
 
-            auto end = buffer.find('\n', cur); // post-msg separator
-            if ( end == std::string::npos )
-                // don't have a whole message
-                break;
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        if ( filter == _filter )
+            return;
 
-            parseJSON(buffer.substr(cur, end - cur));
-            cur = end + 1;
-        }
+        ZEEK_AGENT_DEBUG("system_logs", "active queries changed, now selecting entries: {}",
+                         (filter ? join(filter->journalctlMatches(), " ") : std::string("all")));
 
-        buffer = buffer.substr(cur);
+        _filter = std::move(filter);
+        _filter_changed = true;
     }
 
-    if ( events & reproc::event::exit ) {
-        // Collect exit status and restart
-        process->wait(reproc::milliseconds(0));
-        startProcess();
-        return;
+    _cv.notify_all();
+}
+
+bool SystemLogsLinux::updateFilter(std::optional<JournalFilter>* filter) {
+    const std::lock_guard<std::mutex> lock(_mutex);
+
+    if ( ! _filter_changed )
+        return false;
+
+    *filter = _filter;
+    _filter_changed = false;
+    return true;
+}
+
+void SystemLogsLinux::readerThread() {
+    if ( _have_journal_files ) {
+        platform::linux::journal::Reader reader(JournalFields);
+        if ( auto rc = reader.open() ) {
+            readJournalFiles(&reader);
+            return;
+        }
+        else
+            ZEEK_AGENT_DEBUG("system_logs", "cannot read journal files anymore, trying journalctl: {}", rc.error());
     }
+
+    readJournalctl();
 }
 
-void SystemLogsLinux::parseJSON(const std::string& object) {
-    try {
-        auto j = nlohmann::json::parse(object);
+void SystemLogsLinux::readJournalFiles(platform::linux::journal::Reader* reader) {
+    std::vector<std::vector<Value>> batch;
+    std::optional<JournalFilter> filter;
 
-        Value t;
-        Value process;
-        Value priority;
-        Value msg;
+    while ( ! _stop ) {
+        updateFilter(&filter);
 
-        auto t_ = std::stoll(j.at("__REALTIME_TIMESTAMP").get<std::string>()); // always exists
-        t = Time(std::chrono::time_point<std::chrono::system_clock>(std::chrono::microseconds(t_)));
+        reader->read([&](const platform::linux::journal::Entry& entry) {
+            if ( filter && ! filter->matches(entry) )
+                return;
 
-        for ( const auto& i : std::vector<std::string>{"_COMM", "_EXE", "SYSLOG_IDENTIFIER"} ) {
-            if ( j.contains(i) ) {
-                process = j[i].get<std::string>();
-                break;
+            batch.push_back(convertEntry(entry));
+
+            if ( batch.size() >= MaxBatchSize ) {
+                newEvents(std::move(batch));
+                batch.clear();
             }
+        });
+
+        newEvents(std::move(batch));
+        batch.clear();
+
+        reader->wait(ReaderPollTimeout);
+    }
+}
+
+void SystemLogsLinux::readJournalctl() {
+    std::vector<std::vector<Value>> batch;
+    std::optional<JournalFilter> filter;
+
+    while ( ! _stop ) {
+        if ( updateFilter(&filter) && _process )
+            // Restart with the new matches. The new process continues from
+            // the last entry we read.
+            stopProcess();
+
+        if ( ! _process ) {
+            if ( filter && filter->empty() ) {
+                // No query can match anything, so wait for that to change.
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait_for(lock, RestartDelay, [this]() { return _stop || _filter_changed; });
+                continue;
+            }
+
+            startProcess(filter);
+
+            if ( ! _process )
+                break; // failed permanently
+        }
+
+        auto [events, ec] = _process->poll(reproc::event::out | reproc::event::exit, ReaderPollTimeout);
+        if ( ec && ec != std::errc::timed_out ) {
+            logger()->warn(frmt("[system_logs] cannot read from journalctl, restarting it ({})", ec.message()));
+            stopProcess();
+        }
+
+        if ( events & reproc::event::out )
+            readOutput(&batch);
+
+        if ( ! _process || (events & reproc::event::exit) ) {
+            // Collect exit status and restart after a short delay.
+            if ( _process ) {
+                _process->wait(reproc::milliseconds(0));
+                _process.reset();
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait_for(lock, RestartDelay, [this]() { return _stop || _filter_changed; });
         }
+    }
+
+    stopProcess();
+}
 
-        if ( j.contains("PRIORITY") )
-            priority = j["PRIORITY"].get<std::string>();
+void SystemLogsLinux::readOutput(std::vector<std::vector<Value>>* batch) {
+    // Drain everything that's currently available.
+    while ( true ) {
+        auto space = _buffer.prepare(ReadChunkSize);
+        auto [size, ec] = _process->read(reproc::stream::out, reinterpret_cast<uint8_t*>(space), ReadChunkSize);
+        if ( ec || size == 0 )
+            break;
 
-        if ( j.contains("MESSAGE") )
-            msg = j["MESSAGE"].get<std::string>();
+        _buffer.commit(size);
 
-        newEvent({t, process, priority, msg, {}});
+        _buffer.forEachRecord([&](std::string_view record) {
+            if ( auto row = parseEntry(record, &_cursor) )
+                batch->push_back(std::move(*row));
+        });
 
-    } catch ( const nlohmann::json::exception& e ) {
-        logger()->warn("[system_logs] failed to parse JSON data: {}", e.what());
+        if ( _buffer.pending() > MaxRecordSize ) {
+            logger()->warn("[system_logs] journal entry exceeds maximum size, skipping it");
+            _buffer.discardPartial();
+        }
+
+        if ( batch->size() >= MaxBatchSize ) {
+            newEvents(std::move(*batch));
+            batch->clear();
+        }
+
+        // See if there's more right away. We must check even after a full
+        // chunk because the read would otherwise block until journalctl
+        // writes again, which may take arbitrarily long, and deactivate()
+        // would have to wait for that.
+        auto [events, poll_ec] = _process->poll(reproc::event::out, reproc::milliseconds(0));
+        if ( poll_ec || ! (events & reproc::event::out) )
+            break;
+    }
+
+    newEvents(std::move(*batch));
+    batch->clear();
+}
+
+std::optional<std::vector<Value>> SystemLogsLinux::parseEntry(std::string_view data, std::string* cursor) {
+    JournalEntry entry;
+
+    if ( ! JournalEntryScanner(data).scan(&entry) ) {
+        logger()->warn("[system_logs] failed to parse JSON data");
+        return {};
+    }
+
+    if ( cursor && entry.cursor )
+        *cursor = std::move(*entry.cursor);
+
+    if ( ! entry.realtime ) { // always exists
+        logger()->warn("[system_logs] journal entry without timestamp");
+        return {};
+    }
+
+    Value t = Time(std::chrono::time_point<std::chrono::system_clock>(std::chrono::microseconds(*entry.realtime)));
+    // Process and priority repeat a lot across entries, which we may buffer
+    // for a while, so we intern them.
+    Value process = (entry.process ? Value(InternedString(*entry.process)) : Value());
+    Value priority = (entry.priority ? Value(InternedString(*entry.priority)) : Value());
+    Value msg = (entry.message ? Value(std::move(*entry.message)) : Value());
+
+    return std::vector<Value>{t, process, priority, msg, {}};
+}
+
+std::vector<Value> SystemLogsLinux::convertEntry(const platform::linux::journal::Entry& entry) {
+    const auto& values = entry.values;
+
+    Value t = Time(std::chrono::time_point<std::chrono::system_clock>(std::chrono::microseconds(entry.realtime)));
+    Value process;
+    Value priority = (values[1] ? Value(InternedString(*values[1])) : Value());
+    Value msg = (values[0] ? Value(*values[0]) : Value());
+
+    for ( auto i : {2, 3, 4} ) { // _COMM, _EXE, SYSLOG_IDENTIFIER
+        if ( values[i] ) {
+            process = InternedString(*values[i]);
+            break;
+        }
     }
+
+    return {t, process, priority, msg, {}};
 }
 
 } // namespace
+
+TEST_SUITE("Tables") {
+    TEST_CASE("system_logs journal entry parsing") {
+        SUBCASE("regular entry") {
+            auto row = SystemLogsLinux::parseEntry(
+                R"({"__CURSOR":"s=1;i=2","__REALTIME_TIMESTAMP":"1700000000123456","_BOOT_ID":"abc","PRIORITY":"6","_EXE":"/usr/bin/foo","MESSAGE":"hello \"world\"\nä😀","_NESTED":{"a":[1,{"b":"}"}]},"NUM":42})");
+            REQUIRE(row);
+            CHECK_EQ(std::get<Time>((*row)[0]),
+                     Time(std::chrono::time_point<std::chrono::system_clock>(std::chrono::microseconds(1700000000123456))));
+            CHECK_EQ((*row)[1], Value("/usr/bin/foo"));
+            CHECK_EQ((*row)[2], Value("6"));
+            CHECK_EQ(std::get<std::string>((*row)[3]), "hello \"world\"\n\xc3\xa4\xf0\x9f\x98\x80");
+
+            std::string cursor;
+            SystemLogsLinux::parseEntry(R"({"__CURSOR":"s=1;i=2","__REALTIME_TIMESTAMP":"1"})", &cursor);
+            CHECK_EQ(cursor, "s=1;i=2");
+        }
+
+        SUBCASE("process preference") {
+            auto row = SystemLogsLinux::parseEntry(
+                R"({"SYSLOG_IDENTIFIER":"ident","_EXE":"/bin/exe","_COMM":"comm","__REALTIME_TIMESTAMP":"1"})");
+            REQUIRE(row);
+            CHECK_EQ((*row)[1], Value("comm"));
+            CHECK(std::holds_alternative<std::monostate>((*row)[2]));
+            CHECK(std::holds_alternative<std::monostate>((*row)[3]));
+        }
+
+        SUBCASE("binary, repeated, and null values") {
+            auto row = SystemLogsLinux::parseEntry(
+                R"({"__REALTIME_TIMESTAMP":"1","MESSAGE":[104,105,0,255],"PRIORITY":["3","4"],"_EXE":null})");
+            REQUIRE(row);
+            CHECK_EQ(std::get<std::string>((*row)[3]), std::string("hi\x00\xff", 4));
+            CHECK_EQ((*row)[2], Value("3"));
+            CHECK(std::holds_alternative<std::monostate>((*row)[1]));
+        }
+
+        SUBCASE("invalid") {
+            CHECK_FALSE(SystemLogsLinux::parseEntry(R"({"__REALTIME_TIMESTAMP":"1","MESSAGE":"x)").has_value());
+            CHECK_FALSE(SystemLogsLinux::parseEntry(R"({"MESSAGE":"no timestamp"})").has_value());
+            CHECK_FALSE(SystemLogsLinux::parseEntry("garbage").has_value());
+        }
+    }
+
+    TEST_CASE("system_logs journal file entry conversion") {
+        platform::linux::journal::Entry entry;
+        entry.realtime = 1700000000123456;
+        entry.values = {"msg", "4", std::nullopt, "/bin/exe", "ident"};
+
+        auto row = SystemLogsLinux::convertEntry(entry);
+        CHECK_EQ(std::get<Time>(row[0]),
+                 Time(std::chrono::time_point<std::chrono::system_clock>(std::chrono::microseconds(1700000000123456))));
+        CHECK_EQ(row[1], Value("/bin/exe"));
+        CHECK_EQ(row[2], Value("4"));
+        CHECK_EQ(std::get<std::string>(row[3]), "msg");
+    }
+
+    TEST_CASE("system_logs journal filter") {
+        auto c = [](std::string column, table::Operator op, Value value) {
+            return table::Constraint{.column = std::move(column), .op = op, .value = std::move(value)};
+        };
+
+        std::string sshd = "sshd";
+        std::string cron = "cron";
+
+        SUBCASE("unconstrained") {
+            CHECK_FALSE(JournalFilter::fromConstraints({{}}).has_value());
+            CHECK_FALSE(JournalFilter::fromConstraints({{c("level", table::Operator::LessEqual, "3")},
+                                                        {c("message", table::Operator::Equal, "x")}})
+                            .has_value());
+        }
+
+        SUBCASE("priority and process") {
+            auto f = JournalFilter::fromConstraints(
+                {{c("level", table::Operator::LessEqual, "3")},
+                 {c("process", table::Operator::Equal, "sshd"), c("level", table::Operator::Equal, int64_t(6))}});
+            REQUIRE(f);
+            CHECK_EQ(join(f->journalctlMatches(), " "),
+                     "PRIORITY=0 PRIORITY=1 PRIORITY=2 PRIORITY=3 + PRIORITY=6 _COMM=sshd + PRIORITY=6 _EXE=sshd + "
+                     "PRIORITY=6 SYSLOG_IDENTIFIER=sshd");
+
+            CHECK(f->matches("2", &cron));
+            CHECK(f->matches("6", &sshd));
+            CHECK(f->matches("x", nullptr));
+            CHECK_FALSE(f->matches("6", &cron));
+            CHECK_FALSE(f->matches("5", &sshd));
+        }
+
+        SUBCASE("ranges") {
+            auto f = JournalFilter::fromConstraints(
+                {{c("level", table::Operator::Greater, "2"), c("level", table::Operator::Less, int64_t(5))}});
+            REQUIRE(f);
+            CHECK_EQ(join(f->journalctlMatches(), " "), "PRIORITY=3 PRIORITY=4");
+        }
+
+        SUBCASE("unsupported values") {
+            // These compare as strings, which we don't map to priorities.
+            CHECK_FALSE(JournalFilter::fromConstraints({{c("level", table::Operator::Less, int64_t(10))}}).has_value());
+            CHECK_FALSE(JournalFilter::fromConstraints({{c("level", table::Operator::Less, "err")}}).has_value());
+        }
+
+        SUBCASE("impossible") {
+            auto f = JournalFilter::fromConstraints(
+                {{c("level", table::Operator::Greater, "7")},
+                 {c("process", table::Operator::Equal, "a"), c("process", table::Operator::Equal, "b")}});
+            REQUIRE(f);
+            CHECK(f->empty());
+            CHECK_FALSE(f->matches("1", &sshd));
+        }
+
+        SUBCASE("journal file entry") {
+            platform::linux::journal::Entry entry;
+            entry.values = {"msg", "3", std::nullopt, "/bin/exe", "ident"};
+
+            auto f = JournalFilter::fromConstraints({{c("process", table::Operator::Equal, "/bin/exe")}});
+            REQUIRE(f);
+            CHECK(f->matches(entry));
+
+            f = JournalFilter::fromConstraints({{c("process", table::Operator::Equal, "ident")}});
+            REQUIRE(f);
+            CHECK_FALSE(f->matches(entry));
+        }
+    }
+
+    TEST_CASE("system_logs record buffer") {
+        RecordBuffer buffer;
+        std::vector<std::string> records;
+
+        auto append = [&](std::string_view data) {
+            memcpy(buffer.prepare(data.size()), data.data(), data.size());
+            buffer.commit(data.size());
+            buffer.forEachRecord([&](std::string_view r) { records.emplace_back(r); });
+        };
+
+        append("\x1e{\"a\":1}\n\x1e{\"b\"");
+        CHECK_EQ(records, std::vector<std::string>{"{\"a\":1}"});
+        CHECK_EQ(buffer.pending(), 5);
+
+        append(":2}\n");
+        CHECK_EQ(records, std::vector<std::string>{"{\"a\":1}", "{\"b\":2}"});
+        CHECK_EQ(buffer.pending(), 0);
+
+        append("\x1e{\"too\":\"lo");
+        buffer.discardPartial();
+        append("ng\"}\n\x1e{\"c\":3}\n");
+        CHECK_EQ(records, std::vector<std::string>{"{\"a\":1}", "{\"b\":2}", "{\"c\":3}"});
+    }
+}
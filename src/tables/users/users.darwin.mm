@@ -66,7 +66,7 @@ std::vector<std::vector<Value>> UsersDarwin::snapshot(const std::vector<table::A
 }
 
 void UsersDarwin::addUser(std::vector<std::vector<Value>>* rows, const CBIdentity* identity) {
-    Value short_name, full_name, is_admin, is_system, uid, gid, home, shell, email;
+    Row row;
 
     if ( auto posix_name = [[identity posixName] UTF8String] ) {
         // 80 is the "admin" group.
@@ -74,20 +74,20 @@ void UsersDarwin::addUser(std::vector<std::vector<Value>>* rows, const CBIdentit
         CBGroupIdentity* admin =
             [CBGroupIdentity groupIdentityWithPosixGID:80 authority:[CBIdentityAuthority defaultIdentityAuthority]];
 
-        short_name = posix_name;
-        full_name = value::fromOptionalString([[identity fullName] UTF8String]);
-        email = value::fromOptionalString([[identity emailAddress] UTF8String]);
-        is_admin =
-            static_cast<bool>([identity isMemberOfGroup:admin]); // Looks like this returns int, not bool, on macOS 11.
-        is_system = static_cast<bool>([identity isHidden]);
+        row.set<0>(posix_name);
+        row.set<1>([[identity fullName] UTF8String]);
+        row.set<8>([[identity emailAddress] UTF8String]);
+        row.set<2>(
+            static_cast<bool>([identity isMemberOfGroup:admin])); // Looks like this returns int, not bool, on macOS 11.
+        row.set<3>(static_cast<bool>([identity isHidden]));
 
         struct passwd pwd;
         struct passwd* result = nullptr;
         if ( getpwnam_r(posix_name, &pwd, _buffer.data(), _buffer.size(), &result) == 0 && result ) {
-            uid = std::to_string(pwd.pw_uid);
-            gid = pwd.pw_gid;
-            home = value::fromOptionalString(pwd.pw_dir);
-            shell = value::fromOptionalString(pwd.pw_shell);
+            row.set<4>(std::to_string(pwd.pw_uid));
+            row.set<5>(pwd.pw_gid);
+            row.set<6>(pwd.pw_dir);
+            row.set<7>(pwd.pw_shell);
         }
         else
             logger()->warn("users: getpwname_r() failed for user {}", posix_name);
@@ -95,7 +95,7 @@ void UsersDarwin::addUser(std::vector<std::vector<Value>>* rows, const CBIdentit
     else
         logger()->warn("users: user without posix name");
 
-    rows->push_back({short_name, full_name, is_admin, is_system, uid, gid, home, shell, email});
+    rows->push_back(row.take());
 }
 
 } // namespace zeek::agent::table
@@ -8,8 +8,11 @@ namespace zeek::agent::table {
 
 class UsersCommon : public SnapshotTable {
 public:
-    Schema schema() const override {
-        return {
+    using Row = RowBuilder<value::Type::Text, value::Type::Text, value::Type::Bool, value::Type::Bool, value::Type::Text,
+                           value::Type::Count, value::Type::Text, value::Type::Text, value::Type::Text>;
+
+    Schema buildSchema() const override {
+        return Row::schema({
             // clang-format off
             .name = "users",
             .summary = "user accounts",
@@ -31,7 +34,7 @@ public:
                 {.name = "email", .type = value::Type::Text, .summary = "email address"},
             }
             // clang-format on
-        };
+        });
     }
 };
 
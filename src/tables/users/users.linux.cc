@@ -34,17 +34,15 @@ std::vector<std::vector<Value>> UsersLinux::snapshot(const std::vector<table::Ar
         if ( ! pw )
             break;
 
-        Value short_name = pw->pw_name;
-        Value full_name = pw->pw_gecos;
-        Value is_admin = (pw->pw_uid == 0);
-        Value is_system = {};
-        Value uid = std::to_string(static_cast<int64_t>(pw->pw_uid));
-        Value gid = static_cast<int64_t>(pw->pw_gid);
-        Value home = pw->pw_dir;
-        Value shell = pw->pw_shell;
-        Value email = {};
-
-        rows.push_back({short_name, full_name, is_admin, is_system, uid, gid, home, shell, email});
+        Row row;
+        row.set<0>(pw->pw_name);
+        row.set<1>(pw->pw_gecos);
+        row.set<2>(pw->pw_uid == 0);
+        row.set<4>(std::to_string(static_cast<int64_t>(pw->pw_uid)));
+        row.set<5>(pw->pw_gid);
+        row.set<6>(pw->pw_dir);
+        row.set<7>(pw->pw_shell);
+        rows.push_back(row.take());
     }
 
     endpwent();
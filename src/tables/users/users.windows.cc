@@ -27,17 +27,14 @@ std::vector<std::vector<Value>> UsersWindows::snapshot(const std::vector<table::
     auto user_data = WMIManager::Get().GetUserData();
 
     for ( const auto& user : user_data ) {
-        Value short_name = user.name;
-        Value full_name = user.full_name;
-        Value is_admin = user.is_admin;
-        Value is_system = user.is_system_acct;
-        Value uid = user.sid;
-        Value gid = {};
-        Value home = user.home_directory;
-        Value shell = {};
-        Value email = {};
-
-        rows.push_back({short_name, full_name, is_admin, is_system, uid, gid, home, shell, email});
+        Row row;
+        row.set<0>(user.name);
+        row.set<1>(user.full_name);
+        row.set<2>(user.is_admin);
+        row.set<3>(user.is_system_acct);
+        row.set<4>(user.sid);
+        row.set<6>(user.home_directory);
+        rows.push_back(row.take());
     }
 
     return rows;
@@ -48,8 +48,10 @@ Value addresses() {
 
     if ( auto interfaceState = [NSString stringWithFormat:@"State:/Network/Interface/%@/IPv4", primaryInterface] ) {
         if ( CFPropertyListRef state = SCDynamicStoreCopyValue(storeRef, (CFStringRef)interfaceState) ) {
-            if ( NSString* ip = [(__bridge NSDictionary*)state valueForKey:@"Addresses"][0] )
-                addrs.insert([ip UTF8String]);
+            if ( NSString* ip = [(__bridge NSDictionary*)state valueForKey:@"Addresses"][0] ) {
+                if ( auto addr = Address::fromString([ip UTF8String]) )
+                    addrs.insert(*addr);
+            }
 
             CFRelease(state);
         }
@@ -57,8 +59,10 @@ Value addresses() {
 
     if ( auto interfaceState = [NSString stringWithFormat:@"State:/Network/Interface/%@/IPv6", primaryInterface] ) {
         if ( CFPropertyListRef state = SCDynamicStoreCopyValue(storeRef, (CFStringRef)interfaceState) ) {
-            if ( NSString* ip = [(__bridge NSDictionary*)state valueForKey:@"Addresses"][0] )
-                addrs.insert([ip UTF8String]);
+            if ( NSString* ip = [(__bridge NSDictionary*)state valueForKey:@"Addresses"][0] ) {
+                if ( auto addr = Address::fromString([ip UTF8String]) )
+                    addrs.insert(*addr);
+            }
 
             CFRelease(state);
         }
@@ -11,7 +11,7 @@ public:
     ZeekAgent() { _startup = std::chrono::system_clock::now(); }
     auto startupTime() { return _startup; }
 
-    Schema schema() const override {
+    Schema buildSchema() const override {
         return {
             .name = "zeek_agent",
             .summary = "Zeek Agent information",
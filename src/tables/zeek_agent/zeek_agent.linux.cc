@@ -63,11 +63,12 @@ Value addresses() {
         if ( family != AF_INET && family != AF_INET6 )
             continue;
 
-        auto sock_size = (family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
-        char buffer[NI_MAXHOST];
-        if ( getnameinfo(ifa->ifa_addr, sock_size, buffer, NI_MAXHOST, nullptr, 0, NI_NUMERICHOST) == 0 ) {
-            if ( strchr(buffer, '%') == nullptr ) // ignore link-local addresses ("....%eth0").
-                addrs.insert(std::string(buffer));
+        if ( family == AF_INET )
+            addrs.insert(Address::fromIPv4(&reinterpret_cast<struct sockaddr_in*>(ifa->ifa_addr)->sin_addr));
+        else {
+            auto sa = reinterpret_cast<struct sockaddr_in6*>(ifa->ifa_addr);
+            if ( sa->sin6_scope_id == 0 ) // ignore link-local addresses ("....%eth0").
+                addrs.insert(Address::fromIPv6(&sa->sin6_addr));
         }
     }
 
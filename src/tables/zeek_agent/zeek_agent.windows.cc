@@ -31,19 +31,17 @@ public:
 
 database::RegisterTable<ZeekAgentWindows> _;
 
-std::string get_address_string(const SOCKET_ADDRESS& addr, char* buff, int bufflen) {
-    memset(buff, 0, bufflen);
-
+std::optional<Address> get_address(const SOCKET_ADDRESS& addr) {
     if ( addr.lpSockaddr->sa_family == AF_INET ) {
         auto* sa_in = reinterpret_cast<sockaddr_in*>(addr.lpSockaddr);
-        inet_ntop(AF_INET, &(sa_in->sin_addr), buff, bufflen);
+        return Address::fromIPv4(&(sa_in->sin_addr));
     }
     else if ( addr.lpSockaddr->sa_family == AF_INET6 ) {
         auto* sa_in6 = reinterpret_cast<sockaddr_in6*>(addr.lpSockaddr);
-        inet_ntop(AF_INET6, &(sa_in6->sin6_addr), buff, bufflen);
+        return Address::fromIPv6(&(sa_in6->sin6_addr));
     }
 
-    return buff;
+    return {};
 }
 
 Value addresses() {
@@ -68,26 +66,30 @@ Value addresses() {
     if ( ! ipaa )
         return {};
 
-    char addr_str[128]{};
-
     Set addrs(value::Type::Address);
     PIP_ADAPTER_ADDRESSES curr = ipaa;
     while ( curr ) {
         PIP_ADAPTER_UNICAST_ADDRESS unicast = curr->FirstUnicastAddress;
         while ( unicast ) {
-            addrs.insert(get_address_string(unicast->Address, addr_str, sizeof(addr_str)));
+            if ( auto addr = get_address(unicast->Address) )
+                addrs.insert(*addr);
+
             unicast = unicast->Next;
         }
 
         PIP_ADAPTER_ANYCAST_ADDRESS anycast = curr->FirstAnycastAddress;
         while ( anycast ) {
-            addrs.insert(get_address_string(anycast->Address, addr_str, sizeof(addr_str)));
+            if ( auto addr = get_address(anycast->Address) )
+                addrs.insert(*addr);
+
             anycast = anycast->Next;
         }
 
         PIP_ADAPTER_MULTICAST_ADDRESS multicast = curr->FirstMulticastAddress;
         while ( multicast ) {
-            addrs.insert(get_address_string(multicast->Address, addr_str, sizeof(addr_str)));
+            if ( auto addr = get_address(multicast->Address) )
+                addrs.insert(*addr);
+
             multicast = multicast->Next;
         }
         curr = curr->Next;
@@ -0,0 +1,130 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#include "benchmark.h"
+
+#include "fmt.h"
+#include "helpers.h"
+#include "testing.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+using namespace zeek::agent;
+using namespace zeek::agent::benchmark;
+
+// Cap on iterations, for benchmarks that are too fast to measure reliably.
+static const int64_t MaxIterations = 1'000'000'000;
+
+// Returns the global registry of benchmarks, indexed by name.
+static std::map<std::string, Function>& registry() {
+    static std::map<std::string, Function> benchmarks;
+    return benchmarks;
+}
+
+bool State::keepRunning() {
+    if ( _running )
+        _elapsed += Clock::now() - _start;
+
+    if ( _iterations > 0 && (_elapsed >= _min_time || _iterations >= MaxIterations) ) {
+        _running = false;
+        return false;
+    }
+
+    ++_iterations;
+    _running = true;
+    _start = Clock::now();
+    return true;
+}
+
+void State::pause() {
+    if ( ! _running )
+        return;
+
+    _elapsed += Clock::now() - _start;
+    _running = false;
+}
+
+void State::resume() {
+    if ( _running )
+        return;
+
+    _running = true;
+    _start = Clock::now();
+}
+
+Registration::Registration(const char* name, Function function) {
+    if ( ! registry().emplace(name, function).second )
+        throw InternalError(frmt("benchmark '{}' defined more than once", name));
+}
+
+size_t benchmark::run(std::string_view filter, std::ostream& out, std::chrono::nanoseconds min_time) {
+    size_t count = 0;
+
+    for ( const auto& [name, function] : registry() ) {
+        if ( ! filter.empty() && name.find(filter) == std::string::npos )
+            continue;
+
+        State state(min_time);
+        function(state);
+
+        auto ns = static_cast<double>(state.elapsed().count());
+        auto iterations = std::max(state.iterations(), int64_t(1));
+
+        nlohmann::ordered_json result;
+        result["name"] = name;
+        result["iterations"] = state.iterations();
+        result["ns_per_iteration"] = ns / static_cast<double>(iterations);
+
+        if ( state.itemsPerIteration() > 0 && ns > 0 )
+            result["items_per_second"] =
+                static_cast<double>(state.itemsPerIteration()) * static_cast<double>(iterations) * 1e9 / ns;
+
+        out << result.dump() << std::endl;
+        ++count;
+    }
+
+    return count;
+}
+
+ZEEK_AGENT_BENCHMARK("benchmark/noop") {
+    int64_t x = 0;
+    state.setItemsPerIteration(2);
+
+    while ( state.keepRunning() ) {
+        ++x;
+        benchmark::doNotOptimize(x);
+    }
+}
+
+TEST_SUITE("Helpers") {
+    TEST_CASE("benchmarks") {
+        SUBCASE("state") {
+            State state(std::chrono::milliseconds(1));
+            while ( state.keepRunning() ) {
+                state.pause();
+                state.resume();
+            }
+
+            CHECK_GT(state.iterations(), 0);
+            CHECK_GE(state.elapsed(), std::chrono::milliseconds(1));
+            CHECK(! state.keepRunning());
+        }
+
+        SUBCASE("run") {
+            std::stringstream out;
+            CHECK_EQ(benchmark::run("benchmark/noop", out, std::chrono::milliseconds(1)), 1);
+
+            auto result = nlohmann::json::parse(out.str());
+            CHECK_EQ(result["name"], "benchmark/noop");
+            CHECK_GT(result["iterations"].get<int64_t>(), 0);
+            CHECK(result.contains("ns_per_iteration"));
+            CHECK(result.contains("items_per_second"));
+
+            CHECK_EQ(benchmark::run("does-not-exist", out, std::chrono::milliseconds(1)), 0);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Minimal framework for microbenchmarks. Like unit tests, benchmarks live
+// next to the code they exercise, so that they can reach into its internals:
+//
+//     ZEEK_AGENT_BENCHMARK("sort rows") {
+//         auto rows = makeRows(10000); // not timed
+//         state.setItemsPerIteration(rows.size());
+//
+//         while ( state.keepRunning() ) {
+//             state.pause();
+//             auto copy = rows;
+//             state.resume();
+//
+//             std::sort(copy.begin(), copy.end(), ValueVectorCompare);
+//             benchmark::doNotOptimize(copy);
+//         }
+//     }
+//
+// `zeek-agent --bench` runs them. Benchmarks are compiled in only along with
+// the unit tests.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace zeek::agent::benchmark {
+
+/** State of a running benchmark, controlling its iterations and timing. */
+class State {
+public:
+    /**
+     * Constructor.
+     *
+     * @param min_time minimum total time to spend inside timed iterations
+     */
+    explicit State(std::chrono::nanoseconds min_time) : _min_time(min_time) {}
+
+    /**
+     * Returns true as long as the benchmark should run another iteration.
+     * Timing covers everything between calls, except when paused. Each call
+     * reads the clock, so iterations should do enough work to make that
+     * negligible.
+     */
+    bool keepRunning();
+
+    /** Stops timing, e.g. for per-iteration setup. */
+    void pause();
+
+    /** Resumes timing after `pause()`. */
+    void resume();
+
+    /** Records how many items each iteration processes, for reporting throughput. */
+    void setItemsPerIteration(int64_t n) { _items_per_iteration = n; }
+
+    /** Returns the number of iterations run so far. */
+    int64_t iterations() const { return _iterations; }
+
+    /** Returns the time spent inside timed iterations so far. */
+    std::chrono::nanoseconds elapsed() const { return _elapsed; }
+
+    /** Returns the number of items per iteration, or zero if not set. */
+    int64_t itemsPerIteration() const { return _items_per_iteration; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::chrono::nanoseconds _min_time;
+    std::chrono::nanoseconds _elapsed = {};
+    Clock::time_point _start;
+    int64_t _iterations = 0;
+    int64_t _items_per_iteration = 0;
+    bool _running = false;
+};
+
+/** Function implementing a benchmark. */
+using Function = void (*)(State& state);
+
+/** Registers a benchmark at startup. Use `ZEEK_AGENT_BENCHMARK` instead of instantiating this directly. */
+class Registration {
+public:
+    Registration(const char* name, Function function);
+};
+
+/**
+ * Runs all registered benchmarks, in order of their names. Writes one line
+ * of JSON per benchmark to the output stream, with keys `name`,
+ * `iterations`, `ns_per_iteration`, and, if set, `items_per_second`.
+ *
+ * @param filter if not empty, run only benchmarks whose names contain this string
+ * @param out stream to write the results to
+ * @param min_time minimum time to spend in each benchmark
+ * @return number of benchmarks that ran
+ */
+size_t run(std::string_view filter, std::ostream& out,
+           std::chrono::nanoseconds min_time = std::chrono::milliseconds(500));
+
+/** Prevents the compiler from optimizing away the computation of a value. */
+template<typename T>
+inline void doNotOptimize(T& x) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&x) : "memory");
+#else
+    static volatile const void* sink = nullptr;
+    sink = &x;
+#endif
+}
+
+} // namespace zeek::agent::benchmark
+
+#define __ZEEK_AGENT_BENCHMARK_CONCAT2(x, y) x##y /* NOLINT */
+#define __ZEEK_AGENT_BENCHMARK_CONCAT(x, y) __ZEEK_AGENT_BENCHMARK_CONCAT2(x, y) /* NOLINT */
+#define __ZEEK_AGENT_BENCHMARK_FUNC __ZEEK_AGENT_BENCHMARK_CONCAT(__zeek_agent_benchmark_, __LINE__) /* NOLINT */
+#define __ZEEK_AGENT_BENCHMARK_REG __ZEEK_AGENT_BENCHMARK_CONCAT(__zeek_agent_benchmark_reg_, __LINE__) /* NOLINT */
+
+#ifndef DOCTEST_CONFIG_DISABLE
+/** Defines a benchmark; the body that follows receives `state` as a `benchmark::State&`. */
+#define ZEEK_AGENT_BENCHMARK(name)                                                                                     \
+    static void __ZEEK_AGENT_BENCHMARK_FUNC(::zeek::agent::benchmark::State& state);                                   \
+    static const ::zeek::agent::benchmark::Registration __ZEEK_AGENT_BENCHMARK_REG(name, __ZEEK_AGENT_BENCHMARK_FUNC); \
+    static void __ZEEK_AGENT_BENCHMARK_FUNC(::zeek::agent::benchmark::State& state)
+#else
+#define ZEEK_AGENT_BENCHMARK(name)                                                                                     \
+    [[maybe_unused]] static void __ZEEK_AGENT_BENCHMARK_FUNC(::zeek::agent::benchmark::State& state)
+#endif
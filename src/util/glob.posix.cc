@@ -0,0 +1,299 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Streaming glob expansion. We walk the pattern one path segment at a time,
+// descending through directory file descriptors with `openat()` so that we
+// never have to resolve full paths again, and report matches as we find
+// them instead of building up a list first.
+
+#include "fmt.h"
+#include "helpers.h"
+#include "testing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+using namespace zeek::agent;
+
+namespace {
+
+// Returns true if a path segment contains any characters with special
+// meaning for matching.
+bool isPattern(std::string_view segment) { return segment.find_first_of("*?[\\") != std::string_view::npos; }
+
+// Appends a name to a path.
+void appendName(std::string* path, const std::string& name) {
+    if ( ! path->empty() && path->back() != '/' )
+        *path += '/';
+
+    *path += name;
+}
+
+class Matcher {
+public:
+    Matcher(const std::string& pattern, size_t max, const GlobCallback& callback)
+        : _segments(split(pattern, "/")), _max(max), _callback(callback) {
+        _segments.erase(std::remove(_segments.begin(), _segments.end(), ""), _segments.end());
+    }
+
+    // Performs the expansion, starting at a directory that the caller has
+    // opened.
+    void run(int dirfd, std::string base) { walk(dirfd, &base, 0); }
+
+    // Returns true if the expansion stopped at the maximum number of matches.
+    bool truncated() const { return _truncated; }
+
+private:
+    // Directory entry relevant for matching.
+    struct Entry {
+        std::string name;
+        bool is_dir;
+
+        bool operator<(const Entry& other) const { return name < other.name; }
+    };
+
+    bool walk(int dirfd, std::string* path, size_t idx);
+    bool descend(int dirfd, const std::string& name, std::string* path, size_t idx, bool follow_symlinks);
+    bool emit(const std::string& path);
+    std::vector<Entry> entries(int dirfd);
+
+    std::vector<std::string> _segments; // pattern split into its path segments
+    size_t _max;                        // as passed into constructor
+    const GlobCallback& _callback;      // as passed into constructor
+    size_t _matches = 0;                // number of matches reported so far
+    bool _truncated = false;            // true once we have hit the maximum
+};
+
+// Matches path segments starting at a given index against the content of a
+// directory. Returns false if the expansion is to stop.
+bool Matcher::walk(int dirfd, std::string* path, size_t idx) {
+    if ( idx == _segments.size() )
+        return emit(*path);
+
+    const auto& segment = _segments[idx];
+    const auto last = (idx + 1 == _segments.size());
+
+    if ( segment == "**" ) {
+        if ( ! last ) {
+            // Match zero directories first.
+            if ( ! walk(dirfd, path, idx + 1) )
+                return false;
+        }
+
+        for ( const auto& e : entries(dirfd) ) {
+            if ( e.name[0] == '.' )
+                continue;
+
+            if ( last ) {
+                // Everything below matches.
+                auto old_size = path->size();
+                appendName(path, e.name);
+                auto rc = emit(*path);
+                path->resize(old_size);
+
+                if ( ! rc )
+                    return false;
+            }
+
+            // Not following symlinks here, to avoid walking in circles.
+            if ( e.is_dir && ! descend(dirfd, e.name, path, idx, false) )
+                return false;
+        }
+
+        return true;
+    }
+
+    if ( ! isPattern(segment) ) {
+        // No need to read the directory, the name is either there or not.
+        if ( ! last )
+            return descend(dirfd, segment, path, idx + 1, true);
+
+        struct ::stat st;
+        if ( ::fstatat(dirfd, segment.c_str(), &st, AT_SYMLINK_NOFOLLOW) < 0 )
+            return true;
+
+        auto old_size = path->size();
+        appendName(path, segment);
+        auto rc = emit(*path);
+        path->resize(old_size);
+        return rc;
+    }
+
+    for ( const auto& e : entries(dirfd) ) {
+        if ( ::fnmatch(segment.c_str(), e.name.c_str(), FNM_PERIOD) != 0 )
+            continue;
+
+        if ( last ) {
+            auto old_size = path->size();
+            appendName(path, e.name);
+            auto rc = emit(*path);
+            path->resize(old_size);
+
+            if ( ! rc )
+                return false;
+        }
+        else if ( ! descend(dirfd, e.name, path, idx + 1, true) )
+            return false;
+    }
+
+    return true;
+}
+
+// Opens a subdirectory and continues matching inside it. Returns false if
+// the expansion is to stop.
+bool Matcher::descend(int dirfd, const std::string& name, std::string* path, size_t idx, bool follow_symlinks) {
+    auto fd = ::openat(dirfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow_symlinks ? 0 : O_NOFOLLOW));
+    if ( fd < 0 )
+        // Not a directory, or no permission; either way, nothing to match.
+        return true;
+
+    ScopeGuard _([fd]() { ::close(fd); });
+
+    auto old_size = path->size();
+    appendName(path, name);
+    auto rc = walk(fd, path, idx);
+    path->resize(old_size);
+    return rc;
+}
+
+// Reports a match to the callback. Returns false if the expansion is to stop.
+bool Matcher::emit(const std::string& path) {
+    if ( _max && _matches >= _max ) {
+        _truncated = true;
+        return false;
+    }
+
+    ++_matches;
+    return _callback(path);
+}
+
+// Returns the entries of a directory, sorted by name, and excluding `.` and
+// `..`.
+std::vector<Matcher::Entry> Matcher::entries(int dirfd) {
+    std::vector<Entry> result;
+
+    // `fdopendir()` takes ownership of the descriptor, so give it a copy.
+    // The copy shares the read position with the original, which we may
+    // have read before, hence the rewind.
+    auto fd = ::dup(dirfd);
+    if ( fd < 0 )
+        return result;
+
+    auto dir = ::fdopendir(fd);
+    if ( ! dir ) {
+        ::close(fd);
+        return result;
+    }
+
+    ScopeGuard _([dir]() { ::closedir(dir); });
+    ::rewinddir(dir);
+
+    while ( auto d = ::readdir(dir) ) {
+        if ( strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 )
+            continue;
+
+        bool is_dir = false;
+
+        if ( d->d_type == DT_DIR )
+            is_dir = true;
+        else if ( d->d_type == DT_UNKNOWN ) {
+            // Some file systems don't tell us the type.
+            struct ::stat st;
+            is_dir = (::fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode));
+        }
+
+        result.push_back(Entry{.name = d->d_name, .is_dir = is_dir});
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+} // namespace
+
+bool zeek::agent::forEachGlobMatch(const filesystem::path& pattern, size_t max, const GlobCallback& callback) {
+    const auto& p = pattern.native();
+    const auto absolute = (! p.empty() && p[0] == '/');
+
+    auto fd = ::open(absolute ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if ( fd < 0 )
+        return false;
+
+    ScopeGuard _([fd]() { ::close(fd); });
+
+    Matcher matcher(p, max, callback);
+    matcher.run(fd, absolute ? "/" : "");
+    return matcher.truncated();
+}
+
+TEST_SUITE("Helpers") {
+    TEST_CASE("glob") {
+        auto dir = std::filesystem::temp_directory_path() / frmt("zeek-agent-glob-{}", ::getpid());
+        ScopeGuard _([dir] { std::filesystem::remove_all(dir); });
+
+        for ( const auto& d : {"a", "a/x", "a/x/y", "b", ".hidden"} )
+            std::filesystem::create_directories(dir / d);
+
+        for ( const auto& f : {"1.log", "2.log", "3.txt", ".4.log", "a/5.log", "a/x/6.log", "a/x/y/7.log", "b/8.txt",
+                               ".hidden/9.log"} )
+            std::ofstream(dir / f) << "x";
+
+        std::filesystem::create_directory_symlink(dir, dir / "a" / "loop");
+
+        auto matches = [&](const std::string& pattern, size_t max = 0, bool* truncated = nullptr) {
+            auto prefix = dir.string() + "/";
+
+            std::vector<std::string> result;
+            for ( const auto& p : glob(prefix + pattern, max, truncated) )
+                result.push_back(p.string().substr(prefix.size()));
+
+            return result;
+        };
+
+        using Paths = std::vector<std::string>;
+
+        CHECK_EQ(matches("*.log"), Paths{"1.log", "2.log"});
+        CHECK_EQ(matches(".*.log"), Paths{".4.log"});
+        CHECK_EQ(matches("[12].log"), Paths{"1.log", "2.log"});
+        CHECK_EQ(matches("?.txt"), Paths{"3.txt"});
+        CHECK_EQ(matches("*/*.txt"), Paths{"b/8.txt"});
+        CHECK_EQ(matches("a/5.log"), Paths{"a/5.log"});
+        CHECK_EQ(matches("a/none.log"), Paths{});
+        CHECK_EQ(matches("1.log/*"), Paths{});
+        CHECK_EQ(matches("*"), Paths{"1.log", "2.log", "3.txt", "a", "b"});
+        CHECK_EQ(matches("**/*.log"), Paths{"1.log", "2.log", "a/5.log", "a/x/6.log", "a/x/y/7.log"});
+        CHECK_EQ(matches("a/**/y"), Paths{"a/x/y"});
+        CHECK_EQ(matches("a/**"), Paths{"a/5.log", "a/loop", "a/x", "a/x/6.log", "a/x/y", "a/x/y/7.log"});
+
+        SUBCASE("limit") {
+            bool truncated = true;
+            CHECK_EQ(matches("*.log", 2, &truncated), Paths{"1.log", "2.log"});
+            CHECK_FALSE(truncated);
+
+            CHECK_EQ(matches("**/*.log", 3, &truncated), Paths{"1.log", "2.log", "a/5.log"});
+            CHECK(truncated);
+        }
+
+        SUBCASE("stop") {
+            std::vector<std::string> seen;
+            auto truncated = forEachGlobMatch((dir / "*").string(), 0, [&](const filesystem::path& p) {
+                seen.push_back(p.filename().string());
+                return seen.size() < 2;
+            });
+
+            CHECK_EQ(seen, Paths{"1.log", "2.log"});
+            CHECK_FALSE(truncated);
+        }
+    }
+}
@@ -9,12 +9,12 @@
 
 #include <uuid.h>
 
-#include <glob/glob.h>
-
 #ifdef HAVE_POSIX
 #include <unistd.h>
 
 #include <sys/time.h>
+#else
+#include <glob/glob.h>
 #endif
 
 using namespace zeek::agent;
@@ -157,15 +157,37 @@ std::string zeek::agent::randomUUID() {
     return frmt("{}{}", base62_encode(p[0]), base62_encode(p[1]));
 }
 
-std::vector<filesystem::path> zeek::agent::glob(const filesystem::path& pattern, size_t max) {
+std::vector<filesystem::path> zeek::agent::glob(const filesystem::path& pattern, size_t max, bool* truncated) {
+    std::vector<filesystem::path> paths;
+
+    auto rc = forEachGlobMatch(pattern, max, [&](const filesystem::path& p) {
+        paths.push_back(p);
+        return true;
+    });
+
+    if ( truncated )
+        *truncated = rc;
+
+    return paths;
+}
+
+#ifndef HAVE_POSIX
+// On POSIX systems, we provide our own streaming implementation.
+bool zeek::agent::forEachGlobMatch(const filesystem::path& pattern, size_t max, const GlobCallback& callback) {
     // glob::glob returns std::filesystem::path, but we're using ghc::filesystem for compatibility
     // reasons. this means we need to copy the paths from one vector type to another here.
-    auto paths = glob::glob(pattern.string());
-    if ( paths.size() > max )
-        paths.resize(max);
+    size_t matches = 0;
+    for ( const auto& p : glob::glob(pattern.string()) ) {
+        if ( max && matches++ >= max )
+            return true;
 
-    return paths;
+        if ( ! callback(p.native()) )
+            break;
+    }
+
+    return false;
 }
+#endif
 
 TEST_SUITE("Helpers") {
     TEST_CASE("scope guard") {
@@ -392,14 +392,44 @@ zeek::agent::Result<int64_t> parseVersion(std::string v);
 /** Creates a new random UUID, encoded in base62 ASCII. */
 std::string randomUUID();
 
+/** Default for the maximum number of paths that a glob expands into. */
+constexpr size_t DefaultGlobLimit = 10000;
+
+/**
+ * Callback receiving a path that a glob expanded into. Returning false stops
+ * the expansion.
+ */
+using GlobCallback = std::function<bool(const filesystem::path& path)>;
+
+/**
+ * Expands a shell-style glob, passing each existing path matching it to a
+ * callback as soon as it's found. This doesn't build up the full list of
+ * matches first, and stops as soon as the maximum number of matches has
+ * been reached.
+ *
+ * Besides the standard wildcards, a path segment `**` matches zero or more
+ * directories; as the final segment, it matches everything below. Neither
+ * wildcards nor `**` match names starting with a dot, unless the pattern
+ * has that dot explicitly. Matches are reported in sorted order inside each
+ * directory.
+ *
+ * @param pattern pattern for the path, containing globs
+ * @param max maximum number of matches to report; zero for no limit
+ * @param callback function receiving the matching paths
+ * @returns true if the expansion stopped at `max` while there were further matches
+ */
+extern bool forEachGlobMatch(const filesystem::path& pattern, size_t max, const GlobCallback& callback);
+
 /**
  * Expands a shell-style glob to return all existing paths matching it, up to a
- * given maximum number.
+ * given maximum number. See `forEachGlobMatch()` for the supported syntax.
  *
  * @param pattern pattern for the path, containing globs
- * @param max maximum number of matches to return
+ * @param max maximum number of matches to return; zero for no limit
+ * @param truncated if given, set to true if there were more matches than `max`, and to false otherwise
  */
-extern std::vector<filesystem::path> glob(const filesystem::path& pattern, size_t max = 100);
+extern std::vector<filesystem::path> glob(const filesystem::path& pattern, size_t max = DefaultGlobLimit,
+                                          bool* truncated = nullptr);
 
 } // namespace zeek::agent
 
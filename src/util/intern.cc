@@ -0,0 +1,137 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#include "intern.h"
+
+#include "testing.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace zeek::agent;
+
+namespace {
+
+// Global pool of interned strings, keyed by views into the strings
+// themselves.
+struct Pool {
+    std::mutex mutex;
+    std::unordered_map<std::string_view, std::weak_ptr<const std::string>> strings;
+};
+
+// Returns the global pool. We never destroy it because interned strings may
+// still go away during static destruction.
+Pool& pool() {
+    static auto* pool = new Pool;
+    return *pool;
+}
+
+// Deleter for interned strings, removing them from the pool once the last
+// instance is gone. The pool's entry for the string's value may already
+// refer to a new instance, which we need to leave alone.
+void release(const std::string* s) {
+    auto& p = pool();
+
+    {
+        const std::lock_guard<std::mutex> lock(p.mutex);
+        if ( auto i = p.strings.find(*s); i != p.strings.end() && i->second.expired() )
+            p.strings.erase(i);
+    }
+
+    delete s;
+}
+
+} // namespace
+
+InternedString::InternedString(std::string_view s) {
+    if ( s.empty() )
+        return;
+
+    auto& p = pool();
+
+    {
+        const std::lock_guard<std::mutex> lock(p.mutex);
+        if ( auto i = p.strings.find(s); i != p.strings.end() && (_string = i->second.lock()) )
+            return;
+    }
+
+    // Allocate outside of the lock as the deleter needs to acquire it; that
+    // also applies to destroying the new string if another thread has beaten
+    // us to interning it, which is why we declare it before the lock.
+    std::shared_ptr<const std::string> x(new std::string(s), release);
+
+    const std::lock_guard<std::mutex> lock(p.mutex);
+
+    if ( auto i = p.strings.find(s); i != p.strings.end() ) {
+        if ( (_string = i->second.lock()) )
+            return;
+
+        // Expired, with the deleter still waiting for the lock.
+        p.strings.erase(i);
+    }
+
+    _string = std::move(x);
+    p.strings.emplace(*_string, _string);
+}
+
+size_t InternedString::poolSize() {
+    auto& p = pool();
+    const std::lock_guard<std::mutex> lock(p.mutex);
+    return p.strings.size();
+}
+
+const std::string& InternedString::empty() {
+    static const std::string empty;
+    return empty;
+}
+
+TEST_SUITE("Helpers") {
+    TEST_CASE("interned strings") {
+        auto size = InternedString::poolSize();
+
+        {
+            InternedString a("ESTABLISHED");
+            InternedString b(std::string("ESTABLISHED"));
+            InternedString c("LISTEN");
+
+            CHECK_EQ(a, b);
+            CHECK_NE(a, c);
+            CHECK_LT(a, c);
+            CHECK_EQ(&a.str(), &b.str());
+            CHECK_EQ(a.str(), "ESTABLISHED");
+            CHECK_EQ(c.size(), 6U);
+            CHECK_EQ(InternedString::poolSize(), size + 2);
+
+            InternedString empty("");
+            CHECK_EQ(empty, InternedString());
+            CHECK_EQ(empty.str(), "");
+            CHECK_EQ(InternedString::poolSize(), size + 2);
+        }
+
+        CHECK_EQ(InternedString::poolSize(), size);
+
+        SUBCASE("threads") {
+            std::atomic<int> mismatches = 0;
+            std::vector<std::thread> threads;
+
+            for ( int t = 0; t < 8; t++ ) {
+                threads.emplace_back([&mismatches]() {
+                    for ( int i = 0; i < 10000; i++ ) {
+                        InternedString a(std::to_string(i % 7));
+                        InternedString b(std::to_string(i % 7));
+                        if ( a != b || a.str() != std::to_string(i % 7) )
+                            ++mismatches;
+                    }
+                });
+            }
+
+            for ( auto& t : threads )
+                t.join();
+
+            CHECK_EQ(mismatches, 0);
+            CHECK_EQ(InternedString::poolSize(), size);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace zeek::agent {
+
+/**
+ * An immutable string that's stored only once agent-wide, however many
+ * instances refer to it. That's worth it for strings that repeat across many
+ * rows and stay around for a while, such as the path column of an event table
+ * buffering lines from the same few files.
+ *
+ * Copying an instance just bumps a reference count, and comparing two
+ * instances for equality is a pointer comparison. Creating one requires a
+ * lookup in a global, mutex-protected pool, so that's more expensive than
+ * copying a short `std::string`. A string leaves the pool once its last
+ * instance goes away.
+ *
+ * Instances are thread-safe to the same degree as `std::shared_ptr`.
+ */
+class InternedString {
+public:
+    /** Constructor creating an empty string. */
+    InternedString() = default;
+
+    /** Constructor interning a string. */
+    explicit InternedString(std::string_view s);
+
+    /** Returns the string. */
+    const std::string& str() const { return _string ? *_string : empty(); }
+
+    /** Returns the size of the string. */
+    size_t size() const { return _string ? _string->size() : 0; }
+
+    bool operator==(const InternedString& other) const { return _string == other._string; }
+    bool operator!=(const InternedString& other) const { return _string != other._string; }
+    bool operator<(const InternedString& other) const { return _string != other._string && str() < other.str(); }
+
+    /** Returns the number of distinct strings currently interned. */
+    static size_t poolSize();
+
+private:
+    static const std::string& empty();
+
+    std::shared_ptr<const std::string> _string; // null for the empty string
+};
+
+} // namespace zeek::agent
@@ -0,0 +1,88 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+//
+// Platform-independent helpers declared in line-reader.h.
+
+#include "line-reader.h"
+
+#include "helpers.h"
+#include "testing.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace zeek::agent;
+
+std::string_view zeek::agent::trimView(std::string_view s) {
+    auto begin = s.find_first_not_of(detail::whitespace_chars);
+    if ( begin == std::string_view::npos )
+        return {};
+
+    auto end = s.find_last_not_of(detail::whitespace_chars);
+    return s.substr(begin, end - begin + 1);
+}
+
+void zeek::agent::splitView(std::string_view s, std::string_view delim, std::vector<std::string_view>* pieces) {
+    pieces->clear();
+
+    if ( delim.empty() || s.size() < delim.size() ) {
+        pieces->push_back(s);
+        return;
+    }
+
+    const bool ends_in_delim = (s.substr(s.size() - delim.size()) == delim);
+
+    do {
+        size_t p = s.find(delim);
+        pieces->push_back(s.substr(0, p));
+        if ( p == std::string_view::npos )
+            break;
+
+        s = s.substr(p + delim.size());
+    } while ( ! s.empty() );
+
+    if ( ends_in_delim )
+        pieces->emplace_back();
+}
+
+void zeek::agent::splitView(std::string_view s, std::vector<std::string_view>* pieces) {
+    pieces->clear();
+
+    s = trimView(s);
+
+    while ( ! s.empty() ) {
+        size_t p = s.find_first_of(detail::whitespace_chars);
+        pieces->push_back(s.substr(0, p));
+        if ( p == std::string_view::npos )
+            break;
+
+        s = s.substr(p);
+        s = s.substr(std::min(s.find_first_not_of(detail::whitespace_chars), s.size()));
+    }
+}
+
+TEST_SUITE("Helpers") {
+    TEST_CASE("string view helpers") {
+        using Pieces = std::vector<std::string_view>;
+        Pieces pieces;
+
+        CHECK_EQ(trimView("  a b \t\n"), "a b");
+        CHECK_EQ(trimView(" \t "), "");
+
+        for ( const auto& [s, delim] : std::vector<std::pair<std::string, std::string>>{
+                  {"a:b:c", ":"}, {"a::b", ":"}, {"a:b:", ":"}, {":", ":"}, {"", ":"}, {"ab", "abc"}, {"a<>b", "<>"}} ) {
+            CAPTURE(s);
+            splitView(s, delim, &pieces);
+            auto expected = split(s, delim);
+            CHECK_EQ(pieces, Pieces(expected.begin(), expected.end()));
+        }
+
+        for ( const auto& s : std::vector<std::string>{"a b  c", "  a\tb ", "", "   ", "abc"} ) {
+            CAPTURE(s);
+            splitView(s, &pieces);
+            auto expected = split(s);
+            CHECK_EQ(pieces, Pieces(expected.begin(), expected.end()));
+        }
+    }
+}
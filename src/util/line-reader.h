@@ -0,0 +1,110 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include "util/filesystem.h"
+#include "util/result.h"
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace zeek::agent {
+
+/**
+ * Reads a file line by line without copying the lines. The reader pulls in
+ * large blocks and finds line ends with `memchr()`, returning views into its
+ * buffer. We deliberately don't `mmap()` the files: if somebody truncates a
+ * file while it's mapped, accessing the lost pages would raise `SIGBUS`.
+ *
+ * Instances are not thread-safe.
+ */
+class LineReader {
+public:
+    static constexpr size_t DefaultMaxLineSize = 1024 * 1024; /**< default for the maximum size of a line */
+    static constexpr size_t DefaultBlockSize = 256 * 1024;    /**< default for the number of bytes to read at a time */
+
+    /**
+     * Constructor.
+     *
+     * @param max_line_size maximum number of bytes to return for a single
+     * line; longer lines get cut off, with `truncated()` signaling that
+     * @param block_size number of bytes to read from the file at a time
+     */
+    LineReader(size_t max_line_size = DefaultMaxLineSize, size_t block_size = DefaultBlockSize);
+    ~LineReader();
+
+    LineReader(const LineReader& other) = delete;
+    LineReader(LineReader&& other) = delete;
+    LineReader& operator=(const LineReader& other) = delete;
+    LineReader& operator=(LineReader&& other) = delete;
+
+    /**
+     * Opens a file for reading, closing any file opened previously.
+     *
+     * @param path file to open
+     * @returns an error if the file cannot be opened
+     */
+    Result<Nothing> open(const filesystem::path& path);
+
+    /** Closes the current file, if any. */
+    void close();
+
+    /**
+     * Returns the next line, without its newline character. A final line
+     * without a newline gets returned as well.
+     *
+     * @returns the line, which remains valid only until the next call; or
+     * unset once the whole file has been read, or if reading failed
+     */
+    std::optional<std::string_view> next();
+
+    /** Returns true if `next()` cut off the most recent line because it exceeded the maximum size. */
+    bool truncated() const { return _truncated; }
+
+private:
+    size_t find(size_t from) const;
+    bool fill();
+
+    size_t _max_line_size;     // as passed into constructor
+    size_t _block_size;        // as passed into constructor
+    int _fd = -1;              // file descriptor of current file, or -1 if none
+    std::vector<char> _buffer; // buffer holding data read from the file
+    size_t _begin = 0;         // offset of first byte in buffer not yet returned
+    size_t _end = 0;           // offset of first byte in buffer not yet filled
+    bool _eof = false;         // true once no more data can be read
+    bool _skipping = false;    // true to skip the remainder of a line that got cut off
+    bool _truncated = false;   // true if the most recent line got cut off
+};
+
+/**
+ * Returns a view of a string with all leading & trailing white space
+ * removed. This is the `std::string_view` counterpart to `trim()`.
+ *
+ * \note This function is not UTF8-aware.
+ */
+extern std::string_view trimView(std::string_view s);
+
+/**
+ * Splits a string at all occurrences of a delimiter, with the pieces
+ * pointing into the original string. This is the `std::string_view`
+ * counterpart to `split(s, delim)`, with the same semantics.
+ *
+ * @param s string to split
+ * @param delim delimiter to split at
+ * @param pieces vector receiving the pieces; it gets cleared first, but keeps its capacity
+ */
+extern void splitView(std::string_view s, std::string_view delim, std::vector<std::string_view>* pieces);
+
+/**
+ * Splits a string at all occurrences of successive white space, with the
+ * pieces pointing into the original string. This is the `std::string_view`
+ * counterpart to `split(s)`, with the same semantics.
+ *
+ * @param s string to split
+ * @param pieces vector receiving the pieces; it gets cleared first, but keeps its capacity
+ */
+extern void splitView(std::string_view s, std::vector<std::string_view>* pieces);
+
+} // namespace zeek::agent
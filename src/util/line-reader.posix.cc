@@ -0,0 +1,175 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#include "line-reader.h"
+
+#include "fmt.h"
+#include "helpers.h"
+#include "testing.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace zeek::agent;
+
+LineReader::LineReader(size_t max_line_size, size_t block_size)
+    : _max_line_size(max_line_size), _block_size(block_size) {}
+
+LineReader::~LineReader() { close(); }
+
+Result<Nothing> LineReader::open(const filesystem::path& path) {
+    close();
+
+    _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if ( _fd < 0 )
+        return result::Error(frmt("cannot open {}: {}", path.native(), strerror(errno)));
+
+    return Nothing();
+}
+
+void LineReader::close() {
+    if ( _fd >= 0 )
+        ::close(_fd);
+
+    _fd = -1;
+    _begin = _end = 0;
+    _eof = _skipping = _truncated = false;
+}
+
+std::optional<std::string_view> LineReader::next() {
+    if ( _fd < 0 )
+        return {};
+
+    _truncated = false;
+
+    while ( _skipping ) {
+        // Drop the remainder of a line that we cut off.
+        if ( auto nl = find(_begin); nl != _end ) {
+            _begin = nl + 1;
+            _skipping = false;
+        }
+        else {
+            _begin = _end;
+            if ( ! fill() )
+                return {};
+        }
+    }
+
+    auto scanned = _begin; // offset up to which we have searched for a newline
+
+    while ( true ) {
+        if ( auto nl = find(scanned); nl != _end ) {
+            std::string_view line(_buffer.data() + _begin, nl - _begin);
+            _begin = nl + 1;
+
+            if ( line.size() > _max_line_size ) {
+                line = line.substr(0, _max_line_size);
+                _truncated = true;
+            }
+
+            return line;
+        }
+
+        if ( _end - _begin > _max_line_size ) {
+            // Too long, return what we have and skip the rest later.
+            std::string_view line(_buffer.data() + _begin, _max_line_size);
+            _begin = _end;
+            _skipping = true;
+            _truncated = true;
+            return line;
+        }
+
+        scanned = _end - _begin; // relative, as fill() may move data
+        auto eof = ! fill();
+        scanned += _begin;
+
+        if ( eof ) {
+            if ( _begin == _end )
+                return {};
+
+            // Final line without newline.
+            std::string_view line(_buffer.data() + _begin, _end - _begin);
+            _begin = _end;
+            return line;
+        }
+    }
+}
+
+// Returns the offset of the first newline at or after a given offset in the
+// buffer, or `_end` if there's none.
+size_t LineReader::find(size_t from) const {
+    if ( from >= _end )
+        return _end;
+
+    auto nl = static_cast<const char*>(memchr(_buffer.data() + from, '\n', _end - from));
+    return nl ? static_cast<size_t>(nl - _buffer.data()) : _end;
+}
+
+// Reads the next block from the file, returning false if there's no more
+// data. This may move data inside the buffer, and invalidates any views into
+// it.
+bool LineReader::fill() {
+    if ( _eof )
+        return false;
+
+    if ( _begin > 0 ) {
+        memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+        _end -= _begin;
+        _begin = 0;
+    }
+
+    if ( _buffer.size() < _end + _block_size )
+        _buffer.resize(_end + _block_size);
+
+    while ( true ) {
+        auto n = ::read(_fd, _buffer.data() + _end, _block_size);
+        if ( n < 0 && errno == EINTR )
+            continue;
+
+        if ( n <= 0 ) {
+            _eof = true;
+            return false;
+        }
+
+        _end += n;
+        return true;
+    }
+}
+
+TEST_SUITE("Helpers") {
+    TEST_CASE("line reader") {
+        auto path = std::filesystem::temp_directory_path() / frmt("zeek-agent-line-reader-{}", ::getpid());
+        ScopeGuard _([path] { std::filesystem::remove(path); });
+
+        auto lines = [&](const std::string& data, size_t max_line_size, size_t block_size) {
+            std::ofstream(path, std::ios::trunc | std::ios::binary) << data;
+
+            LineReader reader(max_line_size, block_size);
+            REQUIRE(reader.open(path));
+
+            std::vector<std::string> result;
+            while ( auto line = reader.next() )
+                result.emplace_back(std::string(*line) + (reader.truncated() ? "+" : ""));
+
+            return result;
+        };
+
+        using Lines = std::vector<std::string>;
+
+        for ( auto block_size : {1, 3, 1024} ) {
+            CAPTURE(block_size);
+            CHECK_EQ(lines("", 100, block_size), Lines{});
+            CHECK_EQ(lines("a\nbb\n\nccc\n", 100, block_size), Lines{"a", "bb", "", "ccc"});
+            CHECK_EQ(lines("a\r\nbb", 100, block_size), Lines{"a\r", "bb"});
+            CHECK_EQ(lines("12345\n123\n1234567890\n12", 4, block_size), Lines{"1234+", "123", "1234+", "12"});
+        }
+
+        LineReader reader;
+        CHECK(! reader.open("/does/not/exist"));
+        CHECK_FALSE(reader.next().has_value());
+    }
+}
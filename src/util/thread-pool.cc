@@ -0,0 +1,190 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#include "thread-pool.h"
+
+#include "testing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+
+using namespace zeek::agent;
+
+namespace {
+
+// State shared between the caller of `ThreadPool::run()` and the workers
+// helping out. Reference-counted because workers may pick up their job only
+// after the caller has already returned.
+struct Batch {
+    Batch(size_t n, const std::function<void(size_t)>& f) : n(n), f(f) {}
+
+    // Processes indices until none are left.
+    void process() {
+        for ( size_t i = next++; i < n; i = next++ ) {
+            try {
+                f(i);
+            } catch ( ... ) {
+                const std::lock_guard<std::mutex> lock(mutex);
+                if ( ! exception )
+                    exception = std::current_exception();
+            }
+
+            const std::lock_guard<std::mutex> lock(mutex);
+            if ( ++completed == n )
+                cv.notify_all();
+        }
+    }
+
+    const size_t n;                       // number of indices
+    const std::function<void(size_t)>& f; // function to call; valid while caller waits
+    std::atomic<size_t> next = 0;         // next index to process
+    size_t completed = 0;                 // number of calls completed; protected by mutex
+    std::exception_ptr exception;         // first exception thrown; protected by mutex
+    std::mutex mutex;                     // protects `completed` and `exception`
+    std::condition_variable cv;           // signals completion of all calls
+};
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threads) {
+    if ( threads == 0 )
+        threads = std::max(std::thread::hardware_concurrency(), 1U);
+
+    for ( size_t i = 0; i < threads; i++ )
+        _threads.emplace_back([this]() { worker(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _done = true;
+    }
+
+    _cv.notify_all();
+
+    for ( auto& t : _threads )
+        t.join();
+}
+
+void ThreadPool::run(size_t n, const std::function<void(size_t)>& f) {
+    if ( n == 0 )
+        return;
+
+    auto batch = std::make_shared<Batch>(n, f);
+
+    if ( n > 1 ) {
+        // Enlist helpers, the caller will be processing indices as well.
+        auto helpers = std::min(n - 1, _threads.size());
+
+        {
+            const std::lock_guard<std::mutex> lock(_mutex);
+            for ( size_t i = 0; i < helpers; i++ )
+                _jobs.emplace_back([batch]() { batch->process(); });
+        }
+
+        if ( helpers == 1 )
+            _cv.notify_one();
+        else
+            _cv.notify_all();
+    }
+
+    batch->process();
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->cv.wait(lock, [&]() { return batch->completed == n; });
+
+    if ( batch->exception )
+        std::rethrow_exception(batch->exception);
+}
+
+void ThreadPool::submit(std::function<void()> f) {
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.emplace_back(std::move(f));
+    }
+
+    _cv.notify_one();
+}
+
+size_t ThreadPool::shards(size_t items, size_t min_per_shard) const {
+    auto max_shards = _threads.size() + 1; // the caller is working, too
+    auto shards = items / std::max(min_per_shard, size_t(1));
+    return std::max(std::min(shards, max_shards), size_t(1));
+}
+
+void ThreadPool::worker() {
+    while ( true ) {
+        std::function<void()> job;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _done || ! _jobs.empty(); });
+
+            if ( _done )
+                return;
+
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+
+        job();
+    }
+}
+
+TEST_SUITE("Helpers") {
+    TEST_CASE("thread pool") {
+        ThreadPool pool(4);
+        CHECK_EQ(pool.size(), 4);
+
+        SUBCASE("each index once") {
+            std::vector<std::atomic<int>> seen(1000);
+            pool.run(seen.size(), [&](size_t i) { seen[i]++; });
+
+            for ( const auto& s : seen )
+                CHECK_EQ(s.load(), 1);
+        }
+
+        SUBCASE("nested") {
+            std::atomic<int> count = 0;
+            pool.run(8, [&](size_t) { pool.run(8, [&](size_t) { count++; }); });
+            CHECK_EQ(count.load(), 64);
+        }
+
+        SUBCASE("exception") {
+            std::atomic<int> count = 0;
+            CHECK_THROWS_AS(pool.run(10,
+                                     [&](size_t i) {
+                                         count++;
+                                         if ( i == 5 )
+                                             throw std::runtime_error("boom");
+                                     }),
+                            std::runtime_error);
+            CHECK_EQ(count.load(), 10);
+        }
+
+        SUBCASE("submit") {
+            std::mutex mutex;
+            std::condition_variable cv;
+            int count = 0;
+
+            for ( auto i = 0; i < 10; i++ )
+                pool.submit([&]() {
+                    const std::lock_guard<std::mutex> lock(mutex);
+                    ++count;
+                    cv.notify_all();
+                });
+
+            std::unique_lock<std::mutex> lock(mutex);
+            CHECK(cv.wait_for(lock, std::chrono::seconds(10), [&]() { return count == 10; }));
+        }
+
+        SUBCASE("shards") {
+            CHECK_EQ(pool.shards(0, 100), 1);
+            CHECK_EQ(pool.shards(250, 100), 2);
+            CHECK_EQ(pool.shards(100000, 100), 5);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2021-2024 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zeek::agent {
+
+/**
+ * Fixed-size pool of worker threads for spreading CPU-bound work, like
+ * scanning `/proc`, across cores. The pool is meant to be shared: the
+ * database owns one instance that all tables use.
+ *
+ * All public methods are thread-safe.
+ */
+class ThreadPool {
+public:
+    /**
+     * Constructor starting the worker threads.
+     *
+     * @param threads number of worker threads; zero means one per CPU
+     */
+    ThreadPool(size_t threads);
+
+    /** Destructor waiting for all workers to finish their current jobs. */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool(ThreadPool&& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+    ThreadPool& operator=(ThreadPool&& other) = delete;
+
+    /** Returns the number of worker threads. */
+    size_t size() const { return _threads.size(); }
+
+    /**
+     * Calls a function once for each index in `[0, n)`, distributing the
+     * calls across the workers, and blocks until all of them have returned.
+     * The calling thread processes indices as well, so it's safe to call
+     * this from inside a job running on the pool itself. If any call throws,
+     * the first exception is rethrown after all calls have completed.
+     *
+     * @param n number of indices
+     * @param f function to call with each index
+     */
+    void run(size_t n, const std::function<void(size_t)>& f);
+
+    /**
+     * Queues a function to run on one of the workers in the background,
+     * returning immediately. That's for work that nobody needs to wait on,
+     * like refreshing a table's state. The destructor waits for a job that's
+     * already running, but discards any that haven't started yet.
+     *
+     * @param f function to run; must not throw
+     */
+    void submit(std::function<void()> f);
+
+    /**
+     * Returns a number of shards suitable for splitting a list of items
+     * across the pool, so that each shard receives at least a minimum
+     * number of items.
+     *
+     * @param items total number of items
+     * @param min_per_shard minimum number of items per shard
+     */
+    size_t shards(size_t items, size_t min_per_shard) const;
+
+private:
+    void worker();
+
+    std::vector<std::thread> _threads;       // worker threads
+    std::deque<std::function<void()>> _jobs; // pending jobs
+    std::mutex _mutex;                       // protects `_jobs` and `_done`
+    std::condition_variable _cv;             // signals new jobs and termination
+    bool _done = false;                      // set to true to terminate workers
+};
+
+} // namespace zeek::agent